@@ -40,21 +40,51 @@ def ensure_ending_newline(lines):
 def reorganize_includes(lines):
     include_lines = []
     normal_lines = []
+    conditional_depth = 0
 
+    # Includes inside of #if blocks are platform-specific, so they stay where they are.
     for line in lines:
         stripped_line = line.strip()
-        if stripped_line.startswith('#include'):
+        if stripped_line.startswith('#if'):
+            conditional_depth += 1
+        elif stripped_line.startswith('#endif'):
+            conditional_depth -= 1
+
+        if stripped_line.startswith('#include') and conditional_depth == 0:
             include_lines.append(stripped_line + '\n')
         else:
             normal_lines.append(line)
 
     return sorted(set(include_lines)) + normal_lines
 
+def split_feature_test_macros(lines):
+    # Feature test macros only work when defined before any system header is included,
+    # so a leading #if block that defines one is moved to the top of the single header.
+    if len(lines) == 0 or not lines[0].strip().startswith('#if'):
+        return [], lines
+
+    conditional_depth = 0
+    for line_index, line in enumerate(lines):
+        stripped_line = line.strip()
+        if stripped_line.startswith('#if'):
+            conditional_depth += 1
+        elif stripped_line.startswith('#endif'):
+            conditional_depth -= 1
+            if conditional_depth == 0:
+                block_lines = lines[:line_index + 1]
+                if any(block_line.strip().startswith('#define _POSIX_C_SOURCE') for block_line in block_lines):
+                    return block_lines, lines[line_index + 1:]
+                break
+    return [], lines
+
 fig_config_h_lines = ensure_ending_newline(strip_include_guard('FIG_CONFIG_H', list(open('include/fig_config.h'))))
 fig_h_lines = ensure_ending_newline(strip_header_include('<fig_config.h>', strip_include_guard('FIG_H', list(open('include/fig.h')))))
+fig_feature_lines = []
 fig_c_lines = []
 for filename in sorted(glob.glob('src/*.c')):
-    fig_c_lines.extend(ensure_ending_newline(strip_header_include('<fig.h>', list(open(filename)))))
+    feature_lines, c_lines = split_feature_test_macros(ensure_ending_newline(strip_header_include('<fig.h>', list(open(filename)))))
+    fig_feature_lines.extend(feature_lines)
+    fig_c_lines.extend(c_lines)
 
 fig_c_lines = reorganize_includes(fig_c_lines)
 
@@ -65,6 +95,10 @@ out_file.write('/* A single-header distribution of fig. */\n')
 out_file.write('/* To use, there must be ONE source file that contains the library implementation: */\n')
 out_file.write('/* #define FIG_IMPLEMENTATION */\n')
 out_file.write('/* #include <fig.h> */\n')
+if len(fig_feature_lines) > 0:
+    out_file.write('#ifdef FIG_IMPLEMENTATION\n')
+    out_file.write(''.join(fig_feature_lines))
+    out_file.write('#endif\n')
 out_file.write(''.join(fig_config_h_lines))
 out_file.write(''.join(fig_h_lines))
 out_file.write('#ifdef FIG_IMPLEMENTATION\n')
@@ -51,10 +51,20 @@ typedef struct fig_state fig_state;
 typedef struct fig_palette fig_palette;
 typedef struct fig_image fig_image;
 typedef struct fig_animation fig_animation;
+typedef struct fig_player fig_player;
+typedef struct fig_atlas fig_atlas;
+typedef struct fig_atlas_frame fig_atlas_frame;
+typedef struct fig_atlas_options fig_atlas_options;
+typedef struct fig_resampler fig_resampler;
+typedef struct fig_tensor_options fig_tensor_options;
+typedef struct fig_histogram fig_histogram;
+typedef struct fig_color_count fig_color_count;
 typedef struct fig_input fig_input;
 typedef struct fig_input_callbacks fig_input_callbacks;
 typedef struct fig_output fig_output;
 typedef struct fig_output_callbacks fig_output_callbacks;
+typedef struct fig_load_options fig_load_options;
+typedef struct fig_rect fig_rect;
 
 /* A function that allocates and manages blocks of memory.
  *
@@ -100,6 +110,103 @@ typedef enum fig_disposal_t {
     FIG_DISPOSAL_COUNT
 } fig_disposal_t;
 
+/* An enumeration of possible ways to store the result of rendering an animation. */
+typedef enum fig_render_mode_t {
+    /* Every image has a render surface covering the full canvas. */
+    FIG_RENDER_MODE_FULL,
+    /* Every image has a render surface covering only the area of the canvas
+       that changed since the previous image. Pixels outside of it are the same
+       as the previous image. The first image covers the full canvas. */
+    FIG_RENDER_MODE_DELTA,
+    /* Only some images keep a render surface covering the full canvas,
+       every checkpoint interval. Every other image has an empty render surface,
+       and can be reconstructed with fig_animation_get_frame_rgba. */
+    FIG_RENDER_MODE_CHECKPOINT,
+    /* Every image has a render surface covering the full canvas, which holds
+       palette indices into the animation palette instead of BGRA colors.
+       Parts of the canvas that show the background hold the render background
+       index of the animation. This requires every image to use the animation
+       palette, and a palette index that no image draws. */
+    FIG_RENDER_MODE_INDEX,
+    /* Only sampled images keep a render surface covering the full canvas,
+       either every sample interval images, or the images showing at each
+       sample time of the sample rate. Every other image has an empty render
+       surface. Every image is still drawn onto one running canvas, so the
+       sampled renders are the same as FIG_RENDER_MODE_FULL. */
+    FIG_RENDER_MODE_SAMPLED,
+    /* Number of render modes. */
+    FIG_RENDER_MODE_COUNT
+} fig_render_mode_t;
+
+/* An enumeration of pixel layouts that render surfaces can be converted into. */
+typedef enum fig_pixel_format_t {
+    /* 4 bytes per pixel, in R, G, B, A order. */
+    FIG_PIXEL_FORMAT_RGBA8,
+    /* 4 bytes per pixel, in B, G, R, A order. */
+    FIG_PIXEL_FORMAT_BGRA8,
+    /* 3 bytes per pixel, in R, G, B order. Alpha is discarded. */
+    FIG_PIXEL_FORMAT_RGB8,
+    /* A native-endian 16-bit value per pixel, with 5 bits of red in the
+       highest bits, 6 bits of green and 5 bits of blue. Alpha is discarded. */
+    FIG_PIXEL_FORMAT_RGB565,
+    /* 4 bytes per pixel, in R, G, B, A order, with R, G, B multiplied by A. */
+    FIG_PIXEL_FORMAT_PREMULTIPLIED_RGBA8,
+    /* Number of pixel formats. */
+    FIG_PIXEL_FORMAT_COUNT
+} fig_pixel_format_t;
+
+/* An enumeration of ways to reorient an animation. Rotations are clockwise. */
+typedef enum fig_transform_t {
+    /* Rotate by 90 degrees. The canvas width and height are swapped. */
+    FIG_TRANSFORM_ROTATE_90,
+    /* Rotate by 180 degrees. */
+    FIG_TRANSFORM_ROTATE_180,
+    /* Rotate by 270 degrees. The canvas width and height are swapped. */
+    FIG_TRANSFORM_ROTATE_270,
+    /* Mirror the columns, so that the left edge becomes the right edge. */
+    FIG_TRANSFORM_FLIP_HORIZONTAL,
+    /* Mirror the rows, so that the top edge becomes the bottom edge. */
+    FIG_TRANSFORM_FLIP_VERTICAL,
+    /* Swap the rows and columns, mirroring across the diagonal from the top left. */
+    FIG_TRANSFORM_TRANSPOSE,
+    /* Number of transforms. */
+    FIG_TRANSFORM_COUNT
+} fig_transform_t;
+
+/* An enumeration of filters used to resample images. */
+typedef enum fig_filter_t {
+    /* Average the source pixels covered by each destination pixel.
+       Upscaling repeats pixels, like nearest neighbor sampling. */
+    FIG_FILTER_BOX,
+    /* Blend linearly between neighboring source pixels. Also known as a triangle filter. */
+    FIG_FILTER_BILINEAR,
+    /* A windowed sinc filter reaching 3 pixels out, which keeps edges sharp,
+       but can ring slightly around them. */
+    FIG_FILTER_LANCZOS3,
+    /* Number of filters. */
+    FIG_FILTER_COUNT
+} fig_filter_t;
+
+/* An enumeration of element types of exported tensors. */
+typedef enum fig_tensor_type_t {
+    /* 1 byte per element, holding the channel value from 0 to 255. */
+    FIG_TENSOR_TYPE_UINT8,
+    /* A float per element, holding the channel value scaled to 0 to 1, then normalized. */
+    FIG_TENSOR_TYPE_FLOAT32,
+    /* Number of tensor types. */
+    FIG_TENSOR_TYPE_COUNT
+} fig_tensor_type_t;
+
+/* An enumeration of element orders of exported tensors. */
+typedef enum fig_tensor_layout_t {
+    /* Frames, then channels, then rows, then columns, so that each channel is a separate plane. */
+    FIG_TENSOR_LAYOUT_NCHW,
+    /* Frames, then rows, then columns, then channels, so that the channels of a pixel are together. */
+    FIG_TENSOR_LAYOUT_NHWC,
+    /* Number of tensor layouts. */
+    FIG_TENSOR_LAYOUT_COUNT
+} fig_tensor_layout_t;
+
 /* An enumeration of possible seek origins for input/output streams. */
 typedef enum fig_seek_origin_t {
     /* Seek forward from beginning of file. */
@@ -110,6 +217,18 @@ typedef enum fig_seek_origin_t {
     FIG_SEEK_END = SEEK_END
 } fig_seek_origin_t;
 
+/* A rectangular area of the animation canvas. */
+struct fig_rect {
+    /* The position of the left edge of the area. */
+    size_t x;
+    /* The position of the top edge of the area. */
+    size_t y;
+    /* The number of columns in the area. */
+    size_t width;
+    /* The number of rows in the area. */
+    size_t height;
+};
+
 
 
 /* A collection of shared state used by the library.
@@ -140,6 +259,16 @@ void fig_state_set_error_allocation_failed(fig_state *self);
 fig_allocator_t fig_state_get_allocator(fig_state *self);
 /* Get the userdata associated with this state. */
 void *fig_state_get_userdata(fig_state *self);
+/* Set the allocator + userdata used for the blocks that hold the surfaces of
+ * every image in an animation, such as fig_animation_allocate_render_slab.
+ * These can be far larger than other allocations, so they may be placed
+ * somewhere else, such as with fig_mapped_storage_alloc.
+ * (default: the allocator + userdata of the state) */
+void fig_state_set_storage_allocator(fig_state *self, fig_allocator_t alloc, void *ud);
+/* Get the allocator function used for the surface blocks of animations. */
+fig_allocator_t fig_state_get_storage_allocator(fig_state *self);
+/* Get the userdata passed to the allocator for the surface blocks of animations. */
+void *fig_state_get_storage_userdata(fig_state *self);
 /* Free a state created with one of the fig_create_state functions. */
 void fig_state_free(fig_state *self);
 
@@ -168,7 +297,8 @@ void fig_palette_free(fig_palette *self);
 
 
 
-/* An image containing a palette-indexed surface, and a BGRA render surface. */
+/* An image containing a palette-indexed surface, and a render surface
+ * of either BGRA colors or palette indices. */
 struct fig_image;
 
 /* Create and return a new image. Returns NULL on failure. */
@@ -183,8 +313,15 @@ size_t fig_image_get_origin_y(fig_image *self);
 size_t fig_image_get_indexed_width(fig_image *self);
 /* Get the height of the image indexed data. */
 size_t fig_image_get_indexed_height(fig_image *self);
-/* Get a raw pointer to image index data. */
+/* Get a raw pointer to image index data. Rows start
+ * fig_image_get_indexed_stride bytes apart. */
 fig_uint8_t *fig_image_get_indexed_data(fig_image *self);
+/* Get the number of bytes between the start of each row of the image index data.
+ * This is the indexed width, unless the data is a view made by fig_image_attach_indexed_view. */
+size_t fig_image_get_indexed_stride(fig_image *self);
+/* Count how many pixels of the indexed data hold each palette index,
+ * and write the 256 counts into counts. */
+void fig_image_count_indices(fig_image *self, size_t *counts);
 /* Set the x position of the image index data relative to the animation canvas. */
 void fig_image_set_origin_x(fig_image *self, size_t value);
 /* Set the y position of the image index data relative to the animation canvas. */
@@ -194,17 +331,68 @@ void fig_image_set_origin_y(fig_image *self, size_t value);
  * The data must be reinitialized after resizing.
  * Returns whether the resize was successful. */
 fig_bool_t fig_image_resize_indexed(fig_image *self, size_t width, size_t height);
+/* Use storage provided by the user as the indexed surface of the image,
+ * holding width * height palette indices. The previous indexed surface is freed.
+ * If owned is true, the image frees the data with the allocator of the state.
+ * Otherwise the data stays owned by the user, and must outlive its use by the image.
+ * Resizing the indexed surface keeps the storage if the dimensions don't change.
+ * Returns whether this was successful. */
+fig_bool_t fig_image_attach_indexed(fig_image *self, fig_uint8_t *data, size_t width, size_t height, fig_bool_t owned);
+/* Use an area of a larger block of palette indices owned by the user as the
+ * indexed surface of the image, without copying it, such as a cell of a sprite sheet.
+ * The rows of the block are parent_stride bytes apart, and the area must fit
+ * within a row of the block. Several images can view the same block.
+ * The image keeps no reference to the block and never frees it, so the block
+ * must outlive the view: it can only be freed once the image is freed, or has
+ * been given another indexed surface, such as by resizing, scaling or transforming.
+ * The previous indexed surface is freed.
+ * Returns whether this was successful. */
+fig_bool_t fig_image_attach_indexed_view(fig_image *self, fig_uint8_t *parent, size_t parent_stride, const fig_rect *rect);
 /* Get the width of the image render data. */
 size_t fig_image_get_render_width(fig_image *self);
 /* Get the height of the image render data. */
 size_t fig_image_get_render_height(fig_image *self);
-/* Get a raw pointer to image BGRA color data. */
+/* Get the x position of the image render data relative to the animation canvas. */
+size_t fig_image_get_render_origin_x(fig_image *self);
+/* Get the y position of the image render data relative to the animation canvas. */
+size_t fig_image_get_render_origin_y(fig_image *self);
+/* Get the number of bytes between the start of each row of the image render data. */
+size_t fig_image_get_render_stride(fig_image *self);
+/* Get a raw pointer to image BGRA color data.
+ * Returns NULL if the render surface holds palette indices. */
 fig_uint32_t *fig_image_get_render_data(fig_image *self);
+/* Get a raw pointer to image render palette index data.
+ * Returns NULL if the render surface holds BGRA colors. */
+fig_uint8_t *fig_image_get_render_index_data(fig_image *self);
+/* Set the x position of the image render data relative to the animation canvas. */
+void fig_image_set_render_origin_x(fig_image *self, size_t value);
+/* Set the y position of the image render data relative to the animation canvas. */
+void fig_image_set_render_origin_y(fig_image *self, size_t value);
 /* Resize the render surface of the image.
  * Invalidates the render data pointer on success.
  * The data must be reinitialized after resizing.
  * Returns whether the resize was successful. */
 fig_bool_t fig_image_resize_render(fig_image *self, size_t width, size_t height);
+/* Resize the render surface of the image to hold palette indices.
+ * Invalidates the render data pointers on success.
+ * The data must be reinitialized after resizing.
+ * Returns whether the resize was successful. */
+fig_bool_t fig_image_resize_render_index(fig_image *self, size_t width, size_t height);
+/* Use storage provided by the user as the render surface of the image, holding
+ * width * height BGRA colors with stride bytes between the start of each row.
+ * The previous render surface is freed.
+ * If owned is true, the image frees the data as a block of stride * height bytes
+ * with the allocator of the state. Otherwise the data stays owned by the user,
+ * and must outlive its use by the image.
+ * Resizing the render surface keeps the storage if the dimensions don't change,
+ * so rendering writes straight into it when it matches what the render mode
+ * stores, such as the full canvas for FIG_RENDER_MODE_FULL.
+ * Returns whether this was successful. */
+fig_bool_t fig_image_attach_render(fig_image *self, fig_uint32_t *data, size_t width, size_t height, size_t stride, fig_bool_t owned);
+/* Use storage provided by the user as the render surface of the image, holding
+ * width * height palette indices with stride bytes between the start of each row.
+ * This works the same way as fig_image_attach_render otherwise. */
+fig_bool_t fig_image_attach_render_index(fig_image *self, fig_uint8_t *data, size_t width, size_t height, size_t stride, fig_bool_t owned);
 /* Get the delay to apply on this image. */
 size_t fig_image_get_delay(fig_image *self);
 /* Get the disposal to apply between this image and the next. */
@@ -221,6 +409,25 @@ void fig_image_set_disposal(fig_image *self, fig_disposal_t value);
 void fig_image_set_transparent(fig_image *self, fig_bool_t value);
 /* Set the color that should be transparent during rendering. */
 void fig_image_set_transparency_index(fig_image *self, size_t value);
+/* Get the 8 byte perceptual hash of the frame that this image shows, or NULL if none was computed.
+ * Rendering computes it when perceptual hashes are enabled on the animation. Frames that look
+ * alike have hashes that differ in few bits, as counted by fig_perceptual_hash_distance. */
+const fig_uint8_t *fig_image_get_perceptual_hash(fig_image *self);
+/* Set the 8 byte perceptual hash of the image, or remove it if hash is NULL. */
+void fig_image_set_perceptual_hash(fig_image *self, const fig_uint8_t *hash);
+/* Get the number of bits that differ between two 8 byte perceptual hashes,
+ * from 0 for frames that look the same, up to 64. */
+size_t fig_perceptual_hash_distance(const fig_uint8_t *a, const fig_uint8_t *b);
+/* Get the 8 byte content hash of the image, made by fig_animation_hash_images, or NULL if none was computed.
+ * It covers the indexed data, its position and size, the render palette, and the transparency settings,
+ * so images that are encoded the same way have the same content hash. */
+const fig_uint8_t *fig_image_get_content_hash(fig_image *self);
+/* Get the 8 byte frame hash of the image, made by fig_animation_hash_images, or NULL if none was computed.
+ * It covers the composited frame that the image shows, so images that look the same have the same
+ * frame hash, however they are encoded. */
+const fig_uint8_t *fig_image_get_frame_hash(fig_image *self);
+/* Set the 8 byte content and frame hashes of the image, or remove them if either is NULL. */
+void fig_image_set_hashes(fig_image *self, const fig_uint8_t *content_hash, const fig_uint8_t *frame_hash);
 /* Free an image created with fig_create_image. */
 void fig_image_free(fig_image *self);
 
@@ -243,10 +450,47 @@ void fig_animation_set_dimensions(fig_animation *self, size_t width, size_t heig
 size_t fig_animation_count_images(fig_animation *self);
 /* Get a raw pointer to a contiguous image array, possibly NULL. */
 fig_image **fig_animation_get_images(fig_animation *self);
-/* Get loop count of the animation. 0 = infinite looping */
+/* Get loop count of the animation. 0 = infinite looping
+ * Otherwise, this is the number of times the images repeat after they are
+ * first played, as in the GIF format, so a loop count of 1 plays them twice. */
 size_t fig_animation_get_loop_count(fig_animation *self);
 /* Set loop count of the animation. 0 = infinite looping */
 void fig_animation_set_loop_count(fig_animation *self, size_t value);
+/* Get how the render surfaces of images are stored when rendering. */
+fig_render_mode_t fig_animation_get_render_mode(fig_animation *self);
+/* Set how the render surfaces of images are stored when rendering. */
+void fig_animation_set_render_mode(fig_animation *self, fig_render_mode_t value);
+/* Get how many images apart the stored renders of FIG_RENDER_MODE_CHECKPOINT are.
+ * 0 = only keyframes are checkpoints. (default: 16) */
+size_t fig_animation_get_checkpoint_interval(fig_animation *self);
+/* Set how many images apart the stored renders of FIG_RENDER_MODE_CHECKPOINT are.
+ * 0 = only keyframes are checkpoints. */
+void fig_animation_set_checkpoint_interval(fig_animation *self, size_t value);
+/* Get how many images apart the sampled images of FIG_RENDER_MODE_SAMPLED are,
+ * starting from the first image. This is used when the sample rate is 0. (default: 1) */
+size_t fig_animation_get_sample_interval(fig_animation *self);
+/* Set how many images apart the sampled images of FIG_RENDER_MODE_SAMPLED are. 1 <= value */
+void fig_animation_set_sample_interval(fig_animation *self, size_t value);
+/* Get how many samples FIG_RENDER_MODE_SAMPLED takes every sample duration,
+ * or 0 if images are sampled every sample interval instead. (default: 0) */
+size_t fig_animation_get_sample_rate(fig_animation *self);
+/* Get the time that the sample rate is counted over, in the same units as image delays. (default: 100) */
+size_t fig_animation_get_sample_duration(fig_animation *self);
+/* Make FIG_RENDER_MODE_SAMPLED take rate samples every duration units of time,
+ * starting when the first image is shown, and keep the images showing at the sample times.
+ * GIF delays are in hundredths of a second, so a duration of 100 makes the rate
+ * frames per second. A rate of 0 samples every sample interval images instead.
+ * 1 <= duration */
+void fig_animation_set_sample_rate(fig_animation *self, size_t rate, size_t duration);
+/* Get whether rendering computes the perceptual hash of every image. (default: 0) */
+fig_bool_t fig_animation_get_perceptual_hashes(fig_animation *self);
+/* Set whether rendering computes the perceptual hash of every image.
+ * The hash is a difference hash: the canvas is divided into a grid of 9 x 8 cells,
+ * and each of the 64 bits is whether the average luminance of a cell is greater than
+ * that of the cell to its right, row by row, with the most significant bit first.
+ * The cell sums are kept while compositing, and only the area that changed since the
+ * previous image is scanned again, so this doesn't need another pass over every render. */
+void fig_animation_set_perceptual_hashes(fig_animation *self, fig_bool_t value);
 /* Exchange order of two images at the given indices. 0 <= index < size */
 void fig_animation_swap_images(fig_animation *self, size_t index_a, size_t index_b);
 /* Create and add an image to the end of the animation, and return it.
@@ -265,16 +509,360 @@ fig_image *fig_animation_insert_image(fig_animation *self, size_t index);
 void fig_animation_remove_image(fig_animation *self, size_t index);
 /* Render all the images by using their indexed data and palette to
  * generate their complete appearance. If this was succesful,
- * every image will contain a full color render surface of the result.
+ * every image will contain a full color render surface of the result,
+ * stored according to the render mode of the animation.
  * Returns whether the render was succesful. */
 fig_bool_t fig_animation_render_images(fig_animation *self);
+/* Allocate the render surfaces of every image as a single contiguous block,
+ * holding one full canvas per image, in the order of the images.
+ * The surfaces hold palette indices for FIG_RENDER_MODE_INDEX, and BGRA colors
+ * for FIG_RENDER_MODE_FULL. Other render modes don't keep a full canvas per image,
+ * so this fails for them rather than allocating memory they wouldn't use.
+ * The previous render surfaces are freed, so the images must be rendered again.
+ * Rendering writes into the block, which stays allocated until this is called
+ * again or the animation is freed. Returns whether the allocation was successful. */
+fig_bool_t fig_animation_allocate_render_slab(fig_animation *self);
+/* Get the block allocated by fig_animation_allocate_render_slab, or NULL if there is none.
+ * The render surface of the image at index i starts i * pitch bytes into it. */
+void *fig_animation_get_render_slab(fig_animation *self);
+/* Get the number of bytes between the render surfaces in the block allocated by
+ * fig_animation_allocate_render_slab. */
+size_t fig_animation_get_render_slab_pitch(fig_animation *self);
+/* Free the block allocated by fig_animation_allocate_render_slab.
+ * Images with a render surface in the block are left without a render surface. */
+void fig_animation_release_render_slab(fig_animation *self);
+/* Move the indexed data of every image into a single contiguous block,
+ * in the order of the images, with room for the largest indexed surface per image.
+ * The block stays allocated until this is called again or the animation is freed.
+ * Returns whether the allocation was successful. */
+fig_bool_t fig_animation_pack_indexed_data(fig_animation *self);
+/* Get the block allocated by fig_animation_pack_indexed_data, or NULL if there is none.
+ * The indexed data of the image at index i starts i * pitch bytes into it. */
+fig_uint8_t *fig_animation_get_indexed_slab(fig_animation *self);
+/* Get the number of bytes between the indexed surfaces in the block allocated by
+ * fig_animation_pack_indexed_data. */
+size_t fig_animation_get_indexed_slab_pitch(fig_animation *self);
+/* Scale the animation up by a whole number factor, by repeating every palette
+ * index of the indexed data of each image into a factor x factor block.
+ * The canvas dimensions and image origins are scaled to match, and the palettes
+ * and transparency are kept, so the result can be encoded again as it is.
+ * Render surfaces no longer match the indexed data, so they are freed,
+ * along with any block made by fig_animation_pack_indexed_data.
+ * Returns whether this was successful. If not, the animation is unchanged. */
+fig_bool_t fig_animation_scale(fig_animation *self, size_t factor);
+/* Rotate, flip or transpose the animation, by moving the palette indices of the
+ * indexed data of each image, along with the image origins and canvas dimensions.
+ * Like fig_animation_scale, the result can be encoded again as it is, and render
+ * surfaces and any block made by fig_animation_pack_indexed_data are freed.
+ * Every image must lie inside the canvas.
+ * Returns whether this was successful. If not, the animation is unchanged. */
+fig_bool_t fig_animation_transform(fig_animation *self, fig_transform_t transform);
+/* Get the palette index that stands for the background in the render
+ * surfaces of FIG_RENDER_MODE_INDEX. This is the first index past the end
+ * of the animation palette, or otherwise an index that no image draws.
+ * Returns 256 if every palette index is drawn by some image. */
+size_t fig_animation_get_render_background_index(fig_animation *self);
+/* Get the areas of the canvas that can differ between the render of the image
+ * before the given index and the render of this image: the area disposed after
+ * the image before it, and the area drawn by this image, each without the rows
+ * and columns that are left transparent. Areas that overlap or touch are merged.
+ * For the first image, this is the full canvas.
+ * Writes up to 2 rectangles into rects, and returns how many were written.
+ * 0 <= index < size */
+size_t fig_animation_get_dirty_rects(fig_animation *self, size_t index, fig_rect *rects);
+/* Get whether the image at the given index is a keyframe, which means it can be
+ * rendered without the render of any image before it, and the images after it
+ * don't depend on the render of any image before it either.
+ * The first image is always a keyframe. 0 <= index < size */
+fig_bool_t fig_animation_is_keyframe(fig_animation *self, size_t index);
+/* Get how many samples of FIG_RENDER_MODE_SAMPLED show the image at the given index,
+ * which is 0 if the image isn't sampled. Sampling by interval gives 0 or 1, but an
+ * image with a long delay can show at several sample times when sampling by rate.
+ * This depends on the delays of the images before it. 0 <= index < size */
+size_t fig_animation_count_samples(fig_animation *self, size_t index);
+/* Compute the content hash and frame hash of every image, which are fast 64-bit hashes
+ * meant for finding identical images, rather than cryptographic ones.
+ * The frames are composited once in order, and only the rows of the canvas that changed
+ * since the image before are hashed again. The hashes aren't updated when the animation changes.
+ * Returns whether this was successful. */
+fig_bool_t fig_animation_hash_images(fig_animation *self);
+/* Find the images that show identical frames, consecutive or not, by their frame hashes.
+ * For every image, writes the index of the first image with the same frame into firsts,
+ * which is the index of the image itself if no image before it shows the same frame.
+ * Images are hashed first with fig_animation_hash_images if any of them have no hashes.
+ * firsts holds an index for every image, and the number of distinct frames is written
+ * into distinct_count, which is 0 for an animation without images.
+ * Returns whether this was successful. */
+fig_bool_t fig_animation_find_duplicate_frames(fig_animation *self, size_t *firsts, size_t *distinct_count);
+/* Do the work that rendering needs from every image once, before any range
+ * is rendered with fig_animation_render_image_range. With FIG_RENDER_MODE_INDEX,
+ * this checks that no image has a local palette and picks the palette index
+ * used for the background, which must be picked again after the indexed data
+ * changes. Other render modes need nothing. fig_animation_render_images
+ * calls this itself. Returns whether this was successful. */
+fig_bool_t fig_animation_prepare_render(fig_animation *self);
+/* Render the images from index start up to (but not including) end,
+ * with the same result as fig_animation_render_images for those images.
+ * The image at start must be a keyframe, and fig_animation_prepare_render
+ * must have been called since the animation last changed.
+ * Ranges that don't overlap only write to their own images, and only read
+ * the rest of the animation, so the segments between keyframes can be rendered
+ * on separate threads, as long as the allocator of the state can be used
+ * concurrently. There is no worker pool in the library: creating the threads
+ * and handing out ranges is left to the caller. Errors are still set on the
+ * shared state, and setting them isn't thread-safe, so the error message
+ * can't be relied on when ranges fail in parallel, only the return values.
+ * Returns whether the render was succesful. 0 <= start <= end <= size */
+fig_bool_t fig_animation_render_image_range(fig_animation *self, size_t start, size_t end);
+/* Reconstruct the full canvas of the image at the given index into out,
+ * which must hold width * height BGRA colors.
+ * This only needs the indexed data of the images, but it replays fewer
+ * images when starting from a render surface made by fig_animation_render_images.
+ * Returns whether this was successful. 0 <= index < size */
+fig_bool_t fig_animation_get_frame_rgba(fig_animation *self, size_t index, fig_uint32_t *out);
+/* Reconstruct an area of the canvas of the image at the given index into out,
+ * which must hold area->width * area->height BGRA colors, with out_stride bytes
+ * between the start of each row. Only the parts of images inside the area are
+ * drawn, and the memory used is in proportion to the area rather than the canvas,
+ * so this can show part of a very large canvas, or render the canvas as tiles.
+ * This renders a single area: splitting the canvas into tiles is left to the caller.
+ * Areas don't depend on each other, so tiles can be rendered on separate threads,
+ * as long as the allocator of the state can be used concurrently. Errors are still
+ * set on the shared state, and setting them isn't thread-safe, so the error message
+ * can't be relied on when tiles fail in parallel, only the return values.
+ * Returns whether this was successful. 0 <= index < size */
+fig_bool_t fig_animation_get_frame_area_rgba(fig_animation *self, size_t index, const fig_rect *area, fig_uint32_t *out, size_t out_stride);
 /* Get the palette to apply for rendering the specified image in the animation. */
 fig_palette *fig_animation_get_render_palette(fig_animation *self, fig_image *image);
+/* Convert the render surface of an image in the animation into out, which
+ * holds a full canvas of pixels in the given format, with out_stride bytes
+ * between the start of each row. Only the area covered by the render surface
+ * is written, at its render origin, so converting the images of
+ * FIG_RENDER_MODE_DELTA in order into the same buffer produces every frame.
+ * Render surfaces of palette indices are converted straight from the
+ * animation palette, without expanding them into BGRA colors first. */
+void fig_animation_convert_render(fig_animation *self, fig_image *image, void *out, size_t out_stride, fig_pixel_format_t format);
+/* Convert the render surface of palette indices of an image like
+ * fig_animation_convert_render, but look the colors up in the given palette
+ * instead of the animation palette, for palette swaps and color cycling.
+ * If area is not NULL, only the part of the surface inside that canvas
+ * area is written, such as a dirty rect of the frame. This is a single table
+ * lookup per pixel, with no compositing, so the images only need to be
+ * rendered once with FIG_RENDER_MODE_INDEX.
+ * Returns whether this was successful. */
+fig_bool_t fig_animation_convert_render_palette(fig_animation *self, fig_image *image, fig_palette *palette, const fig_rect *area, void *out, size_t out_stride, fig_pixel_format_t format);
 /* Free an animation created with fig_create_animation. */
 void fig_animation_free(fig_animation *self);
 
 
 
+/* A playback position within an animation, which keeps a single canvas
+ * with the appearance of the current image. Moving to the next image only
+ * redraws the area that changed, so the animation doesn't need any render
+ * surfaces. Time is measured in the same units as image delays.
+ * The animation must outlive the player, and must not be modified while
+ * it is being played. */
+struct fig_player;
+
+/* Create and return a player showing the first image of the animation.
+ * Returns NULL on failure. */
+fig_player *fig_create_player(fig_state *state, fig_animation *animation);
+/* Get a raw pointer to the BGRA color data of the canvas, which is
+ * the size of the animation canvas. */
+const fig_uint32_t *fig_player_get_canvas(fig_player *self);
+/* Get the index of the image that is currently shown. */
+size_t fig_player_get_image_index(fig_player *self);
+/* Get how many times playback has looped back to the first image. */
+size_t fig_player_get_loop_index(fig_player *self);
+/* Get the time at which the current image started being shown. */
+size_t fig_player_get_time(fig_player *self);
+/* Move to the next image, looping back to the first image
+ * as allowed by the loop count of the animation. The images are played
+ * one more time than the loop count, or forever if it is 0.
+ * Returns 0 if playback is finished, and the last image stays shown. */
+fig_bool_t fig_player_advance(fig_player *self);
+/* Move to the image shown at the given time since playback started,
+ * taking image delays and looping into account like fig_player_advance.
+ * If the animation has no delays at all, the last image is shown at any time,
+ * and playback is finished unless the animation loops forever.
+ * Returns 0 if playback is finished by that time, and the last image is shown. */
+fig_bool_t fig_player_seek_time(fig_player *self, size_t time);
+/* Free a player created with fig_create_player. */
+void fig_player_free(fig_player *self);
+
+
+
+/* A single texture holding every distinct frame of an animation, trimmed to the
+ * area that isn't transparent, along with where and for how long each frame is drawn. */
+struct fig_atlas;
+
+/* Where a frame of an animation is stored in an atlas. */
+struct fig_atlas_frame {
+    /* The area of the atlas holding the frame. This is empty if the whole frame
+       is transparent, and identical frames share the same area. */
+    fig_rect source;
+    /* The position on the canvas where the top left corner of the area is drawn. */
+    size_t x;
+    size_t y;
+    /* The delay of the image that the frame shows. */
+    size_t delay;
+};
+
+/* Options that control how an atlas is packed. */
+struct fig_atlas_options {
+    /* Whether the atlas holds palette indices instead of BGRA colors. (default: 0)
+     * This reads the render surfaces of an animation rendered with FIG_RENDER_MODE_INDEX,
+     * and transparent parts of the atlas hold its render background index. */
+    fig_bool_t indexed;
+    /* The widest the atlas can be, or 0 to pick a width that keeps it roughly square. (default: 0) */
+    size_t max_width;
+    /* The number of transparent pixels left between frames. (default: 0) */
+    size_t padding;
+};
+
+/* Initialize atlas options to their default values. */
+void fig_init_atlas_options(fig_atlas_options *options);
+/* Create and return an empty atlas. Returns NULL on failure. */
+fig_atlas *fig_create_atlas(fig_state *state);
+/* Pack every frame of the animation into the atlas, replacing what it held before.
+ * Each frame is composited, trimmed to the bounds of its pixels that aren't transparent,
+ * and only stored once if other frames are identical to it. The frames are placed
+ * tallest first with a skyline packer.
+ * Returns whether this was successful. If not, the atlas is unchanged. */
+fig_bool_t fig_atlas_pack(fig_atlas *self, fig_animation *animation, const fig_atlas_options *options);
+/* Get the width of the atlas. */
+size_t fig_atlas_get_width(fig_atlas *self);
+/* Get the height of the atlas. */
+size_t fig_atlas_get_height(fig_atlas *self);
+/* Get a raw pointer to the BGRA color data of the atlas, with width * height colors,
+ * or NULL if the atlas holds palette indices. */
+fig_uint32_t *fig_atlas_get_data(fig_atlas *self);
+/* Get a raw pointer to the palette indices of the atlas, with width * height indices,
+ * or NULL if the atlas holds BGRA colors. */
+fig_uint8_t *fig_atlas_get_index_data(fig_atlas *self);
+/* Get the number of distinct frames stored in the atlas. */
+size_t fig_atlas_count_sprites(fig_atlas *self);
+/* Get the number of frames, which is the number of images of the packed animation. */
+size_t fig_atlas_count_frames(fig_atlas *self);
+/* Get a raw pointer to the frames, in the order of the images of the packed animation. */
+fig_atlas_frame *fig_atlas_get_frames(fig_atlas *self);
+/* Free an atlas created with fig_create_atlas. */
+void fig_atlas_free(fig_atlas *self);
+
+
+
+/* A resize of BGRA images from one size to another, with the filter weights
+ * of every row and column computed once, so that it can be reused for every frame. */
+struct fig_resampler;
+
+/* Create and return a resampler from images of src_width x src_height to
+ * dest_width x dest_height, using the given filter. Each axis is scaled independently.
+ * Colors are filtered with premultiplied alpha, so transparent pixels don't bleed into their neighbors.
+ * Returns NULL on failure. */
+fig_resampler *fig_create_resampler(fig_state *state, size_t src_width, size_t src_height, size_t dest_width, size_t dest_height, fig_filter_t filter);
+/* Get the width of images that the resampler reads. */
+size_t fig_resampler_get_src_width(fig_resampler *self);
+/* Get the height of images that the resampler reads. */
+size_t fig_resampler_get_src_height(fig_resampler *self);
+/* Get the width of images that the resampler writes. */
+size_t fig_resampler_get_dest_width(fig_resampler *self);
+/* Get the height of images that the resampler writes. */
+size_t fig_resampler_get_dest_height(fig_resampler *self);
+/* Resample the BGRA colors in src into dest. src_stride and dest_stride are
+ * the number of bytes between the start of each row of src and dest.
+ * Returns whether this was successful. */
+fig_bool_t fig_resampler_resample(fig_resampler *self, const fig_uint32_t *src, size_t src_stride, fig_uint32_t *dest, size_t dest_stride);
+/* Resample only the destination rows in the range [start, end). Ranges don't depend
+ * on each other, so an image can be split into bands that are resampled in parallel,
+ * as long as the allocator of the state can be used concurrently.
+ * Returns whether this was successful. 0 <= start <= end <= destination height */
+fig_bool_t fig_resampler_resample_rows(fig_resampler *self, const fig_uint32_t *src, size_t src_stride, fig_uint32_t *dest, size_t dest_stride, size_t start, size_t end);
+/* Resample the full canvas of the image at the given index into out, which must hold
+ * the destination width * height BGRA colors, with out_stride bytes between the start of each row.
+ * The source size of the resampler must match the canvas of the animation.
+ * A render surface made with FIG_RENDER_MODE_FULL is read directly, and otherwise the frame
+ * is reconstructed like fig_animation_get_frame_rgba.
+ * Returns whether this was successful. 0 <= index < size */
+fig_bool_t fig_animation_resample_frame(fig_animation *self, size_t index, fig_resampler *resampler, fig_uint32_t *out, size_t out_stride);
+/* Free a resampler created with fig_create_resampler. */
+void fig_resampler_free(fig_resampler *self);
+
+
+
+/* Options that control how frames are exported into a tensor. */
+struct fig_tensor_options {
+    /* The type of each element. (default: FIG_TENSOR_TYPE_UINT8) */
+    fig_tensor_type_t type;
+    /* The order of the elements. (default: FIG_TENSOR_LAYOUT_NCHW) */
+    fig_tensor_layout_t layout;
+    /* The number of channels, either 3 for R, G, B, or 4 for R, G, B, A. (default: 3)
+     * Colors aren't premultiplied, and transparent pixels are 0 in every channel. */
+    size_t channels;
+    /* The width and height of each frame, or 0 to use the canvas size. (default: 0) */
+    size_t width;
+    size_t height;
+    /* The filter used when the frame size differs from the canvas. (default: FIG_FILTER_BILINEAR) */
+    fig_filter_t filter;
+    /* Each channel of FIG_TENSOR_TYPE_FLOAT32 is written as (value / 255 - mean) / std,
+     * in the same order as the channels. (default: 0 mean, 1 std) */
+    float mean[4];
+    float std[4];
+};
+
+/* Initialize tensor options to their default values. */
+void fig_init_tensor_options(fig_tensor_options *options);
+/* Get the number of bytes needed to export count frames of the animation with the given options,
+ * or 0 if that doesn't fit in a size_t, or the options don't have 3 or 4 channels. */
+size_t fig_get_tensor_size(fig_animation *animation, size_t count, const fig_tensor_options *options);
+/* Export the frames of the images at the given indices of the animation into out, which must hold
+ * fig_get_tensor_size(animation, count, options) bytes, in order. If indices is NULL, the first count images are exported.
+ * Render surfaces of palette indices covering the canvas are read through a table made from the animation
+ * palette, and BGRA render surfaces covering the canvas are read directly, so exporting the images
+ * sampled by FIG_RENDER_MODE_SAMPLED needs no compositing. Other frames are reconstructed
+ * like fig_animation_get_frame_rgba, and frames of a different size are resampled first.
+ * Returns whether this was successful. */
+fig_bool_t fig_export_tensor(fig_state *state, void *out, fig_animation *animation, const size_t *indices, size_t count, const fig_tensor_options *options);
+
+
+
+/* A count of the colors drawn by images, gathered from their indexed data
+ * and render palettes, without reading any render surfaces. */
+struct fig_histogram;
+
+/* The number of pixels of a color in a histogram. */
+struct fig_color_count {
+    fig_uint32_t color;
+    size_t count;
+};
+
+/* Create and return an empty histogram. Returns NULL on failure. */
+fig_histogram *fig_create_histogram(fig_state *state);
+/* Remove every count from the histogram, keeping its storage. */
+void fig_histogram_clear(fig_histogram *self);
+/* Count the pixels drawn by an image of the animation. Each palette index of the
+ * indexed data is counted once, then looked up in the render palette of the image,
+ * so colors shared by several indices or palettes are merged. This counts the pixels
+ * of the image itself, rather than the composited frame.
+ * Returns whether this was successful. If not, the histogram is unchanged. */
+fig_bool_t fig_histogram_add_image(fig_histogram *self, fig_animation *animation, fig_image *image);
+/* Count the pixels drawn by every image of the animation.
+ * Returns whether this was successful. If not, only some images were counted. */
+fig_bool_t fig_histogram_add_animation(fig_histogram *self, fig_animation *animation);
+/* Get the number of pixels counted. */
+size_t fig_histogram_count_pixels(fig_histogram *self);
+/* Get the number of pixels counted that are transparent, because they hold the
+ * transparency index, or an index past the end of the palette. */
+size_t fig_histogram_count_transparent(fig_histogram *self);
+/* Get the number of distinct colors of the pixels that aren't transparent. */
+size_t fig_histogram_count_colors(fig_histogram *self);
+/* Get a raw pointer to the distinct colors and their counts, most common first,
+ * with colors of the same count in increasing order. */
+fig_color_count *fig_histogram_get_colors(fig_histogram *self);
+/* Free a histogram created with fig_create_histogram. */
+void fig_histogram_free(fig_histogram *self);
+
+
+
 /* A input stream used for reading binary data. */
 struct fig_input;
 
@@ -369,9 +957,41 @@ void fig_output_free(fig_output *self);
 
 
 
+/* Options that control what work is done while loading an animation. */
+struct fig_load_options {
+    /* Whether to render every image after loading. (default: 1)
+     * When this is 0, only indexed data is loaded, and images have no render
+     * surface until fig_animation_render_images is called on the animation.
+     * This avoids a full-canvas allocation and compositing pass per image,
+     * for callers that only need the indexed data (eg. re-encoding). */
+    fig_bool_t render_images;
+    /* How render surfaces are stored when rendering. (default: FIG_RENDER_MODE_FULL) */
+    fig_render_mode_t render_mode;
+    /* Whether to allocate every render surface as one block before rendering,
+     * with fig_animation_allocate_render_slab. This is ignored unless the render
+     * mode is FIG_RENDER_MODE_FULL or FIG_RENDER_MODE_INDEX. (default: 0) */
+    fig_bool_t contiguous_render;
+    /* Whether to move all indexed data into one block after loading,
+     * with fig_animation_pack_indexed_data. (default: 0) */
+    fig_bool_t contiguous_indexed;
+    /* Whether rendering computes the perceptual hash of every image,
+     * with fig_animation_set_perceptual_hashes. (default: 0) */
+    fig_bool_t perceptual_hashes;
+};
+
+/* Initialize load options to their default values. */
+void fig_init_load_options(fig_load_options *options);
+
+
+
 /* GIF format support */
 #ifdef FIG_LOAD_GIF
+/* Load a GIF animation with the default load options. Returns NULL on failure.
+ * Unlike fig_load_gif_with_options, a failure to render the images doesn't fail
+ * the load: the animation is still returned, with the error set on the state. */
 fig_animation *fig_load_gif(fig_state *state, fig_input *input);
+/* Load a GIF animation with the given load options. Returns NULL on failure. */
+fig_animation *fig_load_gif_with_options(fig_state *state, fig_input *input, const fig_load_options *options);
 #endif
 #ifdef FIG_SAVE_GIF
 fig_bool_t fig_save_gif(fig_state *state, fig_output *output, fig_animation *animation);
@@ -384,6 +1004,22 @@ fig_bool_t fig_save_gif(fig_state *state, fig_output *output, fig_animation *ani
 fig_uint32_t fig_pack_color(fig_uint8_t r, fig_uint8_t g, fig_uint8_t b, fig_uint8_t a);
 /* Extracts the r, g, b, a components of the given 32-bit BGRA color. */
 void fig_unpack_color(fig_uint32_t color, fig_uint8_t *r, fig_uint8_t *g, fig_uint8_t *b, fig_uint8_t *a);
+#ifdef FIG_MAPPED_STORAGE
+/* An allocator that places each allocation in its own temporary file mapped into memory,
+ * so that its pages are written out to disk rather than using memory when needed.
+ * The file is removed once it is freed or the process exits. The userdata is unused.
+ * This is meant for fig_state_set_storage_allocator, for animations too large for memory. */
+void *fig_mapped_storage_alloc(void *ud, void *ptr, size_t old_size, size_t new_size);
+#endif
+/* Returns the number of bytes used by a single pixel of the given format. */
+size_t fig_pixel_format_get_size(fig_pixel_format_t format);
+/* Convert a width * height area of BGRA colors into pixels of the given format.
+ * The strides are the number of bytes between the start of each row. */
+void fig_convert_colors(const fig_uint32_t *src, size_t src_stride, void *dest, size_t dest_stride, size_t width, size_t height, fig_pixel_format_t format);
+/* Convert a width * height area of palette indices into pixels of the given format,
+ * by looking up each index in colors. Indices past color_count become transparent black.
+ * The strides are the number of bytes between the start of each row. */
+void fig_convert_indices(const fig_uint8_t *src, size_t src_stride, const fig_uint32_t *colors, size_t color_count, void *dest, size_t dest_stride, size_t width, size_t height, fig_pixel_format_t format);
 
 
 
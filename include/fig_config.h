@@ -11,6 +11,10 @@ typedef TYPE_GOES_HERE fig_uint16_t;
 typedef TYPE_GOES_HERE fig_uint32_t; 
 typedef TYPE_GOES_HERE fig_bool_t; */
 
+/* To provide fig_mapped_storage_alloc, which keeps surface blocks in
+   temporary memory-mapped files (requires POSIX or Windows): */
+/* #define FIG_MAPPED_STORAGE */
+
 /* To manually specify which formats to support: */
 /* #define FIG_EXPLICIT_SUPPORT */
 
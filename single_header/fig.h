@@ -4,6 +4,12 @@
 /* To use, there must be ONE source file that contains the library implementation: */
 /* #define FIG_IMPLEMENTATION */
 /* #include <fig.h> */
+#ifdef FIG_IMPLEMENTATION
+#if defined(FIG_MAPPED_STORAGE) && !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+/* ftruncate and fileno are POSIX, so they aren't declared in strict ANSI C without this. */
+#define _POSIX_C_SOURCE 200112L
+#endif
+#endif
 
 /* To disable asserts: */
 /* #define FIG_ASSERT(x) ((void) x) */
@@ -15,6 +21,10 @@ typedef TYPE_GOES_HERE fig_uint16_t;
 typedef TYPE_GOES_HERE fig_uint32_t; 
 typedef TYPE_GOES_HERE fig_bool_t; */
 
+/* To provide fig_mapped_storage_alloc, which keeps surface blocks in
+   temporary memory-mapped files (requires POSIX or Windows): */
+/* #define FIG_MAPPED_STORAGE */
+
 /* To manually specify which formats to support: */
 /* #define FIG_EXPLICIT_SUPPORT */
 
@@ -73,10 +83,20 @@ typedef struct fig_state fig_state;
 typedef struct fig_palette fig_palette;
 typedef struct fig_image fig_image;
 typedef struct fig_animation fig_animation;
+typedef struct fig_player fig_player;
+typedef struct fig_atlas fig_atlas;
+typedef struct fig_atlas_frame fig_atlas_frame;
+typedef struct fig_atlas_options fig_atlas_options;
+typedef struct fig_resampler fig_resampler;
+typedef struct fig_tensor_options fig_tensor_options;
+typedef struct fig_histogram fig_histogram;
+typedef struct fig_color_count fig_color_count;
 typedef struct fig_input fig_input;
 typedef struct fig_input_callbacks fig_input_callbacks;
 typedef struct fig_output fig_output;
 typedef struct fig_output_callbacks fig_output_callbacks;
+typedef struct fig_load_options fig_load_options;
+typedef struct fig_rect fig_rect;
 
 /* A function that allocates and manages blocks of memory.
  *
@@ -122,6 +142,103 @@ typedef enum fig_disposal_t {
     FIG_DISPOSAL_COUNT
 } fig_disposal_t;
 
+/* An enumeration of possible ways to store the result of rendering an animation. */
+typedef enum fig_render_mode_t {
+    /* Every image has a render surface covering the full canvas. */
+    FIG_RENDER_MODE_FULL,
+    /* Every image has a render surface covering only the area of the canvas
+       that changed since the previous image. Pixels outside of it are the same
+       as the previous image. The first image covers the full canvas. */
+    FIG_RENDER_MODE_DELTA,
+    /* Only some images keep a render surface covering the full canvas,
+       every checkpoint interval. Every other image has an empty render surface,
+       and can be reconstructed with fig_animation_get_frame_rgba. */
+    FIG_RENDER_MODE_CHECKPOINT,
+    /* Every image has a render surface covering the full canvas, which holds
+       palette indices into the animation palette instead of BGRA colors.
+       Parts of the canvas that show the background hold the render background
+       index of the animation. This requires every image to use the animation
+       palette, and a palette index that no image draws. */
+    FIG_RENDER_MODE_INDEX,
+    /* Only sampled images keep a render surface covering the full canvas,
+       either every sample interval images, or the images showing at each
+       sample time of the sample rate. Every other image has an empty render
+       surface. Every image is still drawn onto one running canvas, so the
+       sampled renders are the same as FIG_RENDER_MODE_FULL. */
+    FIG_RENDER_MODE_SAMPLED,
+    /* Number of render modes. */
+    FIG_RENDER_MODE_COUNT
+} fig_render_mode_t;
+
+/* An enumeration of pixel layouts that render surfaces can be converted into. */
+typedef enum fig_pixel_format_t {
+    /* 4 bytes per pixel, in R, G, B, A order. */
+    FIG_PIXEL_FORMAT_RGBA8,
+    /* 4 bytes per pixel, in B, G, R, A order. */
+    FIG_PIXEL_FORMAT_BGRA8,
+    /* 3 bytes per pixel, in R, G, B order. Alpha is discarded. */
+    FIG_PIXEL_FORMAT_RGB8,
+    /* A native-endian 16-bit value per pixel, with 5 bits of red in the
+       highest bits, 6 bits of green and 5 bits of blue. Alpha is discarded. */
+    FIG_PIXEL_FORMAT_RGB565,
+    /* 4 bytes per pixel, in R, G, B, A order, with R, G, B multiplied by A. */
+    FIG_PIXEL_FORMAT_PREMULTIPLIED_RGBA8,
+    /* Number of pixel formats. */
+    FIG_PIXEL_FORMAT_COUNT
+} fig_pixel_format_t;
+
+/* An enumeration of ways to reorient an animation. Rotations are clockwise. */
+typedef enum fig_transform_t {
+    /* Rotate by 90 degrees. The canvas width and height are swapped. */
+    FIG_TRANSFORM_ROTATE_90,
+    /* Rotate by 180 degrees. */
+    FIG_TRANSFORM_ROTATE_180,
+    /* Rotate by 270 degrees. The canvas width and height are swapped. */
+    FIG_TRANSFORM_ROTATE_270,
+    /* Mirror the columns, so that the left edge becomes the right edge. */
+    FIG_TRANSFORM_FLIP_HORIZONTAL,
+    /* Mirror the rows, so that the top edge becomes the bottom edge. */
+    FIG_TRANSFORM_FLIP_VERTICAL,
+    /* Swap the rows and columns, mirroring across the diagonal from the top left. */
+    FIG_TRANSFORM_TRANSPOSE,
+    /* Number of transforms. */
+    FIG_TRANSFORM_COUNT
+} fig_transform_t;
+
+/* An enumeration of filters used to resample images. */
+typedef enum fig_filter_t {
+    /* Average the source pixels covered by each destination pixel.
+       Upscaling repeats pixels, like nearest neighbor sampling. */
+    FIG_FILTER_BOX,
+    /* Blend linearly between neighboring source pixels. Also known as a triangle filter. */
+    FIG_FILTER_BILINEAR,
+    /* A windowed sinc filter reaching 3 pixels out, which keeps edges sharp,
+       but can ring slightly around them. */
+    FIG_FILTER_LANCZOS3,
+    /* Number of filters. */
+    FIG_FILTER_COUNT
+} fig_filter_t;
+
+/* An enumeration of element types of exported tensors. */
+typedef enum fig_tensor_type_t {
+    /* 1 byte per element, holding the channel value from 0 to 255. */
+    FIG_TENSOR_TYPE_UINT8,
+    /* A float per element, holding the channel value scaled to 0 to 1, then normalized. */
+    FIG_TENSOR_TYPE_FLOAT32,
+    /* Number of tensor types. */
+    FIG_TENSOR_TYPE_COUNT
+} fig_tensor_type_t;
+
+/* An enumeration of element orders of exported tensors. */
+typedef enum fig_tensor_layout_t {
+    /* Frames, then channels, then rows, then columns, so that each channel is a separate plane. */
+    FIG_TENSOR_LAYOUT_NCHW,
+    /* Frames, then rows, then columns, then channels, so that the channels of a pixel are together. */
+    FIG_TENSOR_LAYOUT_NHWC,
+    /* Number of tensor layouts. */
+    FIG_TENSOR_LAYOUT_COUNT
+} fig_tensor_layout_t;
+
 /* An enumeration of possible seek origins for input/output streams. */
 typedef enum fig_seek_origin_t {
     /* Seek forward from beginning of file. */
@@ -132,6 +249,18 @@ typedef enum fig_seek_origin_t {
     FIG_SEEK_END = SEEK_END
 } fig_seek_origin_t;
 
+/* A rectangular area of the animation canvas. */
+struct fig_rect {
+    /* The position of the left edge of the area. */
+    size_t x;
+    /* The position of the top edge of the area. */
+    size_t y;
+    /* The number of columns in the area. */
+    size_t width;
+    /* The number of rows in the area. */
+    size_t height;
+};
+
 
 
 /* A collection of shared state used by the library.
@@ -162,6 +291,16 @@ void fig_state_set_error_allocation_failed(fig_state *self);
 fig_allocator_t fig_state_get_allocator(fig_state *self);
 /* Get the userdata associated with this state. */
 void *fig_state_get_userdata(fig_state *self);
+/* Set the allocator + userdata used for the blocks that hold the surfaces of
+ * every image in an animation, such as fig_animation_allocate_render_slab.
+ * These can be far larger than other allocations, so they may be placed
+ * somewhere else, such as with fig_mapped_storage_alloc.
+ * (default: the allocator + userdata of the state) */
+void fig_state_set_storage_allocator(fig_state *self, fig_allocator_t alloc, void *ud);
+/* Get the allocator function used for the surface blocks of animations. */
+fig_allocator_t fig_state_get_storage_allocator(fig_state *self);
+/* Get the userdata passed to the allocator for the surface blocks of animations. */
+void *fig_state_get_storage_userdata(fig_state *self);
 /* Free a state created with one of the fig_create_state functions. */
 void fig_state_free(fig_state *self);
 
@@ -190,7 +329,8 @@ void fig_palette_free(fig_palette *self);
 
 
 
-/* An image containing a palette-indexed surface, and a BGRA render surface. */
+/* An image containing a palette-indexed surface, and a render surface
+ * of either BGRA colors or palette indices. */
 struct fig_image;
 
 /* Create and return a new image. Returns NULL on failure. */
@@ -205,8 +345,15 @@ size_t fig_image_get_origin_y(fig_image *self);
 size_t fig_image_get_indexed_width(fig_image *self);
 /* Get the height of the image indexed data. */
 size_t fig_image_get_indexed_height(fig_image *self);
-/* Get a raw pointer to image index data. */
+/* Get a raw pointer to image index data. Rows start
+ * fig_image_get_indexed_stride bytes apart. */
 fig_uint8_t *fig_image_get_indexed_data(fig_image *self);
+/* Get the number of bytes between the start of each row of the image index data.
+ * This is the indexed width, unless the data is a view made by fig_image_attach_indexed_view. */
+size_t fig_image_get_indexed_stride(fig_image *self);
+/* Count how many pixels of the indexed data hold each palette index,
+ * and write the 256 counts into counts. */
+void fig_image_count_indices(fig_image *self, size_t *counts);
 /* Set the x position of the image index data relative to the animation canvas. */
 void fig_image_set_origin_x(fig_image *self, size_t value);
 /* Set the y position of the image index data relative to the animation canvas. */
@@ -216,17 +363,68 @@ void fig_image_set_origin_y(fig_image *self, size_t value);
  * The data must be reinitialized after resizing.
  * Returns whether the resize was successful. */
 fig_bool_t fig_image_resize_indexed(fig_image *self, size_t width, size_t height);
+/* Use storage provided by the user as the indexed surface of the image,
+ * holding width * height palette indices. The previous indexed surface is freed.
+ * If owned is true, the image frees the data with the allocator of the state.
+ * Otherwise the data stays owned by the user, and must outlive its use by the image.
+ * Resizing the indexed surface keeps the storage if the dimensions don't change.
+ * Returns whether this was successful. */
+fig_bool_t fig_image_attach_indexed(fig_image *self, fig_uint8_t *data, size_t width, size_t height, fig_bool_t owned);
+/* Use an area of a larger block of palette indices owned by the user as the
+ * indexed surface of the image, without copying it, such as a cell of a sprite sheet.
+ * The rows of the block are parent_stride bytes apart, and the area must fit
+ * within a row of the block. Several images can view the same block.
+ * The image keeps no reference to the block and never frees it, so the block
+ * must outlive the view: it can only be freed once the image is freed, or has
+ * been given another indexed surface, such as by resizing, scaling or transforming.
+ * The previous indexed surface is freed.
+ * Returns whether this was successful. */
+fig_bool_t fig_image_attach_indexed_view(fig_image *self, fig_uint8_t *parent, size_t parent_stride, const fig_rect *rect);
 /* Get the width of the image render data. */
 size_t fig_image_get_render_width(fig_image *self);
 /* Get the height of the image render data. */
 size_t fig_image_get_render_height(fig_image *self);
-/* Get a raw pointer to image BGRA color data. */
+/* Get the x position of the image render data relative to the animation canvas. */
+size_t fig_image_get_render_origin_x(fig_image *self);
+/* Get the y position of the image render data relative to the animation canvas. */
+size_t fig_image_get_render_origin_y(fig_image *self);
+/* Get the number of bytes between the start of each row of the image render data. */
+size_t fig_image_get_render_stride(fig_image *self);
+/* Get a raw pointer to image BGRA color data.
+ * Returns NULL if the render surface holds palette indices. */
 fig_uint32_t *fig_image_get_render_data(fig_image *self);
+/* Get a raw pointer to image render palette index data.
+ * Returns NULL if the render surface holds BGRA colors. */
+fig_uint8_t *fig_image_get_render_index_data(fig_image *self);
+/* Set the x position of the image render data relative to the animation canvas. */
+void fig_image_set_render_origin_x(fig_image *self, size_t value);
+/* Set the y position of the image render data relative to the animation canvas. */
+void fig_image_set_render_origin_y(fig_image *self, size_t value);
 /* Resize the render surface of the image.
  * Invalidates the render data pointer on success.
  * The data must be reinitialized after resizing.
  * Returns whether the resize was successful. */
 fig_bool_t fig_image_resize_render(fig_image *self, size_t width, size_t height);
+/* Resize the render surface of the image to hold palette indices.
+ * Invalidates the render data pointers on success.
+ * The data must be reinitialized after resizing.
+ * Returns whether the resize was successful. */
+fig_bool_t fig_image_resize_render_index(fig_image *self, size_t width, size_t height);
+/* Use storage provided by the user as the render surface of the image, holding
+ * width * height BGRA colors with stride bytes between the start of each row.
+ * The previous render surface is freed.
+ * If owned is true, the image frees the data as a block of stride * height bytes
+ * with the allocator of the state. Otherwise the data stays owned by the user,
+ * and must outlive its use by the image.
+ * Resizing the render surface keeps the storage if the dimensions don't change,
+ * so rendering writes straight into it when it matches what the render mode
+ * stores, such as the full canvas for FIG_RENDER_MODE_FULL.
+ * Returns whether this was successful. */
+fig_bool_t fig_image_attach_render(fig_image *self, fig_uint32_t *data, size_t width, size_t height, size_t stride, fig_bool_t owned);
+/* Use storage provided by the user as the render surface of the image, holding
+ * width * height palette indices with stride bytes between the start of each row.
+ * This works the same way as fig_image_attach_render otherwise. */
+fig_bool_t fig_image_attach_render_index(fig_image *self, fig_uint8_t *data, size_t width, size_t height, size_t stride, fig_bool_t owned);
 /* Get the delay to apply on this image. */
 size_t fig_image_get_delay(fig_image *self);
 /* Get the disposal to apply between this image and the next. */
@@ -243,6 +441,25 @@ void fig_image_set_disposal(fig_image *self, fig_disposal_t value);
 void fig_image_set_transparent(fig_image *self, fig_bool_t value);
 /* Set the color that should be transparent during rendering. */
 void fig_image_set_transparency_index(fig_image *self, size_t value);
+/* Get the 8 byte perceptual hash of the frame that this image shows, or NULL if none was computed.
+ * Rendering computes it when perceptual hashes are enabled on the animation. Frames that look
+ * alike have hashes that differ in few bits, as counted by fig_perceptual_hash_distance. */
+const fig_uint8_t *fig_image_get_perceptual_hash(fig_image *self);
+/* Set the 8 byte perceptual hash of the image, or remove it if hash is NULL. */
+void fig_image_set_perceptual_hash(fig_image *self, const fig_uint8_t *hash);
+/* Get the number of bits that differ between two 8 byte perceptual hashes,
+ * from 0 for frames that look the same, up to 64. */
+size_t fig_perceptual_hash_distance(const fig_uint8_t *a, const fig_uint8_t *b);
+/* Get the 8 byte content hash of the image, made by fig_animation_hash_images, or NULL if none was computed.
+ * It covers the indexed data, its position and size, the render palette, and the transparency settings,
+ * so images that are encoded the same way have the same content hash. */
+const fig_uint8_t *fig_image_get_content_hash(fig_image *self);
+/* Get the 8 byte frame hash of the image, made by fig_animation_hash_images, or NULL if none was computed.
+ * It covers the composited frame that the image shows, so images that look the same have the same
+ * frame hash, however they are encoded. */
+const fig_uint8_t *fig_image_get_frame_hash(fig_image *self);
+/* Set the 8 byte content and frame hashes of the image, or remove them if either is NULL. */
+void fig_image_set_hashes(fig_image *self, const fig_uint8_t *content_hash, const fig_uint8_t *frame_hash);
 /* Free an image created with fig_create_image. */
 void fig_image_free(fig_image *self);
 
@@ -265,10 +482,47 @@ void fig_animation_set_dimensions(fig_animation *self, size_t width, size_t heig
 size_t fig_animation_count_images(fig_animation *self);
 /* Get a raw pointer to a contiguous image array, possibly NULL. */
 fig_image **fig_animation_get_images(fig_animation *self);
-/* Get loop count of the animation. 0 = infinite looping */
+/* Get loop count of the animation. 0 = infinite looping
+ * Otherwise, this is the number of times the images repeat after they are
+ * first played, as in the GIF format, so a loop count of 1 plays them twice. */
 size_t fig_animation_get_loop_count(fig_animation *self);
 /* Set loop count of the animation. 0 = infinite looping */
 void fig_animation_set_loop_count(fig_animation *self, size_t value);
+/* Get how the render surfaces of images are stored when rendering. */
+fig_render_mode_t fig_animation_get_render_mode(fig_animation *self);
+/* Set how the render surfaces of images are stored when rendering. */
+void fig_animation_set_render_mode(fig_animation *self, fig_render_mode_t value);
+/* Get how many images apart the stored renders of FIG_RENDER_MODE_CHECKPOINT are.
+ * 0 = only keyframes are checkpoints. (default: 16) */
+size_t fig_animation_get_checkpoint_interval(fig_animation *self);
+/* Set how many images apart the stored renders of FIG_RENDER_MODE_CHECKPOINT are.
+ * 0 = only keyframes are checkpoints. */
+void fig_animation_set_checkpoint_interval(fig_animation *self, size_t value);
+/* Get how many images apart the sampled images of FIG_RENDER_MODE_SAMPLED are,
+ * starting from the first image. This is used when the sample rate is 0. (default: 1) */
+size_t fig_animation_get_sample_interval(fig_animation *self);
+/* Set how many images apart the sampled images of FIG_RENDER_MODE_SAMPLED are. 1 <= value */
+void fig_animation_set_sample_interval(fig_animation *self, size_t value);
+/* Get how many samples FIG_RENDER_MODE_SAMPLED takes every sample duration,
+ * or 0 if images are sampled every sample interval instead. (default: 0) */
+size_t fig_animation_get_sample_rate(fig_animation *self);
+/* Get the time that the sample rate is counted over, in the same units as image delays. (default: 100) */
+size_t fig_animation_get_sample_duration(fig_animation *self);
+/* Make FIG_RENDER_MODE_SAMPLED take rate samples every duration units of time,
+ * starting when the first image is shown, and keep the images showing at the sample times.
+ * GIF delays are in hundredths of a second, so a duration of 100 makes the rate
+ * frames per second. A rate of 0 samples every sample interval images instead.
+ * 1 <= duration */
+void fig_animation_set_sample_rate(fig_animation *self, size_t rate, size_t duration);
+/* Get whether rendering computes the perceptual hash of every image. (default: 0) */
+fig_bool_t fig_animation_get_perceptual_hashes(fig_animation *self);
+/* Set whether rendering computes the perceptual hash of every image.
+ * The hash is a difference hash: the canvas is divided into a grid of 9 x 8 cells,
+ * and each of the 64 bits is whether the average luminance of a cell is greater than
+ * that of the cell to its right, row by row, with the most significant bit first.
+ * The cell sums are kept while compositing, and only the area that changed since the
+ * previous image is scanned again, so this doesn't need another pass over every render. */
+void fig_animation_set_perceptual_hashes(fig_animation *self, fig_bool_t value);
 /* Exchange order of two images at the given indices. 0 <= index < size */
 void fig_animation_swap_images(fig_animation *self, size_t index_a, size_t index_b);
 /* Create and add an image to the end of the animation, and return it.
@@ -287,16 +541,360 @@ fig_image *fig_animation_insert_image(fig_animation *self, size_t index);
 void fig_animation_remove_image(fig_animation *self, size_t index);
 /* Render all the images by using their indexed data and palette to
  * generate their complete appearance. If this was succesful,
- * every image will contain a full color render surface of the result.
+ * every image will contain a full color render surface of the result,
+ * stored according to the render mode of the animation.
  * Returns whether the render was succesful. */
 fig_bool_t fig_animation_render_images(fig_animation *self);
+/* Allocate the render surfaces of every image as a single contiguous block,
+ * holding one full canvas per image, in the order of the images.
+ * The surfaces hold palette indices for FIG_RENDER_MODE_INDEX, and BGRA colors
+ * for FIG_RENDER_MODE_FULL. Other render modes don't keep a full canvas per image,
+ * so this fails for them rather than allocating memory they wouldn't use.
+ * The previous render surfaces are freed, so the images must be rendered again.
+ * Rendering writes into the block, which stays allocated until this is called
+ * again or the animation is freed. Returns whether the allocation was successful. */
+fig_bool_t fig_animation_allocate_render_slab(fig_animation *self);
+/* Get the block allocated by fig_animation_allocate_render_slab, or NULL if there is none.
+ * The render surface of the image at index i starts i * pitch bytes into it. */
+void *fig_animation_get_render_slab(fig_animation *self);
+/* Get the number of bytes between the render surfaces in the block allocated by
+ * fig_animation_allocate_render_slab. */
+size_t fig_animation_get_render_slab_pitch(fig_animation *self);
+/* Free the block allocated by fig_animation_allocate_render_slab.
+ * Images with a render surface in the block are left without a render surface. */
+void fig_animation_release_render_slab(fig_animation *self);
+/* Move the indexed data of every image into a single contiguous block,
+ * in the order of the images, with room for the largest indexed surface per image.
+ * The block stays allocated until this is called again or the animation is freed.
+ * Returns whether the allocation was successful. */
+fig_bool_t fig_animation_pack_indexed_data(fig_animation *self);
+/* Get the block allocated by fig_animation_pack_indexed_data, or NULL if there is none.
+ * The indexed data of the image at index i starts i * pitch bytes into it. */
+fig_uint8_t *fig_animation_get_indexed_slab(fig_animation *self);
+/* Get the number of bytes between the indexed surfaces in the block allocated by
+ * fig_animation_pack_indexed_data. */
+size_t fig_animation_get_indexed_slab_pitch(fig_animation *self);
+/* Scale the animation up by a whole number factor, by repeating every palette
+ * index of the indexed data of each image into a factor x factor block.
+ * The canvas dimensions and image origins are scaled to match, and the palettes
+ * and transparency are kept, so the result can be encoded again as it is.
+ * Render surfaces no longer match the indexed data, so they are freed,
+ * along with any block made by fig_animation_pack_indexed_data.
+ * Returns whether this was successful. If not, the animation is unchanged. */
+fig_bool_t fig_animation_scale(fig_animation *self, size_t factor);
+/* Rotate, flip or transpose the animation, by moving the palette indices of the
+ * indexed data of each image, along with the image origins and canvas dimensions.
+ * Like fig_animation_scale, the result can be encoded again as it is, and render
+ * surfaces and any block made by fig_animation_pack_indexed_data are freed.
+ * Every image must lie inside the canvas.
+ * Returns whether this was successful. If not, the animation is unchanged. */
+fig_bool_t fig_animation_transform(fig_animation *self, fig_transform_t transform);
+/* Get the palette index that stands for the background in the render
+ * surfaces of FIG_RENDER_MODE_INDEX. This is the first index past the end
+ * of the animation palette, or otherwise an index that no image draws.
+ * Returns 256 if every palette index is drawn by some image. */
+size_t fig_animation_get_render_background_index(fig_animation *self);
+/* Get the areas of the canvas that can differ between the render of the image
+ * before the given index and the render of this image: the area disposed after
+ * the image before it, and the area drawn by this image, each without the rows
+ * and columns that are left transparent. Areas that overlap or touch are merged.
+ * For the first image, this is the full canvas.
+ * Writes up to 2 rectangles into rects, and returns how many were written.
+ * 0 <= index < size */
+size_t fig_animation_get_dirty_rects(fig_animation *self, size_t index, fig_rect *rects);
+/* Get whether the image at the given index is a keyframe, which means it can be
+ * rendered without the render of any image before it, and the images after it
+ * don't depend on the render of any image before it either.
+ * The first image is always a keyframe. 0 <= index < size */
+fig_bool_t fig_animation_is_keyframe(fig_animation *self, size_t index);
+/* Get how many samples of FIG_RENDER_MODE_SAMPLED show the image at the given index,
+ * which is 0 if the image isn't sampled. Sampling by interval gives 0 or 1, but an
+ * image with a long delay can show at several sample times when sampling by rate.
+ * This depends on the delays of the images before it. 0 <= index < size */
+size_t fig_animation_count_samples(fig_animation *self, size_t index);
+/* Compute the content hash and frame hash of every image, which are fast 64-bit hashes
+ * meant for finding identical images, rather than cryptographic ones.
+ * The frames are composited once in order, and only the rows of the canvas that changed
+ * since the image before are hashed again. The hashes aren't updated when the animation changes.
+ * Returns whether this was successful. */
+fig_bool_t fig_animation_hash_images(fig_animation *self);
+/* Find the images that show identical frames, consecutive or not, by their frame hashes.
+ * For every image, writes the index of the first image with the same frame into firsts,
+ * which is the index of the image itself if no image before it shows the same frame.
+ * Images are hashed first with fig_animation_hash_images if any of them have no hashes.
+ * firsts holds an index for every image, and the number of distinct frames is written
+ * into distinct_count, which is 0 for an animation without images.
+ * Returns whether this was successful. */
+fig_bool_t fig_animation_find_duplicate_frames(fig_animation *self, size_t *firsts, size_t *distinct_count);
+/* Do the work that rendering needs from every image once, before any range
+ * is rendered with fig_animation_render_image_range. With FIG_RENDER_MODE_INDEX,
+ * this checks that no image has a local palette and picks the palette index
+ * used for the background, which must be picked again after the indexed data
+ * changes. Other render modes need nothing. fig_animation_render_images
+ * calls this itself. Returns whether this was successful. */
+fig_bool_t fig_animation_prepare_render(fig_animation *self);
+/* Render the images from index start up to (but not including) end,
+ * with the same result as fig_animation_render_images for those images.
+ * The image at start must be a keyframe, and fig_animation_prepare_render
+ * must have been called since the animation last changed.
+ * Ranges that don't overlap only write to their own images, and only read
+ * the rest of the animation, so the segments between keyframes can be rendered
+ * on separate threads, as long as the allocator of the state can be used
+ * concurrently. There is no worker pool in the library: creating the threads
+ * and handing out ranges is left to the caller. Errors are still set on the
+ * shared state, and setting them isn't thread-safe, so the error message
+ * can't be relied on when ranges fail in parallel, only the return values.
+ * Returns whether the render was succesful. 0 <= start <= end <= size */
+fig_bool_t fig_animation_render_image_range(fig_animation *self, size_t start, size_t end);
+/* Reconstruct the full canvas of the image at the given index into out,
+ * which must hold width * height BGRA colors.
+ * This only needs the indexed data of the images, but it replays fewer
+ * images when starting from a render surface made by fig_animation_render_images.
+ * Returns whether this was successful. 0 <= index < size */
+fig_bool_t fig_animation_get_frame_rgba(fig_animation *self, size_t index, fig_uint32_t *out);
+/* Reconstruct an area of the canvas of the image at the given index into out,
+ * which must hold area->width * area->height BGRA colors, with out_stride bytes
+ * between the start of each row. Only the parts of images inside the area are
+ * drawn, and the memory used is in proportion to the area rather than the canvas,
+ * so this can show part of a very large canvas, or render the canvas as tiles.
+ * This renders a single area: splitting the canvas into tiles is left to the caller.
+ * Areas don't depend on each other, so tiles can be rendered on separate threads,
+ * as long as the allocator of the state can be used concurrently. Errors are still
+ * set on the shared state, and setting them isn't thread-safe, so the error message
+ * can't be relied on when tiles fail in parallel, only the return values.
+ * Returns whether this was successful. 0 <= index < size */
+fig_bool_t fig_animation_get_frame_area_rgba(fig_animation *self, size_t index, const fig_rect *area, fig_uint32_t *out, size_t out_stride);
 /* Get the palette to apply for rendering the specified image in the animation. */
 fig_palette *fig_animation_get_render_palette(fig_animation *self, fig_image *image);
+/* Convert the render surface of an image in the animation into out, which
+ * holds a full canvas of pixels in the given format, with out_stride bytes
+ * between the start of each row. Only the area covered by the render surface
+ * is written, at its render origin, so converting the images of
+ * FIG_RENDER_MODE_DELTA in order into the same buffer produces every frame.
+ * Render surfaces of palette indices are converted straight from the
+ * animation palette, without expanding them into BGRA colors first. */
+void fig_animation_convert_render(fig_animation *self, fig_image *image, void *out, size_t out_stride, fig_pixel_format_t format);
+/* Convert the render surface of palette indices of an image like
+ * fig_animation_convert_render, but look the colors up in the given palette
+ * instead of the animation palette, for palette swaps and color cycling.
+ * If area is not NULL, only the part of the surface inside that canvas
+ * area is written, such as a dirty rect of the frame. This is a single table
+ * lookup per pixel, with no compositing, so the images only need to be
+ * rendered once with FIG_RENDER_MODE_INDEX.
+ * Returns whether this was successful. */
+fig_bool_t fig_animation_convert_render_palette(fig_animation *self, fig_image *image, fig_palette *palette, const fig_rect *area, void *out, size_t out_stride, fig_pixel_format_t format);
 /* Free an animation created with fig_create_animation. */
 void fig_animation_free(fig_animation *self);
 
 
 
+/* A playback position within an animation, which keeps a single canvas
+ * with the appearance of the current image. Moving to the next image only
+ * redraws the area that changed, so the animation doesn't need any render
+ * surfaces. Time is measured in the same units as image delays.
+ * The animation must outlive the player, and must not be modified while
+ * it is being played. */
+struct fig_player;
+
+/* Create and return a player showing the first image of the animation.
+ * Returns NULL on failure. */
+fig_player *fig_create_player(fig_state *state, fig_animation *animation);
+/* Get a raw pointer to the BGRA color data of the canvas, which is
+ * the size of the animation canvas. */
+const fig_uint32_t *fig_player_get_canvas(fig_player *self);
+/* Get the index of the image that is currently shown. */
+size_t fig_player_get_image_index(fig_player *self);
+/* Get how many times playback has looped back to the first image. */
+size_t fig_player_get_loop_index(fig_player *self);
+/* Get the time at which the current image started being shown. */
+size_t fig_player_get_time(fig_player *self);
+/* Move to the next image, looping back to the first image
+ * as allowed by the loop count of the animation. The images are played
+ * one more time than the loop count, or forever if it is 0.
+ * Returns 0 if playback is finished, and the last image stays shown. */
+fig_bool_t fig_player_advance(fig_player *self);
+/* Move to the image shown at the given time since playback started,
+ * taking image delays and looping into account like fig_player_advance.
+ * If the animation has no delays at all, the last image is shown at any time,
+ * and playback is finished unless the animation loops forever.
+ * Returns 0 if playback is finished by that time, and the last image is shown. */
+fig_bool_t fig_player_seek_time(fig_player *self, size_t time);
+/* Free a player created with fig_create_player. */
+void fig_player_free(fig_player *self);
+
+
+
+/* A single texture holding every distinct frame of an animation, trimmed to the
+ * area that isn't transparent, along with where and for how long each frame is drawn. */
+struct fig_atlas;
+
+/* Where a frame of an animation is stored in an atlas. */
+struct fig_atlas_frame {
+    /* The area of the atlas holding the frame. This is empty if the whole frame
+       is transparent, and identical frames share the same area. */
+    fig_rect source;
+    /* The position on the canvas where the top left corner of the area is drawn. */
+    size_t x;
+    size_t y;
+    /* The delay of the image that the frame shows. */
+    size_t delay;
+};
+
+/* Options that control how an atlas is packed. */
+struct fig_atlas_options {
+    /* Whether the atlas holds palette indices instead of BGRA colors. (default: 0)
+     * This reads the render surfaces of an animation rendered with FIG_RENDER_MODE_INDEX,
+     * and transparent parts of the atlas hold its render background index. */
+    fig_bool_t indexed;
+    /* The widest the atlas can be, or 0 to pick a width that keeps it roughly square. (default: 0) */
+    size_t max_width;
+    /* The number of transparent pixels left between frames. (default: 0) */
+    size_t padding;
+};
+
+/* Initialize atlas options to their default values. */
+void fig_init_atlas_options(fig_atlas_options *options);
+/* Create and return an empty atlas. Returns NULL on failure. */
+fig_atlas *fig_create_atlas(fig_state *state);
+/* Pack every frame of the animation into the atlas, replacing what it held before.
+ * Each frame is composited, trimmed to the bounds of its pixels that aren't transparent,
+ * and only stored once if other frames are identical to it. The frames are placed
+ * tallest first with a skyline packer.
+ * Returns whether this was successful. If not, the atlas is unchanged. */
+fig_bool_t fig_atlas_pack(fig_atlas *self, fig_animation *animation, const fig_atlas_options *options);
+/* Get the width of the atlas. */
+size_t fig_atlas_get_width(fig_atlas *self);
+/* Get the height of the atlas. */
+size_t fig_atlas_get_height(fig_atlas *self);
+/* Get a raw pointer to the BGRA color data of the atlas, with width * height colors,
+ * or NULL if the atlas holds palette indices. */
+fig_uint32_t *fig_atlas_get_data(fig_atlas *self);
+/* Get a raw pointer to the palette indices of the atlas, with width * height indices,
+ * or NULL if the atlas holds BGRA colors. */
+fig_uint8_t *fig_atlas_get_index_data(fig_atlas *self);
+/* Get the number of distinct frames stored in the atlas. */
+size_t fig_atlas_count_sprites(fig_atlas *self);
+/* Get the number of frames, which is the number of images of the packed animation. */
+size_t fig_atlas_count_frames(fig_atlas *self);
+/* Get a raw pointer to the frames, in the order of the images of the packed animation. */
+fig_atlas_frame *fig_atlas_get_frames(fig_atlas *self);
+/* Free an atlas created with fig_create_atlas. */
+void fig_atlas_free(fig_atlas *self);
+
+
+
+/* A resize of BGRA images from one size to another, with the filter weights
+ * of every row and column computed once, so that it can be reused for every frame. */
+struct fig_resampler;
+
+/* Create and return a resampler from images of src_width x src_height to
+ * dest_width x dest_height, using the given filter. Each axis is scaled independently.
+ * Colors are filtered with premultiplied alpha, so transparent pixels don't bleed into their neighbors.
+ * Returns NULL on failure. */
+fig_resampler *fig_create_resampler(fig_state *state, size_t src_width, size_t src_height, size_t dest_width, size_t dest_height, fig_filter_t filter);
+/* Get the width of images that the resampler reads. */
+size_t fig_resampler_get_src_width(fig_resampler *self);
+/* Get the height of images that the resampler reads. */
+size_t fig_resampler_get_src_height(fig_resampler *self);
+/* Get the width of images that the resampler writes. */
+size_t fig_resampler_get_dest_width(fig_resampler *self);
+/* Get the height of images that the resampler writes. */
+size_t fig_resampler_get_dest_height(fig_resampler *self);
+/* Resample the BGRA colors in src into dest. src_stride and dest_stride are
+ * the number of bytes between the start of each row of src and dest.
+ * Returns whether this was successful. */
+fig_bool_t fig_resampler_resample(fig_resampler *self, const fig_uint32_t *src, size_t src_stride, fig_uint32_t *dest, size_t dest_stride);
+/* Resample only the destination rows in the range [start, end). Ranges don't depend
+ * on each other, so an image can be split into bands that are resampled in parallel,
+ * as long as the allocator of the state can be used concurrently.
+ * Returns whether this was successful. 0 <= start <= end <= destination height */
+fig_bool_t fig_resampler_resample_rows(fig_resampler *self, const fig_uint32_t *src, size_t src_stride, fig_uint32_t *dest, size_t dest_stride, size_t start, size_t end);
+/* Resample the full canvas of the image at the given index into out, which must hold
+ * the destination width * height BGRA colors, with out_stride bytes between the start of each row.
+ * The source size of the resampler must match the canvas of the animation.
+ * A render surface made with FIG_RENDER_MODE_FULL is read directly, and otherwise the frame
+ * is reconstructed like fig_animation_get_frame_rgba.
+ * Returns whether this was successful. 0 <= index < size */
+fig_bool_t fig_animation_resample_frame(fig_animation *self, size_t index, fig_resampler *resampler, fig_uint32_t *out, size_t out_stride);
+/* Free a resampler created with fig_create_resampler. */
+void fig_resampler_free(fig_resampler *self);
+
+
+
+/* Options that control how frames are exported into a tensor. */
+struct fig_tensor_options {
+    /* The type of each element. (default: FIG_TENSOR_TYPE_UINT8) */
+    fig_tensor_type_t type;
+    /* The order of the elements. (default: FIG_TENSOR_LAYOUT_NCHW) */
+    fig_tensor_layout_t layout;
+    /* The number of channels, either 3 for R, G, B, or 4 for R, G, B, A. (default: 3)
+     * Colors aren't premultiplied, and transparent pixels are 0 in every channel. */
+    size_t channels;
+    /* The width and height of each frame, or 0 to use the canvas size. (default: 0) */
+    size_t width;
+    size_t height;
+    /* The filter used when the frame size differs from the canvas. (default: FIG_FILTER_BILINEAR) */
+    fig_filter_t filter;
+    /* Each channel of FIG_TENSOR_TYPE_FLOAT32 is written as (value / 255 - mean) / std,
+     * in the same order as the channels. (default: 0 mean, 1 std) */
+    float mean[4];
+    float std[4];
+};
+
+/* Initialize tensor options to their default values. */
+void fig_init_tensor_options(fig_tensor_options *options);
+/* Get the number of bytes needed to export count frames of the animation with the given options,
+ * or 0 if that doesn't fit in a size_t, or the options don't have 3 or 4 channels. */
+size_t fig_get_tensor_size(fig_animation *animation, size_t count, const fig_tensor_options *options);
+/* Export the frames of the images at the given indices of the animation into out, which must hold
+ * fig_get_tensor_size(animation, count, options) bytes, in order. If indices is NULL, the first count images are exported.
+ * Render surfaces of palette indices covering the canvas are read through a table made from the animation
+ * palette, and BGRA render surfaces covering the canvas are read directly, so exporting the images
+ * sampled by FIG_RENDER_MODE_SAMPLED needs no compositing. Other frames are reconstructed
+ * like fig_animation_get_frame_rgba, and frames of a different size are resampled first.
+ * Returns whether this was successful. */
+fig_bool_t fig_export_tensor(fig_state *state, void *out, fig_animation *animation, const size_t *indices, size_t count, const fig_tensor_options *options);
+
+
+
+/* A count of the colors drawn by images, gathered from their indexed data
+ * and render palettes, without reading any render surfaces. */
+struct fig_histogram;
+
+/* The number of pixels of a color in a histogram. */
+struct fig_color_count {
+    fig_uint32_t color;
+    size_t count;
+};
+
+/* Create and return an empty histogram. Returns NULL on failure. */
+fig_histogram *fig_create_histogram(fig_state *state);
+/* Remove every count from the histogram, keeping its storage. */
+void fig_histogram_clear(fig_histogram *self);
+/* Count the pixels drawn by an image of the animation. Each palette index of the
+ * indexed data is counted once, then looked up in the render palette of the image,
+ * so colors shared by several indices or palettes are merged. This counts the pixels
+ * of the image itself, rather than the composited frame.
+ * Returns whether this was successful. If not, the histogram is unchanged. */
+fig_bool_t fig_histogram_add_image(fig_histogram *self, fig_animation *animation, fig_image *image);
+/* Count the pixels drawn by every image of the animation.
+ * Returns whether this was successful. If not, only some images were counted. */
+fig_bool_t fig_histogram_add_animation(fig_histogram *self, fig_animation *animation);
+/* Get the number of pixels counted. */
+size_t fig_histogram_count_pixels(fig_histogram *self);
+/* Get the number of pixels counted that are transparent, because they hold the
+ * transparency index, or an index past the end of the palette. */
+size_t fig_histogram_count_transparent(fig_histogram *self);
+/* Get the number of distinct colors of the pixels that aren't transparent. */
+size_t fig_histogram_count_colors(fig_histogram *self);
+/* Get a raw pointer to the distinct colors and their counts, most common first,
+ * with colors of the same count in increasing order. */
+fig_color_count *fig_histogram_get_colors(fig_histogram *self);
+/* Free a histogram created with fig_create_histogram. */
+void fig_histogram_free(fig_histogram *self);
+
+
+
 /* A input stream used for reading binary data. */
 struct fig_input;
 
@@ -391,9 +989,41 @@ void fig_output_free(fig_output *self);
 
 
 
+/* Options that control what work is done while loading an animation. */
+struct fig_load_options {
+    /* Whether to render every image after loading. (default: 1)
+     * When this is 0, only indexed data is loaded, and images have no render
+     * surface until fig_animation_render_images is called on the animation.
+     * This avoids a full-canvas allocation and compositing pass per image,
+     * for callers that only need the indexed data (eg. re-encoding). */
+    fig_bool_t render_images;
+    /* How render surfaces are stored when rendering. (default: FIG_RENDER_MODE_FULL) */
+    fig_render_mode_t render_mode;
+    /* Whether to allocate every render surface as one block before rendering,
+     * with fig_animation_allocate_render_slab. This is ignored unless the render
+     * mode is FIG_RENDER_MODE_FULL or FIG_RENDER_MODE_INDEX. (default: 0) */
+    fig_bool_t contiguous_render;
+    /* Whether to move all indexed data into one block after loading,
+     * with fig_animation_pack_indexed_data. (default: 0) */
+    fig_bool_t contiguous_indexed;
+    /* Whether rendering computes the perceptual hash of every image,
+     * with fig_animation_set_perceptual_hashes. (default: 0) */
+    fig_bool_t perceptual_hashes;
+};
+
+/* Initialize load options to their default values. */
+void fig_init_load_options(fig_load_options *options);
+
+
+
 /* GIF format support */
 #ifdef FIG_LOAD_GIF
+/* Load a GIF animation with the default load options. Returns NULL on failure.
+ * Unlike fig_load_gif_with_options, a failure to render the images doesn't fail
+ * the load: the animation is still returned, with the error set on the state. */
 fig_animation *fig_load_gif(fig_state *state, fig_input *input);
+/* Load a GIF animation with the given load options. Returns NULL on failure. */
+fig_animation *fig_load_gif_with_options(fig_state *state, fig_input *input, const fig_load_options *options);
 #endif
 #ifdef FIG_SAVE_GIF
 fig_bool_t fig_save_gif(fig_state *state, fig_output *output, fig_animation *animation);
@@ -406,6 +1036,22 @@ fig_bool_t fig_save_gif(fig_state *state, fig_output *output, fig_animation *ani
 fig_uint32_t fig_pack_color(fig_uint8_t r, fig_uint8_t g, fig_uint8_t b, fig_uint8_t a);
 /* Extracts the r, g, b, a components of the given 32-bit BGRA color. */
 void fig_unpack_color(fig_uint32_t color, fig_uint8_t *r, fig_uint8_t *g, fig_uint8_t *b, fig_uint8_t *a);
+#ifdef FIG_MAPPED_STORAGE
+/* An allocator that places each allocation in its own temporary file mapped into memory,
+ * so that its pages are written out to disk rather than using memory when needed.
+ * The file is removed once it is freed or the process exits. The userdata is unused.
+ * This is meant for fig_state_set_storage_allocator, for animations too large for memory. */
+void *fig_mapped_storage_alloc(void *ud, void *ptr, size_t old_size, size_t new_size);
+#endif
+/* Returns the number of bytes used by a single pixel of the given format. */
+size_t fig_pixel_format_get_size(fig_pixel_format_t format);
+/* Convert a width * height area of BGRA colors into pixels of the given format.
+ * The strides are the number of bytes between the start of each row. */
+void fig_convert_colors(const fig_uint32_t *src, size_t src_stride, void *dest, size_t dest_stride, size_t width, size_t height, fig_pixel_format_t format);
+/* Convert a width * height area of palette indices into pixels of the given format,
+ * by looking up each index in colors. Indices past color_count become transparent black.
+ * The strides are the number of bytes between the start of each row. */
+void fig_convert_indices(const fig_uint8_t *src, size_t src_stride, const fig_uint32_t *colors, size_t color_count, void *dest, size_t dest_stride, size_t width, size_t height, fig_pixel_format_t format);
 
 
 
@@ -414,6 +1060,8 @@ void fig_unpack_color(fig_uint32_t color, fig_uint8_t *r, fig_uint8_t *g, fig_ui
 #endif
 
 #ifdef FIG_IMPLEMENTATION
+#include <math.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -427,6 +1075,21 @@ struct fig_animation {
     size_t image_capacity;
     fig_image **image_data;
     size_t loop_count;
+    fig_render_mode_t render_mode;
+    size_t checkpoint_interval;
+    size_t sample_interval;
+    size_t sample_rate;
+    size_t sample_duration;
+    fig_bool_t perceptual_hashes;
+    /* Blocks holding the surfaces of every image, or NULL if not allocated. */
+    void *render_slab;
+    size_t render_slab_pitch;
+    size_t render_slab_count;
+    fig_uint8_t *indexed_slab;
+    size_t indexed_slab_pitch;
+    size_t indexed_slab_count;
+    /* The background index of the last palette index render, or 256 if none. */
+    size_t render_background_index;
 };
 
 fig_animation *fig_create_animation(fig_state *state) {
@@ -441,6 +1104,19 @@ fig_animation *fig_create_animation(fig_state *state) {
             self->image_capacity = 0;
             self->image_data = NULL;
             self->loop_count = 0;
+            self->render_mode = FIG_RENDER_MODE_FULL;
+            self->checkpoint_interval = 16;
+            self->sample_interval = 1;
+            self->sample_rate = 0;
+            self->sample_duration = 100;
+            self->perceptual_hashes = 0;
+            self->render_slab = NULL;
+            self->render_slab_pitch = 0;
+            self->render_slab_count = 0;
+            self->indexed_slab = NULL;
+            self->indexed_slab_pitch = 0;
+            self->indexed_slab_count = 0;
+            self->render_background_index = 256;
 
             if(self->palette == NULL) {
                 return fig_animation_free(self), NULL;
@@ -486,6 +1162,54 @@ void fig_animation_set_loop_count(fig_animation *self, size_t value) {
     self->loop_count = value;
 }
 
+fig_render_mode_t fig_animation_get_render_mode(fig_animation *self) {
+    return self->render_mode;
+}
+
+void fig_animation_set_render_mode(fig_animation *self, fig_render_mode_t value) {
+    FIG_ASSERT(value < FIG_RENDER_MODE_COUNT);
+    self->render_mode = value;
+}
+
+size_t fig_animation_get_checkpoint_interval(fig_animation *self) {
+    return self->checkpoint_interval;
+}
+
+void fig_animation_set_checkpoint_interval(fig_animation *self, size_t value) {
+    self->checkpoint_interval = value;
+}
+
+size_t fig_animation_get_sample_interval(fig_animation *self) {
+    return self->sample_interval;
+}
+
+void fig_animation_set_sample_interval(fig_animation *self, size_t value) {
+    FIG_ASSERT(value >= 1);
+    self->sample_interval = value;
+}
+
+size_t fig_animation_get_sample_rate(fig_animation *self) {
+    return self->sample_rate;
+}
+
+size_t fig_animation_get_sample_duration(fig_animation *self) {
+    return self->sample_duration;
+}
+
+void fig_animation_set_sample_rate(fig_animation *self, size_t rate, size_t duration) {
+    FIG_ASSERT(duration >= 1);
+    self->sample_rate = rate;
+    self->sample_duration = duration;
+}
+
+fig_bool_t fig_animation_get_perceptual_hashes(fig_animation *self) {
+    return self->perceptual_hashes;
+}
+
+void fig_animation_set_perceptual_hashes(fig_animation *self, fig_bool_t value) {
+    self->perceptual_hashes = value;
+}
+
 void fig_animation_swap_images(fig_animation *self, size_t index_a, size_t index_b) {
     fig_image *temp;
     FIG_ASSERT(index_a < self->image_count);
@@ -555,201 +1279,2930 @@ void fig_animation_remove_image(fig_animation *self, size_t index) {
     --self->image_count;
 }
 
-static void fig_clear_image_(fig_animation *self, fig_image *image) {
+static fig_rect fig_get_canvas_rect_(fig_animation *self) {
+    fig_rect rect;
+    rect.x = 0;
+    rect.y = 0;
+    rect.width = self->width;
+    rect.height = self->height;
+    return rect;
+}
+
+static fig_rect fig_get_image_rect_(fig_animation *self, fig_image *image) {
+    fig_rect rect;
+    rect.x = fig_image_get_origin_x(image);
+    rect.y = fig_image_get_origin_y(image);
+    rect.width = fig_image_get_indexed_width(image);
+    rect.height = fig_image_get_indexed_height(image);
+
+    if(rect.x >= self->width || rect.y >= self->height) {
+        rect.x = rect.y = rect.width = rect.height = 0;
+    } else {
+        if(rect.width > self->width - rect.x) {
+            rect.width = self->width - rect.x;
+        }
+        if(rect.height > self->height - rect.y) {
+            rect.height = self->height - rect.y;
+        }
+    }
+    return rect;
+}
+
+static fig_bool_t fig_rect_is_empty_(const fig_rect *rect) {
+    return rect->width == 0 || rect->height == 0;
+}
+
+static void fig_rect_union_(fig_rect *rect, const fig_rect *other) {
+    if(fig_rect_is_empty_(other)) {
+        return;
+    } else if(fig_rect_is_empty_(rect)) {
+        *rect = *other;
+    } else {
+        size_t right = rect->x + rect->width;
+        size_t bottom = rect->y + rect->height;
+        if(other->x + other->width > right) {
+            right = other->x + other->width;
+        }
+        if(other->y + other->height > bottom) {
+            bottom = other->y + other->height;
+        }
+        if(other->x < rect->x) {
+            rect->x = other->x;
+        }
+        if(other->y < rect->y) {
+            rect->y = other->y;
+        }
+        rect->width = right - rect->x;
+        rect->height = bottom - rect->y;
+    }
+}
+
+static fig_rect fig_rect_intersect_(const fig_rect *rect, const fig_rect *other) {
+    fig_rect result;
+    size_t right = rect->x + rect->width;
+    size_t bottom = rect->y + rect->height;
+
+    if(other->x + other->width < right) {
+        right = other->x + other->width;
+    }
+    if(other->y + other->height < bottom) {
+        bottom = other->y + other->height;
+    }
+    result.x = rect->x > other->x ? rect->x : other->x;
+    result.y = rect->y > other->y ? rect->y : other->y;
+    if(result.x >= right || result.y >= bottom) {
+        result.x = result.y = result.width = result.height = 0;
+    } else {
+        result.width = right - result.x;
+        result.height = bottom - result.y;
+    }
+    return result;
+}
+
+/* Copy a rectangle of pixels between two canvas-sized surfaces.
+ * The pitches are the number of pixels between the start of each row. */
+static void fig_copy_canvas_rect_(fig_uint32_t *dest, size_t dest_pitch, const fig_uint32_t *src, size_t src_pitch, const fig_rect *rect) {
     size_t i;
-    size_t size;
-    fig_uint32_t color;
-    fig_uint32_t *render_data;
 
-    size = fig_image_get_render_width(image) * fig_image_get_render_height(image);
-    color = 0;
-    render_data = fig_image_get_render_data(image);
-    for(i = 0; i < size; ++i) {
-        render_data[i] = color;
+    dest += rect->y * dest_pitch + rect->x;
+    src += rect->y * src_pitch + rect->x;
+    for(i = 0; i < rect->height; ++i) {
+        memcpy(dest, src, sizeof(fig_uint32_t) * rect->width);
+        dest += dest_pitch;
+        src += src_pitch;
     }
 }
 
-static void fig_dispose_indexed_(fig_animation *self, fig_image *prev, fig_image *cur, fig_image *next) {
-    size_t cur_x, cur_y, cur_w, cur_h;
-    fig_bool_t cur_transparent;
-    size_t cur_transparency_index;
-    fig_uint8_t *cur_index_data;
-    fig_uint32_t *next_render_data;
-    fig_disposal_t disposal;
+/* Get the number of pixels between the start of each row of an image render surface. */
+static size_t fig_get_render_pitch_(fig_image *image) {
+    if(fig_image_get_render_data(image) != NULL) {
+        return fig_image_get_render_stride(image) / sizeof(fig_uint32_t);
+    } else {
+        return fig_image_get_render_stride(image);
+    }
+}
 
-    cur_x = fig_image_get_origin_x(cur);
-    cur_y = fig_image_get_origin_y(cur);
-    cur_w = fig_image_get_indexed_width(cur);
-    cur_h = fig_image_get_indexed_height(cur);
-    cur_transparent = fig_image_get_transparent(cur);
-    cur_transparency_index = fig_image_get_transparency_index(cur);
-    cur_index_data = fig_image_get_indexed_data(cur);
-    next_render_data = fig_image_get_render_data(next);
-    disposal = fig_image_get_disposal(cur);
+/* Whether drawing this image replaces every pixel of the canvas,
+ * so that nothing drawn before it can show through. */
+static fig_bool_t fig_image_covers_canvas_(fig_animation *self, fig_image *image) {
+    return !fig_image_get_transparent(image)
+        && fig_image_get_origin_x(image) == 0
+        && fig_image_get_origin_y(image) == 0
+        && fig_image_get_indexed_width(image) == self->width
+        && fig_image_get_indexed_height(image) == self->height;
+}
 
-    switch(disposal) {
-        case FIG_DISPOSAL_BACKGROUND: {
-            size_t i, j;
-            for(i = 0; i < cur_h; ++i) {
-                for(j = 0; j < cur_w; ++j) {
-                    if(!cur_transparent || cur_index_data[i * cur_w + j] != cur_transparency_index) {
-                        size_t k = (cur_y + i) * self->width + (cur_x + j);
-                        next_render_data[k] = 0;
-                    }
-                }
+/* Get the smallest area of the canvas that contains every pixel
+ * that the given image draws, skipping rows and columns that it leaves transparent. */
+static fig_rect fig_get_opaque_rect_(fig_animation *self, fig_image *image) {
+    fig_rect rect = fig_get_image_rect_(self, image);
+    size_t transparency_index = fig_image_get_transparency_index(image);
+    const fig_uint8_t *index_data;
+    size_t pitch;
+    size_t left, right, top, bottom;
+    size_t i, j;
+
+    if(!fig_image_get_transparent(image) || transparency_index >= 256 || fig_rect_is_empty_(&rect)) {
+        return rect;
+    }
+
+    pitch = fig_image_get_indexed_stride(image);
+    index_data = fig_image_get_indexed_data(image);
+    left = rect.width;
+    right = 0;
+    top = rect.height;
+    bottom = 0;
+    for(i = 0; i < rect.height; ++i) {
+        const fig_uint8_t *row = index_data + i * pitch;
+        for(j = 0; j < rect.width; ++j) {
+            if(row[j] != transparency_index) {
+                break;
             }
-            break;
         }
-        case FIG_DISPOSAL_PREVIOUS: {
-            size_t i, j;
-            fig_uint32_t *prev_render_data;
-
-            prev_render_data = prev != NULL ? fig_image_get_render_data(prev) : NULL;
-            
-            for(i = 0; i < cur_h; ++i) {
-                for(j = 0; j < cur_w; ++j) {
-                    if(!cur_transparent || cur_index_data[i * cur_w + j] != cur_transparency_index) {
-                        size_t k = (cur_y + i) * self->width + (cur_x + j);
-                        next_render_data[k] = prev != NULL ? prev_render_data[k] : 0;
-                    }
-                }
+        if(j == rect.width) {
+            continue;
+        }
+        if(j < left) {
+            left = j;
+        }
+        for(j = rect.width; j > right; --j) {
+            if(row[j - 1] != transparency_index) {
+                right = j;
+                break;
             }
-            break;
         }
-        case FIG_DISPOSAL_UNSPECIFIED:
-        case FIG_DISPOSAL_NONE:
-        default:
-            break;
+        if(i < top) {
+            top = i;
+        }
+        bottom = i + 1;
+    }
+
+    if(top >= bottom) {
+        rect.width = rect.height = 0;
+    } else {
+        rect.x += left;
+        rect.y += top;
+        rect.width = right - left;
+        rect.height = bottom - top;
     }
+    return rect;
 }
 
-static void fig_blit_indexed_(fig_animation *self, fig_image *image) {
-    fig_palette *palette;
+/* Get the area of the canvas that is changed by disposing the given image. */
+static fig_rect fig_get_disposal_rect_(fig_animation *self, fig_image *image) {
+    switch(fig_image_get_disposal(image)) {
+        case FIG_DISPOSAL_BACKGROUND:
+        case FIG_DISPOSAL_PREVIOUS:
+            return fig_get_image_rect_(self, image);
+        default: {
+            fig_rect rect;
+            rect.x = rect.y = rect.width = rect.height = 0;
+            return rect;
+        }
+    }
+}
+
+/* Get the area of the canvas that may change when the current image is disposed and the next one is drawn.
+ * If nothing was drawn yet, this is the full canvas. */
+static fig_rect fig_get_draw_rect_(fig_animation *self, fig_image *cur, fig_image *next) {
+    fig_rect rect;
+    fig_rect image_rect;
+
+    if(cur == NULL) {
+        return fig_get_canvas_rect_(self);
+    }
+    rect = fig_get_disposal_rect_(self, cur);
+    image_rect = fig_get_image_rect_(self, next);
+    fig_rect_union_(&rect, &image_rect);
+    return rect;
+}
+
+/* Apply the disposal of an image to the canvas.
+ * The restore surface is the render of the most recent image that
+ * was not disposed, or NULL if there is no such image.
+ * Both surfaces hold the given area of the canvas, starting at its top-left corner.
+ * The pitches are the number of pixels between the start of each row. */
+static void fig_dispose_indexed_(fig_animation *self, fig_image *image, const fig_rect *area, fig_uint32_t *canvas, size_t canvas_pitch, const fig_uint32_t *restore, size_t restore_pitch) {
+    fig_rect rect;
     size_t x, y, w, h;
+    size_t pitch;
     fig_bool_t transparent;
     size_t transparency_index;
     fig_uint8_t *index_data;
-    fig_uint32_t *render_data;
+    fig_disposal_t disposal;
     size_t i, j;
 
-    palette = fig_animation_get_render_palette(self, image);
-    x = fig_image_get_origin_x(image);
-    y = fig_image_get_origin_y(image);
-    w = fig_image_get_indexed_width(image);
-    h = fig_image_get_indexed_height(image);
+    disposal = fig_image_get_disposal(image);
+    if(disposal != FIG_DISPOSAL_BACKGROUND && disposal != FIG_DISPOSAL_PREVIOUS) {
+        return;
+    }
+    if(disposal == FIG_DISPOSAL_PREVIOUS && restore == NULL) {
+        disposal = FIG_DISPOSAL_BACKGROUND;
+    }
+
+    /* Clip to the canvas and the area once, so that the row loops don't need bounds checks. */
+    rect = fig_get_image_rect_(self, image);
+    rect = fig_rect_intersect_(&rect, area);
+    if(fig_rect_is_empty_(&rect)) {
+        return;
+    }
+    x = rect.x - area->x;
+    y = rect.y - area->y;
+    w = rect.width;
+    h = rect.height;
+    pitch = fig_image_get_indexed_stride(image);
     transparent = fig_image_get_transparent(image);
     transparency_index = fig_image_get_transparency_index(image);
-    index_data = fig_image_get_indexed_data(image);
-    render_data = fig_image_get_render_data(image);
+    index_data = fig_image_get_indexed_data(image)
+        + (rect.y - fig_image_get_origin_y(image)) * pitch
+        + (rect.x - fig_image_get_origin_x(image));
+    canvas += y * canvas_pitch + x;
+    if(restore != NULL) {
+        restore += y * restore_pitch + x;
+    }
 
     for(i = 0; i < h; ++i) {
-        for(j = 0; j < w; ++j) {
-            fig_uint8_t index = index_data[i * w + j];
+        const fig_uint8_t *src = index_data;
+        fig_uint32_t *dest = canvas;
 
-            if(!transparent || index != transparency_index) {
-                size_t k = (y + i) * self->width + (x + j);
-                render_data[k] = fig_palette_get(palette, index);
+        if(disposal == FIG_DISPOSAL_BACKGROUND) {
+            for(j = 0; j < w; ++j) {
+                if(!transparent || src[j] != transparency_index) {
+                    dest[j] = 0;
+                }
+            }
+        } else {
+            const fig_uint32_t *prev = restore;
+            for(j = 0; j < w; ++j) {
+                if(!transparent || src[j] != transparency_index) {
+                    dest[j] = prev[j];
+                }
             }
+            restore += restore_pitch;
         }
+
+        index_data += pitch;
+        canvas += canvas_pitch;
     }
 }
 
-fig_bool_t fig_animation_render_images(fig_animation *self) {
-    fig_image **images;
-    size_t image_count;
-    fig_image *prev;
-    fig_image *cur;
-    fig_image *next;
-    fig_disposal_t disposal;
+/* A color lookup table for drawing indexed data with a particular palette.
+ * Transparent indices have a color of 0 and a keep mask of all ones,
+ * so that a pixel can be composited as (dest & keep) | color. */
+typedef struct {
+    fig_uint32_t colors[256];
+    fig_uint32_t keep[256];
+    fig_bool_t transparent;
+} fig_render_lut_;
+
+static void fig_build_render_lut_(fig_animation *self, fig_image *image, fig_render_lut_ *lut) {
+    fig_palette *palette;
+    fig_uint32_t *palette_colors;
+    size_t palette_size;
     size_t i;
 
-    images = self->image_data;
-    image_count = self->image_count;
-    prev = NULL;
-    cur = NULL;
-    next = NULL;
+    palette = fig_animation_get_render_palette(self, image);
+    palette_colors = fig_palette_get_colors(palette);
+    palette_size = fig_palette_count_colors(palette);
+    if(palette_size > 256) {
+        palette_size = 256;
+    }
 
-    if(self->width == 0 && self->height == 0) {
-        fig_state_set_error(self->state, "image is empty");
-        return 0;
+    for(i = 0; i < palette_size; ++i) {
+        lut->colors[i] = palette_colors[i];
+        lut->keep[i] = 0;
+    }
+    for(; i < 256; ++i) {
+        lut->colors[i] = 0;
+        lut->keep[i] = 0;
     }
 
-    for(i = 0; i < image_count; ++i) {
-        next = images[i];
-        if(fig_image_get_render_width(next) != self->width
-        || fig_image_get_render_height(next) != self->height) {
-            if(!fig_image_resize_render(next, self->width, self->height)) {
-                return 0;
-            }
-        }
+    lut->transparent = fig_image_get_transparent(image)
+        && fig_image_get_transparency_index(image) < 256;
+    if(lut->transparent) {
+        size_t transparency_index = fig_image_get_transparency_index(image);
+        lut->colors[transparency_index] = 0;
+        lut->keep[transparency_index] = 0xFFFFFFFF;
+    }
+}
+
+/* Draw an image onto a canvas holding the given area of the full canvas. */
+static void fig_blit_indexed_(fig_animation *self, fig_image *image, const fig_rect *area, fig_uint32_t *canvas, size_t canvas_pitch) {
+    fig_render_lut_ lut;
+    fig_rect rect;
+    size_t x, y, w, h;
+    size_t pitch;
+    fig_uint8_t *index_data;
+    fig_uint32_t *render_data;
+    size_t i, j;
+
+    rect = fig_get_image_rect_(self, image);
+    rect = fig_rect_intersect_(&rect, area);
+    if(fig_rect_is_empty_(&rect)) {
+        return;
+    }
+    fig_build_render_lut_(self, image, &lut);
+    x = rect.x - area->x;
+    y = rect.y - area->y;
+    w = rect.width;
+    h = rect.height;
+    pitch = fig_image_get_indexed_stride(image);
+    index_data = fig_image_get_indexed_data(image)
+        + (rect.y - fig_image_get_origin_y(image)) * pitch
+        + (rect.x - fig_image_get_origin_x(image));
+    render_data = canvas + y * canvas_pitch + x;
+
+    for(i = 0; i < h; ++i) {
+        const fig_uint8_t *src = index_data;
+        fig_uint32_t *dest = render_data;
 
-        if(cur == NULL) {
-            fig_clear_image_(self, next);
+        if(lut.transparent) {
+            for(j = 0; j < w; ++j) {
+                fig_uint8_t index = src[j];
+                dest[j] = (dest[j] & lut.keep[index]) | lut.colors[index];
+            }
         } else {
-            memcpy(fig_image_get_render_data(next), fig_image_get_render_data(cur), sizeof(fig_uint32_t) * self->width * self->height);
-            fig_dispose_indexed_(self, prev, cur, next);
+            for(j = 0; j < w; ++j) {
+                dest[j] = lut.colors[src[j]];
+            }
         }
 
-        fig_blit_indexed_(self, next);
+        index_data += pitch;
+        render_data += canvas_pitch;
+    }
+}
 
-        if(cur != NULL) {
-            disposal = fig_image_get_disposal(cur);
-            if(disposal == FIG_DISPOSAL_NONE || disposal == FIG_DISPOSAL_UNSPECIFIED) {
-                prev = cur;
-            }
+/* Whether any image in the animation uses previous disposal. */
+static fig_bool_t fig_animation_uses_restore_(fig_animation *self) {
+    size_t i;
+    for(i = 0; i < self->image_count; ++i) {
+        if(fig_image_get_disposal(self->image_data[i]) == FIG_DISPOSAL_PREVIOUS) {
+            return 1;
         }
-        cur = next;
     }
-    return 1;
+    return 0;
 }
 
-fig_palette *fig_animation_get_render_palette(fig_animation *self, fig_image *image) {
-    fig_palette *local_palette = fig_image_get_palette(image);
-    if(fig_palette_count_colors(local_palette) > 0) {
-        return local_palette;
-    } else {
-        return self->palette;
+/* Whether the rest of the animation can be rendered starting from
+ * the render of this image alone, without anything drawn before it. */
+static fig_bool_t fig_image_is_checkpoint_(fig_image *image, fig_bool_t uses_restore) {
+    fig_disposal_t disposal = fig_image_get_disposal(image);
+    return !uses_restore
+        || disposal == FIG_DISPOSAL_NONE
+        || disposal == FIG_DISPOSAL_UNSPECIFIED;
+}
+
+/* Whether the image at the given index can be rendered without the render
+ * of any image before it, and the images after it don't need to restore
+ * the render of any image before it either. */
+static fig_bool_t fig_animation_is_keyframe_(fig_animation *self, size_t index, fig_bool_t uses_restore) {
+    fig_image *image;
+    fig_image *before;
+
+    if(index == 0) {
+        return 1;
+    }
+
+    image = self->image_data[index];
+    if(!fig_image_is_checkpoint_(image, uses_restore)) {
+        return 0;
     }
+    if(fig_image_covers_canvas_(self, image)) {
+        return 1;
+    }
+
+    /* The image before it clears the whole canvas when disposed. */
+    before = self->image_data[index - 1];
+    return fig_image_covers_canvas_(self, before)
+        && fig_image_get_disposal(before) == FIG_DISPOSAL_BACKGROUND;
 }
 
-void fig_animation_free(fig_animation *self) {
-    if(self != NULL) {
-        fig_allocator_t alloc = fig_state_get_allocator(self->state);
-        void *ud = fig_state_get_userdata(self->state);
+/* Get a palette index that no image draws, to stand in for the background
+ * of palette index canvases. Returns 256 if every index is drawn. */
+static size_t fig_animation_find_background_index_(fig_animation *self) {
+    fig_bool_t used[256];
+    size_t palette_size;
+    size_t i, j;
 
-        if(self->palette != NULL) {
-            fig_palette_free(self->palette);
-        }
-        if(self->image_data != NULL) {
-            fig_image **data;
-            size_t i;
+    palette_size = fig_palette_count_colors(self->palette);
+    if(palette_size < 256) {
+        return palette_size;
+    }
 
-            data = self->image_data;
-            for(i = 0; i < self->image_count; ++i) {
-                fig_image_free(data[i]);
+    memset(used, 0, sizeof(used));
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        const fig_uint8_t *index_data = fig_image_get_indexed_data(image);
+        size_t width = fig_image_get_indexed_width(image);
+        size_t height = fig_image_get_indexed_height(image);
+        size_t stride = fig_image_get_indexed_stride(image);
+        fig_bool_t transparent = fig_image_get_transparent(image);
+        size_t transparency_index = fig_image_get_transparency_index(image);
+        size_t k;
+
+        for(j = 0; j < height; ++j) {
+            const fig_uint8_t *row = index_data + j * stride;
+            for(k = 0; k < width; ++k) {
+                if(!transparent || row[k] != transparency_index) {
+                    used[row[k]] = 1;
+                }
             }
-            alloc(ud, data, sizeof(fig_image *) * self->image_count, 0);
         }
-        alloc(ud, self, sizeof(fig_animation), 0);
     }
+    for(i = 256; i > 0; --i) {
+        if(!used[i - 1]) {
+            return i - 1;
+        }
+    }
+    return 256;
 }
 
-#if defined(FIG_LOAD_GIF) || defined(FIG_SAVE_GIF)
+/* Get the BGRA color of every palette index of a palette index canvas, looking them up in the given palette.
+ * The background index is transparent. */
+static void fig_get_index_canvas_colors_(fig_animation *self, fig_palette *palette, fig_uint32_t *colors) {
+    fig_uint32_t *palette_colors;
+    size_t palette_size;
+    size_t background_index;
+    size_t i;
 
-enum {
-    /* Header definitions */
-    FIG_GIF_HEADER_LENGTH = 6,
+    palette_colors = fig_palette_get_colors(palette);
+    palette_size = fig_palette_count_colors(palette);
+    for(i = 0; i < 256; ++i) {
+        colors[i] = i < palette_size ? palette_colors[i] : 0;
+    }
+    /* Reuse the index picked by the last render, so that swapping palettes doesn't rescan every image. */
+    background_index = self->render_background_index < 256
+        ? self->render_background_index
+        : fig_animation_find_background_index_(self);
+    if(background_index < 256) {
+        colors[background_index] = 0;
+    }
+}
 
-    /* Block types */
-    FIG_GIF_BLOCK_EXTENSION = 0x21,
-    FIG_GIF_BLOCK_IMAGE = 0x2C,
-    FIG_GIF_BLOCK_TERMINATOR = 0x3B,
+/* Expand an area of a palette index canvas into BGRA colors using the animation palette.
+ * The pitches are the number of pixels between the start of each row. */
+static void fig_expand_index_canvas_(fig_animation *self, const fig_uint8_t *src, size_t src_pitch, fig_uint32_t *dest, size_t dest_pitch, const fig_rect *area) {
+    fig_uint32_t colors[256];
+    size_t i, j;
 
-    /* Extension types */
-    FIG_GIF_EXT_GRAPHICS_CONTROL = 0xF9,
-    FIG_GIF_EXT_PLAIN_TEXT = 0x01,
-    FIG_GIF_EXT_COMMENT = 0xFE,
-    FIG_GIF_EXT_APPLICATION = 0xFF,
+    fig_get_index_canvas_colors_(self, self->palette, colors);
+    src += area->y * src_pitch + area->x;
+    for(i = 0; i < area->height; ++i) {
+        for(j = 0; j < area->width; ++j) {
+            dest[j] = colors[src[j]];
+        }
+        src += src_pitch;
+        dest += dest_pitch;
+    }
+}
+
+/* Apply the disposal of an image to a palette index canvas.
+ * The restore surface works the same way as fig_dispose_indexed_. */
+static void fig_dispose_index_canvas_(fig_animation *self, fig_image *image, fig_uint8_t *canvas, size_t canvas_pitch, const fig_uint8_t *restore, size_t restore_pitch, fig_uint8_t background_index) {
+    fig_rect rect;
+    size_t x, y, w, h;
+    size_t pitch;
+    fig_bool_t transparent;
+    size_t transparency_index;
+    fig_uint8_t *index_data;
+    fig_disposal_t disposal;
+    size_t i, j;
+
+    disposal = fig_image_get_disposal(image);
+    if(disposal != FIG_DISPOSAL_BACKGROUND && disposal != FIG_DISPOSAL_PREVIOUS) {
+        return;
+    }
+    if(disposal == FIG_DISPOSAL_PREVIOUS && restore == NULL) {
+        disposal = FIG_DISPOSAL_BACKGROUND;
+    }
+
+    rect = fig_get_image_rect_(self, image);
+    x = rect.x;
+    y = rect.y;
+    w = rect.width;
+    h = rect.height;
+    pitch = fig_image_get_indexed_stride(image);
+    transparent = fig_image_get_transparent(image);
+    transparency_index = fig_image_get_transparency_index(image);
+    index_data = fig_image_get_indexed_data(image);
+    canvas += y * canvas_pitch + x;
+    if(restore != NULL) {
+        restore += y * restore_pitch + x;
+    }
+
+    for(i = 0; i < h; ++i) {
+        const fig_uint8_t *src = index_data;
+        fig_uint8_t *dest = canvas;
+
+        if(disposal == FIG_DISPOSAL_BACKGROUND) {
+            for(j = 0; j < w; ++j) {
+                if(!transparent || src[j] != transparency_index) {
+                    dest[j] = background_index;
+                }
+            }
+        } else {
+            const fig_uint8_t *prev = restore;
+            for(j = 0; j < w; ++j) {
+                if(!transparent || src[j] != transparency_index) {
+                    dest[j] = prev[j];
+                }
+            }
+            restore += restore_pitch;
+        }
+
+        index_data += pitch;
+        canvas += canvas_pitch;
+    }
+}
+
+static void fig_blit_index_canvas_(fig_animation *self, fig_image *image, fig_uint8_t *canvas, size_t canvas_pitch) {
+    fig_rect rect;
+    size_t x, y, w, h;
+    size_t pitch;
+    fig_bool_t transparent;
+    size_t transparency_index;
+    fig_uint8_t *index_data;
+    fig_uint8_t *render_data;
+    size_t i, j;
+
+    rect = fig_get_image_rect_(self, image);
+    x = rect.x;
+    y = rect.y;
+    w = rect.width;
+    h = rect.height;
+    pitch = fig_image_get_indexed_stride(image);
+    transparent = fig_image_get_transparent(image) && fig_image_get_transparency_index(image) < 256;
+    transparency_index = fig_image_get_transparency_index(image);
+    index_data = fig_image_get_indexed_data(image);
+    render_data = canvas + y * canvas_pitch + x;
+
+    for(i = 0; i < h; ++i) {
+        if(transparent) {
+            for(j = 0; j < w; ++j) {
+                fig_uint8_t index = index_data[j];
+                render_data[j] = index != transparency_index ? index : render_data[j];
+            }
+        } else {
+            memcpy(render_data, index_data, w);
+        }
+
+        index_data += pitch;
+        render_data += canvas_pitch;
+    }
+}
+
+enum {
+    /* The perceptual hash compares each cell of a grid with the cell to its right. */
+    FIG_HASH_COLUMNS = 9,
+    FIG_HASH_ROWS = 8
+};
+
+/* The luminance of a canvas summed over each cell of the perceptual hash grid.
+ * The sums are whole numbers well within the precision of a double,
+ * so an area can be subtracted and added back without drifting. */
+typedef struct {
+    double sums[FIG_HASH_ROWS][FIG_HASH_COLUMNS];
+} fig_luma_grid_;
+
+static unsigned long fig_color_luma_(fig_uint32_t color) {
+    return ((color >> 16) & 0xFF) * 77 + ((color >> 8) & 0xFF) * 150 + (color & 0xFF) * 29;
+}
+
+/* Add the luminance of an area of a canvas to the grid, or subtract it if sign is negative.
+ * The canvas holds BGRA colors, or palette indices if lumas holds the luminance of every index.
+ * The pitch is the number of pixels between the start of each row. */
+static void fig_luma_grid_scan_(fig_animation *self, fig_luma_grid_ *grid, const void *canvas, size_t pitch, const unsigned long *lumas, const fig_rect *rect, double sign) {
+    size_t row, column, x, y;
+
+    for(row = 0; row < FIG_HASH_ROWS; ++row) {
+        size_t top = row * self->height / FIG_HASH_ROWS;
+        size_t bottom = (row + 1) * self->height / FIG_HASH_ROWS;
+
+        top = top > rect->y ? top : rect->y;
+        bottom = bottom < rect->y + rect->height ? bottom : rect->y + rect->height;
+        for(column = 0; column < FIG_HASH_COLUMNS; ++column) {
+            size_t left = column * self->width / FIG_HASH_COLUMNS;
+            size_t right = (column + 1) * self->width / FIG_HASH_COLUMNS;
+
+            left = left > rect->x ? left : rect->x;
+            right = right < rect->x + rect->width ? right : rect->x + rect->width;
+            for(y = top; y < bottom && left < right; ++y) {
+                unsigned long sum = 0;
+
+                if(lumas != NULL) {
+                    const fig_uint8_t *pixels = (const fig_uint8_t *) canvas + y * pitch;
+                    for(x = left; x < right; ++x) {
+                        sum += lumas[pixels[x]];
+                    }
+                } else {
+                    const fig_uint32_t *pixels = (const fig_uint32_t *) canvas + y * pitch;
+                    for(x = left; x < right; ++x) {
+                        sum += fig_color_luma_(pixels[x]);
+                    }
+                }
+                grid->sums[row][column] += sign * (double) sum;
+            }
+        }
+    }
+}
+
+/* Set the perceptual hash of an image from the grid of the canvas that shows it. */
+static void fig_luma_grid_hash_(fig_animation *self, const fig_luma_grid_ *grid, fig_image *image) {
+    fig_uint8_t hash[FIG_HASH_ROWS];
+    size_t row, column;
+
+    for(row = 0; row < FIG_HASH_ROWS; ++row) {
+        hash[row] = 0;
+        for(column = 0; column + 1 < FIG_HASH_COLUMNS; ++column) {
+            double width = (double) ((column + 1) * self->width / FIG_HASH_COLUMNS - column * self->width / FIG_HASH_COLUMNS);
+            double next_width = (double) ((column + 2) * self->width / FIG_HASH_COLUMNS - (column + 1) * self->width / FIG_HASH_COLUMNS);
+
+            /* The averages are compared without dividing, so that the empty cells of narrow canvases count as 0. */
+            if(grid->sums[row][column] * next_width > grid->sums[row][column + 1] * width) {
+                hash[row] |= (fig_uint8_t) (0x80 >> column);
+            }
+        }
+    }
+    fig_image_set_perceptual_hash(image, hash);
+}
+
+static fig_bool_t fig_render_images_full_(fig_animation *self, size_t start, size_t end) {
+    fig_image **images;
+    fig_image *prev;
+    fig_image *cur;
+    fig_image *next;
+    fig_disposal_t disposal;
+    fig_rect canvas_rect;
+    fig_luma_grid_ grid;
+    size_t i;
+
+    canvas_rect = fig_get_canvas_rect_(self);
+    images = self->image_data;
+    prev = NULL;
+    cur = NULL;
+    next = NULL;
+
+    /* Rendering starts at a keyframe, so it's drawn onto a clear canvas. */
+    for(i = start; i < end; ++i) {
+        fig_uint32_t *render_data;
+        size_t render_pitch;
+        fig_rect draw_rect;
+
+        next = images[i];
+        if(fig_image_get_render_data(next) == NULL
+        || fig_image_get_render_width(next) != self->width
+        || fig_image_get_render_height(next) != self->height) {
+            if(!fig_image_resize_render(next, self->width, self->height)) {
+                return 0;
+            }
+        }
+        fig_image_set_render_origin_x(next, 0);
+        fig_image_set_render_origin_y(next, 0);
+        render_data = fig_image_get_render_data(next);
+        render_pitch = fig_get_render_pitch_(next);
+        draw_rect = fig_get_draw_rect_(self, cur, next);
+
+        if(self->perceptual_hashes) {
+            if(cur == NULL) {
+                memset(&grid, 0, sizeof(grid));
+            } else {
+                fig_luma_grid_scan_(self, &grid, fig_image_get_render_data(cur), fig_get_render_pitch_(cur), NULL, &draw_rect, -1.0);
+            }
+        }
+
+        /* An image that replaces the whole canvas doesn't need the previous canvas. */
+        if(!fig_image_covers_canvas_(self, next)) {
+            if(cur == NULL) {
+                size_t y;
+                for(y = 0; y < self->height; ++y) {
+                    memset(render_data + y * render_pitch, 0, sizeof(fig_uint32_t) * self->width);
+                }
+            } else {
+                fig_copy_canvas_rect_(render_data, render_pitch,
+                    fig_image_get_render_data(cur), fig_get_render_pitch_(cur), &canvas_rect);
+                fig_dispose_indexed_(self, cur, &canvas_rect, render_data, render_pitch,
+                    prev != NULL ? fig_image_get_render_data(prev) : NULL,
+                    prev != NULL ? fig_get_render_pitch_(prev) : 0);
+            }
+        }
+
+        fig_blit_indexed_(self, next, &canvas_rect, render_data, render_pitch);
+
+        if(self->perceptual_hashes) {
+            fig_luma_grid_scan_(self, &grid, render_data, render_pitch, NULL, &draw_rect, 1.0);
+            fig_luma_grid_hash_(self, &grid, next);
+        }
+
+        if(cur != NULL) {
+            disposal = fig_image_get_disposal(cur);
+            if(disposal == FIG_DISPOSAL_NONE || disposal == FIG_DISPOSAL_UNSPECIFIED) {
+                prev = cur;
+            }
+        }
+        cur = next;
+    }
+    return 1;
+}
+
+static fig_bool_t fig_render_images_index_(fig_animation *self, size_t start, size_t end) {
+    fig_image **images;
+    fig_image *prev;
+    fig_image *cur;
+    fig_image *next;
+    fig_disposal_t disposal;
+    size_t background_index;
+    fig_luma_grid_ grid;
+    unsigned long lumas[256];
+    size_t i;
+
+    for(i = start; i < end; ++i) {
+        if(fig_palette_count_colors(fig_image_get_palette(self->image_data[i])) > 0) {
+            fig_state_set_error(self->state, "palette index rendering requires every image to use the animation palette");
+            return 0;
+        }
+    }
+    /* Ranges only read the background index, which is picked once for every range. */
+    background_index = self->render_background_index;
+    if(background_index >= 256) {
+        fig_state_set_error(self->state, "palette index rendering requires fig_animation_prepare_render first");
+        return 0;
+    }
+    if(self->perceptual_hashes) {
+        fig_uint32_t colors[256];
+
+        fig_get_index_canvas_colors_(self, self->palette, colors);
+        for(i = 0; i < 256; ++i) {
+            lumas[i] = fig_color_luma_(colors[i]);
+        }
+    }
+
+    images = self->image_data;
+    prev = NULL;
+    cur = NULL;
+    next = NULL;
+
+    /* Rendering starts at a keyframe, so it's drawn onto a clear canvas. */
+    for(i = start; i < end; ++i) {
+        fig_uint8_t *render_data;
+        size_t render_pitch;
+        fig_rect draw_rect;
+        size_t y;
+
+        next = images[i];
+        if(fig_image_get_render_index_data(next) == NULL
+        || fig_image_get_render_width(next) != self->width
+        || fig_image_get_render_height(next) != self->height) {
+            if(!fig_image_resize_render_index(next, self->width, self->height)) {
+                return 0;
+            }
+        }
+        fig_image_set_render_origin_x(next, 0);
+        fig_image_set_render_origin_y(next, 0);
+        render_data = fig_image_get_render_index_data(next);
+        render_pitch = fig_get_render_pitch_(next);
+        draw_rect = fig_get_draw_rect_(self, cur, next);
+
+        if(self->perceptual_hashes) {
+            if(cur == NULL) {
+                memset(&grid, 0, sizeof(grid));
+            } else {
+                fig_luma_grid_scan_(self, &grid, fig_image_get_render_index_data(cur), fig_get_render_pitch_(cur), lumas, &draw_rect, -1.0);
+            }
+        }
+
+        if(!fig_image_covers_canvas_(self, next)) {
+            if(cur == NULL) {
+                for(y = 0; y < self->height; ++y) {
+                    memset(render_data + y * render_pitch, (int) background_index, self->width);
+                }
+            } else {
+                const fig_uint8_t *cur_data = fig_image_get_render_index_data(cur);
+                size_t cur_pitch = fig_get_render_pitch_(cur);
+                for(y = 0; y < self->height; ++y) {
+                    memcpy(render_data + y * render_pitch, cur_data + y * cur_pitch, self->width);
+                }
+                fig_dispose_index_canvas_(self, cur, render_data, render_pitch,
+                    prev != NULL ? fig_image_get_render_index_data(prev) : NULL,
+                    prev != NULL ? fig_get_render_pitch_(prev) : 0,
+                    (fig_uint8_t) background_index);
+            }
+        }
+
+        fig_blit_index_canvas_(self, next, render_data, render_pitch);
+
+        if(self->perceptual_hashes) {
+            fig_luma_grid_scan_(self, &grid, render_data, render_pitch, lumas, &draw_rect, 1.0);
+            fig_luma_grid_hash_(self, &grid, next);
+        }
+
+        if(cur != NULL) {
+            disposal = fig_image_get_disposal(cur);
+            if(disposal == FIG_DISPOSAL_NONE || disposal == FIG_DISPOSAL_UNSPECIFIED) {
+                prev = cur;
+            }
+        }
+        cur = next;
+    }
+    return 1;
+}
+
+/* A running canvas that images are drawn onto one at a time. */
+typedef struct {
+    fig_animation *animation;
+    /* The area of the animation canvas that is drawn. */
+    fig_rect area;
+    fig_uint32_t *canvas;
+    /* The number of pixels between the start of each row of the canvas. */
+    size_t pitch;
+    /* A snapshot of the most recent undisposed image,
+       or NULL if no image in the animation uses previous disposal. */
+    fig_uint32_t *restore;
+    /* The area of the canvas that changed since the snapshot was taken. */
+    fig_rect restore_dirty;
+    /* The image drawn most recently, or NULL if nothing was drawn yet. */
+    fig_image *cur;
+    /* The number of images drawn so far, so that cur is at position - 1. */
+    size_t position;
+    fig_bool_t owns_canvas;
+    /* The luminance grid of the full canvas, kept up to date for perceptual hashes, or NULL. */
+    fig_luma_grid_ *grid;
+} fig_compositor_;
+
+static void fig_compositor_free_(fig_compositor_ *self) {
+    fig_state *state = self->animation->state;
+    size_t canvas_size = sizeof(fig_uint32_t) * self->area.width * self->area.height;
+
+    if(self->owns_canvas) {
+        fig_state_get_allocator(state)(fig_state_get_userdata(state), self->canvas, self->canvas != NULL ? canvas_size : 0, 0);
+    }
+    fig_state_get_allocator(state)(fig_state_get_userdata(state), self->restore, self->restore != NULL ? canvas_size : 0, 0);
+    self->canvas = NULL;
+    self->restore = NULL;
+}
+
+/* Clear the canvas to the state before the first image is drawn. */
+static void fig_compositor_reset_(fig_compositor_ *self) {
+    size_t i;
+
+    for(i = 0; i < self->area.height; ++i) {
+        memset(self->canvas + i * self->pitch, 0, sizeof(fig_uint32_t) * self->area.width);
+    }
+    if(self->restore != NULL) {
+        memset(self->restore, 0, sizeof(fig_uint32_t) * self->area.width * self->area.height);
+    }
+    self->restore_dirty.x = self->restore_dirty.y = self->restore_dirty.width = self->restore_dirty.height = 0;
+    if(self->grid != NULL) {
+        memset(self->grid, 0, sizeof(fig_luma_grid_));
+    }
+    self->cur = NULL;
+    self->position = 0;
+}
+
+/* Prepare a compositor for an area of the animation canvas.
+ * If canvas is NULL, a canvas is allocated and owned by the compositor.
+ * Otherwise, the canvas is user-owned, and must hold the area
+ * with pitch pixels between the start of each row. */
+static fig_bool_t fig_compositor_init_area_(fig_compositor_ *self, fig_animation *animation, const fig_rect *area, fig_uint32_t *canvas, size_t pitch) {
+    fig_allocator_t alloc = fig_state_get_allocator(animation->state);
+    void *ud = fig_state_get_userdata(animation->state);
+    size_t canvas_size = sizeof(fig_uint32_t) * area->width * area->height;
+
+    FIG_ASSERT(area->x + area->width <= animation->width && area->y + area->height <= animation->height);
+    self->animation = animation;
+    self->area = *area;
+    self->canvas = canvas;
+    self->pitch = canvas != NULL ? pitch : area->width;
+    self->restore = NULL;
+    self->owns_canvas = canvas == NULL;
+    self->grid = NULL;
+
+    if(area->height != 0 && area->width > ~(size_t) 0 / sizeof(fig_uint32_t) / area->height) {
+        fig_state_set_error(animation->state, "image dimensions requested are too large");
+        return 0;
+    }
+    if(self->canvas == NULL) {
+        self->canvas = (fig_uint32_t *) alloc(ud, NULL, 0, canvas_size);
+        if(self->canvas == NULL) {
+            fig_state_set_error_allocation_failed(animation->state);
+            return 0;
+        }
+    }
+    if(fig_animation_uses_restore_(animation)) {
+        self->restore = (fig_uint32_t *) alloc(ud, NULL, 0, canvas_size);
+        if(self->restore == NULL) {
+            fig_state_set_error_allocation_failed(animation->state);
+            fig_compositor_free_(self);
+            return 0;
+        }
+    }
+
+    fig_compositor_reset_(self);
+    return 1;
+}
+
+/* Prepare a compositor for the full animation canvas.
+ * If canvas is NULL, a canvas is allocated and owned by the compositor.
+ * Otherwise, the canvas is user-owned, and must be width * height pixels. */
+static fig_bool_t fig_compositor_init_(fig_compositor_ *self, fig_animation *animation, fig_uint32_t *canvas) {
+    fig_rect area = fig_get_canvas_rect_(animation);
+    return fig_compositor_init_area_(self, animation, &area, canvas, animation->width);
+}
+
+/* Set the perceptual hash of every image drawn by a compositor that was just prepared
+ * for the full canvas, if the animation computes them. The grid must outlive the compositor. */
+static void fig_compositor_track_hashes_(fig_compositor_ *self, fig_luma_grid_ *grid) {
+    if(self->animation->perceptual_hashes) {
+        self->grid = grid;
+        memset(grid, 0, sizeof(fig_luma_grid_));
+    }
+}
+
+/* Resume drawing after the image at the given index, from its render
+ * surface covering the full canvas. The image must be a checkpoint. */
+static void fig_compositor_resume_(fig_compositor_ *self, size_t index) {
+    fig_image *image = self->animation->image_data[index];
+
+    self->restore_dirty = self->area;
+    if(fig_image_get_render_index_data(image) != NULL) {
+        fig_expand_index_canvas_(self->animation, fig_image_get_render_index_data(image), fig_get_render_pitch_(image),
+            self->canvas, self->pitch, &self->area);
+    } else if(fig_image_get_render_data(image) != self->canvas) {
+        size_t image_pitch = fig_get_render_pitch_(image);
+        const fig_uint32_t *src = fig_image_get_render_data(image) + self->area.y * image_pitch + self->area.x;
+        size_t i;
+
+        for(i = 0; i < self->area.height; ++i) {
+            memcpy(self->canvas + i * self->pitch, src + i * image_pitch, sizeof(fig_uint32_t) * self->area.width);
+        }
+    }
+    if(self->grid != NULL) {
+        memset(self->grid, 0, sizeof(fig_luma_grid_));
+        fig_luma_grid_scan_(self->animation, self->grid, self->canvas, self->pitch, NULL, &self->area, 1.0);
+    }
+    self->cur = image;
+    self->position = index + 1;
+}
+
+/* Dispose the current image and draw the next one.
+ * Returns the area of the canvas that may have changed. */
+static fig_rect fig_compositor_draw_(fig_compositor_ *self, fig_image *next) {
+    fig_animation *animation = self->animation;
+    fig_rect rect = fig_get_draw_rect_(animation, self->cur, next);
+
+    if(self->grid != NULL) {
+        fig_luma_grid_scan_(animation, self->grid, self->canvas, self->pitch, NULL, &rect, -1.0);
+    }
+    if(self->cur != NULL) {
+        fig_disposal_t disposal;
+
+        fig_dispose_indexed_(animation, self->cur, &self->area, self->canvas, self->pitch, self->restore, self->area.width);
+
+        /* The canvas now holds the render of the undisposed image,
+         * so bring the snapshot up to date with the parts that changed. */
+        disposal = fig_image_get_disposal(self->cur);
+        if(self->restore != NULL
+        && (disposal == FIG_DISPOSAL_NONE || disposal == FIG_DISPOSAL_UNSPECIFIED)) {
+            fig_rect dirty = fig_rect_intersect_(&self->restore_dirty, &self->area);
+            if(!fig_rect_is_empty_(&dirty)) {
+                dirty.x -= self->area.x;
+                dirty.y -= self->area.y;
+                fig_copy_canvas_rect_(self->restore, self->area.width, self->canvas, self->pitch, &dirty);
+            }
+            self->restore_dirty.x = self->restore_dirty.y = self->restore_dirty.width = self->restore_dirty.height = 0;
+        }
+    }
+
+    fig_blit_indexed_(animation, next, &self->area, self->canvas, self->pitch);
+    if(self->grid != NULL) {
+        fig_luma_grid_scan_(animation, self->grid, self->canvas, self->pitch, NULL, &rect, 1.0);
+        fig_luma_grid_hash_(animation, self->grid, next);
+    }
+    fig_rect_union_(&self->restore_dirty, &rect);
+    self->cur = next;
+    ++self->position;
+    return rect;
+}
+
+/* Bring the canvas to the render of the image at the given index.
+ * This continues from the current image when possible, or otherwise
+ * from the nearest checkpoint render or keyframe at or before the index,
+ * and replays the images after it. Renders of other images can't be
+ * resumed from, since the restore snapshot can't be rebuilt from them. */
+static void fig_compositor_seek_(fig_compositor_ *self, size_t index) {
+    fig_animation *animation = self->animation;
+    fig_bool_t uses_restore = self->restore != NULL;
+    size_t start;
+
+    for(start = index + 1; start > 0; --start) {
+        fig_image *image = animation->image_data[start - 1];
+
+        if(start == self->position) {
+            break;
+        } else if(fig_image_get_render_origin_x(image) == 0
+        && fig_image_get_render_origin_y(image) == 0
+        && fig_image_get_render_width(image) == animation->width
+        && fig_image_get_render_height(image) == animation->height
+        && fig_image_is_checkpoint_(image, uses_restore)) {
+            fig_compositor_resume_(self, start - 1);
+            break;
+        } else if(fig_animation_is_keyframe_(animation, start - 1, uses_restore)) {
+            /* Before the first image, nothing can be restored either. */
+            if(start == 1 || !fig_image_covers_canvas_(animation, image)) {
+                fig_compositor_reset_(self);
+            }
+            self->cur = NULL;
+            fig_compositor_draw_(self, image);
+            self->position = start;
+            break;
+        }
+    }
+    if(start == 0 && self->position != 0) {
+        fig_compositor_reset_(self);
+    }
+
+    for(; start <= index; ++start) {
+        fig_compositor_draw_(self, animation->image_data[start]);
+    }
+}
+
+static fig_bool_t fig_store_render_rect_(fig_animation *self, fig_image *image, const fig_uint32_t *canvas, const fig_rect *rect) {
+    fig_uint32_t *dest;
+    size_t dest_pitch;
+    const fig_uint32_t *src;
+    size_t i;
+
+    if(fig_image_get_render_data(image) == NULL
+    || fig_image_get_render_width(image) != rect->width
+    || fig_image_get_render_height(image) != rect->height) {
+        if(!fig_image_resize_render(image, rect->width, rect->height)) {
+            return 0;
+        }
+    }
+    fig_image_set_render_origin_x(image, rect->x);
+    fig_image_set_render_origin_y(image, rect->y);
+
+    dest = fig_image_get_render_data(image);
+    dest_pitch = fig_get_render_pitch_(image);
+    src = canvas + rect->y * self->width + rect->x;
+    for(i = 0; i < rect->height; ++i) {
+        memcpy(dest, src, sizeof(fig_uint32_t) * rect->width);
+        dest += dest_pitch;
+        src += self->width;
+    }
+    return 1;
+}
+
+static fig_bool_t fig_render_images_delta_(fig_animation *self, size_t start, size_t end) {
+    fig_compositor_ compositor;
+    fig_luma_grid_ grid;
+    size_t i;
+
+    if(!fig_compositor_init_(&compositor, self, NULL)) {
+        return 0;
+    }
+    fig_compositor_track_hashes_(&compositor, &grid);
+
+    for(i = start; i < end; ++i) {
+        fig_image *image = self->image_data[i];
+        fig_rect rect = fig_compositor_draw_(&compositor, image);
+
+        /* Rendering starts at a keyframe, so only the area that changed
+         * since the image before it needs to be stored. */
+        if(i == start && start > 0) {
+            fig_rect image_rect = fig_get_image_rect_(self, image);
+            rect = fig_get_disposal_rect_(self, self->image_data[start - 1]);
+            fig_rect_union_(&rect, &image_rect);
+        }
+
+        if(!fig_store_render_rect_(self, image, compositor.canvas, &rect)) {
+            fig_compositor_free_(&compositor);
+            return 0;
+        }
+    }
+
+    fig_compositor_free_(&compositor);
+    return 1;
+}
+
+static fig_bool_t fig_render_images_checkpoint_(fig_animation *self, size_t start, size_t end) {
+    fig_compositor_ compositor;
+    fig_luma_grid_ grid;
+    fig_bool_t uses_restore;
+    size_t last_checkpoint;
+    size_t i;
+
+    if(!fig_compositor_init_(&compositor, self, NULL)) {
+        return 0;
+    }
+    fig_compositor_track_hashes_(&compositor, &grid);
+    uses_restore = compositor.restore != NULL;
+    last_checkpoint = start;
+
+    for(i = start; i < end; ++i) {
+        fig_image *image = self->image_data[i];
+        fig_rect rect;
+
+        fig_compositor_draw_(&compositor, image);
+
+        if(fig_animation_is_keyframe_(self, i, uses_restore)) {
+            /* This can be rendered again by drawing only this image, so storing it is unnecessary. */
+            last_checkpoint = i;
+            rect.x = rect.y = rect.width = rect.height = 0;
+        } else if(fig_image_is_checkpoint_(image, uses_restore)
+        && self->checkpoint_interval != 0
+        && i - last_checkpoint >= self->checkpoint_interval) {
+            last_checkpoint = i;
+            rect = fig_get_canvas_rect_(self);
+        } else {
+            rect.x = rect.y = rect.width = rect.height = 0;
+        }
+
+        if(!fig_store_render_rect_(self, image, compositor.canvas, &rect)) {
+            fig_compositor_free_(&compositor);
+            return 0;
+        }
+    }
+
+    fig_compositor_free_(&compositor);
+    return 1;
+}
+
+/* Get the number of sample times before the given time, which is ceil(time * rate / duration).
+ * The whole durations are counted separately so that the product doesn't overflow as easily. */
+static size_t fig_animation_count_sample_times_(fig_animation *self, size_t time) {
+    size_t rate = self->sample_rate;
+    size_t duration = self->sample_duration;
+    return time / duration * rate + (time % duration * rate + duration - 1) / duration;
+}
+
+/* Get the time when the image at the given index starts showing. */
+static size_t fig_animation_get_image_time_(fig_animation *self, size_t index) {
+    size_t time = 0;
+    size_t i;
+
+    for(i = 0; i < index; ++i) {
+        time += fig_image_get_delay(self->image_data[i]);
+    }
+    return time;
+}
+
+/* Get the number of samples showing the image at the given index, which starts showing at time. */
+static size_t fig_animation_count_samples_(fig_animation *self, size_t index, size_t time) {
+    if(self->sample_rate == 0) {
+        return index % self->sample_interval == 0 ? 1 : 0;
+    }
+    return fig_animation_count_sample_times_(self, time + fig_image_get_delay(self->image_data[index]))
+        - fig_animation_count_sample_times_(self, time);
+}
+
+static fig_bool_t fig_render_images_sampled_(fig_animation *self, size_t start, size_t end) {
+    fig_compositor_ compositor;
+    fig_luma_grid_ grid;
+    size_t time;
+    size_t i;
+
+    if(!fig_compositor_init_(&compositor, self, NULL)) {
+        return 0;
+    }
+    fig_compositor_track_hashes_(&compositor, &grid);
+    time = fig_animation_get_image_time_(self, start);
+
+    for(i = start; i < end; ++i) {
+        fig_image *image = self->image_data[i];
+        fig_rect rect;
+
+        fig_compositor_draw_(&compositor, image);
+
+        /* Images that aren't sampled are only drawn onto the running canvas. */
+        if(fig_animation_count_samples_(self, i, time) != 0) {
+            rect = fig_get_canvas_rect_(self);
+        } else {
+            rect.x = rect.y = rect.width = rect.height = 0;
+        }
+        time += fig_image_get_delay(image);
+
+        if(!fig_store_render_rect_(self, image, compositor.canvas, &rect)) {
+            fig_compositor_free_(&compositor);
+            return 0;
+        }
+    }
+
+    fig_compositor_free_(&compositor);
+    return 1;
+}
+
+fig_bool_t fig_animation_prepare_render(fig_animation *self) {
+    if(self->render_mode == FIG_RENDER_MODE_INDEX) {
+        size_t i;
+
+        for(i = 0; i < self->image_count; ++i) {
+            if(fig_palette_count_colors(fig_image_get_palette(self->image_data[i])) > 0) {
+                fig_state_set_error(self->state, "palette index rendering requires every image to use the animation palette");
+                return 0;
+            }
+        }
+        self->render_background_index = fig_animation_find_background_index_(self);
+        if(self->render_background_index >= 256) {
+            fig_state_set_error(self->state, "no palette index is free to represent the background");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+fig_bool_t fig_animation_render_images(fig_animation *self) {
+    return fig_animation_prepare_render(self)
+        && fig_animation_render_image_range(self, 0, self->image_count);
+}
+
+fig_bool_t fig_animation_allocate_render_slab(fig_animation *self) {
+    fig_allocator_t alloc = fig_state_get_storage_allocator(self->state);
+    void *ud = fig_state_get_storage_userdata(self->state);
+    size_t pixel_size;
+    size_t pitch;
+    fig_uint8_t *slab;
+    size_t i;
+
+    if(self->render_mode != FIG_RENDER_MODE_FULL && self->render_mode != FIG_RENDER_MODE_INDEX) {
+        fig_state_set_error(self->state, "a render block requires FIG_RENDER_MODE_FULL or FIG_RENDER_MODE_INDEX");
+        return 0;
+    }
+    pixel_size = self->render_mode == FIG_RENDER_MODE_INDEX ? sizeof(fig_uint8_t) : sizeof(fig_uint32_t);
+    if(self->height != 0 && self->width > ~(size_t) 0 / pixel_size / self->height) {
+        fig_state_set_error(self->state, "image dimensions requested are too large");
+        return 0;
+    }
+    pitch = pixel_size * self->width * self->height;
+    if(self->image_count != 0 && pitch > ~(size_t) 0 / self->image_count) {
+        fig_state_set_error(self->state, "image dimensions requested are too large");
+        return 0;
+    }
+
+    slab = NULL;
+    if(pitch * self->image_count != 0) {
+        slab = (fig_uint8_t *) alloc(ud, NULL, 0, pitch * self->image_count);
+        if(slab == NULL) {
+            fig_state_set_error_allocation_failed(self->state);
+            return 0;
+        }
+    }
+
+    /* The images stop using the old block before it's freed. */
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        fig_uint8_t *data = slab != NULL ? slab + i * pitch : NULL;
+
+        if(pixel_size == sizeof(fig_uint8_t)) {
+            fig_image_attach_render_index(image, data, self->width, self->height, self->width, 0);
+        } else {
+            fig_image_attach_render(image, (fig_uint32_t *) data, self->width, self->height, pixel_size * self->width, 0);
+        }
+        fig_image_set_render_origin_x(image, 0);
+        fig_image_set_render_origin_y(image, 0);
+    }
+    alloc(ud, self->render_slab, self->render_slab_pitch * self->render_slab_count, 0);
+
+    self->render_slab = slab;
+    self->render_slab_pitch = slab != NULL ? pitch : 0;
+    self->render_slab_count = slab != NULL ? self->image_count : 0;
+    return 1;
+}
+
+void *fig_animation_get_render_slab(fig_animation *self) {
+    return self->render_slab;
+}
+
+size_t fig_animation_get_render_slab_pitch(fig_animation *self) {
+    return self->render_slab_pitch;
+}
+
+void fig_animation_release_render_slab(fig_animation *self) {
+    const fig_uint8_t *slab = (const fig_uint8_t *) self->render_slab;
+    size_t slab_size = self->render_slab_pitch * self->render_slab_count;
+    size_t i;
+
+    if(slab == NULL) {
+        return;
+    }
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        const fig_uint8_t *data = fig_image_get_render_data(image) != NULL
+            ? (const fig_uint8_t *) fig_image_get_render_data(image)
+            : fig_image_get_render_index_data(image);
+
+        if(data != NULL && data >= slab && data < slab + slab_size) {
+            fig_image_resize_render(image, 0, 0);
+        }
+    }
+    fig_state_get_storage_allocator(self->state)(fig_state_get_storage_userdata(self->state), self->render_slab, slab_size, 0);
+    self->render_slab = NULL;
+    self->render_slab_pitch = 0;
+    self->render_slab_count = 0;
+}
+
+fig_bool_t fig_animation_pack_indexed_data(fig_animation *self) {
+    fig_allocator_t alloc = fig_state_get_storage_allocator(self->state);
+    void *ud = fig_state_get_storage_userdata(self->state);
+    size_t pitch;
+    fig_uint8_t *slab;
+    size_t i;
+
+    pitch = 0;
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        size_t size = fig_image_get_indexed_width(image) * fig_image_get_indexed_height(image);
+        if(size > pitch) {
+            pitch = size;
+        }
+    }
+    if(self->image_count != 0 && pitch > ~(size_t) 0 / self->image_count) {
+        fig_state_set_error(self->state, "image dimensions requested are too large");
+        return 0;
+    }
+
+    slab = NULL;
+    if(pitch * self->image_count != 0) {
+        slab = (fig_uint8_t *) alloc(ud, NULL, 0, pitch * self->image_count);
+        if(slab == NULL) {
+            fig_state_set_error_allocation_failed(self->state);
+            return 0;
+        }
+    }
+
+    /* The images stop using the old block before it's freed. */
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        size_t width = fig_image_get_indexed_width(image);
+        size_t height = fig_image_get_indexed_height(image);
+        size_t stride = fig_image_get_indexed_stride(image);
+        size_t j;
+
+        if(width * height != 0) {
+            for(j = 0; j < height; ++j) {
+                memcpy(slab + i * pitch + j * width, fig_image_get_indexed_data(image) + j * stride, width);
+            }
+            fig_image_attach_indexed(image, slab + i * pitch, width, height, 0);
+        }
+    }
+    alloc(ud, self->indexed_slab, self->indexed_slab_pitch * self->indexed_slab_count, 0);
+
+    self->indexed_slab = slab;
+    self->indexed_slab_pitch = slab != NULL ? pitch : 0;
+    self->indexed_slab_count = slab != NULL ? self->image_count : 0;
+    return 1;
+}
+
+fig_uint8_t *fig_animation_get_indexed_slab(fig_animation *self) {
+    return self->indexed_slab;
+}
+
+size_t fig_animation_get_indexed_slab_pitch(fig_animation *self) {
+    return self->indexed_slab_pitch;
+}
+
+/* Drop every render surface and the indexed block, after the indexed data of
+ * every image has been replaced, since they no longer match the indexed data. */
+static void fig_animation_discard_surfaces_(fig_animation *self) {
+    size_t i;
+
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image_resize_render(self->image_data[i], 0, 0);
+    }
+    fig_animation_release_render_slab(self);
+    fig_state_get_storage_allocator(self->state)(fig_state_get_storage_userdata(self->state),
+        self->indexed_slab, self->indexed_slab_pitch * self->indexed_slab_count, 0);
+    self->indexed_slab = NULL;
+    self->indexed_slab_pitch = 0;
+    self->indexed_slab_count = 0;
+    self->render_background_index = 256;
+}
+
+/* New indexed data for an image, made by a transform of the animation. */
+typedef struct {
+    fig_uint8_t *data;
+    size_t width;
+    size_t height;
+} fig_indexed_surface_;
+
+/* Allocate an empty new indexed surface for every image. There must be at least one image.
+ * Returns NULL on failure. */
+static fig_indexed_surface_ *fig_animation_create_surfaces_(fig_animation *self) {
+    fig_indexed_surface_ *surfaces;
+    size_t i;
+
+    if(self->image_count > ~(size_t) 0 / sizeof(fig_indexed_surface_)) {
+        fig_state_set_error_allocation_failed(self->state);
+        return NULL;
+    }
+    surfaces = (fig_indexed_surface_ *) fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
+        NULL, 0, self->image_count * sizeof(fig_indexed_surface_));
+    if(surfaces == NULL) {
+        fig_state_set_error_allocation_failed(self->state);
+        return NULL;
+    }
+    for(i = 0; i < self->image_count; ++i) {
+        surfaces[i].data = NULL;
+        surfaces[i].width = 0;
+        surfaces[i].height = 0;
+    }
+    return surfaces;
+}
+
+/* Free the new indexed surfaces after a transform failed part of the way through. */
+static void fig_animation_free_surfaces_(fig_animation *self, fig_indexed_surface_ *surfaces) {
+    fig_allocator_t alloc = fig_state_get_allocator(self->state);
+    void *ud = fig_state_get_userdata(self->state);
+    size_t i;
+
+    for(i = 0; i < self->image_count; ++i) {
+        alloc(ud, surfaces[i].data, surfaces[i].width * surfaces[i].height, 0);
+    }
+    alloc(ud, surfaces, self->image_count * sizeof(fig_indexed_surface_), 0);
+}
+
+/* Give every image its new indexed surface, once the transform can no longer fail. */
+static void fig_animation_replace_indexed_(fig_animation *self, fig_indexed_surface_ *surfaces) {
+    size_t i;
+
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image_attach_indexed(self->image_data[i], surfaces[i].data, surfaces[i].width, surfaces[i].height, 1);
+    }
+    fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
+        surfaces, self->image_count * sizeof(fig_indexed_surface_), 0);
+    fig_animation_discard_surfaces_(self);
+}
+
+/* Repeat every palette index of a row factor times. */
+static void fig_scale_indexed_row_(const fig_uint8_t *src, size_t width, size_t factor, fig_uint8_t *dest) {
+    size_t i;
+
+    switch(factor) {
+        case 2:
+            for(i = 0; i < width; ++i) {
+                dest[0] = dest[1] = src[i];
+                dest += 2;
+            }
+            break;
+        case 3:
+            for(i = 0; i < width; ++i) {
+                dest[0] = dest[1] = dest[2] = src[i];
+                dest += 3;
+            }
+            break;
+        case 4:
+            for(i = 0; i < width; ++i) {
+                dest[0] = dest[1] = dest[2] = dest[3] = src[i];
+                dest += 4;
+            }
+            break;
+        default:
+            for(i = 0; i < width; ++i) {
+                memset(dest, src[i], factor);
+                dest += factor;
+            }
+            break;
+    }
+}
+
+fig_bool_t fig_animation_scale(fig_animation *self, size_t factor) {
+    fig_indexed_surface_ *surfaces;
+    size_t limit;
+    size_t i, j, k;
+
+    if(factor == 0) {
+        fig_state_set_error(self->state, "scale factor must be at least 1");
+        return 0;
+    }
+    if(factor == 1) {
+        return 1;
+    }
+
+    limit = ~(size_t) 0 / factor;
+    if(self->width > limit || self->height > limit) {
+        fig_state_set_error(self->state, "image dimensions requested are too large");
+        return 0;
+    }
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        size_t width = fig_image_get_indexed_width(image);
+        size_t height = fig_image_get_indexed_height(image);
+
+        if(fig_image_get_origin_x(image) > limit || fig_image_get_origin_y(image) > limit
+        || width > limit || height > limit
+        || (height != 0 && width * factor > ~(size_t) 0 / (height * factor))) {
+            fig_state_set_error(self->state, "image dimensions requested are too large");
+            return 0;
+        }
+    }
+
+    /* Every image is scaled into new storage first, so that a failed allocation leaves the animation as it was. */
+    if(self->image_count == 0) {
+        surfaces = NULL;
+    } else {
+        surfaces = fig_animation_create_surfaces_(self);
+        if(surfaces == NULL) {
+            return 0;
+        }
+    }
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        size_t width = fig_image_get_indexed_width(image);
+        size_t height = fig_image_get_indexed_height(image);
+        const fig_uint8_t *src = fig_image_get_indexed_data(image);
+        size_t row_size = width * factor;
+        fig_uint8_t *dest;
+
+        if(width * height == 0) {
+            continue;
+        }
+        dest = (fig_uint8_t *) fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
+            NULL, 0, row_size * height * factor);
+        if(dest == NULL) {
+            fig_animation_free_surfaces_(self, surfaces);
+            fig_state_set_error_allocation_failed(self->state);
+            return 0;
+        }
+        surfaces[i].data = dest;
+        surfaces[i].width = row_size;
+        surfaces[i].height = height * factor;
+
+        /* Each row is widened once, then copied for the rest of its rows. */
+        for(j = 0; j < height; ++j) {
+            fig_scale_indexed_row_(src, width, factor, dest);
+            for(k = 1; k < factor; ++k) {
+                memcpy(dest + k * row_size, dest, row_size);
+            }
+            src += fig_image_get_indexed_stride(image);
+            dest += row_size * factor;
+        }
+    }
+
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        fig_image_set_origin_x(image, fig_image_get_origin_x(image) * factor);
+        fig_image_set_origin_y(image, fig_image_get_origin_y(image) * factor);
+    }
+    self->width *= factor;
+    self->height *= factor;
+    if(surfaces != NULL) {
+        fig_animation_replace_indexed_(self, surfaces);
+    }
+    return 1;
+}
+
+enum {
+    /* The number of rows and columns of the tiles that transforms are copied in,
+       so that the rows read and written by a tile stay in the cache together. */
+    FIG_TRANSFORM_TILE_SIZE = 64
+};
+
+/* Copy width x height palette indices into dest, where the index at row i and column j
+ * is read from src[i * row_step + j * col_step]. */
+static void fig_transform_indexed_(const fig_uint8_t *src, ptrdiff_t row_step, ptrdiff_t col_step, fig_uint8_t *dest, size_t width, size_t height) {
+    size_t tile_y, tile_x;
+    size_t i, j;
+
+    if(col_step == 1) {
+        for(i = 0; i < height; ++i) {
+            memcpy(dest + i * width, src + (ptrdiff_t) i * row_step, width);
+        }
+        return;
+    }
+    for(tile_y = 0; tile_y < height; tile_y += FIG_TRANSFORM_TILE_SIZE) {
+        size_t tile_bottom = height - tile_y < FIG_TRANSFORM_TILE_SIZE ? height : tile_y + FIG_TRANSFORM_TILE_SIZE;
+
+        for(tile_x = 0; tile_x < width; tile_x += FIG_TRANSFORM_TILE_SIZE) {
+            size_t tile_right = width - tile_x < FIG_TRANSFORM_TILE_SIZE ? width : tile_x + FIG_TRANSFORM_TILE_SIZE;
+
+            for(i = tile_y; i < tile_bottom; ++i) {
+                const fig_uint8_t *from = src + (ptrdiff_t) i * row_step + (ptrdiff_t) tile_x * col_step;
+                fig_uint8_t *to = dest + i * width;
+
+                for(j = tile_x; j < tile_right; ++j) {
+                    to[j] = *from;
+                    from += col_step;
+                }
+            }
+        }
+    }
+}
+
+fig_bool_t fig_animation_transform(fig_animation *self, fig_transform_t transform) {
+    fig_indexed_surface_ *surfaces;
+    fig_bool_t swap_axes;
+    size_t i;
+
+    FIG_ASSERT(transform < FIG_TRANSFORM_COUNT);
+
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+
+        if(fig_image_get_origin_x(image) > self->width
+        || fig_image_get_indexed_width(image) > self->width - fig_image_get_origin_x(image)
+        || fig_image_get_origin_y(image) > self->height
+        || fig_image_get_indexed_height(image) > self->height - fig_image_get_origin_y(image)) {
+            fig_state_set_error(self->state, "transforming an animation requires every image to lie inside the canvas");
+            return 0;
+        }
+    }
+    if(self->image_count == 0) {
+        surfaces = NULL;
+    } else {
+        surfaces = fig_animation_create_surfaces_(self);
+        if(surfaces == NULL) {
+            return 0;
+        }
+    }
+
+    swap_axes = transform == FIG_TRANSFORM_ROTATE_90
+        || transform == FIG_TRANSFORM_ROTATE_270
+        || transform == FIG_TRANSFORM_TRANSPOSE;
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        size_t width = fig_image_get_indexed_width(image);
+        size_t height = fig_image_get_indexed_height(image);
+        size_t stride = fig_image_get_indexed_stride(image);
+        const fig_uint8_t *src = fig_image_get_indexed_data(image);
+        ptrdiff_t row_step;
+        ptrdiff_t col_step;
+
+        if(width * height == 0) {
+            continue;
+        }
+        surfaces[i].data = (fig_uint8_t *) fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
+            NULL, 0, width * height);
+        if(surfaces[i].data == NULL) {
+            fig_animation_free_surfaces_(self, surfaces);
+            fig_state_set_error_allocation_failed(self->state);
+            return 0;
+        }
+        surfaces[i].width = swap_axes ? height : width;
+        surfaces[i].height = swap_axes ? width : height;
+
+        /* Start from the source index that lands in the top left corner. */
+        switch(transform) {
+            case FIG_TRANSFORM_ROTATE_90:
+                src += (height - 1) * stride;
+                row_step = 1;
+                col_step = -(ptrdiff_t) stride;
+                break;
+            case FIG_TRANSFORM_ROTATE_180:
+                src += (height - 1) * stride + width - 1;
+                row_step = -(ptrdiff_t) stride;
+                col_step = -1;
+                break;
+            case FIG_TRANSFORM_ROTATE_270:
+                src += width - 1;
+                row_step = -1;
+                col_step = (ptrdiff_t) stride;
+                break;
+            case FIG_TRANSFORM_FLIP_HORIZONTAL:
+                src += width - 1;
+                row_step = (ptrdiff_t) stride;
+                col_step = -1;
+                break;
+            case FIG_TRANSFORM_FLIP_VERTICAL:
+                src += (height - 1) * stride;
+                row_step = -(ptrdiff_t) stride;
+                col_step = 1;
+                break;
+            default:
+                row_step = 1;
+                col_step = (ptrdiff_t) stride;
+                break;
+        }
+        fig_transform_indexed_(src, row_step, col_step, surfaces[i].data, surfaces[i].width, surfaces[i].height);
+    }
+
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        size_t x = fig_image_get_origin_x(image);
+        size_t y = fig_image_get_origin_y(image);
+        size_t right = self->width - x - fig_image_get_indexed_width(image);
+        size_t bottom = self->height - y - fig_image_get_indexed_height(image);
+
+        switch(transform) {
+            case FIG_TRANSFORM_ROTATE_90:
+                fig_image_set_origin_x(image, bottom);
+                fig_image_set_origin_y(image, x);
+                break;
+            case FIG_TRANSFORM_ROTATE_180:
+                fig_image_set_origin_x(image, right);
+                fig_image_set_origin_y(image, bottom);
+                break;
+            case FIG_TRANSFORM_ROTATE_270:
+                fig_image_set_origin_x(image, y);
+                fig_image_set_origin_y(image, right);
+                break;
+            case FIG_TRANSFORM_FLIP_HORIZONTAL:
+                fig_image_set_origin_x(image, right);
+                break;
+            case FIG_TRANSFORM_FLIP_VERTICAL:
+                fig_image_set_origin_y(image, bottom);
+                break;
+            default:
+                fig_image_set_origin_x(image, y);
+                fig_image_set_origin_y(image, x);
+                break;
+        }
+    }
+    if(swap_axes) {
+        size_t width = self->width;
+        self->width = self->height;
+        self->height = width;
+    }
+    if(surfaces != NULL) {
+        fig_animation_replace_indexed_(self, surfaces);
+    }
+    return 1;
+}
+
+size_t fig_animation_get_render_background_index(fig_animation *self) {
+    return fig_animation_find_background_index_(self);
+}
+
+size_t fig_animation_get_dirty_rects(fig_animation *self, size_t index, fig_rect *rects) {
+    fig_rect drawn;
+    fig_rect disposed;
+
+    FIG_ASSERT(index < self->image_count);
+    if(index == 0) {
+        rects[0] = fig_get_canvas_rect_(self);
+        return fig_rect_is_empty_(&rects[0]) ? 0 : 1;
+    }
+
+    /* Disposal only touches the pixels that the disposed image drew. */
+    disposed = fig_get_disposal_rect_(self, self->image_data[index - 1]);
+    if(!fig_rect_is_empty_(&disposed)) {
+        disposed = fig_get_opaque_rect_(self, self->image_data[index - 1]);
+    }
+    drawn = fig_get_opaque_rect_(self, self->image_data[index]);
+
+    if(fig_rect_is_empty_(&disposed)) {
+        rects[0] = drawn;
+        return fig_rect_is_empty_(&drawn) ? 0 : 1;
+    } else if(fig_rect_is_empty_(&drawn)) {
+        rects[0] = disposed;
+        return 1;
+    } else if(disposed.x > drawn.x + drawn.width || drawn.x > disposed.x + disposed.width
+    || disposed.y > drawn.y + drawn.height || drawn.y > disposed.y + disposed.height) {
+        rects[0] = disposed;
+        rects[1] = drawn;
+        return 2;
+    } else {
+        /* Areas that overlap or touch are reported as one. */
+        fig_rect_union_(&disposed, &drawn);
+        rects[0] = disposed;
+        return 1;
+    }
+}
+
+fig_bool_t fig_animation_is_keyframe(fig_animation *self, size_t index) {
+    FIG_ASSERT(index < self->image_count);
+    return fig_animation_is_keyframe_(self, index, fig_animation_uses_restore_(self));
+}
+
+size_t fig_animation_count_samples(fig_animation *self, size_t index) {
+    FIG_ASSERT(index < self->image_count);
+    return fig_animation_count_samples_(self, index, fig_animation_get_image_time_(self, index));
+}
+
+/* Two independent lanes of 32-bit multiply and rotate mixing, which together make a 64-bit hash
+ * without needing a 64-bit integer type. */
+typedef struct {
+    fig_uint32_t lanes[2];
+    fig_uint32_t length;
+} fig_hash_;
+
+static fig_uint32_t fig_hash_rotate_(fig_uint32_t value, unsigned bits) {
+    return (fig_uint32_t) ((value << bits) | (value >> (32 - bits)));
+}
+
+static void fig_hash_init_(fig_hash_ *hash) {
+    hash->lanes[0] = 0x811C9DC5;
+    hash->lanes[1] = 0x9E3779B9;
+    hash->length = 0;
+}
+
+static void fig_hash_word_(fig_hash_ *hash, fig_uint32_t word) {
+    fig_uint32_t key = fig_hash_rotate_((fig_uint32_t) (word * 0xCC9E2D51), 15) * 0x1B873593;
+
+    hash->lanes[0] = fig_hash_rotate_(hash->lanes[0] ^ key, 13) * 5 + 0xE6546B64;
+    hash->lanes[1] = fig_hash_rotate_(hash->lanes[1] ^ (fig_uint32_t) (key * 0x85EBCA6B), 17) * 9 + 0x52DCE729;
+    ++hash->length;
+}
+
+static void fig_hash_bytes_(fig_hash_ *hash, const fig_uint8_t *data, size_t size) {
+    size_t i;
+
+    for(i = 0; i + 4 <= size; i += 4) {
+        fig_hash_word_(hash, (fig_uint32_t) data[i]
+            | ((fig_uint32_t) data[i + 1] << 8)
+            | ((fig_uint32_t) data[i + 2] << 16)
+            | ((fig_uint32_t) data[i + 3] << 24));
+    }
+    if(i < size) {
+        fig_uint32_t word = 0;
+        size_t shift;
+
+        for(shift = 0; i < size; ++i, shift += 8) {
+            word |= (fig_uint32_t) data[i] << shift;
+        }
+        fig_hash_word_(hash, word);
+    }
+}
+
+static fig_uint32_t fig_hash_avalanche_(fig_uint32_t value) {
+    value ^= value >> 16;
+    value *= 0x85EBCA6B;
+    value ^= value >> 13;
+    value *= 0xC2B2AE35;
+    value ^= value >> 16;
+    return value;
+}
+
+/* Mix the lanes together and write the hash as 8 bytes, most significant first. */
+static void fig_hash_finish_(const fig_hash_ *hash, fig_uint8_t *out) {
+    fig_uint32_t a = fig_hash_avalanche_(hash->lanes[0] ^ hash->length);
+    fig_uint32_t b = fig_hash_avalanche_(hash->lanes[1] ^ (hash->length * 0x9E3779B9));
+    size_t i;
+
+    a += b;
+    b += a;
+    for(i = 0; i < 4; ++i) {
+        out[i] = (fig_uint8_t) ((a >> (24 - i * 8)) & 0xFF);
+        out[i + 4] = (fig_uint8_t) ((b >> (24 - i * 8)) & 0xFF);
+    }
+}
+
+static void fig_hash_image_content_(fig_animation *self, fig_image *image, fig_uint8_t *out) {
+    fig_palette *palette = fig_animation_get_render_palette(self, image);
+    const fig_uint8_t *data = fig_image_get_indexed_data(image);
+    size_t stride = fig_image_get_indexed_stride(image);
+    size_t width = fig_image_get_indexed_width(image);
+    size_t height = fig_image_get_indexed_height(image);
+    fig_uint32_t *colors = fig_palette_get_colors(palette);
+    size_t color_count = fig_palette_count_colors(palette);
+    fig_hash_ hash;
+    size_t i;
+
+    fig_hash_init_(&hash);
+    fig_hash_word_(&hash, (fig_uint32_t) fig_image_get_origin_x(image));
+    fig_hash_word_(&hash, (fig_uint32_t) fig_image_get_origin_y(image));
+    fig_hash_word_(&hash, (fig_uint32_t) width);
+    fig_hash_word_(&hash, (fig_uint32_t) height);
+    fig_hash_word_(&hash, fig_image_get_transparent(image) ? (fig_uint32_t) fig_image_get_transparency_index(image) : 0xFFFFFFFF);
+    fig_hash_word_(&hash, (fig_uint32_t) color_count);
+    for(i = 0; i < color_count; ++i) {
+        fig_hash_word_(&hash, colors[i]);
+    }
+    for(i = 0; i < height; ++i) {
+        fig_hash_bytes_(&hash, data + i * stride, width);
+    }
+    fig_hash_finish_(&hash, out);
+}
+
+fig_bool_t fig_animation_hash_images(fig_animation *self) {
+    fig_allocator_t alloc = fig_state_get_allocator(self->state);
+    void *ud = fig_state_get_userdata(self->state);
+    fig_compositor_ compositor;
+    fig_uint32_t *row_hashes;
+    size_t i, y;
+
+    if(self->image_count == 0) {
+        return 1;
+    }
+    if(self->width == 0 || self->height == 0) {
+        fig_state_set_error(self->state, "image is empty");
+        return 0;
+    }
+    if(self->height > ~(size_t) 0 / sizeof(fig_uint32_t) / 2) {
+        fig_state_set_error(self->state, "image dimensions requested are too large");
+        return 0;
+    }
+    row_hashes = (fig_uint32_t *) alloc(ud, NULL, 0, self->height * 2 * sizeof(fig_uint32_t));
+    if(row_hashes == NULL) {
+        fig_state_set_error_allocation_failed(self->state);
+        return 0;
+    }
+    if(!fig_compositor_init_(&compositor, self, NULL)) {
+        alloc(ud, row_hashes, self->height * 2 * sizeof(fig_uint32_t), 0);
+        return 0;
+    }
+
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        fig_rect rect = fig_compositor_draw_(&compositor, image);
+        fig_uint8_t content_hash[8];
+        fig_uint8_t frame_hash[8];
+        fig_hash_ hash;
+
+        /* Rows outside of the area that changed keep their hashes from the image before. */
+        for(y = rect.y; y < rect.y + rect.height; ++y) {
+            const fig_uint32_t *row = compositor.canvas + y * compositor.pitch;
+            size_t x;
+
+            fig_hash_init_(&hash);
+            for(x = 0; x < self->width; ++x) {
+                fig_hash_word_(&hash, row[x]);
+            }
+            row_hashes[y * 2] = hash.lanes[0];
+            row_hashes[y * 2 + 1] = hash.lanes[1];
+        }
+
+        fig_hash_init_(&hash);
+        fig_hash_word_(&hash, (fig_uint32_t) self->width);
+        fig_hash_word_(&hash, (fig_uint32_t) self->height);
+        for(y = 0; y < self->height * 2; ++y) {
+            fig_hash_word_(&hash, row_hashes[y]);
+        }
+        fig_hash_finish_(&hash, frame_hash);
+        fig_hash_image_content_(self, image, content_hash);
+        fig_image_set_hashes(image, content_hash, frame_hash);
+    }
+
+    fig_compositor_free_(&compositor);
+    alloc(ud, row_hashes, self->height * 2 * sizeof(fig_uint32_t), 0);
+    return 1;
+}
+
+fig_bool_t fig_animation_find_duplicate_frames(fig_animation *self, size_t *firsts, size_t *distinct_count) {
+    fig_allocator_t alloc = fig_state_get_allocator(self->state);
+    void *ud = fig_state_get_userdata(self->state);
+    size_t *table;
+    size_t table_size;
+    size_t distinct;
+    size_t i;
+
+    for(i = 0; i < self->image_count; ++i) {
+        if(fig_image_get_frame_hash(self->image_data[i]) == NULL) {
+            if(!fig_animation_hash_images(self)) {
+                return 0;
+            }
+            break;
+        }
+    }
+
+    /* An open addressing table of image indices plus one, kept at most half full. */
+    table_size = 16;
+    while(table_size < self->image_count * 2) {
+        table_size *= 2;
+    }
+    if(table_size > ~(size_t) 0 / sizeof(size_t)) {
+        fig_state_set_error(self->state, "too many images");
+        return 0;
+    }
+    table = (size_t *) alloc(ud, NULL, 0, table_size * sizeof(size_t));
+    if(table == NULL) {
+        fig_state_set_error_allocation_failed(self->state);
+        return 0;
+    }
+    memset(table, 0, table_size * sizeof(size_t));
+
+    distinct = 0;
+    for(i = 0; i < self->image_count; ++i) {
+        const fig_uint8_t *hash = fig_image_get_frame_hash(self->image_data[i]);
+        size_t slot = ((size_t) hash[4] << 24 | (size_t) hash[5] << 16 | (size_t) hash[6] << 8 | (size_t) hash[7]) & (table_size - 1);
+
+        while(table[slot] != 0
+        && memcmp(fig_image_get_frame_hash(self->image_data[table[slot] - 1]), hash, 8) != 0) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if(table[slot] == 0) {
+            table[slot] = i + 1;
+            ++distinct;
+        }
+        firsts[i] = table[slot] - 1;
+    }
+
+    alloc(ud, table, table_size * sizeof(size_t), 0);
+    *distinct_count = distinct;
+    return 1;
+}
+
+fig_bool_t fig_animation_render_image_range(fig_animation *self, size_t start, size_t end) {
+    if(self->width == 0 && self->height == 0) {
+        fig_state_set_error(self->state, "image is empty");
+        return 0;
+    }
+    if(start > end || end > self->image_count) {
+        fig_state_set_error(self->state, "image range is out of bounds");
+        return 0;
+    }
+    if(start < end && !fig_animation_is_keyframe(self, start)) {
+        fig_state_set_error(self->state, "image range does not start at a keyframe");
+        return 0;
+    }
+
+    switch(self->render_mode) {
+        case FIG_RENDER_MODE_DELTA:
+            return fig_render_images_delta_(self, start, end);
+        case FIG_RENDER_MODE_CHECKPOINT:
+            return fig_render_images_checkpoint_(self, start, end);
+        case FIG_RENDER_MODE_INDEX:
+            return fig_render_images_index_(self, start, end);
+        case FIG_RENDER_MODE_SAMPLED:
+            return fig_render_images_sampled_(self, start, end);
+        case FIG_RENDER_MODE_FULL:
+        default:
+            return fig_render_images_full_(self, start, end);
+    }
+}
+
+fig_bool_t fig_animation_get_frame_rgba(fig_animation *self, size_t index, fig_uint32_t *out) {
+    fig_compositor_ compositor;
+
+    if(index >= self->image_count) {
+        fig_state_set_error(self->state, "image index is out of range");
+        return 0;
+    }
+    if(self->width == 0 && self->height == 0) {
+        fig_state_set_error(self->state, "image is empty");
+        return 0;
+    }
+    if(!fig_compositor_init_(&compositor, self, out)) {
+        return 0;
+    }
+
+    fig_compositor_seek_(&compositor, index);
+    fig_compositor_free_(&compositor);
+    return 1;
+}
+
+fig_bool_t fig_animation_get_frame_area_rgba(fig_animation *self, size_t index, const fig_rect *area, fig_uint32_t *out, size_t out_stride) {
+    fig_compositor_ compositor;
+
+    if(index >= self->image_count) {
+        fig_state_set_error(self->state, "image index is out of range");
+        return 0;
+    }
+    if(area->x > self->width || area->width > self->width - area->x
+    || area->y > self->height || area->height > self->height - area->y) {
+        fig_state_set_error(self->state, "area is outside of the canvas");
+        return 0;
+    }
+    if(out_stride % sizeof(fig_uint32_t) != 0 || out_stride / sizeof(fig_uint32_t) < area->width) {
+        fig_state_set_error(self->state, "stride is too small for the width");
+        return 0;
+    }
+    if(fig_rect_is_empty_(area)) {
+        return 1;
+    }
+    if(!fig_compositor_init_area_(&compositor, self, area, out, out_stride / sizeof(fig_uint32_t))) {
+        return 0;
+    }
+
+    fig_compositor_seek_(&compositor, index);
+    fig_compositor_free_(&compositor);
+    return 1;
+}
+
+fig_palette *fig_animation_get_render_palette(fig_animation *self, fig_image *image) {
+    fig_palette *local_palette = fig_image_get_palette(image);
+    if(fig_palette_count_colors(local_palette) > 0) {
+        return local_palette;
+    } else {
+        return self->palette;
+    }
+}
+
+void fig_animation_convert_render(fig_animation *self, fig_image *image, void *out, size_t out_stride, fig_pixel_format_t format) {
+    size_t width = fig_image_get_render_width(image);
+    size_t height = fig_image_get_render_height(image);
+    fig_uint8_t *dest = (fig_uint8_t *) out
+        + fig_image_get_render_origin_y(image) * out_stride
+        + fig_image_get_render_origin_x(image) * fig_pixel_format_get_size(format);
+
+    FIG_ASSERT(fig_image_get_render_origin_x(image) + width <= self->width);
+    FIG_ASSERT(fig_image_get_render_origin_y(image) + height <= self->height);
+
+    if(fig_image_get_render_index_data(image) != NULL) {
+        fig_uint32_t colors[256];
+
+        fig_get_index_canvas_colors_(self, self->palette, colors);
+        fig_convert_indices(fig_image_get_render_index_data(image), fig_image_get_render_stride(image), colors, 256, dest, out_stride, width, height, format);
+    } else if(fig_image_get_render_data(image) != NULL) {
+        fig_convert_colors(fig_image_get_render_data(image), fig_image_get_render_stride(image), dest, out_stride, width, height, format);
+    }
+}
+
+fig_bool_t fig_animation_convert_render_palette(fig_animation *self, fig_image *image, fig_palette *palette, const fig_rect *area, void *out, size_t out_stride, fig_pixel_format_t format) {
+    fig_rect surface_rect;
+    fig_rect rect;
+    fig_uint32_t colors[256];
+    size_t stride = fig_image_get_render_stride(image);
+    const fig_uint8_t *src = fig_image_get_render_index_data(image);
+    fig_uint8_t *dest;
+
+    if(src == NULL) {
+        fig_state_set_error(self->state, "palette swapping requires a render surface of palette indices");
+        return 0;
+    }
+
+    surface_rect.x = fig_image_get_render_origin_x(image);
+    surface_rect.y = fig_image_get_render_origin_y(image);
+    surface_rect.width = fig_image_get_render_width(image);
+    surface_rect.height = fig_image_get_render_height(image);
+    FIG_ASSERT(surface_rect.x + surface_rect.width <= self->width);
+    FIG_ASSERT(surface_rect.y + surface_rect.height <= self->height);
+    rect = area != NULL ? fig_rect_intersect_(&surface_rect, area) : surface_rect;
+    if(fig_rect_is_empty_(&rect)) {
+        return 1;
+    }
+
+    fig_get_index_canvas_colors_(self, palette, colors);
+    src += (rect.y - surface_rect.y) * stride + (rect.x - surface_rect.x);
+    dest = (fig_uint8_t *) out + rect.y * out_stride + rect.x * fig_pixel_format_get_size(format);
+    fig_convert_indices(src, stride, colors, 256, dest, out_stride, rect.width, rect.height, format);
+    return 1;
+}
+
+void fig_animation_free(fig_animation *self) {
+    if(self != NULL) {
+        fig_allocator_t alloc = fig_state_get_allocator(self->state);
+        void *ud = fig_state_get_userdata(self->state);
+
+        if(self->palette != NULL) {
+            fig_palette_free(self->palette);
+        }
+        if(self->image_data != NULL) {
+            fig_image **data;
+            size_t i;
+
+            data = self->image_data;
+            for(i = 0; i < self->image_count; ++i) {
+                fig_image_free(data[i]);
+            }
+            alloc(ud, data, sizeof(fig_image *) * self->image_count, 0);
+        }
+        fig_state_get_storage_allocator(self->state)(fig_state_get_storage_userdata(self->state),
+            self->render_slab, self->render_slab_pitch * self->render_slab_count, 0);
+        fig_state_get_storage_allocator(self->state)(fig_state_get_storage_userdata(self->state),
+            self->indexed_slab, self->indexed_slab_pitch * self->indexed_slab_count, 0);
+        alloc(ud, self, sizeof(fig_animation), 0);
+    }
+}
+
+
+
+struct fig_player {
+    fig_state *state;
+    fig_animation *animation;
+    fig_compositor_ compositor;
+    /* The time at which each image starts within a loop, followed by the duration of a loop. */
+    size_t *start_times;
+    size_t loop;
+};
+
+fig_player *fig_create_player(fig_state *state, fig_animation *animation) {
+    if(state != NULL) {
+        fig_player *self;
+
+        if(animation == NULL) {
+            fig_state_set_error(state, "animation is NULL");
+            return NULL;
+        }
+        if(animation->image_count == 0
+        || (animation->width == 0 && animation->height == 0)) {
+            fig_state_set_error(state, "image is empty");
+            return NULL;
+        }
+
+        self = (fig_player *) fig_state_get_allocator(state)(fig_state_get_userdata(state), NULL, 0, sizeof(fig_player));
+        if(self != NULL) {
+            size_t i;
+
+            self->state = state;
+            self->animation = animation;
+            self->loop = 0;
+            self->start_times = (size_t *) fig_state_get_allocator(state)(fig_state_get_userdata(state), NULL, 0, (animation->image_count + 1) * sizeof(size_t));
+            if(self->start_times == NULL) {
+                fig_state_set_error_allocation_failed(state);
+                fig_state_get_allocator(state)(fig_state_get_userdata(state), self, sizeof(fig_player), 0);
+                return NULL;
+            }
+            self->start_times[0] = 0;
+            for(i = 0; i < animation->image_count; ++i) {
+                self->start_times[i + 1] = self->start_times[i] + fig_image_get_delay(animation->image_data[i]);
+            }
+
+            if(!fig_compositor_init_(&self->compositor, animation, NULL)) {
+                fig_state_get_allocator(state)(fig_state_get_userdata(state), self->start_times, (animation->image_count + 1) * sizeof(size_t), 0);
+                fig_state_get_allocator(state)(fig_state_get_userdata(state), self, sizeof(fig_player), 0);
+                return NULL;
+            }
+            fig_compositor_seek_(&self->compositor, 0);
+        } else {
+            fig_state_set_error_allocation_failed(state);
+        }
+        return self;
+    }
+    return NULL;
+}
+
+const fig_uint32_t *fig_player_get_canvas(fig_player *self) {
+    return self->compositor.canvas;
+}
+
+size_t fig_player_get_image_index(fig_player *self) {
+    return self->compositor.position - 1;
+}
+
+size_t fig_player_get_loop_index(fig_player *self) {
+    return self->loop;
+}
+
+size_t fig_player_get_time(fig_player *self) {
+    return self->loop * self->start_times[self->animation->image_count]
+        + self->start_times[self->compositor.position - 1];
+}
+
+fig_bool_t fig_player_advance(fig_player *self) {
+    fig_animation *animation = self->animation;
+    size_t index = self->compositor.position;
+
+    if(index >= animation->image_count) {
+        if(animation->loop_count != 0 && self->loop >= animation->loop_count) {
+            return 0;
+        }
+        ++self->loop;
+        index = 0;
+    }
+    fig_compositor_seek_(&self->compositor, index);
+    return 1;
+}
+
+fig_bool_t fig_player_seek_time(fig_player *self, size_t time) {
+    fig_animation *animation = self->animation;
+    size_t duration;
+    size_t loop;
+    size_t index;
+    fig_bool_t finished;
+
+    duration = self->start_times[animation->image_count];
+    loop = duration != 0 ? time / duration : 0;
+    /* A loop count is the number of times the animation repeats after it first plays. */
+    finished = animation->loop_count != 0 && (duration == 0 || loop > animation->loop_count);
+
+    if(finished || duration == 0) {
+        /* Past the end of playback, the last image of the last loop stays on display.
+         * An animation without any delays shows only its last image, even when looping forever. */
+        loop = finished ? animation->loop_count : 0;
+        index = animation->image_count - 1;
+    } else {
+        size_t low = 0;
+        size_t high = animation->image_count - 1;
+
+        /* Find the first image that ends after the time, skipping images without a delay. */
+        time %= duration;
+        while(low < high) {
+            size_t middle = low + (high - low) / 2;
+            if(self->start_times[middle + 1] > time) {
+                high = middle;
+            } else {
+                low = middle + 1;
+            }
+        }
+        index = low;
+    }
+
+    /* Every loop draws the same images, so the canvas can be reused across loops. */
+    self->loop = loop;
+    fig_compositor_seek_(&self->compositor, index);
+    return !finished;
+}
+
+void fig_player_free(fig_player *self) {
+    if(self != NULL) {
+        fig_compositor_free_(&self->compositor);
+        fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state), self->start_times, (self->animation->image_count + 1) * sizeof(size_t), 0);
+        fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state), self, sizeof(fig_player), 0);
+    }
+}
+
+struct fig_atlas {
+    fig_state *state;
+    size_t width;
+    size_t height;
+    fig_uint32_t *data;
+    fig_uint8_t *index_data;
+    size_t sprite_count;
+    size_t frame_count;
+    fig_atlas_frame *frames;
+};
+
+/* A distinct trimmed frame, kept in the pixel buffer of the builder until it's placed. */
+typedef struct {
+    size_t offset;
+    size_t width;
+    size_t height;
+    fig_uint32_t hash;
+    size_t x;
+    size_t y;
+} fig_atlas_sprite_;
+
+/* A segment of the top edge of the packed sprites, spanning width pixels from x at height y. */
+typedef struct {
+    size_t x;
+    size_t y;
+    size_t width;
+} fig_atlas_skyline_node_;
+
+/* Everything allocated while packing an atlas. */
+typedef struct {
+    fig_state *state;
+    size_t pixel_size;
+    fig_uint8_t background;
+    fig_player *player;
+    fig_atlas_sprite_ *sprites;
+    size_t sprite_count;
+    fig_uint8_t *pixels;
+    size_t pixels_used;
+    size_t pixels_capacity;
+    /* Open addressed table of sprite index + 1 by hash, where 0 marks an empty slot. */
+    size_t *table;
+    size_t table_size;
+    /* The sprite shown by each frame, or (size_t) -1 if the frame is transparent. */
+    size_t *frame_sprites;
+    fig_rect *frame_bounds;
+    fig_atlas_sprite_ **order;
+    fig_atlas_skyline_node_ *nodes;
+    size_t node_count;
+    fig_atlas_frame *frames;
+    fig_uint8_t *data;
+    size_t data_size;
+    /* The number of items that each array above was allocated with. */
+    size_t image_count;
+} fig_atlas_builder_;
+
+fig_atlas *fig_create_atlas(fig_state *state) {
+    if(state != NULL) {
+        fig_atlas *self = (fig_atlas *) fig_state_get_allocator(state)(fig_state_get_userdata(state), NULL, 0, sizeof(fig_atlas));
+        if(self != NULL) {
+            self->state = state;
+            self->width = 0;
+            self->height = 0;
+            self->data = NULL;
+            self->index_data = NULL;
+            self->sprite_count = 0;
+            self->frame_count = 0;
+            self->frames = NULL;
+        } else {
+            fig_state_set_error_allocation_failed(state);
+        }
+        return self;
+    }
+    return NULL;
+}
+
+static void *fig_atlas_builder_alloc_(fig_atlas_builder_ *builder, size_t count, size_t size) {
+    void *result;
+
+    if(count == 0) {
+        count = 1;
+    }
+    if(count > ~(size_t) 0 / size) {
+        fig_state_set_error_allocation_failed(builder->state);
+        return NULL;
+    }
+    result = fig_state_get_allocator(builder->state)(fig_state_get_userdata(builder->state), NULL, 0, count * size);
+    if(result == NULL) {
+        fig_state_set_error_allocation_failed(builder->state);
+    }
+    return result;
+}
+
+static void fig_atlas_builder_free_(fig_atlas_builder_ *builder) {
+    fig_allocator_t alloc = fig_state_get_allocator(builder->state);
+    void *ud = fig_state_get_userdata(builder->state);
+    size_t count = builder->image_count != 0 ? builder->image_count : 1;
+
+    if(builder->player != NULL) {
+        fig_player_free(builder->player);
+    }
+    alloc(ud, builder->sprites, count * sizeof(fig_atlas_sprite_), 0);
+    alloc(ud, builder->pixels, builder->pixels_capacity, 0);
+    alloc(ud, builder->table, builder->table_size * sizeof(size_t), 0);
+    alloc(ud, builder->frame_sprites, count * sizeof(size_t), 0);
+    alloc(ud, builder->frame_bounds, count * sizeof(fig_rect), 0);
+    alloc(ud, builder->order, count * sizeof(fig_atlas_sprite_ *), 0);
+    alloc(ud, builder->nodes, (count + 1) * sizeof(fig_atlas_skyline_node_), 0);
+    alloc(ud, builder->frames, count * sizeof(fig_atlas_frame), 0);
+    alloc(ud, builder->data, builder->data_size, 0);
+}
+
+static fig_bool_t fig_atlas_is_opaque_(const fig_atlas_builder_ *builder, const fig_uint8_t *row, size_t x) {
+    if(builder->pixel_size == sizeof(fig_uint32_t)) {
+        return (((const fig_uint32_t *) row)[x] >> 24) != 0;
+    } else {
+        return row[x] != builder->background;
+    }
+}
+
+/* Find the bounds of the pixels of a frame that aren't transparent.
+ * Returns 0 if the whole frame is transparent. */
+static fig_bool_t fig_atlas_trim_(const fig_atlas_builder_ *builder, const fig_uint8_t *src, size_t stride, size_t width, size_t height, fig_rect *bounds) {
+    size_t left = width;
+    size_t right = 0;
+    size_t top = height;
+    size_t bottom = 0;
+    size_t i, j;
+
+    for(i = 0; i < height; ++i) {
+        const fig_uint8_t *row = src + i * stride;
+        size_t first;
+
+        for(first = 0; first < width; ++first) {
+            if(fig_atlas_is_opaque_(builder, row, first)) {
+                break;
+            }
+        }
+        if(first == width) {
+            continue;
+        }
+        if(first < left) {
+            left = first;
+        }
+        for(j = width; j > right && j > first; --j) {
+            if(fig_atlas_is_opaque_(builder, row, j - 1)) {
+                right = j;
+                break;
+            }
+        }
+        if(top == height) {
+            top = i;
+        }
+        bottom = i + 1;
+    }
+    if(top == height) {
+        return 0;
+    }
+    bounds->x = left;
+    bounds->y = top;
+    bounds->width = right - left;
+    bounds->height = bottom - top;
+    return 1;
+}
+
+/* FNV-1a over the rows of a trimmed frame. */
+static fig_uint32_t fig_atlas_hash_(const fig_uint8_t *src, size_t stride, size_t row_size, size_t height) {
+    fig_uint32_t hash = 2166136261u;
+    size_t i, j;
+
+    for(i = 0; i < height; ++i) {
+        const fig_uint8_t *row = src + i * stride;
+
+        for(j = 0; j < row_size; ++j) {
+            hash = (hash ^ row[j]) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+/* Find a sprite identical to a trimmed frame, or store the frame as a new sprite.
+ * Returns the index of the sprite, or (size_t) -1 on failure. */
+static size_t fig_atlas_add_sprite_(fig_atlas_builder_ *builder, const fig_uint8_t *src, size_t stride, size_t width, size_t height) {
+    size_t row_size = width * builder->pixel_size;
+    fig_uint32_t hash = fig_atlas_hash_(src, stride, row_size, height) ^ (fig_uint32_t) (width * 31 + height);
+    size_t mask = builder->table_size - 1;
+    size_t slot = hash & mask;
+    fig_atlas_sprite_ *sprite;
+    size_t i;
+
+    while(builder->table[slot] != 0) {
+        sprite = &builder->sprites[builder->table[slot] - 1];
+        if(sprite->hash == hash && sprite->width == width && sprite->height == height) {
+            const fig_uint8_t *stored = builder->pixels + sprite->offset;
+
+            for(i = 0; i < height; ++i) {
+                if(memcmp(stored + i * row_size, src + i * stride, row_size) != 0) {
+                    break;
+                }
+            }
+            if(i == height) {
+                return builder->table[slot] - 1;
+            }
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if(row_size * height > builder->pixels_capacity - builder->pixels_used) {
+        size_t capacity = builder->pixels_capacity;
+        fig_uint8_t *pixels;
+
+        while(row_size * height > capacity - builder->pixels_used) {
+            if(capacity > ~(size_t) 0 / 2) {
+                fig_state_set_error_allocation_failed(builder->state);
+                return (size_t) -1;
+            }
+            capacity = capacity != 0 ? capacity * 2 : 4096;
+        }
+        pixels = (fig_uint8_t *) fig_state_get_allocator(builder->state)(fig_state_get_userdata(builder->state),
+            builder->pixels, builder->pixels_capacity, capacity);
+        if(pixels == NULL) {
+            fig_state_set_error_allocation_failed(builder->state);
+            return (size_t) -1;
+        }
+        builder->pixels = pixels;
+        builder->pixels_capacity = capacity;
+    }
+
+    sprite = &builder->sprites[builder->sprite_count];
+    sprite->offset = builder->pixels_used;
+    sprite->width = width;
+    sprite->height = height;
+    sprite->hash = hash;
+    sprite->x = 0;
+    sprite->y = 0;
+    for(i = 0; i < height; ++i) {
+        memcpy(builder->pixels + builder->pixels_used, src + i * stride, row_size);
+        builder->pixels_used += row_size;
+    }
+    builder->table[slot] = ++builder->sprite_count;
+    return builder->sprite_count - 1;
+}
+
+/* Order sprites tallest first, then widest first, so that short sprites fill the gaps left by tall ones. */
+static int fig_atlas_compare_sprites_(const void *a, const void *b) {
+    const fig_atlas_sprite_ *sprite_a = *(fig_atlas_sprite_ * const *) a;
+    const fig_atlas_sprite_ *sprite_b = *(fig_atlas_sprite_ * const *) b;
+
+    if(sprite_a->height != sprite_b->height) {
+        return sprite_a->height > sprite_b->height ? -1 : 1;
+    }
+    if(sprite_a->width != sprite_b->width) {
+        return sprite_a->width > sprite_b->width ? -1 : 1;
+    }
+    return sprite_a < sprite_b ? -1 : sprite_a > sprite_b;
+}
+
+/* Place a width x height rectangle on the lowest part of the skyline that fits it, leftmost first.
+ * Returns 0 if the rectangle is wider than the skyline. */
+static fig_bool_t fig_atlas_skyline_place_(fig_atlas_builder_ *builder, size_t width, size_t height, size_t *x, size_t *y) {
+    fig_atlas_skyline_node_ *nodes = builder->nodes;
+    size_t skyline_width = nodes[builder->node_count - 1].x + nodes[builder->node_count - 1].width;
+    size_t best_index = builder->node_count;
+    size_t best_y = ~(size_t) 0;
+    fig_atlas_skyline_node_ node;
+    size_t i, j;
+
+    for(i = 0; i < builder->node_count && width <= skyline_width - nodes[i].x; ++i) {
+        size_t remaining = width;
+        size_t top = 0;
+
+        for(j = i; remaining > 0; ++j) {
+            if(nodes[j].y > top) {
+                top = nodes[j].y;
+            }
+            if(nodes[j].width >= remaining) {
+                break;
+            }
+            remaining -= nodes[j].width;
+        }
+        if(top < best_y) {
+            best_y = top;
+            best_index = i;
+        }
+    }
+    if(best_index == builder->node_count) {
+        return 0;
+    }
+
+    /* Insert the top edge of the rectangle, then cut away the segments it covers. */
+    node.x = nodes[best_index].x;
+    node.y = best_y + height;
+    node.width = width;
+    memmove(&nodes[best_index + 1], &nodes[best_index], (builder->node_count - best_index) * sizeof(fig_atlas_skyline_node_));
+    nodes[best_index] = node;
+    ++builder->node_count;
+    i = best_index + 1;
+    while(i < builder->node_count && nodes[i].x < node.x + node.width) {
+        size_t shrink = node.x + node.width - nodes[i].x;
+
+        if(nodes[i].width > shrink) {
+            nodes[i].x += shrink;
+            nodes[i].width -= shrink;
+            break;
+        }
+        memmove(&nodes[i], &nodes[i + 1], (builder->node_count - i - 1) * sizeof(fig_atlas_skyline_node_));
+        --builder->node_count;
+    }
+    for(i = 0; i + 1 < builder->node_count; ) {
+        if(nodes[i].y == nodes[i + 1].y) {
+            nodes[i].width += nodes[i + 1].width;
+            memmove(&nodes[i + 1], &nodes[i + 2], (builder->node_count - i - 2) * sizeof(fig_atlas_skyline_node_));
+            --builder->node_count;
+        } else {
+            ++i;
+        }
+    }
+
+    *x = node.x;
+    *y = best_y;
+    return 1;
+}
+
+/* Get the smallest whole number whose square is at least n. */
+static size_t fig_atlas_sqrt_ceil_(size_t n) {
+    size_t x, y;
+
+    if(n < 2) {
+        return n;
+    }
+    x = n;
+    y = n / 2 + 1;
+    while(y < x) {
+        x = y;
+        y = (x + n / x) / 2;
+    }
+    return x * x < n ? x + 1 : x;
+}
+
+/* Composite and trim every frame of the animation, storing the distinct ones as sprites. */
+static fig_bool_t fig_atlas_collect_sprites_(fig_atlas_builder_ *builder, fig_animation *animation) {
+    fig_image **images = fig_animation_get_images(animation);
+    size_t width = fig_animation_get_width(animation);
+    size_t height = fig_animation_get_height(animation);
+    size_t i;
+
+    for(i = 0; i < builder->image_count; ++i) {
+        const fig_uint8_t *src;
+        size_t stride;
+        fig_rect *bounds = &builder->frame_bounds[i];
+
+        if(builder->player != NULL) {
+            if(i > 0) {
+                fig_player_advance(builder->player);
+            }
+            src = (const fig_uint8_t *) fig_player_get_canvas(builder->player);
+            stride = width * sizeof(fig_uint32_t);
+        } else {
+            src = fig_image_get_render_index_data(images[i]);
+            stride = fig_image_get_render_stride(images[i]);
+        }
+
+        builder->frame_sprites[i] = (size_t) -1;
+        if(fig_atlas_trim_(builder, src, stride, width, height, bounds)) {
+            builder->frame_sprites[i] = fig_atlas_add_sprite_(builder,
+                src + bounds->y * stride + bounds->x * builder->pixel_size, stride, bounds->width, bounds->height);
+            if(builder->frame_sprites[i] == (size_t) -1) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/* Pack the sprites and copy them into a new atlas surface. */
+static fig_bool_t fig_atlas_place_sprites_(fig_atlas_builder_ *builder, const fig_atlas_options *options, size_t *atlas_width, size_t *atlas_height) {
+    size_t padding = options->padding;
+    size_t limit;
+    size_t area;
+    size_t width;
+    size_t height;
+    size_t i, j;
+
+    limit = options->max_width;
+    area = 0;
+    for(i = 0; i < builder->sprite_count; ++i) {
+        fig_atlas_sprite_ *sprite = &builder->sprites[i];
+
+        if(sprite->width > ~(size_t) 0 - padding || sprite->height > ~(size_t) 0 - padding
+        || (sprite->width + padding) > (~(size_t) 0 - area) / (sprite->height + padding)) {
+            fig_state_set_error(builder->state, "atlas dimensions requested are too large");
+            return 0;
+        }
+        area += (sprite->width + padding) * (sprite->height + padding);
+        if(options->max_width == 0 && sprite->width > limit) {
+            limit = sprite->width;
+        }
+        builder->order[i] = sprite;
+    }
+    if(options->max_width == 0) {
+        size_t square = fig_atlas_sqrt_ceil_(area);
+        if(square > limit) {
+            limit = square;
+        }
+    }
+    if(limit > ~(size_t) 0 - padding) {
+        fig_state_set_error(builder->state, "atlas dimensions requested are too large");
+        return 0;
+    }
+
+    qsort(builder->order, builder->sprite_count, sizeof(fig_atlas_sprite_ *), fig_atlas_compare_sprites_);
+
+    /* The skyline is wider by the padding, so that the last column of sprites doesn't need padding after it. */
+    builder->nodes[0].x = 0;
+    builder->nodes[0].y = 0;
+    builder->nodes[0].width = limit + padding;
+    builder->node_count = 1;
+    width = 0;
+    height = 0;
+    for(i = 0; i < builder->sprite_count; ++i) {
+        fig_atlas_sprite_ *sprite = builder->order[i];
+
+        if(!fig_atlas_skyline_place_(builder, sprite->width + padding, sprite->height + padding, &sprite->x, &sprite->y)) {
+            fig_state_set_error(builder->state, "a frame is wider than the atlas");
+            return 0;
+        }
+        if(sprite->x + sprite->width > width) {
+            width = sprite->x + sprite->width;
+        }
+        if(sprite->y > ~(size_t) 0 - sprite->height - padding) {
+            fig_state_set_error(builder->state, "atlas dimensions requested are too large");
+            return 0;
+        }
+        if(sprite->y + sprite->height > height) {
+            height = sprite->y + sprite->height;
+        }
+    }
+
+    if(height != 0 && width > ~(size_t) 0 / height / builder->pixel_size) {
+        fig_state_set_error(builder->state, "atlas dimensions requested are too large");
+        return 0;
+    }
+    builder->data_size = width * height * builder->pixel_size;
+    if(builder->data_size != 0) {
+        builder->data = (fig_uint8_t *) fig_atlas_builder_alloc_(builder, builder->data_size, 1);
+        if(builder->data == NULL) {
+            builder->data_size = 0;
+            return 0;
+        }
+        memset(builder->data, builder->pixel_size == 1 ? builder->background : 0, builder->data_size);
+    }
+    for(i = 0; i < builder->sprite_count; ++i) {
+        fig_atlas_sprite_ *sprite = &builder->sprites[i];
+        size_t row_size = sprite->width * builder->pixel_size;
+        fig_uint8_t *dest = builder->data + (sprite->y * width + sprite->x) * builder->pixel_size;
+        const fig_uint8_t *src = builder->pixels + sprite->offset;
+
+        for(j = 0; j < sprite->height; ++j) {
+            memcpy(dest, src, row_size);
+            dest += width * builder->pixel_size;
+            src += row_size;
+        }
+    }
+
+    *atlas_width = width;
+    *atlas_height = height;
+    return 1;
+}
+
+fig_bool_t fig_atlas_pack(fig_atlas *self, fig_animation *animation, const fig_atlas_options *options) {
+    fig_atlas_builder_ builder;
+    fig_image **images = fig_animation_get_images(animation);
+    fig_allocator_t alloc = fig_state_get_allocator(self->state);
+    void *ud = fig_state_get_userdata(self->state);
+    size_t atlas_width;
+    size_t atlas_height;
+    size_t i;
+
+    memset(&builder, 0, sizeof(builder));
+    builder.state = self->state;
+    builder.image_count = fig_animation_count_images(animation);
+    builder.pixel_size = options->indexed ? sizeof(fig_uint8_t) : sizeof(fig_uint32_t);
+
+    if(options->indexed) {
+        size_t background = fig_animation_get_render_background_index(animation);
+
+        for(i = 0; i < builder.image_count; ++i) {
+            if(fig_image_get_render_index_data(images[i]) == NULL
+            || fig_image_get_render_width(images[i]) != fig_animation_get_width(animation)
+            || fig_image_get_render_height(images[i]) != fig_animation_get_height(animation)) {
+                fig_state_set_error(self->state, "an indexed atlas requires render surfaces of palette indices covering the canvas");
+                return 0;
+            }
+        }
+        builder.background = (fig_uint8_t) (background < 256 ? background : 0);
+    } else if(builder.image_count != 0) {
+        builder.player = fig_create_player(self->state, animation);
+        if(builder.player == NULL) {
+            return 0;
+        }
+    }
+
+    /* Keep the hash table at most half full. */
+    builder.table_size = 16;
+    while(builder.table_size < builder.image_count * 2) {
+        builder.table_size *= 2;
+    }
+    builder.sprites = (fig_atlas_sprite_ *) fig_atlas_builder_alloc_(&builder, builder.image_count, sizeof(fig_atlas_sprite_));
+    builder.table = (size_t *) fig_atlas_builder_alloc_(&builder, builder.table_size, sizeof(size_t));
+    builder.frame_sprites = (size_t *) fig_atlas_builder_alloc_(&builder, builder.image_count, sizeof(size_t));
+    builder.frame_bounds = (fig_rect *) fig_atlas_builder_alloc_(&builder, builder.image_count, sizeof(fig_rect));
+    builder.order = (fig_atlas_sprite_ **) fig_atlas_builder_alloc_(&builder, builder.image_count, sizeof(fig_atlas_sprite_ *));
+    builder.nodes = (fig_atlas_skyline_node_ *) fig_atlas_builder_alloc_(&builder, builder.image_count + 1, sizeof(fig_atlas_skyline_node_));
+    builder.frames = (fig_atlas_frame *) fig_atlas_builder_alloc_(&builder, builder.image_count, sizeof(fig_atlas_frame));
+    if(builder.sprites == NULL || builder.table == NULL || builder.frame_sprites == NULL || builder.frame_bounds == NULL
+    || builder.order == NULL || builder.nodes == NULL || builder.frames == NULL) {
+        fig_atlas_builder_free_(&builder);
+        return 0;
+    }
+    memset(builder.table, 0, builder.table_size * sizeof(size_t));
+
+    if(!fig_atlas_collect_sprites_(&builder, animation)
+    || !fig_atlas_place_sprites_(&builder, options, &atlas_width, &atlas_height)) {
+        fig_atlas_builder_free_(&builder);
+        return 0;
+    }
+
+    for(i = 0; i < builder.image_count; ++i) {
+        fig_atlas_frame *frame = &builder.frames[i];
+
+        if(builder.frame_sprites[i] != (size_t) -1) {
+            fig_atlas_sprite_ *sprite = &builder.sprites[builder.frame_sprites[i]];
+
+            frame->source.x = sprite->x;
+            frame->source.y = sprite->y;
+            frame->source.width = sprite->width;
+            frame->source.height = sprite->height;
+            frame->x = builder.frame_bounds[i].x;
+            frame->y = builder.frame_bounds[i].y;
+        } else {
+            frame->source.x = 0;
+            frame->source.y = 0;
+            frame->source.width = 0;
+            frame->source.height = 0;
+            frame->x = 0;
+            frame->y = 0;
+        }
+        frame->delay = fig_image_get_delay(images[i]);
+    }
+
+    /* Hand the surface and frames over to the atlas, and free what it held before. */
+    alloc(ud, self->data, self->width * self->height * sizeof(fig_uint32_t), 0);
+    alloc(ud, self->index_data, self->width * self->height, 0);
+    alloc(ud, self->frames, (self->frame_count != 0 ? self->frame_count : 1) * sizeof(fig_atlas_frame), 0);
+    self->width = atlas_width;
+    self->height = atlas_height;
+    self->data = options->indexed ? NULL : (fig_uint32_t *) builder.data;
+    self->index_data = options->indexed ? builder.data : NULL;
+    self->sprite_count = builder.sprite_count;
+    self->frame_count = builder.image_count;
+    self->frames = builder.frames;
+    builder.data = NULL;
+    builder.data_size = 0;
+    builder.frames = NULL;
+    fig_atlas_builder_free_(&builder);
+    return 1;
+}
+
+size_t fig_atlas_get_width(fig_atlas *self) {
+    return self->width;
+}
+
+size_t fig_atlas_get_height(fig_atlas *self) {
+    return self->height;
+}
+
+fig_uint32_t *fig_atlas_get_data(fig_atlas *self) {
+    return self->data;
+}
+
+fig_uint8_t *fig_atlas_get_index_data(fig_atlas *self) {
+    return self->index_data;
+}
+
+size_t fig_atlas_count_sprites(fig_atlas *self) {
+    return self->sprite_count;
+}
+
+size_t fig_atlas_count_frames(fig_atlas *self) {
+    return self->frame_count;
+}
+
+fig_atlas_frame *fig_atlas_get_frames(fig_atlas *self) {
+    return self->frames;
+}
+
+void fig_atlas_free(fig_atlas *self) {
+    if(self != NULL) {
+        fig_allocator_t alloc = fig_state_get_allocator(self->state);
+        void *ud = fig_state_get_userdata(self->state);
+
+        alloc(ud, self->data, self->width * self->height * sizeof(fig_uint32_t), 0);
+        alloc(ud, self->index_data, self->width * self->height, 0);
+        alloc(ud, self->frames, (self->frame_count != 0 ? self->frame_count : 1) * sizeof(fig_atlas_frame), 0);
+        alloc(ud, self, sizeof(fig_atlas), 0);
+    }
+}
+
+#if defined(FIG_LOAD_GIF) || defined(FIG_SAVE_GIF)
+
+enum {
+    /* Header definitions */
+    FIG_GIF_HEADER_LENGTH = 6,
+
+    /* Block types */
+    FIG_GIF_BLOCK_EXTENSION = 0x21,
+    FIG_GIF_BLOCK_IMAGE = 0x2C,
+    FIG_GIF_BLOCK_TERMINATOR = 0x3B,
+
+    /* Extension types */
+    FIG_GIF_EXT_GRAPHICS_CONTROL = 0xF9,
+    FIG_GIF_EXT_PLAIN_TEXT = 0x01,
+    FIG_GIF_EXT_COMMENT = 0xFE,
+    FIG_GIF_EXT_APPLICATION = 0xFF,
 
     /* Logical screen descriptor packed fields */
     FIG_GIF_SCREEN_DESC_GLOBAL_COLOR = 0x80,
@@ -1134,6 +4587,19 @@ static fig_disposal_t fig_convert_gif_disposal_to_fig_disposal_(fig_gif_disposal
 }
 
 fig_animation *fig_load_gif(fig_state *state, fig_input *input) {
+    fig_animation *animation;
+    fig_load_options options;
+    fig_init_load_options(&options);
+    options.render_images = 0;
+    animation = fig_load_gif_with_options(state, input, &options);
+    if(animation != NULL) {
+        /* A failed render leaves the images unrendered, but still loaded. */
+        fig_animation_render_images(animation);
+    }
+    return animation;
+}
+
+fig_animation *fig_load_gif_with_options(fig_state *state, fig_input *input, const fig_load_options *options) {
     fig_uint8_t version;
     fig_gif_screen_descriptor_ screen_desc;
     fig_gif_graphics_control_ gfx_ctrl;    
@@ -1143,6 +4609,10 @@ fig_animation *fig_load_gif(fig_state *state, fig_input *input) {
         fig_state_set_error(state, "input is NULL");
         return NULL;
     }
+    if(options == NULL) {
+        fig_state_set_error(state, "options is NULL");
+        return NULL;
+    }
 
     memset(&screen_desc, 0, sizeof(screen_desc));
     memset(&gfx_ctrl, 0, sizeof(gfx_ctrl));
@@ -1161,6 +4631,8 @@ fig_animation *fig_load_gif(fig_state *state, fig_input *input) {
         return NULL;
     }
     fig_animation_set_dimensions(animation, screen_desc.width, screen_desc.height);
+    fig_animation_set_render_mode(animation, options->render_mode);
+    fig_animation_set_perceptual_hashes(animation, options->perceptual_hashes);
 
     if(screen_desc.global_colors > 0
     && !fig_gif_read_palette_(input, screen_desc.global_colors, fig_animation_get_palette(animation))) {
@@ -1234,8 +4706,7 @@ fig_animation *fig_load_gif(fig_state *state, fig_input *input) {
                 image = fig_animation_add_image(animation);
 
                 if(image == NULL
-                || !fig_image_resize_indexed(image, image_desc.width, image_desc.height)
-                || !fig_image_resize_render(image, screen_desc.width, screen_desc.height)) {
+                || !fig_image_resize_indexed(image, image_desc.width, image_desc.height)) {
                     fig_state_set_error(state, "failed to allocate frame image surfaces");
                     return fig_animation_free(animation), NULL;
                 }
@@ -1259,7 +4730,21 @@ fig_animation *fig_load_gif(fig_state *state, fig_input *input) {
                 break;
             }
             case FIG_GIF_BLOCK_TERMINATOR: {
-                fig_animation_render_images(animation);
+                if(options->contiguous_indexed
+                && !fig_animation_pack_indexed_data(animation)) {
+                    return fig_animation_free(animation), NULL;
+                }
+                if(options->render_images) {
+                    /* Other render modes don't keep a full canvas per image, so they don't use a block. */
+                    if(options->contiguous_render
+                    && (options->render_mode == FIG_RENDER_MODE_FULL || options->render_mode == FIG_RENDER_MODE_INDEX)
+                    && !fig_animation_allocate_render_slab(animation)) {
+                        return fig_animation_free(animation), NULL;
+                    }
+                    if(!fig_animation_render_images(animation)) {
+                        return fig_animation_free(animation), NULL;
+                    }
+                }
                 return animation;
             }
             default:
@@ -1370,6 +4855,9 @@ static fig_bool_t fig_gif_write_image_data_(fig_state *state, fig_output *output
     fig_uint8_t block[256];
     size_t pixel_index;
     size_t pixel_count;
+    size_t width;
+    size_t stride;
+    size_t column;
     size_t color_depth;
     size_t padded_palette_size;
     fig_uint8_t* pixels;
@@ -1411,11 +4899,20 @@ static fig_bool_t fig_gif_write_image_data_(fig_state *state, fig_output *output
         return 0;
     }
 
-    pixel_count = fig_image_get_indexed_width(image) * fig_image_get_indexed_height(image);
+    width = fig_image_get_indexed_width(image);
+    stride = fig_image_get_indexed_stride(image);
+    pixel_count = width * fig_image_get_indexed_height(image);
     pixels = fig_image_get_indexed_data(image);
+    column = 0;
 
     for(pixel_index = 0; pixel_index != pixel_count; ++pixel_index) {
-        fig_uint8_t pixel = pixels[pixel_index];
+        fig_uint8_t pixel = pixels[column];
+
+        /* Rows can be further apart than the width, when the image is a view. */
+        if(++column == width && pixel_index + 1 != pixel_count) {
+            column = 0;
+            pixels += stride;
+        }
         if(pixel >= padded_palette_size) {
             fig_state_set_error(state, "encountered indexed pixel with index outside of valid palette range");
             return 0;
@@ -1464,8 +4961,14 @@ static fig_bool_t fig_gif_write_image_data_(fig_state *state, fig_output *output
         }
     }
 
-    if(!fig_gif_block_write_bits_(state, output, block, &accumulator, &accumulator_length, old_code, code_size)
-    || !fig_gif_block_write_bits_(state, output, block, &accumulator, &accumulator_length, eoi_code, code_size)) {
+    if(!fig_gif_block_write_bits_(state, output, block, &accumulator, &accumulator_length, old_code, code_size)) {
+        return 0;
+    }
+    /* The decoder adds a code after reading the last one, so it may already expect a wider end code. */
+    if((code_count & code_mask) == 0 && code_count < FIG_GIF_LZW_MAX_CODES) {
+        ++code_size;
+    }
+    if(!fig_gif_block_write_bits_(state, output, block, &accumulator, &accumulator_length, eoi_code, code_size)) {
         return 0;
     }
 
@@ -1653,14 +5156,233 @@ fig_bool_t fig_save_gif(fig_state *state, fig_output *output, fig_animation *ani
             return 0;
         }
 
-        fig_gif_write_image_data_(state, output, image, (image_desc_packed_fields & FIG_GIF_IMAGE_DESC_LOCAL_COLOR) != 0 ? local_palette : global_palette);
+        fig_gif_write_image_data_(state, output, image, (image_desc_packed_fields & FIG_GIF_IMAGE_DESC_LOCAL_COLOR) != 0 ? local_palette : global_palette);
+    }
+
+    fig_output_write_u8(output, FIG_GIF_BLOCK_TERMINATOR);
+
+    return 1;
+}
+#endif
+
+struct fig_histogram {
+    fig_state *state;
+    size_t pixel_count;
+    size_t transparent_count;
+    fig_color_count *colors;
+    size_t color_count;
+    size_t color_capacity;
+    /* An open addressing table of positions in colors plus one, or 0 for empty slots. */
+    size_t *slots;
+    size_t slot_count;
+    /* Whether colors are in the order returned by fig_histogram_get_colors. */
+    fig_bool_t sorted;
+};
+
+fig_histogram *fig_create_histogram(fig_state *state) {
+    if(state != NULL) {
+        fig_histogram *self = (fig_histogram *) fig_state_get_allocator(state)(fig_state_get_userdata(state), NULL, 0, sizeof(fig_histogram));
+        if(self != NULL) {
+            self->state = state;
+            self->pixel_count = 0;
+            self->transparent_count = 0;
+            self->colors = NULL;
+            self->color_count = 0;
+            self->color_capacity = 0;
+            self->slots = NULL;
+            self->slot_count = 0;
+            self->sorted = 1;
+        } else {
+            fig_state_set_error_allocation_failed(state);
+        }
+        return self;
+    }
+    return NULL;
+}
+
+static size_t fig_histogram_hash_(fig_uint32_t color) {
+    color ^= color >> 16;
+    color = (color * 0x45D9F3B) & 0xFFFFFFFF;
+    color ^= color >> 16;
+    return (size_t) color;
+}
+
+/* Fill the slots with the positions of every color. */
+static void fig_histogram_rehash_(fig_histogram *self) {
+    size_t mask = self->slot_count - 1;
+    size_t i;
+
+    memset(self->slots, 0, self->slot_count * sizeof(size_t));
+    for(i = 0; i < self->color_count; ++i) {
+        size_t slot = fig_histogram_hash_(self->colors[i].color) & mask;
+        while(self->slots[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        self->slots[slot] = i + 1;
+    }
+}
+
+/* Make room for count more colors, so that adding them can't fail. */
+static fig_bool_t fig_histogram_reserve_(fig_histogram *self, size_t count) {
+    fig_allocator_t alloc = fig_state_get_allocator(self->state);
+    void *ud = fig_state_get_userdata(self->state);
+    fig_color_count *colors;
+    size_t *slots;
+    size_t capacity;
+    size_t slot_count;
+
+    if(self->color_count + count <= self->color_capacity) {
+        return 1;
+    }
+    capacity = self->color_capacity != 0 ? self->color_capacity : 256;
+    while(capacity < self->color_count + count) {
+        capacity *= 2;
+    }
+    /* Keep the table at most half full. */
+    slot_count = capacity * 2;
+    if(slot_count > ~(size_t) 0 / sizeof(size_t) || capacity > ~(size_t) 0 / sizeof(fig_color_count)) {
+        fig_state_set_error(self->state, "histogram has too many colors");
+        return 0;
+    }
+
+    /* The slots are rebuilt from scratch, so a new table is allocated first,
+       and nothing changes unless both allocations succeed. */
+    slots = (size_t *) alloc(ud, NULL, 0, slot_count * sizeof(size_t));
+    if(slots == NULL) {
+        fig_state_set_error_allocation_failed(self->state);
+        return 0;
+    }
+    colors = (fig_color_count *) alloc(ud, self->colors, self->color_capacity * sizeof(fig_color_count), capacity * sizeof(fig_color_count));
+    if(colors == NULL) {
+        alloc(ud, slots, slot_count * sizeof(size_t), 0);
+        fig_state_set_error_allocation_failed(self->state);
+        return 0;
+    }
+    alloc(ud, self->slots, self->slot_count * sizeof(size_t), 0);
+    self->colors = colors;
+    self->color_capacity = capacity;
+    self->slots = slots;
+    self->slot_count = slot_count;
+    fig_histogram_rehash_(self);
+    return 1;
+}
+
+static void fig_histogram_add_color_(fig_histogram *self, fig_uint32_t color, size_t count) {
+    size_t mask = self->slot_count - 1;
+    size_t slot = fig_histogram_hash_(color) & mask;
+
+    while(self->slots[slot] != 0) {
+        fig_color_count *entry = &self->colors[self->slots[slot] - 1];
+        if(entry->color == color) {
+            entry->count += count;
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+    self->colors[self->color_count].color = color;
+    self->colors[self->color_count].count = count;
+    self->slots[slot] = ++self->color_count;
+}
+
+void fig_histogram_clear(fig_histogram *self) {
+    self->pixel_count = 0;
+    self->transparent_count = 0;
+    self->color_count = 0;
+    self->sorted = 1;
+    if(self->slots != NULL) {
+        memset(self->slots, 0, self->slot_count * sizeof(size_t));
+    }
+}
+
+fig_bool_t fig_histogram_add_image(fig_histogram *self, fig_animation *animation, fig_image *image) {
+    size_t counts[256];
+    fig_palette *palette;
+    fig_uint32_t *palette_colors;
+    size_t palette_size;
+    size_t transparency_index;
+    size_t i;
+
+    if(!fig_histogram_reserve_(self, 256)) {
+        return 0;
+    }
+
+    fig_image_count_indices(image, counts);
+    palette = fig_animation_get_render_palette(animation, image);
+    palette_colors = fig_palette_get_colors(palette);
+    palette_size = fig_palette_count_colors(palette);
+    transparency_index = fig_image_get_transparent(image) ? fig_image_get_transparency_index(image) : 256;
+
+    /* Indices past the end of the palette are drawn as transparent, like the transparency index. */
+    for(i = 0; i < 256; ++i) {
+        if(counts[i] == 0) {
+            continue;
+        }
+        self->pixel_count += counts[i];
+        if(i == transparency_index || i >= palette_size) {
+            self->transparent_count += counts[i];
+        } else {
+            fig_histogram_add_color_(self, palette_colors[i], counts[i]);
+            self->sorted = 0;
+        }
+    }
+    return 1;
+}
+
+fig_bool_t fig_histogram_add_animation(fig_histogram *self, fig_animation *animation) {
+    fig_image **images = fig_animation_get_images(animation);
+    size_t image_count = fig_animation_count_images(animation);
+    size_t i;
+
+    for(i = 0; i < image_count; ++i) {
+        if(!fig_histogram_add_image(self, animation, images[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+size_t fig_histogram_count_pixels(fig_histogram *self) {
+    return self->pixel_count;
+}
+
+size_t fig_histogram_count_transparent(fig_histogram *self) {
+    return self->transparent_count;
+}
+
+size_t fig_histogram_count_colors(fig_histogram *self) {
+    return self->color_count;
+}
+
+/* Order colors most common first, then by color value, so that the order doesn't depend on the order they were added. */
+static int fig_histogram_compare_colors_(const void *a, const void *b) {
+    const fig_color_count *color_a = (const fig_color_count *) a;
+    const fig_color_count *color_b = (const fig_color_count *) b;
+
+    if(color_a->count != color_b->count) {
+        return color_a->count > color_b->count ? -1 : 1;
     }
+    return color_a->color < color_b->color ? -1 : color_a->color > color_b->color;
+}
 
-    fig_output_write_u8(output, FIG_GIF_BLOCK_TERMINATOR);
+fig_color_count *fig_histogram_get_colors(fig_histogram *self) {
+    if(!self->sorted) {
+        qsort(self->colors, self->color_count, sizeof(fig_color_count), fig_histogram_compare_colors_);
+        fig_histogram_rehash_(self);
+        self->sorted = 1;
+    }
+    return self->colors;
+}
 
-    return 1;
+void fig_histogram_free(fig_histogram *self) {
+    if(self != NULL) {
+        fig_allocator_t alloc = fig_state_get_allocator(self->state);
+        void *ud = fig_state_get_userdata(self->state);
+
+        alloc(ud, self->colors, self->color_capacity * sizeof(fig_color_count), 0);
+        alloc(ud, self->slots, self->slot_count * sizeof(size_t), 0);
+        alloc(ud, self, sizeof(fig_histogram), 0);
+    }
 }
-#endif
 
 struct fig_image {
     fig_state *state;
@@ -1668,6 +5390,8 @@ struct fig_image {
     size_t indexed_y;
     size_t indexed_width;
     size_t indexed_height;
+    size_t render_x;
+    size_t render_y;
     size_t render_width;
     size_t render_height;
     size_t delay;
@@ -1676,7 +5400,22 @@ struct fig_image {
     fig_bool_t transparent;
     size_t transparency_index;
     fig_uint8_t *indexed_data;
-    fig_uint32_t *render_data;
+    /* The number of bytes between the start of each row of the indexed data. */
+    size_t indexed_stride;
+    /* Whether the indexed data is freed by the image, rather than attached by the user. */
+    fig_bool_t indexed_owned;
+    /* Either BGRA colors or palette indices, depending on the pixel size. */
+    void *render_data;
+    size_t render_pixel_size;
+    /* The number of bytes between the start of each row of the render data. */
+    size_t render_stride;
+    /* Whether the render data is freed by the image, rather than attached by the user. */
+    fig_bool_t render_owned;
+    fig_uint8_t perceptual_hash[8];
+    fig_bool_t has_perceptual_hash;
+    fig_uint8_t content_hash[8];
+    fig_uint8_t frame_hash[8];
+    fig_bool_t has_hashes;
 };
 
 static void fig_image_set_error_size_overflow_(fig_state *state) {
@@ -1692,6 +5431,8 @@ fig_image *fig_create_image(fig_state *state) {
             self->indexed_y = 0;
             self->indexed_width = 0;
             self->indexed_height = 0;
+            self->render_x = 0;
+            self->render_y = 0;
             self->render_width = 0;
             self->render_height = 0;
             self->delay = 0;
@@ -1703,7 +5444,14 @@ fig_image *fig_create_image(fig_state *state) {
             self->transparent = 0;
             self->transparency_index = 0;
             self->indexed_data = NULL;
+            self->indexed_stride = 0;
+            self->indexed_owned = 1;
             self->render_data = NULL;
+            self->render_pixel_size = 0;
+            self->render_stride = 0;
+            self->render_owned = 1;
+            self->has_perceptual_hash = 0;
+            self->has_hashes = 0;
         } else {
             fig_state_set_error_allocation_failed(state);
         }
@@ -1736,6 +5484,35 @@ fig_uint8_t *fig_image_get_indexed_data(fig_image *self) {
     return self->indexed_data;
 }
 
+size_t fig_image_get_indexed_stride(fig_image *self) {
+    return self->indexed_stride;
+}
+
+void fig_image_count_indices(fig_image *self, size_t *counts) {
+    size_t partial[4][256];
+    size_t i, x, y;
+
+    /* Counting into four tables in turn lets neighboring pixels with the same index
+     * increment different counters, instead of waiting on each other. */
+    memset(partial, 0, sizeof(partial));
+    for(y = 0; y < self->indexed_height; ++y) {
+        const fig_uint8_t *row = self->indexed_data + y * self->indexed_stride;
+
+        for(x = 0; x + 4 <= self->indexed_width; x += 4) {
+            ++partial[0][row[x]];
+            ++partial[1][row[x + 1]];
+            ++partial[2][row[x + 2]];
+            ++partial[3][row[x + 3]];
+        }
+        for(; x < self->indexed_width; ++x) {
+            ++partial[0][row[x]];
+        }
+    }
+    for(i = 0; i < 256; ++i) {
+        counts[i] = partial[0][i] + partial[1][i] + partial[2][i] + partial[3][i];
+    }
+}
+
 void fig_image_set_origin_x(fig_image *self, size_t value) {
     self->indexed_x = value;
 }
@@ -1748,11 +5525,28 @@ fig_bool_t fig_image_resize_indexed(fig_image *self, size_t width, size_t height
     if(height == 0 || width <= ~(size_t) 0 / height) {
         size_t old_size = self->indexed_width * self->indexed_height;
         size_t new_size = width * height;    
+
+        /* Storage attached by the user isn't ours to resize or free. */
+        if(!self->indexed_owned) {
+            if(self->indexed_data != NULL
+            && self->indexed_width == width
+            && self->indexed_height == height) {
+                return 1;
+            }
+            self->indexed_data = NULL;
+            self->indexed_width = 0;
+            self->indexed_height = 0;
+            self->indexed_stride = 0;
+            self->indexed_owned = 1;
+            old_size = 0;
+        }
+
         if(new_size == 0) {
             fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state), self->indexed_data, old_size, 0);
             self->indexed_data = NULL;
             self->indexed_width = 0;
             self->indexed_height = 0;
+            self->indexed_stride = 0;
             return 1;
         } else {
             fig_uint8_t *index_data;
@@ -1764,6 +5558,7 @@ fig_bool_t fig_image_resize_indexed(fig_image *self, size_t width, size_t height
             } else {
                 self->indexed_width = width;
                 self->indexed_height = height;
+                self->indexed_stride = width;
                 self->indexed_data = index_data;
                 return 1;
             }
@@ -1774,6 +5569,48 @@ fig_bool_t fig_image_resize_indexed(fig_image *self, size_t width, size_t height
     }
 }
 
+fig_bool_t fig_image_attach_indexed(fig_image *self, fig_uint8_t *data, size_t width, size_t height, fig_bool_t owned) {
+    if(height != 0 && width > ~(size_t) 0 / height) {
+        fig_image_set_error_size_overflow_(self->state);
+        return 0;
+    }
+    if(width == 0 || height == 0 || data == NULL) {
+        return fig_image_resize_indexed(self, 0, 0);
+    }
+
+    if(self->indexed_owned) {
+        fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
+            self->indexed_data, self->indexed_width * self->indexed_height, 0);
+    }
+    self->indexed_data = data;
+    self->indexed_width = width;
+    self->indexed_height = height;
+    self->indexed_stride = width;
+    self->indexed_owned = owned;
+    return 1;
+}
+
+fig_bool_t fig_image_attach_indexed_view(fig_image *self, fig_uint8_t *parent, size_t parent_stride, const fig_rect *rect) {
+    if(rect->x > parent_stride || rect->width > parent_stride - rect->x) {
+        fig_state_set_error(self->state, "indexed view is wider than the stride of its parent");
+        return 0;
+    }
+    if(rect->width == 0 || rect->height == 0 || parent == NULL) {
+        return fig_image_resize_indexed(self, 0, 0);
+    }
+
+    if(self->indexed_owned) {
+        fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
+            self->indexed_data, self->indexed_width * self->indexed_height, 0);
+    }
+    self->indexed_data = parent + rect->y * parent_stride + rect->x;
+    self->indexed_width = rect->width;
+    self->indexed_height = rect->height;
+    self->indexed_stride = parent_stride;
+    self->indexed_owned = 0;
+    return 1;
+}
+
 size_t fig_image_get_render_width(fig_image *self) {
     return self->render_width;
 }
@@ -1782,24 +5619,83 @@ size_t fig_image_get_render_height(fig_image *self) {
     return self->render_height;
 }
 
+size_t fig_image_get_render_origin_x(fig_image *self) {
+    return self->render_x;
+}
+
+size_t fig_image_get_render_origin_y(fig_image *self) {
+    return self->render_y;
+}
+
 fig_uint32_t *fig_image_get_render_data(fig_image *self) {
-    return self->render_data;
+    return self->render_pixel_size == sizeof(fig_uint32_t) ? (fig_uint32_t *) self->render_data : NULL;
 }
 
-fig_bool_t fig_image_resize_render(fig_image *self, size_t width, size_t height) {
-    if(height == 0 || width <= ~(size_t) 0 / height) {
-        size_t old_size = self->render_width * self->render_height;
-        size_t new_size = width * height;
+fig_uint8_t *fig_image_get_render_index_data(fig_image *self) {
+    return self->render_pixel_size == sizeof(fig_uint8_t) ? (fig_uint8_t *) self->render_data : NULL;
+}
+
+size_t fig_image_get_render_stride(fig_image *self) {
+    return self->render_stride;
+}
+
+void fig_image_set_render_origin_x(fig_image *self, size_t value) {
+    self->render_x = value;
+}
+
+void fig_image_set_render_origin_y(fig_image *self, size_t value) {
+    self->render_y = value;
+}
+
+static fig_bool_t fig_image_resize_render_surface_(fig_image *self, size_t width, size_t height, size_t pixel_size) {
+    if(height == 0 || width <= ~(size_t) 0 / pixel_size / height) {
+        fig_allocator_t alloc = fig_state_get_allocator(self->state);
+        void *ud = fig_state_get_userdata(self->state);
+        size_t old_size = self->render_stride * self->render_height;
+        size_t new_size = pixel_size * width * height;
+
+        /* Keep the current surface if it already has the requested layout,
+         * so that storage attached by the user keeps being rendered into. */
+        if(self->render_data != NULL
+        && self->render_pixel_size == pixel_size
+        && self->render_width == width
+        && self->render_height == height) {
+            return 1;
+        }
+        /* Storage attached by the user isn't ours to resize or free. */
+        if(!self->render_owned) {
+            self->render_data = NULL;
+            self->render_pixel_size = 0;
+            self->render_stride = 0;
+            self->render_width = 0;
+            self->render_height = 0;
+            self->render_owned = 1;
+            old_size = 0;
+        }
+        /* A surface of a different pixel format can't be reused. */
+        if(self->render_pixel_size != pixel_size && self->render_data != NULL) {
+            alloc(ud, self->render_data, old_size, 0);
+            self->render_data = NULL;
+            self->render_pixel_size = 0;
+            self->render_stride = 0;
+            self->render_width = 0;
+            self->render_height = 0;
+            old_size = 0;
+        }
+
         if(new_size == 0) {
-            fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state), self->render_data, sizeof(fig_uint32_t) * old_size, 0);
+            alloc(ud, self->render_data, old_size, 0);
             self->render_data = NULL;
+            self->render_pixel_size = 0;
+            self->render_stride = 0;
+            self->render_x = 0;
+            self->render_y = 0;
             self->render_width = 0;
             self->render_height = 0;
             return 1;
         } else {
-            fig_uint32_t *render_data;
-            render_data = (fig_uint32_t *) fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
-                self->render_data, sizeof(fig_uint32_t) * old_size, sizeof(fig_uint32_t) * new_size);
+            void *render_data;
+            render_data = alloc(ud, self->render_data, old_size, new_size);
             if(render_data == NULL) {
                 fig_state_set_error_allocation_failed(self->state);
                 return 0;
@@ -1807,6 +5703,8 @@ fig_bool_t fig_image_resize_render(fig_image *self, size_t width, size_t height)
                 self->render_width = width;
                 self->render_height = height;
                 self->render_data = render_data;
+                self->render_pixel_size = pixel_size;
+                self->render_stride = pixel_size * width;
                 return 1;
             }
         }
@@ -1816,6 +5714,48 @@ fig_bool_t fig_image_resize_render(fig_image *self, size_t width, size_t height)
     }
 }
 
+fig_bool_t fig_image_resize_render(fig_image *self, size_t width, size_t height) {
+    return fig_image_resize_render_surface_(self, width, height, sizeof(fig_uint32_t));
+}
+
+fig_bool_t fig_image_resize_render_index(fig_image *self, size_t width, size_t height) {
+    return fig_image_resize_render_surface_(self, width, height, sizeof(fig_uint8_t));
+}
+
+static fig_bool_t fig_image_attach_render_surface_(fig_image *self, void *data, size_t width, size_t height, size_t stride, fig_bool_t owned, size_t pixel_size) {
+    if(stride % pixel_size != 0 || stride / pixel_size < width) {
+        fig_state_set_error(self->state, "render stride is too small for the width");
+        return 0;
+    }
+    if(height != 0 && stride > ~(size_t) 0 / height) {
+        fig_image_set_error_size_overflow_(self->state);
+        return 0;
+    }
+    if(width == 0 || height == 0 || data == NULL) {
+        return fig_image_resize_render_surface_(self, 0, 0, pixel_size);
+    }
+
+    if(self->render_owned) {
+        fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
+            self->render_data, self->render_stride * self->render_height, 0);
+    }
+    self->render_data = data;
+    self->render_pixel_size = pixel_size;
+    self->render_stride = stride;
+    self->render_width = width;
+    self->render_height = height;
+    self->render_owned = owned;
+    return 1;
+}
+
+fig_bool_t fig_image_attach_render(fig_image *self, fig_uint32_t *data, size_t width, size_t height, size_t stride, fig_bool_t owned) {
+    return fig_image_attach_render_surface_(self, data, width, height, stride, owned, sizeof(fig_uint32_t));
+}
+
+fig_bool_t fig_image_attach_render_index(fig_image *self, fig_uint8_t *data, size_t width, size_t height, size_t stride, fig_bool_t owned) {
+    return fig_image_attach_render_surface_(self, data, width, height, stride, owned, sizeof(fig_uint8_t));
+}
+
 size_t fig_image_get_delay(fig_image *self) {
     return self->delay;
 }
@@ -1848,6 +5788,41 @@ void fig_image_set_transparency_index(fig_image *self, size_t value) {
     self->transparency_index = value;
 }
 
+const fig_uint8_t *fig_image_get_perceptual_hash(fig_image *self) {
+    return self->has_perceptual_hash ? self->perceptual_hash : NULL;
+}
+
+const fig_uint8_t *fig_image_get_content_hash(fig_image *self) {
+    return self->has_hashes ? self->content_hash : NULL;
+}
+
+const fig_uint8_t *fig_image_get_frame_hash(fig_image *self) {
+    return self->has_hashes ? self->frame_hash : NULL;
+}
+
+void fig_image_set_hashes(fig_image *self, const fig_uint8_t *content_hash, const fig_uint8_t *frame_hash) {
+    size_t i;
+
+    self->has_hashes = content_hash != NULL && frame_hash != NULL;
+    if(self->has_hashes) {
+        for(i = 0; i < sizeof(self->content_hash); ++i) {
+            self->content_hash[i] = content_hash[i];
+            self->frame_hash[i] = frame_hash[i];
+        }
+    }
+}
+
+void fig_image_set_perceptual_hash(fig_image *self, const fig_uint8_t *hash) {
+    size_t i;
+
+    self->has_perceptual_hash = hash != NULL;
+    if(hash != NULL) {
+        for(i = 0; i < sizeof(self->perceptual_hash); ++i) {
+            self->perceptual_hash[i] = hash[i];
+        }
+    }
+}
+
 void fig_image_free(fig_image *self) {
     if(self != NULL) {
         fig_allocator_t alloc = fig_state_get_allocator(self->state);
@@ -1857,8 +5832,12 @@ void fig_image_free(fig_image *self) {
             fig_palette_free(self->palette);
         }
    
-        alloc(ud, self->indexed_data, self->indexed_width * self->indexed_height, 0);
-        alloc(ud, self->render_data, sizeof(fig_uint32_t) * self->render_width * self->render_height, 0);
+        if(self->indexed_owned) {
+            alloc(ud, self->indexed_data, self->indexed_width * self->indexed_height, 0);
+        }
+        if(self->render_owned) {
+            alloc(ud, self->render_data, self->render_stride * self->render_height, 0);
+        }
         alloc(ud, self, sizeof(fig_image), 0);
     }
 }
@@ -2303,50 +6282,425 @@ fig_uint32_t *fig_palette_get_colors(fig_palette *self) {
     return self->data;
 }
 
-fig_uint32_t fig_palette_get(fig_palette *self, size_t index) {
-    FIG_ASSERT(index < self->size);
-    return self->data[index];
+fig_uint32_t fig_palette_get(fig_palette *self, size_t index) {
+    FIG_ASSERT(index < self->size);
+    return self->data[index];
+}
+
+void fig_palette_set(fig_palette *self, size_t index, fig_uint32_t color) {
+    FIG_ASSERT(index < self->size);
+    self->data[index] = color;
+}
+
+fig_bool_t fig_palette_resize(fig_palette *self, size_t size) {
+    if(self->size >= size) {
+        if(size == 0) {
+            fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
+                self->data, sizeof(fig_uint32_t) * self->size, 0);
+            self->data = NULL;
+        }
+        self->size = size;
+
+        return 1;
+    } else {
+        fig_uint32_t *data;
+        data = (fig_uint32_t *) fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
+            self->data, sizeof(fig_uint32_t) * self->size, sizeof(fig_uint32_t) * size);
+
+        if(data != NULL) {
+            self->data = data;
+            self->size = size;
+            return 1;
+        }
+        fig_state_set_error_allocation_failed(self->state);
+        return 0;
+    }
+}
+
+void fig_palette_free(fig_palette *self) {
+    if(self != NULL) {
+        fig_allocator_t alloc = fig_state_get_allocator(self->state);
+        void *ud = fig_state_get_userdata(self->state);    
+
+        if(self->data != NULL) {
+            alloc(ud, self->data, sizeof(fig_uint32_t) * self->size, 0);
+        }
+        alloc(ud, self, sizeof(fig_palette), 0);
+    }
+}
+
+enum {
+    /* Filter weights are fixed point numbers with this many bits after the point. */
+    FIG_RESAMPLE_WEIGHT_BITS = 14,
+    /* The rows between the two passes keep this many bits after the point. */
+    FIG_RESAMPLE_ROW_BITS = 7
+};
+
+/* The source pixels and weights that make up each destination pixel along one axis. */
+typedef struct {
+    size_t dest_size;
+    /* The largest number of source pixels used by a destination pixel. */
+    size_t taps;
+    /* The first source pixel used by each destination pixel. */
+    size_t *starts;
+    /* The number of source pixels used by each destination pixel. */
+    size_t *counts;
+    /* taps weights per destination pixel, which add up to 1 << FIG_RESAMPLE_WEIGHT_BITS. */
+    int *weights;
+} fig_resample_axis_;
+
+struct fig_resampler {
+    fig_state *state;
+    size_t src_width;
+    size_t src_height;
+    fig_resample_axis_ horizontal;
+    fig_resample_axis_ vertical;
+};
+
+static double fig_filter_sinc_(double x) {
+    if(x == 0.0) {
+        return 1.0;
+    }
+    x *= 3.14159265358979323846;
+    return sin(x) / x;
+}
+
+static double fig_filter_support_(fig_filter_t filter) {
+    switch(filter) {
+        case FIG_FILTER_BOX: return 0.5;
+        case FIG_FILTER_BILINEAR: return 1.0;
+        default: return 3.0;
+    }
+}
+
+static double fig_filter_evaluate_(fig_filter_t filter, double x) {
+    if(x < 0.0) {
+        x = -x;
+    }
+    switch(filter) {
+        case FIG_FILTER_BOX: return x <= 0.5 ? 1.0 : 0.0;
+        case FIG_FILTER_BILINEAR: return x < 1.0 ? 1.0 - x : 0.0;
+        default: return x < 3.0 ? fig_filter_sinc_(x) * fig_filter_sinc_(x / 3.0) : 0.0;
+    }
+}
+
+static void fig_resample_axis_free_(fig_state *state, fig_resample_axis_ *axis) {
+    fig_allocator_t alloc = fig_state_get_allocator(state);
+    void *ud = fig_state_get_userdata(state);
+
+    alloc(ud, axis->starts, axis->dest_size * sizeof(size_t), 0);
+    alloc(ud, axis->counts, axis->dest_size * sizeof(size_t), 0);
+    alloc(ud, axis->weights, axis->dest_size * axis->taps * sizeof(int), 0);
+    axis->starts = NULL;
+    axis->counts = NULL;
+    axis->weights = NULL;
+}
+
+/* Precompute the weights for resampling src_size pixels into dest_size pixels.
+ * Shrinking widens the filter by the scale, so every source pixel contributes. */
+static fig_bool_t fig_resample_axis_init_(fig_state *state, fig_resample_axis_ *axis, size_t src_size, size_t dest_size, fig_filter_t filter) {
+    fig_allocator_t alloc = fig_state_get_allocator(state);
+    void *ud = fig_state_get_userdata(state);
+    double scale = (double) src_size / (double) dest_size;
+    double filter_scale = scale > 1.0 ? scale : 1.0;
+    double support = fig_filter_support_(filter) * filter_scale;
+    size_t i, j;
+
+    axis->dest_size = dest_size;
+    axis->taps = (size_t) ceil(support) * 2 + 1;
+    if(axis->taps > src_size) {
+        axis->taps = src_size;
+    }
+    axis->starts = NULL;
+    axis->counts = NULL;
+    axis->weights = NULL;
+    if(dest_size > ~(size_t) 0 / sizeof(size_t) / axis->taps) {
+        fig_state_set_error(state, "image dimensions requested are too large");
+        return 0;
+    }
+    axis->starts = (size_t *) alloc(ud, NULL, 0, dest_size * sizeof(size_t));
+    axis->counts = (size_t *) alloc(ud, NULL, 0, dest_size * sizeof(size_t));
+    axis->weights = (int *) alloc(ud, NULL, 0, dest_size * axis->taps * sizeof(int));
+    if(axis->starts == NULL || axis->counts == NULL || axis->weights == NULL) {
+        fig_resample_axis_free_(state, axis);
+        fig_state_set_error_allocation_failed(state);
+        return 0;
+    }
+
+    for(i = 0; i < dest_size; ++i) {
+        double center = ((double) i + 0.5) * scale;
+        double low = floor(center - support + 0.5);
+        double high = floor(center + support + 0.5);
+        double factors[64];
+        double total;
+        int *weights = axis->weights + i * axis->taps;
+        size_t start = low > 0.0 ? (size_t) low : 0;
+        size_t end = high < (double) src_size ? (size_t) high : src_size;
+        size_t largest;
+        long sum;
+
+        if(end > start + axis->taps) {
+            end = start + axis->taps;
+        }
+        if(end <= start) {
+            /* Upscaling can leave the filter between two pixels at the edges. */
+            start = center < (double) src_size ? (size_t) center : src_size - 1;
+            end = start + 1;
+        }
+
+        /* Most filters fit on the stack, and the values are only needed until they're quantized. */
+        total = 0.0;
+        for(j = start; j < end; ++j) {
+            double value = fig_filter_evaluate_(filter, ((double) j + 0.5 - center) / filter_scale);
+            if(j - start < sizeof(factors) / sizeof(factors[0])) {
+                factors[j - start] = value;
+            }
+            total += value;
+        }
+        if(total == 0.0) {
+            total = 1.0;
+        }
+
+        sum = 0;
+        largest = 0;
+        for(j = start; j < end; ++j) {
+            double value = j - start < sizeof(factors) / sizeof(factors[0])
+                ? factors[j - start]
+                : fig_filter_evaluate_(filter, ((double) j + 0.5 - center) / filter_scale);
+            weights[j - start] = (int) floor(value / total * (1 << FIG_RESAMPLE_WEIGHT_BITS) + 0.5);
+            sum += weights[j - start];
+            if(weights[j - start] > weights[largest]) {
+                largest = j - start;
+            }
+        }
+        for(j = end - start; j < axis->taps; ++j) {
+            weights[j] = 0;
+        }
+        /* Rounding can leave the weights slightly off, so the largest weight takes up the difference. */
+        weights[largest] += (int) ((1L << FIG_RESAMPLE_WEIGHT_BITS) - sum);
+
+        axis->starts[i] = start;
+        axis->counts[i] = end - start;
+    }
+    return 1;
+}
+
+fig_resampler *fig_create_resampler(fig_state *state, size_t src_width, size_t src_height, size_t dest_width, size_t dest_height, fig_filter_t filter) {
+    if(state != NULL) {
+        fig_resampler *self;
+
+        FIG_ASSERT(filter < FIG_FILTER_COUNT);
+        if(src_width == 0 || src_height == 0 || dest_width == 0 || dest_height == 0) {
+            fig_state_set_error(state, "image is empty");
+            return NULL;
+        }
+
+        self = (fig_resampler *) fig_state_get_allocator(state)(fig_state_get_userdata(state), NULL, 0, sizeof(fig_resampler));
+        if(self == NULL) {
+            fig_state_set_error_allocation_failed(state);
+            return NULL;
+        }
+        self->state = state;
+        self->src_width = src_width;
+        self->src_height = src_height;
+        if(!fig_resample_axis_init_(state, &self->horizontal, src_width, dest_width, filter)) {
+            fig_state_get_allocator(state)(fig_state_get_userdata(state), self, sizeof(fig_resampler), 0);
+            return NULL;
+        }
+        if(!fig_resample_axis_init_(state, &self->vertical, src_height, dest_height, filter)) {
+            fig_resample_axis_free_(state, &self->horizontal);
+            fig_state_get_allocator(state)(fig_state_get_userdata(state), self, sizeof(fig_resampler), 0);
+            return NULL;
+        }
+        return self;
+    }
+    return NULL;
+}
+
+size_t fig_resampler_get_src_width(fig_resampler *self) {
+    return self->src_width;
+}
+
+size_t fig_resampler_get_src_height(fig_resampler *self) {
+    return self->src_height;
+}
+
+size_t fig_resampler_get_dest_width(fig_resampler *self) {
+    return self->horizontal.dest_size;
+}
+
+size_t fig_resampler_get_dest_height(fig_resampler *self) {
+    return self->vertical.dest_size;
+}
+
+/* Filter the source rows used by a destination row into a row of premultiplied channels,
+ * with FIG_RESAMPLE_ROW_BITS bits after the point. */
+static void fig_resample_column_(fig_resampler *self, const fig_uint8_t *src, size_t src_stride, size_t y, long *row) {
+    const int *weights = self->vertical.weights + y * self->vertical.taps;
+    size_t start = self->vertical.starts[y];
+    size_t count = self->vertical.counts[y];
+    size_t width = self->src_width;
+    size_t i, k;
+
+    for(i = 0; i < width * 4; ++i) {
+        row[i] = 0;
+    }
+    for(k = 0; k < count; ++k) {
+        const fig_uint32_t *pixels = (const fig_uint32_t *) (src + (start + k) * src_stride);
+        long weight = weights[k];
+
+        if(weight == 0) {
+            continue;
+        }
+        for(i = 0; i < width; ++i) {
+            fig_uint32_t color = pixels[i];
+            long a = (long) (color >> 24);
+            long r = (long) ((color >> 16) & 0xFF);
+            long g = (long) ((color >> 8) & 0xFF);
+            long b = (long) (color & 0xFF);
+
+            /* Filtering premultiplied colors keeps transparent pixels from darkening their neighbors. */
+            if(a != 255) {
+                r = (r * a + 127) / 255;
+                g = (g * a + 127) / 255;
+                b = (b * a + 127) / 255;
+            }
+            row[i * 4] += b * weight;
+            row[i * 4 + 1] += g * weight;
+            row[i * 4 + 2] += r * weight;
+            row[i * 4 + 3] += a * weight;
+        }
+    }
+    /* Overshoot from negative lobes is clamped here, so the second pass never sees negative values. */
+    for(i = 0; i < width * 4; ++i) {
+        long value = row[i];
+        if(value <= 0) {
+            row[i] = 0;
+        } else {
+            value = (value + (1L << (FIG_RESAMPLE_WEIGHT_BITS - FIG_RESAMPLE_ROW_BITS - 1))) >> (FIG_RESAMPLE_WEIGHT_BITS - FIG_RESAMPLE_ROW_BITS);
+            row[i] = value < (255L << FIG_RESAMPLE_ROW_BITS) ? value : (255L << FIG_RESAMPLE_ROW_BITS);
+        }
+    }
+}
+
+static long fig_resample_channel_(long value) {
+    if(value <= 0) {
+        return 0;
+    }
+    value = (value + (1L << (FIG_RESAMPLE_WEIGHT_BITS + FIG_RESAMPLE_ROW_BITS - 1))) >> (FIG_RESAMPLE_WEIGHT_BITS + FIG_RESAMPLE_ROW_BITS);
+    return value < 255 ? value : 255;
+}
+
+/* Filter a row of premultiplied channels into a destination row of BGRA colors. */
+static void fig_resample_row_(fig_resampler *self, const long *row, fig_uint32_t *dest) {
+    const fig_resample_axis_ *axis = &self->horizontal;
+    size_t x, k;
+
+    for(x = 0; x < axis->dest_size; ++x) {
+        const int *weights = axis->weights + x * axis->taps;
+        const long *channels = row + axis->starts[x] * 4;
+        size_t count = axis->counts[x];
+        long b = 0, g = 0, r = 0, a = 0;
+
+        for(k = 0; k < count; ++k) {
+            long weight = weights[k];
+            b += channels[k * 4] * weight;
+            g += channels[k * 4 + 1] * weight;
+            r += channels[k * 4 + 2] * weight;
+            a += channels[k * 4 + 3] * weight;
+        }
+        a = fig_resample_channel_(a);
+        b = fig_resample_channel_(b);
+        g = fig_resample_channel_(g);
+        r = fig_resample_channel_(r);
+        if(a == 0) {
+            dest[x] = 0;
+            continue;
+        }
+        if(a != 255) {
+            b = b < a ? (b * 255 + a / 2) / a : 255;
+            g = g < a ? (g * 255 + a / 2) / a : 255;
+            r = r < a ? (r * 255 + a / 2) / a : 255;
+        }
+        dest[x] = ((fig_uint32_t) a << 24) | ((fig_uint32_t) r << 16) | ((fig_uint32_t) g << 8) | (fig_uint32_t) b;
+    }
+}
+
+fig_bool_t fig_resampler_resample_rows(fig_resampler *self, const fig_uint32_t *src, size_t src_stride, fig_uint32_t *dest, size_t dest_stride, size_t start, size_t end) {
+    fig_allocator_t alloc = fig_state_get_allocator(self->state);
+    void *ud = fig_state_get_userdata(self->state);
+    size_t row_size;
+    long *row;
+    size_t y;
+
+    FIG_ASSERT(start <= end && end <= self->vertical.dest_size);
+    if(self->src_width > ~(size_t) 0 / (4 * sizeof(long))) {
+        fig_state_set_error(self->state, "image dimensions requested are too large");
+        return 0;
+    }
+    row_size = self->src_width * 4 * sizeof(long);
+    row = (long *) alloc(ud, NULL, 0, row_size);
+    if(row == NULL) {
+        fig_state_set_error_allocation_failed(self->state);
+        return 0;
+    }
+    for(y = start; y < end; ++y) {
+        fig_resample_column_(self, (const fig_uint8_t *) src, src_stride, y, row);
+        fig_resample_row_(self, row, (fig_uint32_t *) ((fig_uint8_t *) dest + y * dest_stride));
+    }
+    alloc(ud, row, row_size, 0);
+    return 1;
+}
+
+fig_bool_t fig_resampler_resample(fig_resampler *self, const fig_uint32_t *src, size_t src_stride, fig_uint32_t *dest, size_t dest_stride) {
+    return fig_resampler_resample_rows(self, src, src_stride, dest, dest_stride, 0, self->vertical.dest_size);
 }
 
-void fig_palette_set(fig_palette *self, size_t index, fig_uint32_t color) {
-    FIG_ASSERT(index < self->size);
-    self->data[index] = color;
-}
+fig_bool_t fig_animation_resample_frame(fig_animation *self, size_t index, fig_resampler *resampler, fig_uint32_t *out, size_t out_stride) {
+    fig_state *state = resampler->state;
+    fig_image *image;
+    size_t width = fig_animation_get_width(self);
+    size_t height = fig_animation_get_height(self);
+    fig_uint32_t *canvas;
+    fig_bool_t result;
 
-fig_bool_t fig_palette_resize(fig_palette *self, size_t size) {
-    if(self->size >= size) {
-        if(size == 0) {
-            fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
-                self->data, sizeof(fig_uint32_t) * self->size, 0);
-            self->data = NULL;
-        }
-        self->size = size;
+    if(index >= fig_animation_count_images(self)) {
+        fig_state_set_error(state, "image index is out of range");
+        return 0;
+    }
+    if(resampler->src_width != width || resampler->src_height != height) {
+        fig_state_set_error(state, "resampler source size doesn't match the canvas");
+        return 0;
+    }
 
-        return 1;
-    } else {
-        fig_uint32_t *data;
-        data = (fig_uint32_t *) fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
-            self->data, sizeof(fig_uint32_t) * self->size, sizeof(fig_uint32_t) * size);
+    /* A render surface covering the canvas is the frame itself, so it's read in place. */
+    image = fig_animation_get_images(self)[index];
+    if(fig_image_get_render_data(image) != NULL
+    && fig_image_get_render_width(image) == width
+    && fig_image_get_render_height(image) == height) {
+        return fig_resampler_resample(resampler, fig_image_get_render_data(image), fig_image_get_render_stride(image), out, out_stride);
+    }
 
-        if(data != NULL) {
-            self->data = data;
-            self->size = size;
-            return 1;
-        }
-        fig_state_set_error_allocation_failed(self->state);
+    if(height > ~(size_t) 0 / sizeof(fig_uint32_t) / width) {
+        fig_state_set_error(state, "image dimensions requested are too large");
+        return 0;
+    }
+    canvas = (fig_uint32_t *) fig_state_get_allocator(state)(fig_state_get_userdata(state), NULL, 0, width * height * sizeof(fig_uint32_t));
+    if(canvas == NULL) {
+        fig_state_set_error_allocation_failed(state);
         return 0;
     }
+    result = fig_animation_get_frame_rgba(self, index, canvas)
+        && fig_resampler_resample(resampler, canvas, width * sizeof(fig_uint32_t), out, out_stride);
+    fig_state_get_allocator(state)(fig_state_get_userdata(state), canvas, width * height * sizeof(fig_uint32_t), 0);
+    return result;
 }
 
-void fig_palette_free(fig_palette *self) {
+void fig_resampler_free(fig_resampler *self) {
     if(self != NULL) {
-        fig_allocator_t alloc = fig_state_get_allocator(self->state);
-        void *ud = fig_state_get_userdata(self->state);    
-
-        if(self->data != NULL) {
-            alloc(ud, self->data, sizeof(fig_uint32_t) * self->size, 0);
-        }
-        alloc(ud, self, sizeof(fig_palette), 0);
+        fig_resample_axis_free_(self->state, &self->horizontal);
+        fig_resample_axis_free_(self->state, &self->vertical);
+        fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state), self, sizeof(fig_resampler), 0);
     }
 }
 
@@ -2354,6 +6708,8 @@ struct fig_state {
     const char *error;
     fig_allocator_t alloc;
     void *ud;
+    fig_allocator_t storage_alloc;
+    void *storage_ud;
 };
 
 static void *fig_default_alloc_(void *ud, void *ptr, size_t old_size, size_t new_size) {
@@ -2382,6 +6738,8 @@ fig_state *fig_create_custom_state(fig_allocator_t alloc, void *ud) {
         self->error = NULL;
         self->alloc = alloc;
         self->ud = ud;
+        self->storage_alloc = alloc;
+        self->storage_ud = ud;
     }
     return self;
 }
@@ -2406,11 +6764,404 @@ void *fig_state_get_userdata(fig_state *self) {
     return self->ud;
 }
 
+void fig_state_set_storage_allocator(fig_state *self, fig_allocator_t alloc, void *ud) {
+    self->storage_alloc = alloc;
+    self->storage_ud = ud;
+}
+
+fig_allocator_t fig_state_get_storage_allocator(fig_state *self) {
+    return self->storage_alloc;
+}
+
+void *fig_state_get_storage_userdata(fig_state *self) {
+    return self->storage_ud;
+}
+
 void fig_state_free(fig_state *self) {
     if(self != NULL) {
         self->alloc(self->ud, self, sizeof(fig_state), 0);
     }
 }
+#ifdef FIG_MAPPED_STORAGE
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#endif
+
+#ifdef FIG_MAPPED_STORAGE
+
+#ifdef _WIN32
+static void *fig_map_temporary_file_(size_t size) {
+    char directory[MAX_PATH];
+    char filename[MAX_PATH];
+    HANDLE file;
+    HANDLE mapping;
+    void *data;
+
+    if(GetTempPathA(MAX_PATH, directory) == 0
+    || GetTempFileNameA(directory, "fig", 0, filename) == 0) {
+        return NULL;
+    }
+    file = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if(file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE,
+        (DWORD) ((unsigned __int64) size >> 32), (DWORD) size, NULL);
+    /* The view keeps the file alive until it's unmapped, and then it's deleted. */
+    CloseHandle(file);
+    if(mapping == NULL) {
+        return NULL;
+    }
+    data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    CloseHandle(mapping);
+    return data;
+}
+
+static void fig_unmap_temporary_file_(void *data, size_t size) {
+    (void) size;
+    UnmapViewOfFile(data);
+}
+#else
+static void *fig_map_temporary_file_(size_t size) {
+    FILE *file;
+    void *data;
+
+    file = tmpfile();
+    if(file == NULL) {
+        return NULL;
+    }
+    if(ftruncate(fileno(file), (off_t) size) != 0) {
+        fclose(file);
+        return NULL;
+    }
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(file), 0);
+    /* The mapping keeps the file alive until it's unmapped, and then it's deleted. */
+    fclose(file);
+    return data != MAP_FAILED ? data : NULL;
+}
+
+static void fig_unmap_temporary_file_(void *data, size_t size) {
+    munmap(data, size);
+}
+#endif
+
+void *fig_mapped_storage_alloc(void *ud, void *ptr, size_t old_size, size_t new_size) {
+    void *data;
+    (void) ud;
+
+    if((ptr != NULL && old_size == 0)
+    || (ptr == NULL && old_size != 0)) {
+        return NULL;
+    }
+
+    data = NULL;
+    if(new_size != 0) {
+        data = fig_map_temporary_file_(new_size);
+        if(data == NULL) {
+            return NULL;
+        }
+        if(ptr != NULL) {
+            memcpy(data, ptr, old_size < new_size ? old_size : new_size);
+        }
+    }
+    if(ptr != NULL) {
+        fig_unmap_temporary_file_(ptr, old_size);
+    }
+    return data;
+}
+
+#endif
+
+/* The tensor value of each channel for every possible byte of that channel. */
+typedef struct {
+    size_t channels;
+    fig_bool_t is_float;
+    float floats[4][256];
+    fig_uint8_t bytes[4][256];
+} fig_tensor_lut_;
+
+/* Where the channels are in a BGRA color, in tensor channel order. */
+static const unsigned fig_tensor_channel_shifts_[4] = { 16, 8, 0, 24 };
+
+static void fig_tensor_lut_init_(fig_tensor_lut_ *lut, const fig_tensor_options *options) {
+    size_t c, i;
+
+    lut->channels = options->channels;
+    lut->is_float = options->type == FIG_TENSOR_TYPE_FLOAT32;
+    for(c = 0; c < lut->channels; ++c) {
+        for(i = 0; i < 256; ++i) {
+            lut->floats[c][i] = ((float) i / 255.0f - options->mean[c]) / options->std[c];
+            lut->bytes[c][i] = (fig_uint8_t) i;
+        }
+    }
+}
+
+/* Fold a palette into a lookup table, so that each channel of a palette index is a single lookup.
+ * The background index is transparent. */
+static void fig_tensor_lut_fold_palette_(const fig_tensor_lut_ *lut, fig_palette *palette, size_t background_index, fig_tensor_lut_ *dest) {
+    fig_uint32_t *colors = fig_palette_get_colors(palette);
+    size_t color_count = fig_palette_count_colors(palette);
+    size_t c, i;
+
+    dest->channels = lut->channels;
+    dest->is_float = lut->is_float;
+    for(i = 0; i < 256; ++i) {
+        fig_uint32_t color = i < color_count && i != background_index ? colors[i] : 0;
+
+        for(c = 0; c < lut->channels; ++c) {
+            size_t value = (color >> fig_tensor_channel_shifts_[c]) & 0xFF;
+            dest->floats[c][i] = lut->floats[c][value];
+            dest->bytes[c][i] = lut->bytes[c][value];
+        }
+    }
+}
+
+/* Write a row of palette indices into the tensor. Each channel is written as its own pass,
+ * so that the planes of a NCHW tensor are written sequentially. The steps are in elements. */
+static void fig_tensor_write_index_row_(const fig_tensor_lut_ *lut, const fig_uint8_t *src, size_t width, void *dest, size_t pixel_step, size_t channel_step) {
+    size_t c, x;
+
+    for(c = 0; c < lut->channels; ++c) {
+        if(lut->is_float) {
+            const float *values = lut->floats[c];
+            float *out = (float *) dest + c * channel_step;
+
+            for(x = 0; x < width; ++x) {
+                out[x * pixel_step] = values[src[x]];
+            }
+        } else {
+            const fig_uint8_t *values = lut->bytes[c];
+            fig_uint8_t *out = (fig_uint8_t *) dest + c * channel_step;
+
+            for(x = 0; x < width; ++x) {
+                out[x * pixel_step] = values[src[x]];
+            }
+        }
+    }
+}
+
+/* Write a row of BGRA colors into the tensor, like fig_tensor_write_index_row_. */
+static void fig_tensor_write_color_row_(const fig_tensor_lut_ *lut, const fig_uint32_t *src, size_t width, void *dest, size_t pixel_step, size_t channel_step) {
+    size_t c, x;
+
+    for(c = 0; c < lut->channels; ++c) {
+        unsigned shift = fig_tensor_channel_shifts_[c];
+
+        if(lut->is_float) {
+            const float *values = lut->floats[c];
+            float *out = (float *) dest + c * channel_step;
+
+            for(x = 0; x < width; ++x) {
+                out[x * pixel_step] = values[(src[x] >> shift) & 0xFF];
+            }
+        } else {
+            fig_uint8_t *out = (fig_uint8_t *) dest + c * channel_step;
+
+            for(x = 0; x < width; ++x) {
+                out[x * pixel_step] = (fig_uint8_t) ((src[x] >> shift) & 0xFF);
+            }
+        }
+    }
+}
+
+/* Get the tensor dimensions for an animation. */
+static void fig_tensor_get_dimensions_(fig_animation *animation, const fig_tensor_options *options, size_t *width, size_t *height) {
+    *width = options->width != 0 ? options->width : fig_animation_get_width(animation);
+    *height = options->height != 0 ? options->height : fig_animation_get_height(animation);
+}
+
+size_t fig_get_tensor_size(fig_animation *animation, size_t count, const fig_tensor_options *options) {
+    size_t element_size = options->type == FIG_TENSOR_TYPE_FLOAT32 ? sizeof(float) : sizeof(fig_uint8_t);
+    size_t width, height;
+
+    if(options->channels != 3 && options->channels != 4) {
+        return 0;
+    }
+    fig_tensor_get_dimensions_(animation, options, &width, &height);
+    if((height != 0 && width > ~(size_t) 0 / height)
+    || (width * height != 0 && count > ~(size_t) 0 / (width * height) / options->channels / element_size)) {
+        return 0;
+    }
+    return count * width * height * options->channels * element_size;
+}
+
+/* The state used for writing every frame of a tensor. */
+typedef struct {
+    fig_state *state;
+    fig_animation *animation;
+    const fig_tensor_options *options;
+    size_t width;
+    size_t height;
+    size_t element_size;
+    fig_tensor_lut_ lut;
+    /* The lookup table folded with the animation palette, or NULL if not made yet. */
+    fig_tensor_lut_ *index_lut;
+    /* Reused for frames without a render surface to read, or NULL if not allocated yet. */
+    fig_uint32_t *canvas;
+    size_t canvas_size;
+    /* Used when the tensor size differs from the canvas, or NULL. */
+    fig_resampler *resampler;
+} fig_tensor_writer_;
+
+static void fig_tensor_writer_free_(fig_tensor_writer_ *self) {
+    fig_allocator_t alloc = fig_state_get_allocator(self->state);
+    void *ud = fig_state_get_userdata(self->state);
+
+    alloc(ud, self->index_lut, self->index_lut != NULL ? sizeof(fig_tensor_lut_) : 0, 0);
+    alloc(ud, self->canvas, self->canvas != NULL ? self->canvas_size : 0, 0);
+    fig_resampler_free(self->resampler);
+}
+
+/* Write the frame of the image at the given index into a tensor frame starting at dest. */
+static fig_bool_t fig_tensor_write_frame_(fig_tensor_writer_ *self, size_t index, fig_uint8_t *dest) {
+    fig_animation *animation = self->animation;
+    fig_image *image = fig_animation_get_images(animation)[index];
+    size_t canvas_width = fig_animation_get_width(animation);
+    size_t canvas_height = fig_animation_get_height(animation);
+    size_t pixel_step, channel_step, row_step;
+    size_t y;
+
+    if(self->options->layout == FIG_TENSOR_LAYOUT_NHWC) {
+        pixel_step = self->options->channels;
+        channel_step = 1;
+        row_step = self->width * self->options->channels;
+    } else {
+        pixel_step = 1;
+        channel_step = self->width * self->height;
+        row_step = self->width;
+    }
+    row_step *= self->element_size;
+
+    if(self->resampler == NULL
+    && fig_image_get_render_index_data(image) != NULL
+    && fig_image_get_render_width(image) == canvas_width
+    && fig_image_get_render_height(image) == canvas_height) {
+        const fig_uint8_t *src = fig_image_get_render_index_data(image);
+        size_t stride = fig_image_get_render_stride(image);
+
+        /* Palette index surfaces are read straight through the palette, without expanding them into colors. */
+        if(self->index_lut == NULL) {
+            self->index_lut = (fig_tensor_lut_ *) fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state), NULL, 0, sizeof(fig_tensor_lut_));
+            if(self->index_lut == NULL) {
+                fig_state_set_error_allocation_failed(self->state);
+                return 0;
+            }
+            fig_tensor_lut_fold_palette_(&self->lut, fig_animation_get_palette(animation),
+                fig_animation_get_render_background_index(animation), self->index_lut);
+        }
+        for(y = 0; y < self->height; ++y) {
+            fig_tensor_write_index_row_(self->index_lut, src + y * stride, self->width, dest + y * row_step, pixel_step, channel_step);
+        }
+    } else {
+        const fig_uint32_t *src;
+        size_t stride;
+
+        if(self->resampler == NULL
+        && fig_image_get_render_data(image) != NULL
+        && fig_image_get_render_width(image) == canvas_width
+        && fig_image_get_render_height(image) == canvas_height) {
+            src = fig_image_get_render_data(image);
+            stride = fig_image_get_render_stride(image);
+        } else {
+            if(self->canvas == NULL) {
+                self->canvas = (fig_uint32_t *) fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state), NULL, 0, self->canvas_size);
+                if(self->canvas == NULL) {
+                    fig_state_set_error_allocation_failed(self->state);
+                    return 0;
+                }
+            }
+            if(self->resampler != NULL) {
+                if(!fig_animation_resample_frame(animation, index, self->resampler, self->canvas, self->width * sizeof(fig_uint32_t))) {
+                    return 0;
+                }
+            } else if(!fig_animation_get_frame_rgba(animation, index, self->canvas)) {
+                return 0;
+            }
+            src = self->canvas;
+            stride = self->width * sizeof(fig_uint32_t);
+        }
+        for(y = 0; y < self->height; ++y) {
+            fig_tensor_write_color_row_(&self->lut, (const fig_uint32_t *) ((const fig_uint8_t *) src + y * stride),
+                self->width, dest + y * row_step, pixel_step, channel_step);
+        }
+    }
+    return 1;
+}
+
+fig_bool_t fig_export_tensor(fig_state *state, void *out, fig_animation *animation, const size_t *indices, size_t count, const fig_tensor_options *options) {
+    fig_tensor_writer_ writer;
+    size_t image_count = fig_animation_count_images(animation);
+    size_t frame_size;
+    size_t i;
+
+    FIG_ASSERT(options->type < FIG_TENSOR_TYPE_COUNT);
+    FIG_ASSERT(options->layout < FIG_TENSOR_LAYOUT_COUNT);
+    if(options->channels != 3 && options->channels != 4) {
+        fig_state_set_error(state, "tensors must have 3 or 4 channels");
+        return 0;
+    }
+    if(options->type == FIG_TENSOR_TYPE_FLOAT32) {
+        for(i = 0; i < options->channels; ++i) {
+            if(options->std[i] == 0.0f) {
+                fig_state_set_error(state, "tensor normalization requires a nonzero standard deviation");
+                return 0;
+            }
+        }
+    }
+    for(i = 0; i < count; ++i) {
+        if((indices != NULL ? indices[i] : i) >= image_count) {
+            fig_state_set_error(state, "image index is out of range");
+            return 0;
+        }
+    }
+    if(fig_animation_get_width(animation) == 0 || fig_animation_get_height(animation) == 0) {
+        fig_state_set_error(state, "image is empty");
+        return 0;
+    }
+    frame_size = fig_get_tensor_size(animation, 1, options);
+    if(frame_size == 0 || (count != 0 && fig_get_tensor_size(animation, count, options) == 0)) {
+        fig_state_set_error(state, "image dimensions requested are too large");
+        return 0;
+    }
+
+    memset(&writer, 0, sizeof(writer));
+    writer.state = state;
+    writer.animation = animation;
+    writer.options = options;
+    fig_tensor_get_dimensions_(animation, options, &writer.width, &writer.height);
+    writer.element_size = options->type == FIG_TENSOR_TYPE_FLOAT32 ? sizeof(float) : sizeof(fig_uint8_t);
+    fig_tensor_lut_init_(&writer.lut, options);
+
+    if(writer.width != fig_animation_get_width(animation) || writer.height != fig_animation_get_height(animation)) {
+        writer.resampler = fig_create_resampler(state, fig_animation_get_width(animation), fig_animation_get_height(animation),
+            writer.width, writer.height, options->filter);
+        if(writer.resampler == NULL) {
+            return 0;
+        }
+    }
+    /* The canvas holds a reconstructed or resampled frame, which is the size of the tensor frame either way. */
+    if(writer.width * writer.height > ~(size_t) 0 / sizeof(fig_uint32_t)) {
+        fig_state_set_error(state, "image dimensions requested are too large");
+        fig_tensor_writer_free_(&writer);
+        return 0;
+    }
+    writer.canvas_size = writer.width * writer.height * sizeof(fig_uint32_t);
+
+    for(i = 0; i < count; ++i) {
+        if(!fig_tensor_write_frame_(&writer, indices != NULL ? indices[i] : i, (fig_uint8_t *) out + i * frame_size)) {
+            fig_tensor_writer_free_(&writer);
+            return 0;
+        }
+    }
+    fig_tensor_writer_free_(&writer);
+    return 1;
+}
 
 fig_uint32_t fig_pack_color(fig_uint8_t r, fig_uint8_t g, fig_uint8_t b, fig_uint8_t a) {
     return ((fig_uint32_t) r << 16)
@@ -2425,6 +7176,185 @@ void fig_unpack_color(fig_uint32_t color, fig_uint8_t *r, fig_uint8_t *g, fig_ui
     *b = (fig_uint8_t)(color & 0xFF);
     *a = (fig_uint8_t)((color >> 24) & 0xFF);
 }
+
+void fig_init_load_options(fig_load_options *options) {
+    options->render_images = 1;
+    options->render_mode = FIG_RENDER_MODE_FULL;
+    options->contiguous_render = 0;
+    options->contiguous_indexed = 0;
+    options->perceptual_hashes = 0;
+}
+
+size_t fig_perceptual_hash_distance(const fig_uint8_t *a, const fig_uint8_t *b) {
+    size_t distance = 0;
+    size_t i;
+
+    for(i = 0; i < 8; ++i) {
+        unsigned bits = (unsigned) (a[i] ^ b[i]);
+        while(bits != 0) {
+            bits &= bits - 1;
+            ++distance;
+        }
+    }
+    return distance;
+}
+
+void fig_init_atlas_options(fig_atlas_options *options) {
+    options->indexed = 0;
+    options->max_width = 0;
+    options->padding = 0;
+}
+
+void fig_init_tensor_options(fig_tensor_options *options) {
+    size_t i;
+
+    options->type = FIG_TENSOR_TYPE_UINT8;
+    options->layout = FIG_TENSOR_LAYOUT_NCHW;
+    options->channels = 3;
+    options->width = 0;
+    options->height = 0;
+    options->filter = FIG_FILTER_BILINEAR;
+    for(i = 0; i < 4; ++i) {
+        options->mean[i] = 0.0f;
+        options->std[i] = 1.0f;
+    }
+}
+
+size_t fig_pixel_format_get_size(fig_pixel_format_t format) {
+    switch(format) {
+        case FIG_PIXEL_FORMAT_RGB8: return 3;
+        case FIG_PIXEL_FORMAT_RGB565: return 2;
+        default: return 4;
+    }
+}
+
+/* Convert a row of BGRA colors into the given format.
+ * The format is dispatched once per row, so every inner loop is a
+ * straight pass that the compiler is free to unroll or vectorize. */
+static void fig_convert_color_row_(const fig_uint32_t *src, fig_uint8_t *dest, size_t width, fig_pixel_format_t format) {
+    size_t i;
+
+    switch(format) {
+        case FIG_PIXEL_FORMAT_RGBA8:
+            for(i = 0; i < width; ++i) {
+                fig_uint32_t color = src[i];
+                dest[0] = (fig_uint8_t)((color >> 16) & 0xFF);
+                dest[1] = (fig_uint8_t)((color >> 8) & 0xFF);
+                dest[2] = (fig_uint8_t)(color & 0xFF);
+                dest[3] = (fig_uint8_t)((color >> 24) & 0xFF);
+                dest += 4;
+            }
+            break;
+        case FIG_PIXEL_FORMAT_BGRA8:
+            for(i = 0; i < width; ++i) {
+                fig_uint32_t color = src[i];
+                dest[0] = (fig_uint8_t)(color & 0xFF);
+                dest[1] = (fig_uint8_t)((color >> 8) & 0xFF);
+                dest[2] = (fig_uint8_t)((color >> 16) & 0xFF);
+                dest[3] = (fig_uint8_t)((color >> 24) & 0xFF);
+                dest += 4;
+            }
+            break;
+        case FIG_PIXEL_FORMAT_RGB8:
+            for(i = 0; i < width; ++i) {
+                fig_uint32_t color = src[i];
+                dest[0] = (fig_uint8_t)((color >> 16) & 0xFF);
+                dest[1] = (fig_uint8_t)((color >> 8) & 0xFF);
+                dest[2] = (fig_uint8_t)(color & 0xFF);
+                dest += 3;
+            }
+            break;
+        case FIG_PIXEL_FORMAT_RGB565: {
+            fig_uint16_t *dest16 = (fig_uint16_t *) dest;
+            for(i = 0; i < width; ++i) {
+                fig_uint32_t color = src[i];
+                dest16[i] = (fig_uint16_t)(((color >> 8) & 0xF800)
+                    | ((color >> 5) & 0x07E0)
+                    | ((color >> 3) & 0x001F));
+            }
+            break;
+        }
+        case FIG_PIXEL_FORMAT_PREMULTIPLIED_RGBA8:
+            for(i = 0; i < width; ++i) {
+                fig_uint32_t color = src[i];
+                fig_uint32_t a = (color >> 24) & 0xFF;
+                dest[0] = (fig_uint8_t)((((color >> 16) & 0xFF) * a + 127) / 255);
+                dest[1] = (fig_uint8_t)((((color >> 8) & 0xFF) * a + 127) / 255);
+                dest[2] = (fig_uint8_t)(((color & 0xFF) * a + 127) / 255);
+                dest[3] = (fig_uint8_t) a;
+                dest += 4;
+            }
+            break;
+        default:
+            FIG_ASSERT(0);
+            break;
+    }
+}
+
+void fig_convert_colors(const fig_uint32_t *src, size_t src_stride, void *dest, size_t dest_stride, size_t width, size_t height, fig_pixel_format_t format) {
+    const fig_uint8_t *src_row = (const fig_uint8_t *) src;
+    fig_uint8_t *dest_row = (fig_uint8_t *) dest;
+    size_t i;
+
+    for(i = 0; i < height; ++i) {
+        fig_convert_color_row_((const fig_uint32_t *) src_row, dest_row, width, format);
+        src_row += src_stride;
+        dest_row += dest_stride;
+    }
+}
+
+void fig_convert_indices(const fig_uint8_t *src, size_t src_stride, const fig_uint32_t *colors, size_t color_count, void *dest, size_t dest_stride, size_t width, size_t height, fig_pixel_format_t format) {
+    fig_uint32_t lut_colors[256];
+    fig_uint8_t lut[256 * 4];
+    fig_uint16_t lut16[256];
+    fig_uint8_t *dest_row = (fig_uint8_t *) dest;
+    size_t pixel_size = fig_pixel_format_get_size(format);
+    size_t i, j;
+
+    /* Convert the palette once, so each pixel is a single table lookup. */
+    for(i = 0; i < 256; ++i) {
+        lut_colors[i] = i < color_count ? colors[i] : 0;
+    }
+    for(i = 0; i < 256; ++i) {
+        if(pixel_size == 2) {
+            fig_convert_color_row_(&lut_colors[i], (fig_uint8_t *) &lut16[i], 1, format);
+        } else {
+            fig_convert_color_row_(&lut_colors[i], lut + i * 4, 1, format);
+        }
+    }
+
+    for(i = 0; i < height; ++i) {
+        const fig_uint8_t *src_row = src + i * src_stride;
+
+        switch(pixel_size) {
+            case 4:
+                for(j = 0; j < width; ++j) {
+                    const fig_uint8_t *pixel = lut + src_row[j] * 4;
+                    dest_row[j * 4] = pixel[0];
+                    dest_row[j * 4 + 1] = pixel[1];
+                    dest_row[j * 4 + 2] = pixel[2];
+                    dest_row[j * 4 + 3] = pixel[3];
+                }
+                break;
+            case 3:
+                for(j = 0; j < width; ++j) {
+                    const fig_uint8_t *pixel = lut + src_row[j] * 4;
+                    dest_row[j * 3] = pixel[0];
+                    dest_row[j * 3 + 1] = pixel[1];
+                    dest_row[j * 3 + 2] = pixel[2];
+                }
+                break;
+            case 2: {
+                fig_uint16_t *dest16 = (fig_uint16_t *) dest_row;
+                for(j = 0; j < width; ++j) {
+                    dest16[j] = lut16[src_row[j]];
+                }
+                break;
+            }
+        }
+        dest_row += dest_stride;
+    }
+}
 #endif
 
 #endif
@@ -1,3 +1,4 @@
+#include <stddef.h>
 #include <string.h>
 #include <fig.h>
 
@@ -10,6 +11,21 @@ struct fig_animation {
     size_t image_capacity;
     fig_image **image_data;
     size_t loop_count;
+    fig_render_mode_t render_mode;
+    size_t checkpoint_interval;
+    size_t sample_interval;
+    size_t sample_rate;
+    size_t sample_duration;
+    fig_bool_t perceptual_hashes;
+    /* Blocks holding the surfaces of every image, or NULL if not allocated. */
+    void *render_slab;
+    size_t render_slab_pitch;
+    size_t render_slab_count;
+    fig_uint8_t *indexed_slab;
+    size_t indexed_slab_pitch;
+    size_t indexed_slab_count;
+    /* The background index of the last palette index render, or 256 if none. */
+    size_t render_background_index;
 };
 
 fig_animation *fig_create_animation(fig_state *state) {
@@ -24,6 +40,19 @@ fig_animation *fig_create_animation(fig_state *state) {
             self->image_capacity = 0;
             self->image_data = NULL;
             self->loop_count = 0;
+            self->render_mode = FIG_RENDER_MODE_FULL;
+            self->checkpoint_interval = 16;
+            self->sample_interval = 1;
+            self->sample_rate = 0;
+            self->sample_duration = 100;
+            self->perceptual_hashes = 0;
+            self->render_slab = NULL;
+            self->render_slab_pitch = 0;
+            self->render_slab_count = 0;
+            self->indexed_slab = NULL;
+            self->indexed_slab_pitch = 0;
+            self->indexed_slab_count = 0;
+            self->render_background_index = 256;
 
             if(self->palette == NULL) {
                 return fig_animation_free(self), NULL;
@@ -69,6 +98,54 @@ void fig_animation_set_loop_count(fig_animation *self, size_t value) {
     self->loop_count = value;
 }
 
+fig_render_mode_t fig_animation_get_render_mode(fig_animation *self) {
+    return self->render_mode;
+}
+
+void fig_animation_set_render_mode(fig_animation *self, fig_render_mode_t value) {
+    FIG_ASSERT(value < FIG_RENDER_MODE_COUNT);
+    self->render_mode = value;
+}
+
+size_t fig_animation_get_checkpoint_interval(fig_animation *self) {
+    return self->checkpoint_interval;
+}
+
+void fig_animation_set_checkpoint_interval(fig_animation *self, size_t value) {
+    self->checkpoint_interval = value;
+}
+
+size_t fig_animation_get_sample_interval(fig_animation *self) {
+    return self->sample_interval;
+}
+
+void fig_animation_set_sample_interval(fig_animation *self, size_t value) {
+    FIG_ASSERT(value >= 1);
+    self->sample_interval = value;
+}
+
+size_t fig_animation_get_sample_rate(fig_animation *self) {
+    return self->sample_rate;
+}
+
+size_t fig_animation_get_sample_duration(fig_animation *self) {
+    return self->sample_duration;
+}
+
+void fig_animation_set_sample_rate(fig_animation *self, size_t rate, size_t duration) {
+    FIG_ASSERT(duration >= 1);
+    self->sample_rate = rate;
+    self->sample_duration = duration;
+}
+
+fig_bool_t fig_animation_get_perceptual_hashes(fig_animation *self) {
+    return self->perceptual_hashes;
+}
+
+void fig_animation_set_perceptual_hashes(fig_animation *self, fig_bool_t value) {
+    self->perceptual_hashes = value;
+}
+
 void fig_animation_swap_images(fig_animation *self, size_t index_a, size_t index_b) {
     fig_image *temp;
     FIG_ASSERT(index_a < self->image_count);
@@ -138,142 +215,719 @@ void fig_animation_remove_image(fig_animation *self, size_t index) {
     --self->image_count;
 }
 
-static void fig_clear_image_(fig_animation *self, fig_image *image) {
+static fig_rect fig_get_canvas_rect_(fig_animation *self) {
+    fig_rect rect;
+    rect.x = 0;
+    rect.y = 0;
+    rect.width = self->width;
+    rect.height = self->height;
+    return rect;
+}
+
+static fig_rect fig_get_image_rect_(fig_animation *self, fig_image *image) {
+    fig_rect rect;
+    rect.x = fig_image_get_origin_x(image);
+    rect.y = fig_image_get_origin_y(image);
+    rect.width = fig_image_get_indexed_width(image);
+    rect.height = fig_image_get_indexed_height(image);
+
+    if(rect.x >= self->width || rect.y >= self->height) {
+        rect.x = rect.y = rect.width = rect.height = 0;
+    } else {
+        if(rect.width > self->width - rect.x) {
+            rect.width = self->width - rect.x;
+        }
+        if(rect.height > self->height - rect.y) {
+            rect.height = self->height - rect.y;
+        }
+    }
+    return rect;
+}
+
+static fig_bool_t fig_rect_is_empty_(const fig_rect *rect) {
+    return rect->width == 0 || rect->height == 0;
+}
+
+static void fig_rect_union_(fig_rect *rect, const fig_rect *other) {
+    if(fig_rect_is_empty_(other)) {
+        return;
+    } else if(fig_rect_is_empty_(rect)) {
+        *rect = *other;
+    } else {
+        size_t right = rect->x + rect->width;
+        size_t bottom = rect->y + rect->height;
+        if(other->x + other->width > right) {
+            right = other->x + other->width;
+        }
+        if(other->y + other->height > bottom) {
+            bottom = other->y + other->height;
+        }
+        if(other->x < rect->x) {
+            rect->x = other->x;
+        }
+        if(other->y < rect->y) {
+            rect->y = other->y;
+        }
+        rect->width = right - rect->x;
+        rect->height = bottom - rect->y;
+    }
+}
+
+static fig_rect fig_rect_intersect_(const fig_rect *rect, const fig_rect *other) {
+    fig_rect result;
+    size_t right = rect->x + rect->width;
+    size_t bottom = rect->y + rect->height;
+
+    if(other->x + other->width < right) {
+        right = other->x + other->width;
+    }
+    if(other->y + other->height < bottom) {
+        bottom = other->y + other->height;
+    }
+    result.x = rect->x > other->x ? rect->x : other->x;
+    result.y = rect->y > other->y ? rect->y : other->y;
+    if(result.x >= right || result.y >= bottom) {
+        result.x = result.y = result.width = result.height = 0;
+    } else {
+        result.width = right - result.x;
+        result.height = bottom - result.y;
+    }
+    return result;
+}
+
+/* Copy a rectangle of pixels between two canvas-sized surfaces.
+ * The pitches are the number of pixels between the start of each row. */
+static void fig_copy_canvas_rect_(fig_uint32_t *dest, size_t dest_pitch, const fig_uint32_t *src, size_t src_pitch, const fig_rect *rect) {
     size_t i;
-    size_t size;
-    fig_uint32_t color;
-    fig_uint32_t *render_data;
 
-    size = fig_image_get_render_width(image) * fig_image_get_render_height(image);
-    color = 0;
-    render_data = fig_image_get_render_data(image);
-    for(i = 0; i < size; ++i) {
-        render_data[i] = color;
+    dest += rect->y * dest_pitch + rect->x;
+    src += rect->y * src_pitch + rect->x;
+    for(i = 0; i < rect->height; ++i) {
+        memcpy(dest, src, sizeof(fig_uint32_t) * rect->width);
+        dest += dest_pitch;
+        src += src_pitch;
+    }
+}
+
+/* Get the number of pixels between the start of each row of an image render surface. */
+static size_t fig_get_render_pitch_(fig_image *image) {
+    if(fig_image_get_render_data(image) != NULL) {
+        return fig_image_get_render_stride(image) / sizeof(fig_uint32_t);
+    } else {
+        return fig_image_get_render_stride(image);
+    }
+}
+
+/* Whether drawing this image replaces every pixel of the canvas,
+ * so that nothing drawn before it can show through. */
+static fig_bool_t fig_image_covers_canvas_(fig_animation *self, fig_image *image) {
+    return !fig_image_get_transparent(image)
+        && fig_image_get_origin_x(image) == 0
+        && fig_image_get_origin_y(image) == 0
+        && fig_image_get_indexed_width(image) == self->width
+        && fig_image_get_indexed_height(image) == self->height;
+}
+
+/* Get the smallest area of the canvas that contains every pixel
+ * that the given image draws, skipping rows and columns that it leaves transparent. */
+static fig_rect fig_get_opaque_rect_(fig_animation *self, fig_image *image) {
+    fig_rect rect = fig_get_image_rect_(self, image);
+    size_t transparency_index = fig_image_get_transparency_index(image);
+    const fig_uint8_t *index_data;
+    size_t pitch;
+    size_t left, right, top, bottom;
+    size_t i, j;
+
+    if(!fig_image_get_transparent(image) || transparency_index >= 256 || fig_rect_is_empty_(&rect)) {
+        return rect;
+    }
+
+    pitch = fig_image_get_indexed_stride(image);
+    index_data = fig_image_get_indexed_data(image);
+    left = rect.width;
+    right = 0;
+    top = rect.height;
+    bottom = 0;
+    for(i = 0; i < rect.height; ++i) {
+        const fig_uint8_t *row = index_data + i * pitch;
+        for(j = 0; j < rect.width; ++j) {
+            if(row[j] != transparency_index) {
+                break;
+            }
+        }
+        if(j == rect.width) {
+            continue;
+        }
+        if(j < left) {
+            left = j;
+        }
+        for(j = rect.width; j > right; --j) {
+            if(row[j - 1] != transparency_index) {
+                right = j;
+                break;
+            }
+        }
+        if(i < top) {
+            top = i;
+        }
+        bottom = i + 1;
+    }
+
+    if(top >= bottom) {
+        rect.width = rect.height = 0;
+    } else {
+        rect.x += left;
+        rect.y += top;
+        rect.width = right - left;
+        rect.height = bottom - top;
+    }
+    return rect;
+}
+
+/* Get the area of the canvas that is changed by disposing the given image. */
+static fig_rect fig_get_disposal_rect_(fig_animation *self, fig_image *image) {
+    switch(fig_image_get_disposal(image)) {
+        case FIG_DISPOSAL_BACKGROUND:
+        case FIG_DISPOSAL_PREVIOUS:
+            return fig_get_image_rect_(self, image);
+        default: {
+            fig_rect rect;
+            rect.x = rect.y = rect.width = rect.height = 0;
+            return rect;
+        }
+    }
+}
+
+/* Get the area of the canvas that may change when the current image is disposed and the next one is drawn.
+ * If nothing was drawn yet, this is the full canvas. */
+static fig_rect fig_get_draw_rect_(fig_animation *self, fig_image *cur, fig_image *next) {
+    fig_rect rect;
+    fig_rect image_rect;
+
+    if(cur == NULL) {
+        return fig_get_canvas_rect_(self);
     }
+    rect = fig_get_disposal_rect_(self, cur);
+    image_rect = fig_get_image_rect_(self, next);
+    fig_rect_union_(&rect, &image_rect);
+    return rect;
 }
 
-static void fig_dispose_indexed_(fig_animation *self, fig_image *prev, fig_image *cur, fig_image *next) {
-    size_t cur_x, cur_y, cur_w, cur_h;
-    fig_bool_t cur_transparent;
-    size_t cur_transparency_index;
-    fig_uint8_t *cur_index_data;
-    fig_uint32_t *next_render_data;
+/* Apply the disposal of an image to the canvas.
+ * The restore surface is the render of the most recent image that
+ * was not disposed, or NULL if there is no such image.
+ * Both surfaces hold the given area of the canvas, starting at its top-left corner.
+ * The pitches are the number of pixels between the start of each row. */
+static void fig_dispose_indexed_(fig_animation *self, fig_image *image, const fig_rect *area, fig_uint32_t *canvas, size_t canvas_pitch, const fig_uint32_t *restore, size_t restore_pitch) {
+    fig_rect rect;
+    size_t x, y, w, h;
+    size_t pitch;
+    fig_bool_t transparent;
+    size_t transparency_index;
+    fig_uint8_t *index_data;
     fig_disposal_t disposal;
+    size_t i, j;
 
-    cur_x = fig_image_get_origin_x(cur);
-    cur_y = fig_image_get_origin_y(cur);
-    cur_w = fig_image_get_indexed_width(cur);
-    cur_h = fig_image_get_indexed_height(cur);
-    cur_transparent = fig_image_get_transparent(cur);
-    cur_transparency_index = fig_image_get_transparency_index(cur);
-    cur_index_data = fig_image_get_indexed_data(cur);
-    next_render_data = fig_image_get_render_data(next);
-    disposal = fig_image_get_disposal(cur);
-
-    switch(disposal) {
-        case FIG_DISPOSAL_BACKGROUND: {
-            size_t i, j;
-            for(i = 0; i < cur_h; ++i) {
-                for(j = 0; j < cur_w; ++j) {
-                    if(!cur_transparent || cur_index_data[i * cur_w + j] != cur_transparency_index) {
-                        size_t k = (cur_y + i) * self->width + (cur_x + j);
-                        next_render_data[k] = 0;
-                    }
+    disposal = fig_image_get_disposal(image);
+    if(disposal != FIG_DISPOSAL_BACKGROUND && disposal != FIG_DISPOSAL_PREVIOUS) {
+        return;
+    }
+    if(disposal == FIG_DISPOSAL_PREVIOUS && restore == NULL) {
+        disposal = FIG_DISPOSAL_BACKGROUND;
+    }
+
+    /* Clip to the canvas and the area once, so that the row loops don't need bounds checks. */
+    rect = fig_get_image_rect_(self, image);
+    rect = fig_rect_intersect_(&rect, area);
+    if(fig_rect_is_empty_(&rect)) {
+        return;
+    }
+    x = rect.x - area->x;
+    y = rect.y - area->y;
+    w = rect.width;
+    h = rect.height;
+    pitch = fig_image_get_indexed_stride(image);
+    transparent = fig_image_get_transparent(image);
+    transparency_index = fig_image_get_transparency_index(image);
+    index_data = fig_image_get_indexed_data(image)
+        + (rect.y - fig_image_get_origin_y(image)) * pitch
+        + (rect.x - fig_image_get_origin_x(image));
+    canvas += y * canvas_pitch + x;
+    if(restore != NULL) {
+        restore += y * restore_pitch + x;
+    }
+
+    for(i = 0; i < h; ++i) {
+        const fig_uint8_t *src = index_data;
+        fig_uint32_t *dest = canvas;
+
+        if(disposal == FIG_DISPOSAL_BACKGROUND) {
+            for(j = 0; j < w; ++j) {
+                if(!transparent || src[j] != transparency_index) {
+                    dest[j] = 0;
                 }
             }
-            break;
-        }
-        case FIG_DISPOSAL_PREVIOUS: {
-            size_t i, j;
-            fig_uint32_t *prev_render_data;
-
-            prev_render_data = prev != NULL ? fig_image_get_render_data(prev) : NULL;
-            
-            for(i = 0; i < cur_h; ++i) {
-                for(j = 0; j < cur_w; ++j) {
-                    if(!cur_transparent || cur_index_data[i * cur_w + j] != cur_transparency_index) {
-                        size_t k = (cur_y + i) * self->width + (cur_x + j);
-                        next_render_data[k] = prev != NULL ? prev_render_data[k] : 0;
-                    }
+        } else {
+            const fig_uint32_t *prev = restore;
+            for(j = 0; j < w; ++j) {
+                if(!transparent || src[j] != transparency_index) {
+                    dest[j] = prev[j];
                 }
             }
-            break;
+            restore += restore_pitch;
         }
-        case FIG_DISPOSAL_UNSPECIFIED:
-        case FIG_DISPOSAL_NONE:
-        default:
-            break;
+
+        index_data += pitch;
+        canvas += canvas_pitch;
     }
 }
 
-static void fig_blit_indexed_(fig_animation *self, fig_image *image) {
+/* A color lookup table for drawing indexed data with a particular palette.
+ * Transparent indices have a color of 0 and a keep mask of all ones,
+ * so that a pixel can be composited as (dest & keep) | color. */
+typedef struct {
+    fig_uint32_t colors[256];
+    fig_uint32_t keep[256];
+    fig_bool_t transparent;
+} fig_render_lut_;
+
+static void fig_build_render_lut_(fig_animation *self, fig_image *image, fig_render_lut_ *lut) {
     fig_palette *palette;
+    fig_uint32_t *palette_colors;
+    size_t palette_size;
+    size_t i;
+
+    palette = fig_animation_get_render_palette(self, image);
+    palette_colors = fig_palette_get_colors(palette);
+    palette_size = fig_palette_count_colors(palette);
+    if(palette_size > 256) {
+        palette_size = 256;
+    }
+
+    for(i = 0; i < palette_size; ++i) {
+        lut->colors[i] = palette_colors[i];
+        lut->keep[i] = 0;
+    }
+    for(; i < 256; ++i) {
+        lut->colors[i] = 0;
+        lut->keep[i] = 0;
+    }
+
+    lut->transparent = fig_image_get_transparent(image)
+        && fig_image_get_transparency_index(image) < 256;
+    if(lut->transparent) {
+        size_t transparency_index = fig_image_get_transparency_index(image);
+        lut->colors[transparency_index] = 0;
+        lut->keep[transparency_index] = 0xFFFFFFFF;
+    }
+}
+
+/* Draw an image onto a canvas holding the given area of the full canvas. */
+static void fig_blit_indexed_(fig_animation *self, fig_image *image, const fig_rect *area, fig_uint32_t *canvas, size_t canvas_pitch) {
+    fig_render_lut_ lut;
+    fig_rect rect;
+    size_t x, y, w, h;
+    size_t pitch;
+    fig_uint8_t *index_data;
+    fig_uint32_t *render_data;
+    size_t i, j;
+
+    rect = fig_get_image_rect_(self, image);
+    rect = fig_rect_intersect_(&rect, area);
+    if(fig_rect_is_empty_(&rect)) {
+        return;
+    }
+    fig_build_render_lut_(self, image, &lut);
+    x = rect.x - area->x;
+    y = rect.y - area->y;
+    w = rect.width;
+    h = rect.height;
+    pitch = fig_image_get_indexed_stride(image);
+    index_data = fig_image_get_indexed_data(image)
+        + (rect.y - fig_image_get_origin_y(image)) * pitch
+        + (rect.x - fig_image_get_origin_x(image));
+    render_data = canvas + y * canvas_pitch + x;
+
+    for(i = 0; i < h; ++i) {
+        const fig_uint8_t *src = index_data;
+        fig_uint32_t *dest = render_data;
+
+        if(lut.transparent) {
+            for(j = 0; j < w; ++j) {
+                fig_uint8_t index = src[j];
+                dest[j] = (dest[j] & lut.keep[index]) | lut.colors[index];
+            }
+        } else {
+            for(j = 0; j < w; ++j) {
+                dest[j] = lut.colors[src[j]];
+            }
+        }
+
+        index_data += pitch;
+        render_data += canvas_pitch;
+    }
+}
+
+/* Whether any image in the animation uses previous disposal. */
+static fig_bool_t fig_animation_uses_restore_(fig_animation *self) {
+    size_t i;
+    for(i = 0; i < self->image_count; ++i) {
+        if(fig_image_get_disposal(self->image_data[i]) == FIG_DISPOSAL_PREVIOUS) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Whether the rest of the animation can be rendered starting from
+ * the render of this image alone, without anything drawn before it. */
+static fig_bool_t fig_image_is_checkpoint_(fig_image *image, fig_bool_t uses_restore) {
+    fig_disposal_t disposal = fig_image_get_disposal(image);
+    return !uses_restore
+        || disposal == FIG_DISPOSAL_NONE
+        || disposal == FIG_DISPOSAL_UNSPECIFIED;
+}
+
+/* Whether the image at the given index can be rendered without the render
+ * of any image before it, and the images after it don't need to restore
+ * the render of any image before it either. */
+static fig_bool_t fig_animation_is_keyframe_(fig_animation *self, size_t index, fig_bool_t uses_restore) {
+    fig_image *image;
+    fig_image *before;
+
+    if(index == 0) {
+        return 1;
+    }
+
+    image = self->image_data[index];
+    if(!fig_image_is_checkpoint_(image, uses_restore)) {
+        return 0;
+    }
+    if(fig_image_covers_canvas_(self, image)) {
+        return 1;
+    }
+
+    /* The image before it clears the whole canvas when disposed. */
+    before = self->image_data[index - 1];
+    return fig_image_covers_canvas_(self, before)
+        && fig_image_get_disposal(before) == FIG_DISPOSAL_BACKGROUND;
+}
+
+/* Get a palette index that no image draws, to stand in for the background
+ * of palette index canvases. Returns 256 if every index is drawn. */
+static size_t fig_animation_find_background_index_(fig_animation *self) {
+    fig_bool_t used[256];
+    size_t palette_size;
+    size_t i, j;
+
+    palette_size = fig_palette_count_colors(self->palette);
+    if(palette_size < 256) {
+        return palette_size;
+    }
+
+    memset(used, 0, sizeof(used));
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        const fig_uint8_t *index_data = fig_image_get_indexed_data(image);
+        size_t width = fig_image_get_indexed_width(image);
+        size_t height = fig_image_get_indexed_height(image);
+        size_t stride = fig_image_get_indexed_stride(image);
+        fig_bool_t transparent = fig_image_get_transparent(image);
+        size_t transparency_index = fig_image_get_transparency_index(image);
+        size_t k;
+
+        for(j = 0; j < height; ++j) {
+            const fig_uint8_t *row = index_data + j * stride;
+            for(k = 0; k < width; ++k) {
+                if(!transparent || row[k] != transparency_index) {
+                    used[row[k]] = 1;
+                }
+            }
+        }
+    }
+    for(i = 256; i > 0; --i) {
+        if(!used[i - 1]) {
+            return i - 1;
+        }
+    }
+    return 256;
+}
+
+/* Get the BGRA color of every palette index of a palette index canvas, looking them up in the given palette.
+ * The background index is transparent. */
+static void fig_get_index_canvas_colors_(fig_animation *self, fig_palette *palette, fig_uint32_t *colors) {
+    fig_uint32_t *palette_colors;
+    size_t palette_size;
+    size_t background_index;
+    size_t i;
+
+    palette_colors = fig_palette_get_colors(palette);
+    palette_size = fig_palette_count_colors(palette);
+    for(i = 0; i < 256; ++i) {
+        colors[i] = i < palette_size ? palette_colors[i] : 0;
+    }
+    /* Reuse the index picked by the last render, so that swapping palettes doesn't rescan every image. */
+    background_index = self->render_background_index < 256
+        ? self->render_background_index
+        : fig_animation_find_background_index_(self);
+    if(background_index < 256) {
+        colors[background_index] = 0;
+    }
+}
+
+/* Expand an area of a palette index canvas into BGRA colors using the animation palette.
+ * The pitches are the number of pixels between the start of each row. */
+static void fig_expand_index_canvas_(fig_animation *self, const fig_uint8_t *src, size_t src_pitch, fig_uint32_t *dest, size_t dest_pitch, const fig_rect *area) {
+    fig_uint32_t colors[256];
+    size_t i, j;
+
+    fig_get_index_canvas_colors_(self, self->palette, colors);
+    src += area->y * src_pitch + area->x;
+    for(i = 0; i < area->height; ++i) {
+        for(j = 0; j < area->width; ++j) {
+            dest[j] = colors[src[j]];
+        }
+        src += src_pitch;
+        dest += dest_pitch;
+    }
+}
+
+/* Apply the disposal of an image to a palette index canvas.
+ * The restore surface works the same way as fig_dispose_indexed_. */
+static void fig_dispose_index_canvas_(fig_animation *self, fig_image *image, fig_uint8_t *canvas, size_t canvas_pitch, const fig_uint8_t *restore, size_t restore_pitch, fig_uint8_t background_index) {
+    fig_rect rect;
     size_t x, y, w, h;
+    size_t pitch;
     fig_bool_t transparent;
     size_t transparency_index;
     fig_uint8_t *index_data;
-    fig_uint32_t *render_data;
+    fig_disposal_t disposal;
     size_t i, j;
 
-    palette = fig_animation_get_render_palette(self, image);
-    x = fig_image_get_origin_x(image);
-    y = fig_image_get_origin_y(image);
-    w = fig_image_get_indexed_width(image);
-    h = fig_image_get_indexed_height(image);
+    disposal = fig_image_get_disposal(image);
+    if(disposal != FIG_DISPOSAL_BACKGROUND && disposal != FIG_DISPOSAL_PREVIOUS) {
+        return;
+    }
+    if(disposal == FIG_DISPOSAL_PREVIOUS && restore == NULL) {
+        disposal = FIG_DISPOSAL_BACKGROUND;
+    }
+
+    rect = fig_get_image_rect_(self, image);
+    x = rect.x;
+    y = rect.y;
+    w = rect.width;
+    h = rect.height;
+    pitch = fig_image_get_indexed_stride(image);
     transparent = fig_image_get_transparent(image);
     transparency_index = fig_image_get_transparency_index(image);
     index_data = fig_image_get_indexed_data(image);
-    render_data = fig_image_get_render_data(image);
+    canvas += y * canvas_pitch + x;
+    if(restore != NULL) {
+        restore += y * restore_pitch + x;
+    }
 
     for(i = 0; i < h; ++i) {
-        for(j = 0; j < w; ++j) {
-            fig_uint8_t index = index_data[i * w + j];
+        const fig_uint8_t *src = index_data;
+        fig_uint8_t *dest = canvas;
 
-            if(!transparent || index != transparency_index) {
-                size_t k = (y + i) * self->width + (x + j);
-                render_data[k] = fig_palette_get(palette, index);
+        if(disposal == FIG_DISPOSAL_BACKGROUND) {
+            for(j = 0; j < w; ++j) {
+                if(!transparent || src[j] != transparency_index) {
+                    dest[j] = background_index;
+                }
+            }
+        } else {
+            const fig_uint8_t *prev = restore;
+            for(j = 0; j < w; ++j) {
+                if(!transparent || src[j] != transparency_index) {
+                    dest[j] = prev[j];
+                }
             }
+            restore += restore_pitch;
         }
+
+        index_data += pitch;
+        canvas += canvas_pitch;
     }
 }
 
-fig_bool_t fig_animation_render_images(fig_animation *self) {
+static void fig_blit_index_canvas_(fig_animation *self, fig_image *image, fig_uint8_t *canvas, size_t canvas_pitch) {
+    fig_rect rect;
+    size_t x, y, w, h;
+    size_t pitch;
+    fig_bool_t transparent;
+    size_t transparency_index;
+    fig_uint8_t *index_data;
+    fig_uint8_t *render_data;
+    size_t i, j;
+
+    rect = fig_get_image_rect_(self, image);
+    x = rect.x;
+    y = rect.y;
+    w = rect.width;
+    h = rect.height;
+    pitch = fig_image_get_indexed_stride(image);
+    transparent = fig_image_get_transparent(image) && fig_image_get_transparency_index(image) < 256;
+    transparency_index = fig_image_get_transparency_index(image);
+    index_data = fig_image_get_indexed_data(image);
+    render_data = canvas + y * canvas_pitch + x;
+
+    for(i = 0; i < h; ++i) {
+        if(transparent) {
+            for(j = 0; j < w; ++j) {
+                fig_uint8_t index = index_data[j];
+                render_data[j] = index != transparency_index ? index : render_data[j];
+            }
+        } else {
+            memcpy(render_data, index_data, w);
+        }
+
+        index_data += pitch;
+        render_data += canvas_pitch;
+    }
+}
+
+enum {
+    /* The perceptual hash compares each cell of a grid with the cell to its right. */
+    FIG_HASH_COLUMNS = 9,
+    FIG_HASH_ROWS = 8
+};
+
+/* The luminance of a canvas summed over each cell of the perceptual hash grid.
+ * The sums are whole numbers well within the precision of a double,
+ * so an area can be subtracted and added back without drifting. */
+typedef struct {
+    double sums[FIG_HASH_ROWS][FIG_HASH_COLUMNS];
+} fig_luma_grid_;
+
+static unsigned long fig_color_luma_(fig_uint32_t color) {
+    return ((color >> 16) & 0xFF) * 77 + ((color >> 8) & 0xFF) * 150 + (color & 0xFF) * 29;
+}
+
+/* Add the luminance of an area of a canvas to the grid, or subtract it if sign is negative.
+ * The canvas holds BGRA colors, or palette indices if lumas holds the luminance of every index.
+ * The pitch is the number of pixels between the start of each row. */
+static void fig_luma_grid_scan_(fig_animation *self, fig_luma_grid_ *grid, const void *canvas, size_t pitch, const unsigned long *lumas, const fig_rect *rect, double sign) {
+    size_t row, column, x, y;
+
+    for(row = 0; row < FIG_HASH_ROWS; ++row) {
+        size_t top = row * self->height / FIG_HASH_ROWS;
+        size_t bottom = (row + 1) * self->height / FIG_HASH_ROWS;
+
+        top = top > rect->y ? top : rect->y;
+        bottom = bottom < rect->y + rect->height ? bottom : rect->y + rect->height;
+        for(column = 0; column < FIG_HASH_COLUMNS; ++column) {
+            size_t left = column * self->width / FIG_HASH_COLUMNS;
+            size_t right = (column + 1) * self->width / FIG_HASH_COLUMNS;
+
+            left = left > rect->x ? left : rect->x;
+            right = right < rect->x + rect->width ? right : rect->x + rect->width;
+            for(y = top; y < bottom && left < right; ++y) {
+                unsigned long sum = 0;
+
+                if(lumas != NULL) {
+                    const fig_uint8_t *pixels = (const fig_uint8_t *) canvas + y * pitch;
+                    for(x = left; x < right; ++x) {
+                        sum += lumas[pixels[x]];
+                    }
+                } else {
+                    const fig_uint32_t *pixels = (const fig_uint32_t *) canvas + y * pitch;
+                    for(x = left; x < right; ++x) {
+                        sum += fig_color_luma_(pixels[x]);
+                    }
+                }
+                grid->sums[row][column] += sign * (double) sum;
+            }
+        }
+    }
+}
+
+/* Set the perceptual hash of an image from the grid of the canvas that shows it. */
+static void fig_luma_grid_hash_(fig_animation *self, const fig_luma_grid_ *grid, fig_image *image) {
+    fig_uint8_t hash[FIG_HASH_ROWS];
+    size_t row, column;
+
+    for(row = 0; row < FIG_HASH_ROWS; ++row) {
+        hash[row] = 0;
+        for(column = 0; column + 1 < FIG_HASH_COLUMNS; ++column) {
+            double width = (double) ((column + 1) * self->width / FIG_HASH_COLUMNS - column * self->width / FIG_HASH_COLUMNS);
+            double next_width = (double) ((column + 2) * self->width / FIG_HASH_COLUMNS - (column + 1) * self->width / FIG_HASH_COLUMNS);
+
+            /* The averages are compared without dividing, so that the empty cells of narrow canvases count as 0. */
+            if(grid->sums[row][column] * next_width > grid->sums[row][column + 1] * width) {
+                hash[row] |= (fig_uint8_t) (0x80 >> column);
+            }
+        }
+    }
+    fig_image_set_perceptual_hash(image, hash);
+}
+
+static fig_bool_t fig_render_images_full_(fig_animation *self, size_t start, size_t end) {
     fig_image **images;
-    size_t image_count;
     fig_image *prev;
     fig_image *cur;
     fig_image *next;
     fig_disposal_t disposal;
+    fig_rect canvas_rect;
+    fig_luma_grid_ grid;
     size_t i;
 
+    canvas_rect = fig_get_canvas_rect_(self);
     images = self->image_data;
-    image_count = self->image_count;
     prev = NULL;
     cur = NULL;
     next = NULL;
 
-    if(self->width == 0 && self->height == 0) {
-        fig_state_set_error(self->state, "image is empty");
-        return 0;
-    }
+    /* Rendering starts at a keyframe, so it's drawn onto a clear canvas. */
+    for(i = start; i < end; ++i) {
+        fig_uint32_t *render_data;
+        size_t render_pitch;
+        fig_rect draw_rect;
 
-    for(i = 0; i < image_count; ++i) {
         next = images[i];
-        if(fig_image_get_render_width(next) != self->width
+        if(fig_image_get_render_data(next) == NULL
+        || fig_image_get_render_width(next) != self->width
         || fig_image_get_render_height(next) != self->height) {
             if(!fig_image_resize_render(next, self->width, self->height)) {
                 return 0;
             }
         }
+        fig_image_set_render_origin_x(next, 0);
+        fig_image_set_render_origin_y(next, 0);
+        render_data = fig_image_get_render_data(next);
+        render_pitch = fig_get_render_pitch_(next);
+        draw_rect = fig_get_draw_rect_(self, cur, next);
 
-        if(cur == NULL) {
-            fig_clear_image_(self, next);
-        } else {
-            memcpy(fig_image_get_render_data(next), fig_image_get_render_data(cur), sizeof(fig_uint32_t) * self->width * self->height);
-            fig_dispose_indexed_(self, prev, cur, next);
+        if(self->perceptual_hashes) {
+            if(cur == NULL) {
+                memset(&grid, 0, sizeof(grid));
+            } else {
+                fig_luma_grid_scan_(self, &grid, fig_image_get_render_data(cur), fig_get_render_pitch_(cur), NULL, &draw_rect, -1.0);
+            }
+        }
+
+        /* An image that replaces the whole canvas doesn't need the previous canvas. */
+        if(!fig_image_covers_canvas_(self, next)) {
+            if(cur == NULL) {
+                size_t y;
+                for(y = 0; y < self->height; ++y) {
+                    memset(render_data + y * render_pitch, 0, sizeof(fig_uint32_t) * self->width);
+                }
+            } else {
+                fig_copy_canvas_rect_(render_data, render_pitch,
+                    fig_image_get_render_data(cur), fig_get_render_pitch_(cur), &canvas_rect);
+                fig_dispose_indexed_(self, cur, &canvas_rect, render_data, render_pitch,
+                    prev != NULL ? fig_image_get_render_data(prev) : NULL,
+                    prev != NULL ? fig_get_render_pitch_(prev) : 0);
+            }
         }
 
-        fig_blit_indexed_(self, next);
+        fig_blit_indexed_(self, next, &canvas_rect, render_data, render_pitch);
+
+        if(self->perceptual_hashes) {
+            fig_luma_grid_scan_(self, &grid, render_data, render_pitch, NULL, &draw_rect, 1.0);
+            fig_luma_grid_hash_(self, &grid, next);
+        }
 
         if(cur != NULL) {
             disposal = fig_image_get_disposal(cur);
@@ -286,18 +940,1422 @@ fig_bool_t fig_animation_render_images(fig_animation *self) {
     return 1;
 }
 
-fig_palette *fig_animation_get_render_palette(fig_animation *self, fig_image *image) {
-    fig_palette *local_palette = fig_image_get_palette(image);
-    if(fig_palette_count_colors(local_palette) > 0) {
-        return local_palette;
-    } else {
-        return self->palette;
-    }
-}
-
-void fig_animation_free(fig_animation *self) {
-    if(self != NULL) {
-        fig_allocator_t alloc = fig_state_get_allocator(self->state);
+static fig_bool_t fig_render_images_index_(fig_animation *self, size_t start, size_t end) {
+    fig_image **images;
+    fig_image *prev;
+    fig_image *cur;
+    fig_image *next;
+    fig_disposal_t disposal;
+    size_t background_index;
+    fig_luma_grid_ grid;
+    unsigned long lumas[256];
+    size_t i;
+
+    for(i = start; i < end; ++i) {
+        if(fig_palette_count_colors(fig_image_get_palette(self->image_data[i])) > 0) {
+            fig_state_set_error(self->state, "palette index rendering requires every image to use the animation palette");
+            return 0;
+        }
+    }
+    /* Ranges only read the background index, which is picked once for every range. */
+    background_index = self->render_background_index;
+    if(background_index >= 256) {
+        fig_state_set_error(self->state, "palette index rendering requires fig_animation_prepare_render first");
+        return 0;
+    }
+    if(self->perceptual_hashes) {
+        fig_uint32_t colors[256];
+
+        fig_get_index_canvas_colors_(self, self->palette, colors);
+        for(i = 0; i < 256; ++i) {
+            lumas[i] = fig_color_luma_(colors[i]);
+        }
+    }
+
+    images = self->image_data;
+    prev = NULL;
+    cur = NULL;
+    next = NULL;
+
+    /* Rendering starts at a keyframe, so it's drawn onto a clear canvas. */
+    for(i = start; i < end; ++i) {
+        fig_uint8_t *render_data;
+        size_t render_pitch;
+        fig_rect draw_rect;
+        size_t y;
+
+        next = images[i];
+        if(fig_image_get_render_index_data(next) == NULL
+        || fig_image_get_render_width(next) != self->width
+        || fig_image_get_render_height(next) != self->height) {
+            if(!fig_image_resize_render_index(next, self->width, self->height)) {
+                return 0;
+            }
+        }
+        fig_image_set_render_origin_x(next, 0);
+        fig_image_set_render_origin_y(next, 0);
+        render_data = fig_image_get_render_index_data(next);
+        render_pitch = fig_get_render_pitch_(next);
+        draw_rect = fig_get_draw_rect_(self, cur, next);
+
+        if(self->perceptual_hashes) {
+            if(cur == NULL) {
+                memset(&grid, 0, sizeof(grid));
+            } else {
+                fig_luma_grid_scan_(self, &grid, fig_image_get_render_index_data(cur), fig_get_render_pitch_(cur), lumas, &draw_rect, -1.0);
+            }
+        }
+
+        if(!fig_image_covers_canvas_(self, next)) {
+            if(cur == NULL) {
+                for(y = 0; y < self->height; ++y) {
+                    memset(render_data + y * render_pitch, (int) background_index, self->width);
+                }
+            } else {
+                const fig_uint8_t *cur_data = fig_image_get_render_index_data(cur);
+                size_t cur_pitch = fig_get_render_pitch_(cur);
+                for(y = 0; y < self->height; ++y) {
+                    memcpy(render_data + y * render_pitch, cur_data + y * cur_pitch, self->width);
+                }
+                fig_dispose_index_canvas_(self, cur, render_data, render_pitch,
+                    prev != NULL ? fig_image_get_render_index_data(prev) : NULL,
+                    prev != NULL ? fig_get_render_pitch_(prev) : 0,
+                    (fig_uint8_t) background_index);
+            }
+        }
+
+        fig_blit_index_canvas_(self, next, render_data, render_pitch);
+
+        if(self->perceptual_hashes) {
+            fig_luma_grid_scan_(self, &grid, render_data, render_pitch, lumas, &draw_rect, 1.0);
+            fig_luma_grid_hash_(self, &grid, next);
+        }
+
+        if(cur != NULL) {
+            disposal = fig_image_get_disposal(cur);
+            if(disposal == FIG_DISPOSAL_NONE || disposal == FIG_DISPOSAL_UNSPECIFIED) {
+                prev = cur;
+            }
+        }
+        cur = next;
+    }
+    return 1;
+}
+
+/* A running canvas that images are drawn onto one at a time. */
+typedef struct {
+    fig_animation *animation;
+    /* The area of the animation canvas that is drawn. */
+    fig_rect area;
+    fig_uint32_t *canvas;
+    /* The number of pixels between the start of each row of the canvas. */
+    size_t pitch;
+    /* A snapshot of the most recent undisposed image,
+       or NULL if no image in the animation uses previous disposal. */
+    fig_uint32_t *restore;
+    /* The area of the canvas that changed since the snapshot was taken. */
+    fig_rect restore_dirty;
+    /* The image drawn most recently, or NULL if nothing was drawn yet. */
+    fig_image *cur;
+    /* The number of images drawn so far, so that cur is at position - 1. */
+    size_t position;
+    fig_bool_t owns_canvas;
+    /* The luminance grid of the full canvas, kept up to date for perceptual hashes, or NULL. */
+    fig_luma_grid_ *grid;
+} fig_compositor_;
+
+static void fig_compositor_free_(fig_compositor_ *self) {
+    fig_state *state = self->animation->state;
+    size_t canvas_size = sizeof(fig_uint32_t) * self->area.width * self->area.height;
+
+    if(self->owns_canvas) {
+        fig_state_get_allocator(state)(fig_state_get_userdata(state), self->canvas, self->canvas != NULL ? canvas_size : 0, 0);
+    }
+    fig_state_get_allocator(state)(fig_state_get_userdata(state), self->restore, self->restore != NULL ? canvas_size : 0, 0);
+    self->canvas = NULL;
+    self->restore = NULL;
+}
+
+/* Clear the canvas to the state before the first image is drawn. */
+static void fig_compositor_reset_(fig_compositor_ *self) {
+    size_t i;
+
+    for(i = 0; i < self->area.height; ++i) {
+        memset(self->canvas + i * self->pitch, 0, sizeof(fig_uint32_t) * self->area.width);
+    }
+    if(self->restore != NULL) {
+        memset(self->restore, 0, sizeof(fig_uint32_t) * self->area.width * self->area.height);
+    }
+    self->restore_dirty.x = self->restore_dirty.y = self->restore_dirty.width = self->restore_dirty.height = 0;
+    if(self->grid != NULL) {
+        memset(self->grid, 0, sizeof(fig_luma_grid_));
+    }
+    self->cur = NULL;
+    self->position = 0;
+}
+
+/* Prepare a compositor for an area of the animation canvas.
+ * If canvas is NULL, a canvas is allocated and owned by the compositor.
+ * Otherwise, the canvas is user-owned, and must hold the area
+ * with pitch pixels between the start of each row. */
+static fig_bool_t fig_compositor_init_area_(fig_compositor_ *self, fig_animation *animation, const fig_rect *area, fig_uint32_t *canvas, size_t pitch) {
+    fig_allocator_t alloc = fig_state_get_allocator(animation->state);
+    void *ud = fig_state_get_userdata(animation->state);
+    size_t canvas_size = sizeof(fig_uint32_t) * area->width * area->height;
+
+    FIG_ASSERT(area->x + area->width <= animation->width && area->y + area->height <= animation->height);
+    self->animation = animation;
+    self->area = *area;
+    self->canvas = canvas;
+    self->pitch = canvas != NULL ? pitch : area->width;
+    self->restore = NULL;
+    self->owns_canvas = canvas == NULL;
+    self->grid = NULL;
+
+    if(area->height != 0 && area->width > ~(size_t) 0 / sizeof(fig_uint32_t) / area->height) {
+        fig_state_set_error(animation->state, "image dimensions requested are too large");
+        return 0;
+    }
+    if(self->canvas == NULL) {
+        self->canvas = (fig_uint32_t *) alloc(ud, NULL, 0, canvas_size);
+        if(self->canvas == NULL) {
+            fig_state_set_error_allocation_failed(animation->state);
+            return 0;
+        }
+    }
+    if(fig_animation_uses_restore_(animation)) {
+        self->restore = (fig_uint32_t *) alloc(ud, NULL, 0, canvas_size);
+        if(self->restore == NULL) {
+            fig_state_set_error_allocation_failed(animation->state);
+            fig_compositor_free_(self);
+            return 0;
+        }
+    }
+
+    fig_compositor_reset_(self);
+    return 1;
+}
+
+/* Prepare a compositor for the full animation canvas.
+ * If canvas is NULL, a canvas is allocated and owned by the compositor.
+ * Otherwise, the canvas is user-owned, and must be width * height pixels. */
+static fig_bool_t fig_compositor_init_(fig_compositor_ *self, fig_animation *animation, fig_uint32_t *canvas) {
+    fig_rect area = fig_get_canvas_rect_(animation);
+    return fig_compositor_init_area_(self, animation, &area, canvas, animation->width);
+}
+
+/* Set the perceptual hash of every image drawn by a compositor that was just prepared
+ * for the full canvas, if the animation computes them. The grid must outlive the compositor. */
+static void fig_compositor_track_hashes_(fig_compositor_ *self, fig_luma_grid_ *grid) {
+    if(self->animation->perceptual_hashes) {
+        self->grid = grid;
+        memset(grid, 0, sizeof(fig_luma_grid_));
+    }
+}
+
+/* Resume drawing after the image at the given index, from its render
+ * surface covering the full canvas. The image must be a checkpoint. */
+static void fig_compositor_resume_(fig_compositor_ *self, size_t index) {
+    fig_image *image = self->animation->image_data[index];
+
+    self->restore_dirty = self->area;
+    if(fig_image_get_render_index_data(image) != NULL) {
+        fig_expand_index_canvas_(self->animation, fig_image_get_render_index_data(image), fig_get_render_pitch_(image),
+            self->canvas, self->pitch, &self->area);
+    } else if(fig_image_get_render_data(image) != self->canvas) {
+        size_t image_pitch = fig_get_render_pitch_(image);
+        const fig_uint32_t *src = fig_image_get_render_data(image) + self->area.y * image_pitch + self->area.x;
+        size_t i;
+
+        for(i = 0; i < self->area.height; ++i) {
+            memcpy(self->canvas + i * self->pitch, src + i * image_pitch, sizeof(fig_uint32_t) * self->area.width);
+        }
+    }
+    if(self->grid != NULL) {
+        memset(self->grid, 0, sizeof(fig_luma_grid_));
+        fig_luma_grid_scan_(self->animation, self->grid, self->canvas, self->pitch, NULL, &self->area, 1.0);
+    }
+    self->cur = image;
+    self->position = index + 1;
+}
+
+/* Dispose the current image and draw the next one.
+ * Returns the area of the canvas that may have changed. */
+static fig_rect fig_compositor_draw_(fig_compositor_ *self, fig_image *next) {
+    fig_animation *animation = self->animation;
+    fig_rect rect = fig_get_draw_rect_(animation, self->cur, next);
+
+    if(self->grid != NULL) {
+        fig_luma_grid_scan_(animation, self->grid, self->canvas, self->pitch, NULL, &rect, -1.0);
+    }
+    if(self->cur != NULL) {
+        fig_disposal_t disposal;
+
+        fig_dispose_indexed_(animation, self->cur, &self->area, self->canvas, self->pitch, self->restore, self->area.width);
+
+        /* The canvas now holds the render of the undisposed image,
+         * so bring the snapshot up to date with the parts that changed. */
+        disposal = fig_image_get_disposal(self->cur);
+        if(self->restore != NULL
+        && (disposal == FIG_DISPOSAL_NONE || disposal == FIG_DISPOSAL_UNSPECIFIED)) {
+            fig_rect dirty = fig_rect_intersect_(&self->restore_dirty, &self->area);
+            if(!fig_rect_is_empty_(&dirty)) {
+                dirty.x -= self->area.x;
+                dirty.y -= self->area.y;
+                fig_copy_canvas_rect_(self->restore, self->area.width, self->canvas, self->pitch, &dirty);
+            }
+            self->restore_dirty.x = self->restore_dirty.y = self->restore_dirty.width = self->restore_dirty.height = 0;
+        }
+    }
+
+    fig_blit_indexed_(animation, next, &self->area, self->canvas, self->pitch);
+    if(self->grid != NULL) {
+        fig_luma_grid_scan_(animation, self->grid, self->canvas, self->pitch, NULL, &rect, 1.0);
+        fig_luma_grid_hash_(animation, self->grid, next);
+    }
+    fig_rect_union_(&self->restore_dirty, &rect);
+    self->cur = next;
+    ++self->position;
+    return rect;
+}
+
+/* Bring the canvas to the render of the image at the given index.
+ * This continues from the current image when possible, or otherwise
+ * from the nearest checkpoint render or keyframe at or before the index,
+ * and replays the images after it. Renders of other images can't be
+ * resumed from, since the restore snapshot can't be rebuilt from them. */
+static void fig_compositor_seek_(fig_compositor_ *self, size_t index) {
+    fig_animation *animation = self->animation;
+    fig_bool_t uses_restore = self->restore != NULL;
+    size_t start;
+
+    for(start = index + 1; start > 0; --start) {
+        fig_image *image = animation->image_data[start - 1];
+
+        if(start == self->position) {
+            break;
+        } else if(fig_image_get_render_origin_x(image) == 0
+        && fig_image_get_render_origin_y(image) == 0
+        && fig_image_get_render_width(image) == animation->width
+        && fig_image_get_render_height(image) == animation->height
+        && fig_image_is_checkpoint_(image, uses_restore)) {
+            fig_compositor_resume_(self, start - 1);
+            break;
+        } else if(fig_animation_is_keyframe_(animation, start - 1, uses_restore)) {
+            /* Before the first image, nothing can be restored either. */
+            if(start == 1 || !fig_image_covers_canvas_(animation, image)) {
+                fig_compositor_reset_(self);
+            }
+            self->cur = NULL;
+            fig_compositor_draw_(self, image);
+            self->position = start;
+            break;
+        }
+    }
+    if(start == 0 && self->position != 0) {
+        fig_compositor_reset_(self);
+    }
+
+    for(; start <= index; ++start) {
+        fig_compositor_draw_(self, animation->image_data[start]);
+    }
+}
+
+static fig_bool_t fig_store_render_rect_(fig_animation *self, fig_image *image, const fig_uint32_t *canvas, const fig_rect *rect) {
+    fig_uint32_t *dest;
+    size_t dest_pitch;
+    const fig_uint32_t *src;
+    size_t i;
+
+    if(fig_image_get_render_data(image) == NULL
+    || fig_image_get_render_width(image) != rect->width
+    || fig_image_get_render_height(image) != rect->height) {
+        if(!fig_image_resize_render(image, rect->width, rect->height)) {
+            return 0;
+        }
+    }
+    fig_image_set_render_origin_x(image, rect->x);
+    fig_image_set_render_origin_y(image, rect->y);
+
+    dest = fig_image_get_render_data(image);
+    dest_pitch = fig_get_render_pitch_(image);
+    src = canvas + rect->y * self->width + rect->x;
+    for(i = 0; i < rect->height; ++i) {
+        memcpy(dest, src, sizeof(fig_uint32_t) * rect->width);
+        dest += dest_pitch;
+        src += self->width;
+    }
+    return 1;
+}
+
+static fig_bool_t fig_render_images_delta_(fig_animation *self, size_t start, size_t end) {
+    fig_compositor_ compositor;
+    fig_luma_grid_ grid;
+    size_t i;
+
+    if(!fig_compositor_init_(&compositor, self, NULL)) {
+        return 0;
+    }
+    fig_compositor_track_hashes_(&compositor, &grid);
+
+    for(i = start; i < end; ++i) {
+        fig_image *image = self->image_data[i];
+        fig_rect rect = fig_compositor_draw_(&compositor, image);
+
+        /* Rendering starts at a keyframe, so only the area that changed
+         * since the image before it needs to be stored. */
+        if(i == start && start > 0) {
+            fig_rect image_rect = fig_get_image_rect_(self, image);
+            rect = fig_get_disposal_rect_(self, self->image_data[start - 1]);
+            fig_rect_union_(&rect, &image_rect);
+        }
+
+        if(!fig_store_render_rect_(self, image, compositor.canvas, &rect)) {
+            fig_compositor_free_(&compositor);
+            return 0;
+        }
+    }
+
+    fig_compositor_free_(&compositor);
+    return 1;
+}
+
+static fig_bool_t fig_render_images_checkpoint_(fig_animation *self, size_t start, size_t end) {
+    fig_compositor_ compositor;
+    fig_luma_grid_ grid;
+    fig_bool_t uses_restore;
+    size_t last_checkpoint;
+    size_t i;
+
+    if(!fig_compositor_init_(&compositor, self, NULL)) {
+        return 0;
+    }
+    fig_compositor_track_hashes_(&compositor, &grid);
+    uses_restore = compositor.restore != NULL;
+    last_checkpoint = start;
+
+    for(i = start; i < end; ++i) {
+        fig_image *image = self->image_data[i];
+        fig_rect rect;
+
+        fig_compositor_draw_(&compositor, image);
+
+        if(fig_animation_is_keyframe_(self, i, uses_restore)) {
+            /* This can be rendered again by drawing only this image, so storing it is unnecessary. */
+            last_checkpoint = i;
+            rect.x = rect.y = rect.width = rect.height = 0;
+        } else if(fig_image_is_checkpoint_(image, uses_restore)
+        && self->checkpoint_interval != 0
+        && i - last_checkpoint >= self->checkpoint_interval) {
+            last_checkpoint = i;
+            rect = fig_get_canvas_rect_(self);
+        } else {
+            rect.x = rect.y = rect.width = rect.height = 0;
+        }
+
+        if(!fig_store_render_rect_(self, image, compositor.canvas, &rect)) {
+            fig_compositor_free_(&compositor);
+            return 0;
+        }
+    }
+
+    fig_compositor_free_(&compositor);
+    return 1;
+}
+
+/* Get the number of sample times before the given time, which is ceil(time * rate / duration).
+ * The whole durations are counted separately so that the product doesn't overflow as easily. */
+static size_t fig_animation_count_sample_times_(fig_animation *self, size_t time) {
+    size_t rate = self->sample_rate;
+    size_t duration = self->sample_duration;
+    return time / duration * rate + (time % duration * rate + duration - 1) / duration;
+}
+
+/* Get the time when the image at the given index starts showing. */
+static size_t fig_animation_get_image_time_(fig_animation *self, size_t index) {
+    size_t time = 0;
+    size_t i;
+
+    for(i = 0; i < index; ++i) {
+        time += fig_image_get_delay(self->image_data[i]);
+    }
+    return time;
+}
+
+/* Get the number of samples showing the image at the given index, which starts showing at time. */
+static size_t fig_animation_count_samples_(fig_animation *self, size_t index, size_t time) {
+    if(self->sample_rate == 0) {
+        return index % self->sample_interval == 0 ? 1 : 0;
+    }
+    return fig_animation_count_sample_times_(self, time + fig_image_get_delay(self->image_data[index]))
+        - fig_animation_count_sample_times_(self, time);
+}
+
+static fig_bool_t fig_render_images_sampled_(fig_animation *self, size_t start, size_t end) {
+    fig_compositor_ compositor;
+    fig_luma_grid_ grid;
+    size_t time;
+    size_t i;
+
+    if(!fig_compositor_init_(&compositor, self, NULL)) {
+        return 0;
+    }
+    fig_compositor_track_hashes_(&compositor, &grid);
+    time = fig_animation_get_image_time_(self, start);
+
+    for(i = start; i < end; ++i) {
+        fig_image *image = self->image_data[i];
+        fig_rect rect;
+
+        fig_compositor_draw_(&compositor, image);
+
+        /* Images that aren't sampled are only drawn onto the running canvas. */
+        if(fig_animation_count_samples_(self, i, time) != 0) {
+            rect = fig_get_canvas_rect_(self);
+        } else {
+            rect.x = rect.y = rect.width = rect.height = 0;
+        }
+        time += fig_image_get_delay(image);
+
+        if(!fig_store_render_rect_(self, image, compositor.canvas, &rect)) {
+            fig_compositor_free_(&compositor);
+            return 0;
+        }
+    }
+
+    fig_compositor_free_(&compositor);
+    return 1;
+}
+
+fig_bool_t fig_animation_prepare_render(fig_animation *self) {
+    if(self->render_mode == FIG_RENDER_MODE_INDEX) {
+        size_t i;
+
+        for(i = 0; i < self->image_count; ++i) {
+            if(fig_palette_count_colors(fig_image_get_palette(self->image_data[i])) > 0) {
+                fig_state_set_error(self->state, "palette index rendering requires every image to use the animation palette");
+                return 0;
+            }
+        }
+        self->render_background_index = fig_animation_find_background_index_(self);
+        if(self->render_background_index >= 256) {
+            fig_state_set_error(self->state, "no palette index is free to represent the background");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+fig_bool_t fig_animation_render_images(fig_animation *self) {
+    return fig_animation_prepare_render(self)
+        && fig_animation_render_image_range(self, 0, self->image_count);
+}
+
+fig_bool_t fig_animation_allocate_render_slab(fig_animation *self) {
+    fig_allocator_t alloc = fig_state_get_storage_allocator(self->state);
+    void *ud = fig_state_get_storage_userdata(self->state);
+    size_t pixel_size;
+    size_t pitch;
+    fig_uint8_t *slab;
+    size_t i;
+
+    if(self->render_mode != FIG_RENDER_MODE_FULL && self->render_mode != FIG_RENDER_MODE_INDEX) {
+        fig_state_set_error(self->state, "a render block requires FIG_RENDER_MODE_FULL or FIG_RENDER_MODE_INDEX");
+        return 0;
+    }
+    pixel_size = self->render_mode == FIG_RENDER_MODE_INDEX ? sizeof(fig_uint8_t) : sizeof(fig_uint32_t);
+    if(self->height != 0 && self->width > ~(size_t) 0 / pixel_size / self->height) {
+        fig_state_set_error(self->state, "image dimensions requested are too large");
+        return 0;
+    }
+    pitch = pixel_size * self->width * self->height;
+    if(self->image_count != 0 && pitch > ~(size_t) 0 / self->image_count) {
+        fig_state_set_error(self->state, "image dimensions requested are too large");
+        return 0;
+    }
+
+    slab = NULL;
+    if(pitch * self->image_count != 0) {
+        slab = (fig_uint8_t *) alloc(ud, NULL, 0, pitch * self->image_count);
+        if(slab == NULL) {
+            fig_state_set_error_allocation_failed(self->state);
+            return 0;
+        }
+    }
+
+    /* The images stop using the old block before it's freed. */
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        fig_uint8_t *data = slab != NULL ? slab + i * pitch : NULL;
+
+        if(pixel_size == sizeof(fig_uint8_t)) {
+            fig_image_attach_render_index(image, data, self->width, self->height, self->width, 0);
+        } else {
+            fig_image_attach_render(image, (fig_uint32_t *) data, self->width, self->height, pixel_size * self->width, 0);
+        }
+        fig_image_set_render_origin_x(image, 0);
+        fig_image_set_render_origin_y(image, 0);
+    }
+    alloc(ud, self->render_slab, self->render_slab_pitch * self->render_slab_count, 0);
+
+    self->render_slab = slab;
+    self->render_slab_pitch = slab != NULL ? pitch : 0;
+    self->render_slab_count = slab != NULL ? self->image_count : 0;
+    return 1;
+}
+
+void *fig_animation_get_render_slab(fig_animation *self) {
+    return self->render_slab;
+}
+
+size_t fig_animation_get_render_slab_pitch(fig_animation *self) {
+    return self->render_slab_pitch;
+}
+
+void fig_animation_release_render_slab(fig_animation *self) {
+    const fig_uint8_t *slab = (const fig_uint8_t *) self->render_slab;
+    size_t slab_size = self->render_slab_pitch * self->render_slab_count;
+    size_t i;
+
+    if(slab == NULL) {
+        return;
+    }
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        const fig_uint8_t *data = fig_image_get_render_data(image) != NULL
+            ? (const fig_uint8_t *) fig_image_get_render_data(image)
+            : fig_image_get_render_index_data(image);
+
+        if(data != NULL && data >= slab && data < slab + slab_size) {
+            fig_image_resize_render(image, 0, 0);
+        }
+    }
+    fig_state_get_storage_allocator(self->state)(fig_state_get_storage_userdata(self->state), self->render_slab, slab_size, 0);
+    self->render_slab = NULL;
+    self->render_slab_pitch = 0;
+    self->render_slab_count = 0;
+}
+
+fig_bool_t fig_animation_pack_indexed_data(fig_animation *self) {
+    fig_allocator_t alloc = fig_state_get_storage_allocator(self->state);
+    void *ud = fig_state_get_storage_userdata(self->state);
+    size_t pitch;
+    fig_uint8_t *slab;
+    size_t i;
+
+    pitch = 0;
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        size_t size = fig_image_get_indexed_width(image) * fig_image_get_indexed_height(image);
+        if(size > pitch) {
+            pitch = size;
+        }
+    }
+    if(self->image_count != 0 && pitch > ~(size_t) 0 / self->image_count) {
+        fig_state_set_error(self->state, "image dimensions requested are too large");
+        return 0;
+    }
+
+    slab = NULL;
+    if(pitch * self->image_count != 0) {
+        slab = (fig_uint8_t *) alloc(ud, NULL, 0, pitch * self->image_count);
+        if(slab == NULL) {
+            fig_state_set_error_allocation_failed(self->state);
+            return 0;
+        }
+    }
+
+    /* The images stop using the old block before it's freed. */
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        size_t width = fig_image_get_indexed_width(image);
+        size_t height = fig_image_get_indexed_height(image);
+        size_t stride = fig_image_get_indexed_stride(image);
+        size_t j;
+
+        if(width * height != 0) {
+            for(j = 0; j < height; ++j) {
+                memcpy(slab + i * pitch + j * width, fig_image_get_indexed_data(image) + j * stride, width);
+            }
+            fig_image_attach_indexed(image, slab + i * pitch, width, height, 0);
+        }
+    }
+    alloc(ud, self->indexed_slab, self->indexed_slab_pitch * self->indexed_slab_count, 0);
+
+    self->indexed_slab = slab;
+    self->indexed_slab_pitch = slab != NULL ? pitch : 0;
+    self->indexed_slab_count = slab != NULL ? self->image_count : 0;
+    return 1;
+}
+
+fig_uint8_t *fig_animation_get_indexed_slab(fig_animation *self) {
+    return self->indexed_slab;
+}
+
+size_t fig_animation_get_indexed_slab_pitch(fig_animation *self) {
+    return self->indexed_slab_pitch;
+}
+
+/* Drop every render surface and the indexed block, after the indexed data of
+ * every image has been replaced, since they no longer match the indexed data. */
+static void fig_animation_discard_surfaces_(fig_animation *self) {
+    size_t i;
+
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image_resize_render(self->image_data[i], 0, 0);
+    }
+    fig_animation_release_render_slab(self);
+    fig_state_get_storage_allocator(self->state)(fig_state_get_storage_userdata(self->state),
+        self->indexed_slab, self->indexed_slab_pitch * self->indexed_slab_count, 0);
+    self->indexed_slab = NULL;
+    self->indexed_slab_pitch = 0;
+    self->indexed_slab_count = 0;
+    self->render_background_index = 256;
+}
+
+/* New indexed data for an image, made by a transform of the animation. */
+typedef struct {
+    fig_uint8_t *data;
+    size_t width;
+    size_t height;
+} fig_indexed_surface_;
+
+/* Allocate an empty new indexed surface for every image. There must be at least one image.
+ * Returns NULL on failure. */
+static fig_indexed_surface_ *fig_animation_create_surfaces_(fig_animation *self) {
+    fig_indexed_surface_ *surfaces;
+    size_t i;
+
+    if(self->image_count > ~(size_t) 0 / sizeof(fig_indexed_surface_)) {
+        fig_state_set_error_allocation_failed(self->state);
+        return NULL;
+    }
+    surfaces = (fig_indexed_surface_ *) fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
+        NULL, 0, self->image_count * sizeof(fig_indexed_surface_));
+    if(surfaces == NULL) {
+        fig_state_set_error_allocation_failed(self->state);
+        return NULL;
+    }
+    for(i = 0; i < self->image_count; ++i) {
+        surfaces[i].data = NULL;
+        surfaces[i].width = 0;
+        surfaces[i].height = 0;
+    }
+    return surfaces;
+}
+
+/* Free the new indexed surfaces after a transform failed part of the way through. */
+static void fig_animation_free_surfaces_(fig_animation *self, fig_indexed_surface_ *surfaces) {
+    fig_allocator_t alloc = fig_state_get_allocator(self->state);
+    void *ud = fig_state_get_userdata(self->state);
+    size_t i;
+
+    for(i = 0; i < self->image_count; ++i) {
+        alloc(ud, surfaces[i].data, surfaces[i].width * surfaces[i].height, 0);
+    }
+    alloc(ud, surfaces, self->image_count * sizeof(fig_indexed_surface_), 0);
+}
+
+/* Give every image its new indexed surface, once the transform can no longer fail. */
+static void fig_animation_replace_indexed_(fig_animation *self, fig_indexed_surface_ *surfaces) {
+    size_t i;
+
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image_attach_indexed(self->image_data[i], surfaces[i].data, surfaces[i].width, surfaces[i].height, 1);
+    }
+    fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
+        surfaces, self->image_count * sizeof(fig_indexed_surface_), 0);
+    fig_animation_discard_surfaces_(self);
+}
+
+/* Repeat every palette index of a row factor times. */
+static void fig_scale_indexed_row_(const fig_uint8_t *src, size_t width, size_t factor, fig_uint8_t *dest) {
+    size_t i;
+
+    switch(factor) {
+        case 2:
+            for(i = 0; i < width; ++i) {
+                dest[0] = dest[1] = src[i];
+                dest += 2;
+            }
+            break;
+        case 3:
+            for(i = 0; i < width; ++i) {
+                dest[0] = dest[1] = dest[2] = src[i];
+                dest += 3;
+            }
+            break;
+        case 4:
+            for(i = 0; i < width; ++i) {
+                dest[0] = dest[1] = dest[2] = dest[3] = src[i];
+                dest += 4;
+            }
+            break;
+        default:
+            for(i = 0; i < width; ++i) {
+                memset(dest, src[i], factor);
+                dest += factor;
+            }
+            break;
+    }
+}
+
+fig_bool_t fig_animation_scale(fig_animation *self, size_t factor) {
+    fig_indexed_surface_ *surfaces;
+    size_t limit;
+    size_t i, j, k;
+
+    if(factor == 0) {
+        fig_state_set_error(self->state, "scale factor must be at least 1");
+        return 0;
+    }
+    if(factor == 1) {
+        return 1;
+    }
+
+    limit = ~(size_t) 0 / factor;
+    if(self->width > limit || self->height > limit) {
+        fig_state_set_error(self->state, "image dimensions requested are too large");
+        return 0;
+    }
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        size_t width = fig_image_get_indexed_width(image);
+        size_t height = fig_image_get_indexed_height(image);
+
+        if(fig_image_get_origin_x(image) > limit || fig_image_get_origin_y(image) > limit
+        || width > limit || height > limit
+        || (height != 0 && width * factor > ~(size_t) 0 / (height * factor))) {
+            fig_state_set_error(self->state, "image dimensions requested are too large");
+            return 0;
+        }
+    }
+
+    /* Every image is scaled into new storage first, so that a failed allocation leaves the animation as it was. */
+    if(self->image_count == 0) {
+        surfaces = NULL;
+    } else {
+        surfaces = fig_animation_create_surfaces_(self);
+        if(surfaces == NULL) {
+            return 0;
+        }
+    }
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        size_t width = fig_image_get_indexed_width(image);
+        size_t height = fig_image_get_indexed_height(image);
+        const fig_uint8_t *src = fig_image_get_indexed_data(image);
+        size_t row_size = width * factor;
+        fig_uint8_t *dest;
+
+        if(width * height == 0) {
+            continue;
+        }
+        dest = (fig_uint8_t *) fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
+            NULL, 0, row_size * height * factor);
+        if(dest == NULL) {
+            fig_animation_free_surfaces_(self, surfaces);
+            fig_state_set_error_allocation_failed(self->state);
+            return 0;
+        }
+        surfaces[i].data = dest;
+        surfaces[i].width = row_size;
+        surfaces[i].height = height * factor;
+
+        /* Each row is widened once, then copied for the rest of its rows. */
+        for(j = 0; j < height; ++j) {
+            fig_scale_indexed_row_(src, width, factor, dest);
+            for(k = 1; k < factor; ++k) {
+                memcpy(dest + k * row_size, dest, row_size);
+            }
+            src += fig_image_get_indexed_stride(image);
+            dest += row_size * factor;
+        }
+    }
+
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        fig_image_set_origin_x(image, fig_image_get_origin_x(image) * factor);
+        fig_image_set_origin_y(image, fig_image_get_origin_y(image) * factor);
+    }
+    self->width *= factor;
+    self->height *= factor;
+    if(surfaces != NULL) {
+        fig_animation_replace_indexed_(self, surfaces);
+    }
+    return 1;
+}
+
+enum {
+    /* The number of rows and columns of the tiles that transforms are copied in,
+       so that the rows read and written by a tile stay in the cache together. */
+    FIG_TRANSFORM_TILE_SIZE = 64
+};
+
+/* Copy width x height palette indices into dest, where the index at row i and column j
+ * is read from src[i * row_step + j * col_step]. */
+static void fig_transform_indexed_(const fig_uint8_t *src, ptrdiff_t row_step, ptrdiff_t col_step, fig_uint8_t *dest, size_t width, size_t height) {
+    size_t tile_y, tile_x;
+    size_t i, j;
+
+    if(col_step == 1) {
+        for(i = 0; i < height; ++i) {
+            memcpy(dest + i * width, src + (ptrdiff_t) i * row_step, width);
+        }
+        return;
+    }
+    for(tile_y = 0; tile_y < height; tile_y += FIG_TRANSFORM_TILE_SIZE) {
+        size_t tile_bottom = height - tile_y < FIG_TRANSFORM_TILE_SIZE ? height : tile_y + FIG_TRANSFORM_TILE_SIZE;
+
+        for(tile_x = 0; tile_x < width; tile_x += FIG_TRANSFORM_TILE_SIZE) {
+            size_t tile_right = width - tile_x < FIG_TRANSFORM_TILE_SIZE ? width : tile_x + FIG_TRANSFORM_TILE_SIZE;
+
+            for(i = tile_y; i < tile_bottom; ++i) {
+                const fig_uint8_t *from = src + (ptrdiff_t) i * row_step + (ptrdiff_t) tile_x * col_step;
+                fig_uint8_t *to = dest + i * width;
+
+                for(j = tile_x; j < tile_right; ++j) {
+                    to[j] = *from;
+                    from += col_step;
+                }
+            }
+        }
+    }
+}
+
+fig_bool_t fig_animation_transform(fig_animation *self, fig_transform_t transform) {
+    fig_indexed_surface_ *surfaces;
+    fig_bool_t swap_axes;
+    size_t i;
+
+    FIG_ASSERT(transform < FIG_TRANSFORM_COUNT);
+
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+
+        if(fig_image_get_origin_x(image) > self->width
+        || fig_image_get_indexed_width(image) > self->width - fig_image_get_origin_x(image)
+        || fig_image_get_origin_y(image) > self->height
+        || fig_image_get_indexed_height(image) > self->height - fig_image_get_origin_y(image)) {
+            fig_state_set_error(self->state, "transforming an animation requires every image to lie inside the canvas");
+            return 0;
+        }
+    }
+    if(self->image_count == 0) {
+        surfaces = NULL;
+    } else {
+        surfaces = fig_animation_create_surfaces_(self);
+        if(surfaces == NULL) {
+            return 0;
+        }
+    }
+
+    swap_axes = transform == FIG_TRANSFORM_ROTATE_90
+        || transform == FIG_TRANSFORM_ROTATE_270
+        || transform == FIG_TRANSFORM_TRANSPOSE;
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        size_t width = fig_image_get_indexed_width(image);
+        size_t height = fig_image_get_indexed_height(image);
+        size_t stride = fig_image_get_indexed_stride(image);
+        const fig_uint8_t *src = fig_image_get_indexed_data(image);
+        ptrdiff_t row_step;
+        ptrdiff_t col_step;
+
+        if(width * height == 0) {
+            continue;
+        }
+        surfaces[i].data = (fig_uint8_t *) fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
+            NULL, 0, width * height);
+        if(surfaces[i].data == NULL) {
+            fig_animation_free_surfaces_(self, surfaces);
+            fig_state_set_error_allocation_failed(self->state);
+            return 0;
+        }
+        surfaces[i].width = swap_axes ? height : width;
+        surfaces[i].height = swap_axes ? width : height;
+
+        /* Start from the source index that lands in the top left corner. */
+        switch(transform) {
+            case FIG_TRANSFORM_ROTATE_90:
+                src += (height - 1) * stride;
+                row_step = 1;
+                col_step = -(ptrdiff_t) stride;
+                break;
+            case FIG_TRANSFORM_ROTATE_180:
+                src += (height - 1) * stride + width - 1;
+                row_step = -(ptrdiff_t) stride;
+                col_step = -1;
+                break;
+            case FIG_TRANSFORM_ROTATE_270:
+                src += width - 1;
+                row_step = -1;
+                col_step = (ptrdiff_t) stride;
+                break;
+            case FIG_TRANSFORM_FLIP_HORIZONTAL:
+                src += width - 1;
+                row_step = (ptrdiff_t) stride;
+                col_step = -1;
+                break;
+            case FIG_TRANSFORM_FLIP_VERTICAL:
+                src += (height - 1) * stride;
+                row_step = -(ptrdiff_t) stride;
+                col_step = 1;
+                break;
+            default:
+                row_step = 1;
+                col_step = (ptrdiff_t) stride;
+                break;
+        }
+        fig_transform_indexed_(src, row_step, col_step, surfaces[i].data, surfaces[i].width, surfaces[i].height);
+    }
+
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        size_t x = fig_image_get_origin_x(image);
+        size_t y = fig_image_get_origin_y(image);
+        size_t right = self->width - x - fig_image_get_indexed_width(image);
+        size_t bottom = self->height - y - fig_image_get_indexed_height(image);
+
+        switch(transform) {
+            case FIG_TRANSFORM_ROTATE_90:
+                fig_image_set_origin_x(image, bottom);
+                fig_image_set_origin_y(image, x);
+                break;
+            case FIG_TRANSFORM_ROTATE_180:
+                fig_image_set_origin_x(image, right);
+                fig_image_set_origin_y(image, bottom);
+                break;
+            case FIG_TRANSFORM_ROTATE_270:
+                fig_image_set_origin_x(image, y);
+                fig_image_set_origin_y(image, right);
+                break;
+            case FIG_TRANSFORM_FLIP_HORIZONTAL:
+                fig_image_set_origin_x(image, right);
+                break;
+            case FIG_TRANSFORM_FLIP_VERTICAL:
+                fig_image_set_origin_y(image, bottom);
+                break;
+            default:
+                fig_image_set_origin_x(image, y);
+                fig_image_set_origin_y(image, x);
+                break;
+        }
+    }
+    if(swap_axes) {
+        size_t width = self->width;
+        self->width = self->height;
+        self->height = width;
+    }
+    if(surfaces != NULL) {
+        fig_animation_replace_indexed_(self, surfaces);
+    }
+    return 1;
+}
+
+size_t fig_animation_get_render_background_index(fig_animation *self) {
+    return fig_animation_find_background_index_(self);
+}
+
+size_t fig_animation_get_dirty_rects(fig_animation *self, size_t index, fig_rect *rects) {
+    fig_rect drawn;
+    fig_rect disposed;
+
+    FIG_ASSERT(index < self->image_count);
+    if(index == 0) {
+        rects[0] = fig_get_canvas_rect_(self);
+        return fig_rect_is_empty_(&rects[0]) ? 0 : 1;
+    }
+
+    /* Disposal only touches the pixels that the disposed image drew. */
+    disposed = fig_get_disposal_rect_(self, self->image_data[index - 1]);
+    if(!fig_rect_is_empty_(&disposed)) {
+        disposed = fig_get_opaque_rect_(self, self->image_data[index - 1]);
+    }
+    drawn = fig_get_opaque_rect_(self, self->image_data[index]);
+
+    if(fig_rect_is_empty_(&disposed)) {
+        rects[0] = drawn;
+        return fig_rect_is_empty_(&drawn) ? 0 : 1;
+    } else if(fig_rect_is_empty_(&drawn)) {
+        rects[0] = disposed;
+        return 1;
+    } else if(disposed.x > drawn.x + drawn.width || drawn.x > disposed.x + disposed.width
+    || disposed.y > drawn.y + drawn.height || drawn.y > disposed.y + disposed.height) {
+        rects[0] = disposed;
+        rects[1] = drawn;
+        return 2;
+    } else {
+        /* Areas that overlap or touch are reported as one. */
+        fig_rect_union_(&disposed, &drawn);
+        rects[0] = disposed;
+        return 1;
+    }
+}
+
+fig_bool_t fig_animation_is_keyframe(fig_animation *self, size_t index) {
+    FIG_ASSERT(index < self->image_count);
+    return fig_animation_is_keyframe_(self, index, fig_animation_uses_restore_(self));
+}
+
+size_t fig_animation_count_samples(fig_animation *self, size_t index) {
+    FIG_ASSERT(index < self->image_count);
+    return fig_animation_count_samples_(self, index, fig_animation_get_image_time_(self, index));
+}
+
+/* Two independent lanes of 32-bit multiply and rotate mixing, which together make a 64-bit hash
+ * without needing a 64-bit integer type. */
+typedef struct {
+    fig_uint32_t lanes[2];
+    fig_uint32_t length;
+} fig_hash_;
+
+static fig_uint32_t fig_hash_rotate_(fig_uint32_t value, unsigned bits) {
+    return (fig_uint32_t) ((value << bits) | (value >> (32 - bits)));
+}
+
+static void fig_hash_init_(fig_hash_ *hash) {
+    hash->lanes[0] = 0x811C9DC5;
+    hash->lanes[1] = 0x9E3779B9;
+    hash->length = 0;
+}
+
+static void fig_hash_word_(fig_hash_ *hash, fig_uint32_t word) {
+    fig_uint32_t key = fig_hash_rotate_((fig_uint32_t) (word * 0xCC9E2D51), 15) * 0x1B873593;
+
+    hash->lanes[0] = fig_hash_rotate_(hash->lanes[0] ^ key, 13) * 5 + 0xE6546B64;
+    hash->lanes[1] = fig_hash_rotate_(hash->lanes[1] ^ (fig_uint32_t) (key * 0x85EBCA6B), 17) * 9 + 0x52DCE729;
+    ++hash->length;
+}
+
+static void fig_hash_bytes_(fig_hash_ *hash, const fig_uint8_t *data, size_t size) {
+    size_t i;
+
+    for(i = 0; i + 4 <= size; i += 4) {
+        fig_hash_word_(hash, (fig_uint32_t) data[i]
+            | ((fig_uint32_t) data[i + 1] << 8)
+            | ((fig_uint32_t) data[i + 2] << 16)
+            | ((fig_uint32_t) data[i + 3] << 24));
+    }
+    if(i < size) {
+        fig_uint32_t word = 0;
+        size_t shift;
+
+        for(shift = 0; i < size; ++i, shift += 8) {
+            word |= (fig_uint32_t) data[i] << shift;
+        }
+        fig_hash_word_(hash, word);
+    }
+}
+
+static fig_uint32_t fig_hash_avalanche_(fig_uint32_t value) {
+    value ^= value >> 16;
+    value *= 0x85EBCA6B;
+    value ^= value >> 13;
+    value *= 0xC2B2AE35;
+    value ^= value >> 16;
+    return value;
+}
+
+/* Mix the lanes together and write the hash as 8 bytes, most significant first. */
+static void fig_hash_finish_(const fig_hash_ *hash, fig_uint8_t *out) {
+    fig_uint32_t a = fig_hash_avalanche_(hash->lanes[0] ^ hash->length);
+    fig_uint32_t b = fig_hash_avalanche_(hash->lanes[1] ^ (hash->length * 0x9E3779B9));
+    size_t i;
+
+    a += b;
+    b += a;
+    for(i = 0; i < 4; ++i) {
+        out[i] = (fig_uint8_t) ((a >> (24 - i * 8)) & 0xFF);
+        out[i + 4] = (fig_uint8_t) ((b >> (24 - i * 8)) & 0xFF);
+    }
+}
+
+static void fig_hash_image_content_(fig_animation *self, fig_image *image, fig_uint8_t *out) {
+    fig_palette *palette = fig_animation_get_render_palette(self, image);
+    const fig_uint8_t *data = fig_image_get_indexed_data(image);
+    size_t stride = fig_image_get_indexed_stride(image);
+    size_t width = fig_image_get_indexed_width(image);
+    size_t height = fig_image_get_indexed_height(image);
+    fig_uint32_t *colors = fig_palette_get_colors(palette);
+    size_t color_count = fig_palette_count_colors(palette);
+    fig_hash_ hash;
+    size_t i;
+
+    fig_hash_init_(&hash);
+    fig_hash_word_(&hash, (fig_uint32_t) fig_image_get_origin_x(image));
+    fig_hash_word_(&hash, (fig_uint32_t) fig_image_get_origin_y(image));
+    fig_hash_word_(&hash, (fig_uint32_t) width);
+    fig_hash_word_(&hash, (fig_uint32_t) height);
+    fig_hash_word_(&hash, fig_image_get_transparent(image) ? (fig_uint32_t) fig_image_get_transparency_index(image) : 0xFFFFFFFF);
+    fig_hash_word_(&hash, (fig_uint32_t) color_count);
+    for(i = 0; i < color_count; ++i) {
+        fig_hash_word_(&hash, colors[i]);
+    }
+    for(i = 0; i < height; ++i) {
+        fig_hash_bytes_(&hash, data + i * stride, width);
+    }
+    fig_hash_finish_(&hash, out);
+}
+
+fig_bool_t fig_animation_hash_images(fig_animation *self) {
+    fig_allocator_t alloc = fig_state_get_allocator(self->state);
+    void *ud = fig_state_get_userdata(self->state);
+    fig_compositor_ compositor;
+    fig_uint32_t *row_hashes;
+    size_t i, y;
+
+    if(self->image_count == 0) {
+        return 1;
+    }
+    if(self->width == 0 || self->height == 0) {
+        fig_state_set_error(self->state, "image is empty");
+        return 0;
+    }
+    if(self->height > ~(size_t) 0 / sizeof(fig_uint32_t) / 2) {
+        fig_state_set_error(self->state, "image dimensions requested are too large");
+        return 0;
+    }
+    row_hashes = (fig_uint32_t *) alloc(ud, NULL, 0, self->height * 2 * sizeof(fig_uint32_t));
+    if(row_hashes == NULL) {
+        fig_state_set_error_allocation_failed(self->state);
+        return 0;
+    }
+    if(!fig_compositor_init_(&compositor, self, NULL)) {
+        alloc(ud, row_hashes, self->height * 2 * sizeof(fig_uint32_t), 0);
+        return 0;
+    }
+
+    for(i = 0; i < self->image_count; ++i) {
+        fig_image *image = self->image_data[i];
+        fig_rect rect = fig_compositor_draw_(&compositor, image);
+        fig_uint8_t content_hash[8];
+        fig_uint8_t frame_hash[8];
+        fig_hash_ hash;
+
+        /* Rows outside of the area that changed keep their hashes from the image before. */
+        for(y = rect.y; y < rect.y + rect.height; ++y) {
+            const fig_uint32_t *row = compositor.canvas + y * compositor.pitch;
+            size_t x;
+
+            fig_hash_init_(&hash);
+            for(x = 0; x < self->width; ++x) {
+                fig_hash_word_(&hash, row[x]);
+            }
+            row_hashes[y * 2] = hash.lanes[0];
+            row_hashes[y * 2 + 1] = hash.lanes[1];
+        }
+
+        fig_hash_init_(&hash);
+        fig_hash_word_(&hash, (fig_uint32_t) self->width);
+        fig_hash_word_(&hash, (fig_uint32_t) self->height);
+        for(y = 0; y < self->height * 2; ++y) {
+            fig_hash_word_(&hash, row_hashes[y]);
+        }
+        fig_hash_finish_(&hash, frame_hash);
+        fig_hash_image_content_(self, image, content_hash);
+        fig_image_set_hashes(image, content_hash, frame_hash);
+    }
+
+    fig_compositor_free_(&compositor);
+    alloc(ud, row_hashes, self->height * 2 * sizeof(fig_uint32_t), 0);
+    return 1;
+}
+
+fig_bool_t fig_animation_find_duplicate_frames(fig_animation *self, size_t *firsts, size_t *distinct_count) {
+    fig_allocator_t alloc = fig_state_get_allocator(self->state);
+    void *ud = fig_state_get_userdata(self->state);
+    size_t *table;
+    size_t table_size;
+    size_t distinct;
+    size_t i;
+
+    for(i = 0; i < self->image_count; ++i) {
+        if(fig_image_get_frame_hash(self->image_data[i]) == NULL) {
+            if(!fig_animation_hash_images(self)) {
+                return 0;
+            }
+            break;
+        }
+    }
+
+    /* An open addressing table of image indices plus one, kept at most half full. */
+    table_size = 16;
+    while(table_size < self->image_count * 2) {
+        table_size *= 2;
+    }
+    if(table_size > ~(size_t) 0 / sizeof(size_t)) {
+        fig_state_set_error(self->state, "too many images");
+        return 0;
+    }
+    table = (size_t *) alloc(ud, NULL, 0, table_size * sizeof(size_t));
+    if(table == NULL) {
+        fig_state_set_error_allocation_failed(self->state);
+        return 0;
+    }
+    memset(table, 0, table_size * sizeof(size_t));
+
+    distinct = 0;
+    for(i = 0; i < self->image_count; ++i) {
+        const fig_uint8_t *hash = fig_image_get_frame_hash(self->image_data[i]);
+        size_t slot = ((size_t) hash[4] << 24 | (size_t) hash[5] << 16 | (size_t) hash[6] << 8 | (size_t) hash[7]) & (table_size - 1);
+
+        while(table[slot] != 0
+        && memcmp(fig_image_get_frame_hash(self->image_data[table[slot] - 1]), hash, 8) != 0) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if(table[slot] == 0) {
+            table[slot] = i + 1;
+            ++distinct;
+        }
+        firsts[i] = table[slot] - 1;
+    }
+
+    alloc(ud, table, table_size * sizeof(size_t), 0);
+    *distinct_count = distinct;
+    return 1;
+}
+
+fig_bool_t fig_animation_render_image_range(fig_animation *self, size_t start, size_t end) {
+    if(self->width == 0 && self->height == 0) {
+        fig_state_set_error(self->state, "image is empty");
+        return 0;
+    }
+    if(start > end || end > self->image_count) {
+        fig_state_set_error(self->state, "image range is out of bounds");
+        return 0;
+    }
+    if(start < end && !fig_animation_is_keyframe(self, start)) {
+        fig_state_set_error(self->state, "image range does not start at a keyframe");
+        return 0;
+    }
+
+    switch(self->render_mode) {
+        case FIG_RENDER_MODE_DELTA:
+            return fig_render_images_delta_(self, start, end);
+        case FIG_RENDER_MODE_CHECKPOINT:
+            return fig_render_images_checkpoint_(self, start, end);
+        case FIG_RENDER_MODE_INDEX:
+            return fig_render_images_index_(self, start, end);
+        case FIG_RENDER_MODE_SAMPLED:
+            return fig_render_images_sampled_(self, start, end);
+        case FIG_RENDER_MODE_FULL:
+        default:
+            return fig_render_images_full_(self, start, end);
+    }
+}
+
+fig_bool_t fig_animation_get_frame_rgba(fig_animation *self, size_t index, fig_uint32_t *out) {
+    fig_compositor_ compositor;
+
+    if(index >= self->image_count) {
+        fig_state_set_error(self->state, "image index is out of range");
+        return 0;
+    }
+    if(self->width == 0 && self->height == 0) {
+        fig_state_set_error(self->state, "image is empty");
+        return 0;
+    }
+    if(!fig_compositor_init_(&compositor, self, out)) {
+        return 0;
+    }
+
+    fig_compositor_seek_(&compositor, index);
+    fig_compositor_free_(&compositor);
+    return 1;
+}
+
+fig_bool_t fig_animation_get_frame_area_rgba(fig_animation *self, size_t index, const fig_rect *area, fig_uint32_t *out, size_t out_stride) {
+    fig_compositor_ compositor;
+
+    if(index >= self->image_count) {
+        fig_state_set_error(self->state, "image index is out of range");
+        return 0;
+    }
+    if(area->x > self->width || area->width > self->width - area->x
+    || area->y > self->height || area->height > self->height - area->y) {
+        fig_state_set_error(self->state, "area is outside of the canvas");
+        return 0;
+    }
+    if(out_stride % sizeof(fig_uint32_t) != 0 || out_stride / sizeof(fig_uint32_t) < area->width) {
+        fig_state_set_error(self->state, "stride is too small for the width");
+        return 0;
+    }
+    if(fig_rect_is_empty_(area)) {
+        return 1;
+    }
+    if(!fig_compositor_init_area_(&compositor, self, area, out, out_stride / sizeof(fig_uint32_t))) {
+        return 0;
+    }
+
+    fig_compositor_seek_(&compositor, index);
+    fig_compositor_free_(&compositor);
+    return 1;
+}
+
+fig_palette *fig_animation_get_render_palette(fig_animation *self, fig_image *image) {
+    fig_palette *local_palette = fig_image_get_palette(image);
+    if(fig_palette_count_colors(local_palette) > 0) {
+        return local_palette;
+    } else {
+        return self->palette;
+    }
+}
+
+void fig_animation_convert_render(fig_animation *self, fig_image *image, void *out, size_t out_stride, fig_pixel_format_t format) {
+    size_t width = fig_image_get_render_width(image);
+    size_t height = fig_image_get_render_height(image);
+    fig_uint8_t *dest = (fig_uint8_t *) out
+        + fig_image_get_render_origin_y(image) * out_stride
+        + fig_image_get_render_origin_x(image) * fig_pixel_format_get_size(format);
+
+    FIG_ASSERT(fig_image_get_render_origin_x(image) + width <= self->width);
+    FIG_ASSERT(fig_image_get_render_origin_y(image) + height <= self->height);
+
+    if(fig_image_get_render_index_data(image) != NULL) {
+        fig_uint32_t colors[256];
+
+        fig_get_index_canvas_colors_(self, self->palette, colors);
+        fig_convert_indices(fig_image_get_render_index_data(image), fig_image_get_render_stride(image), colors, 256, dest, out_stride, width, height, format);
+    } else if(fig_image_get_render_data(image) != NULL) {
+        fig_convert_colors(fig_image_get_render_data(image), fig_image_get_render_stride(image), dest, out_stride, width, height, format);
+    }
+}
+
+fig_bool_t fig_animation_convert_render_palette(fig_animation *self, fig_image *image, fig_palette *palette, const fig_rect *area, void *out, size_t out_stride, fig_pixel_format_t format) {
+    fig_rect surface_rect;
+    fig_rect rect;
+    fig_uint32_t colors[256];
+    size_t stride = fig_image_get_render_stride(image);
+    const fig_uint8_t *src = fig_image_get_render_index_data(image);
+    fig_uint8_t *dest;
+
+    if(src == NULL) {
+        fig_state_set_error(self->state, "palette swapping requires a render surface of palette indices");
+        return 0;
+    }
+
+    surface_rect.x = fig_image_get_render_origin_x(image);
+    surface_rect.y = fig_image_get_render_origin_y(image);
+    surface_rect.width = fig_image_get_render_width(image);
+    surface_rect.height = fig_image_get_render_height(image);
+    FIG_ASSERT(surface_rect.x + surface_rect.width <= self->width);
+    FIG_ASSERT(surface_rect.y + surface_rect.height <= self->height);
+    rect = area != NULL ? fig_rect_intersect_(&surface_rect, area) : surface_rect;
+    if(fig_rect_is_empty_(&rect)) {
+        return 1;
+    }
+
+    fig_get_index_canvas_colors_(self, palette, colors);
+    src += (rect.y - surface_rect.y) * stride + (rect.x - surface_rect.x);
+    dest = (fig_uint8_t *) out + rect.y * out_stride + rect.x * fig_pixel_format_get_size(format);
+    fig_convert_indices(src, stride, colors, 256, dest, out_stride, rect.width, rect.height, format);
+    return 1;
+}
+
+void fig_animation_free(fig_animation *self) {
+    if(self != NULL) {
+        fig_allocator_t alloc = fig_state_get_allocator(self->state);
         void *ud = fig_state_get_userdata(self->state);
 
         if(self->palette != NULL) {
@@ -313,6 +2371,147 @@ void fig_animation_free(fig_animation *self) {
             }
             alloc(ud, data, sizeof(fig_image *) * self->image_count, 0);
         }
+        fig_state_get_storage_allocator(self->state)(fig_state_get_storage_userdata(self->state),
+            self->render_slab, self->render_slab_pitch * self->render_slab_count, 0);
+        fig_state_get_storage_allocator(self->state)(fig_state_get_storage_userdata(self->state),
+            self->indexed_slab, self->indexed_slab_pitch * self->indexed_slab_count, 0);
         alloc(ud, self, sizeof(fig_animation), 0);
     }
+}
+
+
+
+struct fig_player {
+    fig_state *state;
+    fig_animation *animation;
+    fig_compositor_ compositor;
+    /* The time at which each image starts within a loop, followed by the duration of a loop. */
+    size_t *start_times;
+    size_t loop;
+};
+
+fig_player *fig_create_player(fig_state *state, fig_animation *animation) {
+    if(state != NULL) {
+        fig_player *self;
+
+        if(animation == NULL) {
+            fig_state_set_error(state, "animation is NULL");
+            return NULL;
+        }
+        if(animation->image_count == 0
+        || (animation->width == 0 && animation->height == 0)) {
+            fig_state_set_error(state, "image is empty");
+            return NULL;
+        }
+
+        self = (fig_player *) fig_state_get_allocator(state)(fig_state_get_userdata(state), NULL, 0, sizeof(fig_player));
+        if(self != NULL) {
+            size_t i;
+
+            self->state = state;
+            self->animation = animation;
+            self->loop = 0;
+            self->start_times = (size_t *) fig_state_get_allocator(state)(fig_state_get_userdata(state), NULL, 0, (animation->image_count + 1) * sizeof(size_t));
+            if(self->start_times == NULL) {
+                fig_state_set_error_allocation_failed(state);
+                fig_state_get_allocator(state)(fig_state_get_userdata(state), self, sizeof(fig_player), 0);
+                return NULL;
+            }
+            self->start_times[0] = 0;
+            for(i = 0; i < animation->image_count; ++i) {
+                self->start_times[i + 1] = self->start_times[i] + fig_image_get_delay(animation->image_data[i]);
+            }
+
+            if(!fig_compositor_init_(&self->compositor, animation, NULL)) {
+                fig_state_get_allocator(state)(fig_state_get_userdata(state), self->start_times, (animation->image_count + 1) * sizeof(size_t), 0);
+                fig_state_get_allocator(state)(fig_state_get_userdata(state), self, sizeof(fig_player), 0);
+                return NULL;
+            }
+            fig_compositor_seek_(&self->compositor, 0);
+        } else {
+            fig_state_set_error_allocation_failed(state);
+        }
+        return self;
+    }
+    return NULL;
+}
+
+const fig_uint32_t *fig_player_get_canvas(fig_player *self) {
+    return self->compositor.canvas;
+}
+
+size_t fig_player_get_image_index(fig_player *self) {
+    return self->compositor.position - 1;
+}
+
+size_t fig_player_get_loop_index(fig_player *self) {
+    return self->loop;
+}
+
+size_t fig_player_get_time(fig_player *self) {
+    return self->loop * self->start_times[self->animation->image_count]
+        + self->start_times[self->compositor.position - 1];
+}
+
+fig_bool_t fig_player_advance(fig_player *self) {
+    fig_animation *animation = self->animation;
+    size_t index = self->compositor.position;
+
+    if(index >= animation->image_count) {
+        if(animation->loop_count != 0 && self->loop >= animation->loop_count) {
+            return 0;
+        }
+        ++self->loop;
+        index = 0;
+    }
+    fig_compositor_seek_(&self->compositor, index);
+    return 1;
+}
+
+fig_bool_t fig_player_seek_time(fig_player *self, size_t time) {
+    fig_animation *animation = self->animation;
+    size_t duration;
+    size_t loop;
+    size_t index;
+    fig_bool_t finished;
+
+    duration = self->start_times[animation->image_count];
+    loop = duration != 0 ? time / duration : 0;
+    /* A loop count is the number of times the animation repeats after it first plays. */
+    finished = animation->loop_count != 0 && (duration == 0 || loop > animation->loop_count);
+
+    if(finished || duration == 0) {
+        /* Past the end of playback, the last image of the last loop stays on display.
+         * An animation without any delays shows only its last image, even when looping forever. */
+        loop = finished ? animation->loop_count : 0;
+        index = animation->image_count - 1;
+    } else {
+        size_t low = 0;
+        size_t high = animation->image_count - 1;
+
+        /* Find the first image that ends after the time, skipping images without a delay. */
+        time %= duration;
+        while(low < high) {
+            size_t middle = low + (high - low) / 2;
+            if(self->start_times[middle + 1] > time) {
+                high = middle;
+            } else {
+                low = middle + 1;
+            }
+        }
+        index = low;
+    }
+
+    /* Every loop draws the same images, so the canvas can be reused across loops. */
+    self->loop = loop;
+    fig_compositor_seek_(&self->compositor, index);
+    return !finished;
+}
+
+void fig_player_free(fig_player *self) {
+    if(self != NULL) {
+        fig_compositor_free_(&self->compositor);
+        fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state), self->start_times, (self->animation->image_count + 1) * sizeof(size_t), 0);
+        fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state), self, sizeof(fig_player), 0);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,610 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fig.h>
+
+struct fig_atlas {
+    fig_state *state;
+    size_t width;
+    size_t height;
+    fig_uint32_t *data;
+    fig_uint8_t *index_data;
+    size_t sprite_count;
+    size_t frame_count;
+    fig_atlas_frame *frames;
+};
+
+/* A distinct trimmed frame, kept in the pixel buffer of the builder until it's placed. */
+typedef struct {
+    size_t offset;
+    size_t width;
+    size_t height;
+    fig_uint32_t hash;
+    size_t x;
+    size_t y;
+} fig_atlas_sprite_;
+
+/* A segment of the top edge of the packed sprites, spanning width pixels from x at height y. */
+typedef struct {
+    size_t x;
+    size_t y;
+    size_t width;
+} fig_atlas_skyline_node_;
+
+/* Everything allocated while packing an atlas. */
+typedef struct {
+    fig_state *state;
+    size_t pixel_size;
+    fig_uint8_t background;
+    fig_player *player;
+    fig_atlas_sprite_ *sprites;
+    size_t sprite_count;
+    fig_uint8_t *pixels;
+    size_t pixels_used;
+    size_t pixels_capacity;
+    /* Open addressed table of sprite index + 1 by hash, where 0 marks an empty slot. */
+    size_t *table;
+    size_t table_size;
+    /* The sprite shown by each frame, or (size_t) -1 if the frame is transparent. */
+    size_t *frame_sprites;
+    fig_rect *frame_bounds;
+    fig_atlas_sprite_ **order;
+    fig_atlas_skyline_node_ *nodes;
+    size_t node_count;
+    fig_atlas_frame *frames;
+    fig_uint8_t *data;
+    size_t data_size;
+    /* The number of items that each array above was allocated with. */
+    size_t image_count;
+} fig_atlas_builder_;
+
+fig_atlas *fig_create_atlas(fig_state *state) {
+    if(state != NULL) {
+        fig_atlas *self = (fig_atlas *) fig_state_get_allocator(state)(fig_state_get_userdata(state), NULL, 0, sizeof(fig_atlas));
+        if(self != NULL) {
+            self->state = state;
+            self->width = 0;
+            self->height = 0;
+            self->data = NULL;
+            self->index_data = NULL;
+            self->sprite_count = 0;
+            self->frame_count = 0;
+            self->frames = NULL;
+        } else {
+            fig_state_set_error_allocation_failed(state);
+        }
+        return self;
+    }
+    return NULL;
+}
+
+static void *fig_atlas_builder_alloc_(fig_atlas_builder_ *builder, size_t count, size_t size) {
+    void *result;
+
+    if(count == 0) {
+        count = 1;
+    }
+    if(count > ~(size_t) 0 / size) {
+        fig_state_set_error_allocation_failed(builder->state);
+        return NULL;
+    }
+    result = fig_state_get_allocator(builder->state)(fig_state_get_userdata(builder->state), NULL, 0, count * size);
+    if(result == NULL) {
+        fig_state_set_error_allocation_failed(builder->state);
+    }
+    return result;
+}
+
+static void fig_atlas_builder_free_(fig_atlas_builder_ *builder) {
+    fig_allocator_t alloc = fig_state_get_allocator(builder->state);
+    void *ud = fig_state_get_userdata(builder->state);
+    size_t count = builder->image_count != 0 ? builder->image_count : 1;
+
+    if(builder->player != NULL) {
+        fig_player_free(builder->player);
+    }
+    alloc(ud, builder->sprites, count * sizeof(fig_atlas_sprite_), 0);
+    alloc(ud, builder->pixels, builder->pixels_capacity, 0);
+    alloc(ud, builder->table, builder->table_size * sizeof(size_t), 0);
+    alloc(ud, builder->frame_sprites, count * sizeof(size_t), 0);
+    alloc(ud, builder->frame_bounds, count * sizeof(fig_rect), 0);
+    alloc(ud, builder->order, count * sizeof(fig_atlas_sprite_ *), 0);
+    alloc(ud, builder->nodes, (count + 1) * sizeof(fig_atlas_skyline_node_), 0);
+    alloc(ud, builder->frames, count * sizeof(fig_atlas_frame), 0);
+    alloc(ud, builder->data, builder->data_size, 0);
+}
+
+static fig_bool_t fig_atlas_is_opaque_(const fig_atlas_builder_ *builder, const fig_uint8_t *row, size_t x) {
+    if(builder->pixel_size == sizeof(fig_uint32_t)) {
+        return (((const fig_uint32_t *) row)[x] >> 24) != 0;
+    } else {
+        return row[x] != builder->background;
+    }
+}
+
+/* Find the bounds of the pixels of a frame that aren't transparent.
+ * Returns 0 if the whole frame is transparent. */
+static fig_bool_t fig_atlas_trim_(const fig_atlas_builder_ *builder, const fig_uint8_t *src, size_t stride, size_t width, size_t height, fig_rect *bounds) {
+    size_t left = width;
+    size_t right = 0;
+    size_t top = height;
+    size_t bottom = 0;
+    size_t i, j;
+
+    for(i = 0; i < height; ++i) {
+        const fig_uint8_t *row = src + i * stride;
+        size_t first;
+
+        for(first = 0; first < width; ++first) {
+            if(fig_atlas_is_opaque_(builder, row, first)) {
+                break;
+            }
+        }
+        if(first == width) {
+            continue;
+        }
+        if(first < left) {
+            left = first;
+        }
+        for(j = width; j > right && j > first; --j) {
+            if(fig_atlas_is_opaque_(builder, row, j - 1)) {
+                right = j;
+                break;
+            }
+        }
+        if(top == height) {
+            top = i;
+        }
+        bottom = i + 1;
+    }
+    if(top == height) {
+        return 0;
+    }
+    bounds->x = left;
+    bounds->y = top;
+    bounds->width = right - left;
+    bounds->height = bottom - top;
+    return 1;
+}
+
+/* FNV-1a over the rows of a trimmed frame. */
+static fig_uint32_t fig_atlas_hash_(const fig_uint8_t *src, size_t stride, size_t row_size, size_t height) {
+    fig_uint32_t hash = 2166136261u;
+    size_t i, j;
+
+    for(i = 0; i < height; ++i) {
+        const fig_uint8_t *row = src + i * stride;
+
+        for(j = 0; j < row_size; ++j) {
+            hash = (hash ^ row[j]) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+/* Find a sprite identical to a trimmed frame, or store the frame as a new sprite.
+ * Returns the index of the sprite, or (size_t) -1 on failure. */
+static size_t fig_atlas_add_sprite_(fig_atlas_builder_ *builder, const fig_uint8_t *src, size_t stride, size_t width, size_t height) {
+    size_t row_size = width * builder->pixel_size;
+    fig_uint32_t hash = fig_atlas_hash_(src, stride, row_size, height) ^ (fig_uint32_t) (width * 31 + height);
+    size_t mask = builder->table_size - 1;
+    size_t slot = hash & mask;
+    fig_atlas_sprite_ *sprite;
+    size_t i;
+
+    while(builder->table[slot] != 0) {
+        sprite = &builder->sprites[builder->table[slot] - 1];
+        if(sprite->hash == hash && sprite->width == width && sprite->height == height) {
+            const fig_uint8_t *stored = builder->pixels + sprite->offset;
+
+            for(i = 0; i < height; ++i) {
+                if(memcmp(stored + i * row_size, src + i * stride, row_size) != 0) {
+                    break;
+                }
+            }
+            if(i == height) {
+                return builder->table[slot] - 1;
+            }
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if(row_size * height > builder->pixels_capacity - builder->pixels_used) {
+        size_t capacity = builder->pixels_capacity;
+        fig_uint8_t *pixels;
+
+        while(row_size * height > capacity - builder->pixels_used) {
+            if(capacity > ~(size_t) 0 / 2) {
+                fig_state_set_error_allocation_failed(builder->state);
+                return (size_t) -1;
+            }
+            capacity = capacity != 0 ? capacity * 2 : 4096;
+        }
+        pixels = (fig_uint8_t *) fig_state_get_allocator(builder->state)(fig_state_get_userdata(builder->state),
+            builder->pixels, builder->pixels_capacity, capacity);
+        if(pixels == NULL) {
+            fig_state_set_error_allocation_failed(builder->state);
+            return (size_t) -1;
+        }
+        builder->pixels = pixels;
+        builder->pixels_capacity = capacity;
+    }
+
+    sprite = &builder->sprites[builder->sprite_count];
+    sprite->offset = builder->pixels_used;
+    sprite->width = width;
+    sprite->height = height;
+    sprite->hash = hash;
+    sprite->x = 0;
+    sprite->y = 0;
+    for(i = 0; i < height; ++i) {
+        memcpy(builder->pixels + builder->pixels_used, src + i * stride, row_size);
+        builder->pixels_used += row_size;
+    }
+    builder->table[slot] = ++builder->sprite_count;
+    return builder->sprite_count - 1;
+}
+
+/* Order sprites tallest first, then widest first, so that short sprites fill the gaps left by tall ones. */
+static int fig_atlas_compare_sprites_(const void *a, const void *b) {
+    const fig_atlas_sprite_ *sprite_a = *(fig_atlas_sprite_ * const *) a;
+    const fig_atlas_sprite_ *sprite_b = *(fig_atlas_sprite_ * const *) b;
+
+    if(sprite_a->height != sprite_b->height) {
+        return sprite_a->height > sprite_b->height ? -1 : 1;
+    }
+    if(sprite_a->width != sprite_b->width) {
+        return sprite_a->width > sprite_b->width ? -1 : 1;
+    }
+    return sprite_a < sprite_b ? -1 : sprite_a > sprite_b;
+}
+
+/* Place a width x height rectangle on the lowest part of the skyline that fits it, leftmost first.
+ * Returns 0 if the rectangle is wider than the skyline. */
+static fig_bool_t fig_atlas_skyline_place_(fig_atlas_builder_ *builder, size_t width, size_t height, size_t *x, size_t *y) {
+    fig_atlas_skyline_node_ *nodes = builder->nodes;
+    size_t skyline_width = nodes[builder->node_count - 1].x + nodes[builder->node_count - 1].width;
+    size_t best_index = builder->node_count;
+    size_t best_y = ~(size_t) 0;
+    fig_atlas_skyline_node_ node;
+    size_t i, j;
+
+    for(i = 0; i < builder->node_count && width <= skyline_width - nodes[i].x; ++i) {
+        size_t remaining = width;
+        size_t top = 0;
+
+        for(j = i; remaining > 0; ++j) {
+            if(nodes[j].y > top) {
+                top = nodes[j].y;
+            }
+            if(nodes[j].width >= remaining) {
+                break;
+            }
+            remaining -= nodes[j].width;
+        }
+        if(top < best_y) {
+            best_y = top;
+            best_index = i;
+        }
+    }
+    if(best_index == builder->node_count) {
+        return 0;
+    }
+
+    /* Insert the top edge of the rectangle, then cut away the segments it covers. */
+    node.x = nodes[best_index].x;
+    node.y = best_y + height;
+    node.width = width;
+    memmove(&nodes[best_index + 1], &nodes[best_index], (builder->node_count - best_index) * sizeof(fig_atlas_skyline_node_));
+    nodes[best_index] = node;
+    ++builder->node_count;
+    i = best_index + 1;
+    while(i < builder->node_count && nodes[i].x < node.x + node.width) {
+        size_t shrink = node.x + node.width - nodes[i].x;
+
+        if(nodes[i].width > shrink) {
+            nodes[i].x += shrink;
+            nodes[i].width -= shrink;
+            break;
+        }
+        memmove(&nodes[i], &nodes[i + 1], (builder->node_count - i - 1) * sizeof(fig_atlas_skyline_node_));
+        --builder->node_count;
+    }
+    for(i = 0; i + 1 < builder->node_count; ) {
+        if(nodes[i].y == nodes[i + 1].y) {
+            nodes[i].width += nodes[i + 1].width;
+            memmove(&nodes[i + 1], &nodes[i + 2], (builder->node_count - i - 2) * sizeof(fig_atlas_skyline_node_));
+            --builder->node_count;
+        } else {
+            ++i;
+        }
+    }
+
+    *x = node.x;
+    *y = best_y;
+    return 1;
+}
+
+/* Get the smallest whole number whose square is at least n. */
+static size_t fig_atlas_sqrt_ceil_(size_t n) {
+    size_t x, y;
+
+    if(n < 2) {
+        return n;
+    }
+    x = n;
+    y = n / 2 + 1;
+    while(y < x) {
+        x = y;
+        y = (x + n / x) / 2;
+    }
+    return x * x < n ? x + 1 : x;
+}
+
+/* Composite and trim every frame of the animation, storing the distinct ones as sprites. */
+static fig_bool_t fig_atlas_collect_sprites_(fig_atlas_builder_ *builder, fig_animation *animation) {
+    fig_image **images = fig_animation_get_images(animation);
+    size_t width = fig_animation_get_width(animation);
+    size_t height = fig_animation_get_height(animation);
+    size_t i;
+
+    for(i = 0; i < builder->image_count; ++i) {
+        const fig_uint8_t *src;
+        size_t stride;
+        fig_rect *bounds = &builder->frame_bounds[i];
+
+        if(builder->player != NULL) {
+            if(i > 0) {
+                fig_player_advance(builder->player);
+            }
+            src = (const fig_uint8_t *) fig_player_get_canvas(builder->player);
+            stride = width * sizeof(fig_uint32_t);
+        } else {
+            src = fig_image_get_render_index_data(images[i]);
+            stride = fig_image_get_render_stride(images[i]);
+        }
+
+        builder->frame_sprites[i] = (size_t) -1;
+        if(fig_atlas_trim_(builder, src, stride, width, height, bounds)) {
+            builder->frame_sprites[i] = fig_atlas_add_sprite_(builder,
+                src + bounds->y * stride + bounds->x * builder->pixel_size, stride, bounds->width, bounds->height);
+            if(builder->frame_sprites[i] == (size_t) -1) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/* Pack the sprites and copy them into a new atlas surface. */
+static fig_bool_t fig_atlas_place_sprites_(fig_atlas_builder_ *builder, const fig_atlas_options *options, size_t *atlas_width, size_t *atlas_height) {
+    size_t padding = options->padding;
+    size_t limit;
+    size_t area;
+    size_t width;
+    size_t height;
+    size_t i, j;
+
+    limit = options->max_width;
+    area = 0;
+    for(i = 0; i < builder->sprite_count; ++i) {
+        fig_atlas_sprite_ *sprite = &builder->sprites[i];
+
+        if(sprite->width > ~(size_t) 0 - padding || sprite->height > ~(size_t) 0 - padding
+        || (sprite->width + padding) > (~(size_t) 0 - area) / (sprite->height + padding)) {
+            fig_state_set_error(builder->state, "atlas dimensions requested are too large");
+            return 0;
+        }
+        area += (sprite->width + padding) * (sprite->height + padding);
+        if(options->max_width == 0 && sprite->width > limit) {
+            limit = sprite->width;
+        }
+        builder->order[i] = sprite;
+    }
+    if(options->max_width == 0) {
+        size_t square = fig_atlas_sqrt_ceil_(area);
+        if(square > limit) {
+            limit = square;
+        }
+    }
+    if(limit > ~(size_t) 0 - padding) {
+        fig_state_set_error(builder->state, "atlas dimensions requested are too large");
+        return 0;
+    }
+
+    qsort(builder->order, builder->sprite_count, sizeof(fig_atlas_sprite_ *), fig_atlas_compare_sprites_);
+
+    /* The skyline is wider by the padding, so that the last column of sprites doesn't need padding after it. */
+    builder->nodes[0].x = 0;
+    builder->nodes[0].y = 0;
+    builder->nodes[0].width = limit + padding;
+    builder->node_count = 1;
+    width = 0;
+    height = 0;
+    for(i = 0; i < builder->sprite_count; ++i) {
+        fig_atlas_sprite_ *sprite = builder->order[i];
+
+        if(!fig_atlas_skyline_place_(builder, sprite->width + padding, sprite->height + padding, &sprite->x, &sprite->y)) {
+            fig_state_set_error(builder->state, "a frame is wider than the atlas");
+            return 0;
+        }
+        if(sprite->x + sprite->width > width) {
+            width = sprite->x + sprite->width;
+        }
+        if(sprite->y > ~(size_t) 0 - sprite->height - padding) {
+            fig_state_set_error(builder->state, "atlas dimensions requested are too large");
+            return 0;
+        }
+        if(sprite->y + sprite->height > height) {
+            height = sprite->y + sprite->height;
+        }
+    }
+
+    if(height != 0 && width > ~(size_t) 0 / height / builder->pixel_size) {
+        fig_state_set_error(builder->state, "atlas dimensions requested are too large");
+        return 0;
+    }
+    builder->data_size = width * height * builder->pixel_size;
+    if(builder->data_size != 0) {
+        builder->data = (fig_uint8_t *) fig_atlas_builder_alloc_(builder, builder->data_size, 1);
+        if(builder->data == NULL) {
+            builder->data_size = 0;
+            return 0;
+        }
+        memset(builder->data, builder->pixel_size == 1 ? builder->background : 0, builder->data_size);
+    }
+    for(i = 0; i < builder->sprite_count; ++i) {
+        fig_atlas_sprite_ *sprite = &builder->sprites[i];
+        size_t row_size = sprite->width * builder->pixel_size;
+        fig_uint8_t *dest = builder->data + (sprite->y * width + sprite->x) * builder->pixel_size;
+        const fig_uint8_t *src = builder->pixels + sprite->offset;
+
+        for(j = 0; j < sprite->height; ++j) {
+            memcpy(dest, src, row_size);
+            dest += width * builder->pixel_size;
+            src += row_size;
+        }
+    }
+
+    *atlas_width = width;
+    *atlas_height = height;
+    return 1;
+}
+
+fig_bool_t fig_atlas_pack(fig_atlas *self, fig_animation *animation, const fig_atlas_options *options) {
+    fig_atlas_builder_ builder;
+    fig_image **images = fig_animation_get_images(animation);
+    fig_allocator_t alloc = fig_state_get_allocator(self->state);
+    void *ud = fig_state_get_userdata(self->state);
+    size_t atlas_width;
+    size_t atlas_height;
+    size_t i;
+
+    memset(&builder, 0, sizeof(builder));
+    builder.state = self->state;
+    builder.image_count = fig_animation_count_images(animation);
+    builder.pixel_size = options->indexed ? sizeof(fig_uint8_t) : sizeof(fig_uint32_t);
+
+    if(options->indexed) {
+        size_t background = fig_animation_get_render_background_index(animation);
+
+        for(i = 0; i < builder.image_count; ++i) {
+            if(fig_image_get_render_index_data(images[i]) == NULL
+            || fig_image_get_render_width(images[i]) != fig_animation_get_width(animation)
+            || fig_image_get_render_height(images[i]) != fig_animation_get_height(animation)) {
+                fig_state_set_error(self->state, "an indexed atlas requires render surfaces of palette indices covering the canvas");
+                return 0;
+            }
+        }
+        builder.background = (fig_uint8_t) (background < 256 ? background : 0);
+    } else if(builder.image_count != 0) {
+        builder.player = fig_create_player(self->state, animation);
+        if(builder.player == NULL) {
+            return 0;
+        }
+    }
+
+    /* Keep the hash table at most half full. */
+    builder.table_size = 16;
+    while(builder.table_size < builder.image_count * 2) {
+        builder.table_size *= 2;
+    }
+    builder.sprites = (fig_atlas_sprite_ *) fig_atlas_builder_alloc_(&builder, builder.image_count, sizeof(fig_atlas_sprite_));
+    builder.table = (size_t *) fig_atlas_builder_alloc_(&builder, builder.table_size, sizeof(size_t));
+    builder.frame_sprites = (size_t *) fig_atlas_builder_alloc_(&builder, builder.image_count, sizeof(size_t));
+    builder.frame_bounds = (fig_rect *) fig_atlas_builder_alloc_(&builder, builder.image_count, sizeof(fig_rect));
+    builder.order = (fig_atlas_sprite_ **) fig_atlas_builder_alloc_(&builder, builder.image_count, sizeof(fig_atlas_sprite_ *));
+    builder.nodes = (fig_atlas_skyline_node_ *) fig_atlas_builder_alloc_(&builder, builder.image_count + 1, sizeof(fig_atlas_skyline_node_));
+    builder.frames = (fig_atlas_frame *) fig_atlas_builder_alloc_(&builder, builder.image_count, sizeof(fig_atlas_frame));
+    if(builder.sprites == NULL || builder.table == NULL || builder.frame_sprites == NULL || builder.frame_bounds == NULL
+    || builder.order == NULL || builder.nodes == NULL || builder.frames == NULL) {
+        fig_atlas_builder_free_(&builder);
+        return 0;
+    }
+    memset(builder.table, 0, builder.table_size * sizeof(size_t));
+
+    if(!fig_atlas_collect_sprites_(&builder, animation)
+    || !fig_atlas_place_sprites_(&builder, options, &atlas_width, &atlas_height)) {
+        fig_atlas_builder_free_(&builder);
+        return 0;
+    }
+
+    for(i = 0; i < builder.image_count; ++i) {
+        fig_atlas_frame *frame = &builder.frames[i];
+
+        if(builder.frame_sprites[i] != (size_t) -1) {
+            fig_atlas_sprite_ *sprite = &builder.sprites[builder.frame_sprites[i]];
+
+            frame->source.x = sprite->x;
+            frame->source.y = sprite->y;
+            frame->source.width = sprite->width;
+            frame->source.height = sprite->height;
+            frame->x = builder.frame_bounds[i].x;
+            frame->y = builder.frame_bounds[i].y;
+        } else {
+            frame->source.x = 0;
+            frame->source.y = 0;
+            frame->source.width = 0;
+            frame->source.height = 0;
+            frame->x = 0;
+            frame->y = 0;
+        }
+        frame->delay = fig_image_get_delay(images[i]);
+    }
+
+    /* Hand the surface and frames over to the atlas, and free what it held before. */
+    alloc(ud, self->data, self->width * self->height * sizeof(fig_uint32_t), 0);
+    alloc(ud, self->index_data, self->width * self->height, 0);
+    alloc(ud, self->frames, (self->frame_count != 0 ? self->frame_count : 1) * sizeof(fig_atlas_frame), 0);
+    self->width = atlas_width;
+    self->height = atlas_height;
+    self->data = options->indexed ? NULL : (fig_uint32_t *) builder.data;
+    self->index_data = options->indexed ? builder.data : NULL;
+    self->sprite_count = builder.sprite_count;
+    self->frame_count = builder.image_count;
+    self->frames = builder.frames;
+    builder.data = NULL;
+    builder.data_size = 0;
+    builder.frames = NULL;
+    fig_atlas_builder_free_(&builder);
+    return 1;
+}
+
+size_t fig_atlas_get_width(fig_atlas *self) {
+    return self->width;
+}
+
+size_t fig_atlas_get_height(fig_atlas *self) {
+    return self->height;
+}
+
+fig_uint32_t *fig_atlas_get_data(fig_atlas *self) {
+    return self->data;
+}
+
+fig_uint8_t *fig_atlas_get_index_data(fig_atlas *self) {
+    return self->index_data;
+}
+
+size_t fig_atlas_count_sprites(fig_atlas *self) {
+    return self->sprite_count;
+}
+
+size_t fig_atlas_count_frames(fig_atlas *self) {
+    return self->frame_count;
+}
+
+fig_atlas_frame *fig_atlas_get_frames(fig_atlas *self) {
+    return self->frames;
+}
+
+void fig_atlas_free(fig_atlas *self) {
+    if(self != NULL) {
+        fig_allocator_t alloc = fig_state_get_allocator(self->state);
+        void *ud = fig_state_get_userdata(self->state);
+
+        alloc(ud, self->data, self->width * self->height * sizeof(fig_uint32_t), 0);
+        alloc(ud, self->index_data, self->width * self->height, 0);
+        alloc(ud, self->frames, (self->frame_count != 0 ? self->frame_count : 1) * sizeof(fig_atlas_frame), 0);
+        alloc(ud, self, sizeof(fig_atlas), 0);
+    }
+}
@@ -401,6 +401,19 @@ static fig_disposal_t fig_convert_gif_disposal_to_fig_disposal_(fig_gif_disposal
 }
 
 fig_animation *fig_load_gif(fig_state *state, fig_input *input) {
+    fig_animation *animation;
+    fig_load_options options;
+    fig_init_load_options(&options);
+    options.render_images = 0;
+    animation = fig_load_gif_with_options(state, input, &options);
+    if(animation != NULL) {
+        /* A failed render leaves the images unrendered, but still loaded. */
+        fig_animation_render_images(animation);
+    }
+    return animation;
+}
+
+fig_animation *fig_load_gif_with_options(fig_state *state, fig_input *input, const fig_load_options *options) {
     fig_uint8_t version;
     fig_gif_screen_descriptor_ screen_desc;
     fig_gif_graphics_control_ gfx_ctrl;    
@@ -410,6 +423,10 @@ fig_animation *fig_load_gif(fig_state *state, fig_input *input) {
         fig_state_set_error(state, "input is NULL");
         return NULL;
     }
+    if(options == NULL) {
+        fig_state_set_error(state, "options is NULL");
+        return NULL;
+    }
 
     memset(&screen_desc, 0, sizeof(screen_desc));
     memset(&gfx_ctrl, 0, sizeof(gfx_ctrl));
@@ -428,6 +445,8 @@ fig_animation *fig_load_gif(fig_state *state, fig_input *input) {
         return NULL;
     }
     fig_animation_set_dimensions(animation, screen_desc.width, screen_desc.height);
+    fig_animation_set_render_mode(animation, options->render_mode);
+    fig_animation_set_perceptual_hashes(animation, options->perceptual_hashes);
 
     if(screen_desc.global_colors > 0
     && !fig_gif_read_palette_(input, screen_desc.global_colors, fig_animation_get_palette(animation))) {
@@ -501,8 +520,7 @@ fig_animation *fig_load_gif(fig_state *state, fig_input *input) {
                 image = fig_animation_add_image(animation);
 
                 if(image == NULL
-                || !fig_image_resize_indexed(image, image_desc.width, image_desc.height)
-                || !fig_image_resize_render(image, screen_desc.width, screen_desc.height)) {
+                || !fig_image_resize_indexed(image, image_desc.width, image_desc.height)) {
                     fig_state_set_error(state, "failed to allocate frame image surfaces");
                     return fig_animation_free(animation), NULL;
                 }
@@ -526,7 +544,21 @@ fig_animation *fig_load_gif(fig_state *state, fig_input *input) {
                 break;
             }
             case FIG_GIF_BLOCK_TERMINATOR: {
-                fig_animation_render_images(animation);
+                if(options->contiguous_indexed
+                && !fig_animation_pack_indexed_data(animation)) {
+                    return fig_animation_free(animation), NULL;
+                }
+                if(options->render_images) {
+                    /* Other render modes don't keep a full canvas per image, so they don't use a block. */
+                    if(options->contiguous_render
+                    && (options->render_mode == FIG_RENDER_MODE_FULL || options->render_mode == FIG_RENDER_MODE_INDEX)
+                    && !fig_animation_allocate_render_slab(animation)) {
+                        return fig_animation_free(animation), NULL;
+                    }
+                    if(!fig_animation_render_images(animation)) {
+                        return fig_animation_free(animation), NULL;
+                    }
+                }
                 return animation;
             }
             default:
@@ -637,6 +669,9 @@ static fig_bool_t fig_gif_write_image_data_(fig_state *state, fig_output *output
     fig_uint8_t block[256];
     size_t pixel_index;
     size_t pixel_count;
+    size_t width;
+    size_t stride;
+    size_t column;
     size_t color_depth;
     size_t padded_palette_size;
     fig_uint8_t* pixels;
@@ -678,11 +713,20 @@ static fig_bool_t fig_gif_write_image_data_(fig_state *state, fig_output *output
         return 0;
     }
 
-    pixel_count = fig_image_get_indexed_width(image) * fig_image_get_indexed_height(image);
+    width = fig_image_get_indexed_width(image);
+    stride = fig_image_get_indexed_stride(image);
+    pixel_count = width * fig_image_get_indexed_height(image);
     pixels = fig_image_get_indexed_data(image);
+    column = 0;
 
     for(pixel_index = 0; pixel_index != pixel_count; ++pixel_index) {
-        fig_uint8_t pixel = pixels[pixel_index];
+        fig_uint8_t pixel = pixels[column];
+
+        /* Rows can be further apart than the width, when the image is a view. */
+        if(++column == width && pixel_index + 1 != pixel_count) {
+            column = 0;
+            pixels += stride;
+        }
         if(pixel >= padded_palette_size) {
             fig_state_set_error(state, "encountered indexed pixel with index outside of valid palette range");
             return 0;
@@ -731,8 +775,14 @@ static fig_bool_t fig_gif_write_image_data_(fig_state *state, fig_output *output
         }
     }
 
-    if(!fig_gif_block_write_bits_(state, output, block, &accumulator, &accumulator_length, old_code, code_size)
-    || !fig_gif_block_write_bits_(state, output, block, &accumulator, &accumulator_length, eoi_code, code_size)) {
+    if(!fig_gif_block_write_bits_(state, output, block, &accumulator, &accumulator_length, old_code, code_size)) {
+        return 0;
+    }
+    /* The decoder adds a code after reading the last one, so it may already expect a wider end code. */
+    if((code_count & code_mask) == 0 && code_count < FIG_GIF_LZW_MAX_CODES) {
+        ++code_size;
+    }
+    if(!fig_gif_block_write_bits_(state, output, block, &accumulator, &accumulator_length, eoi_code, code_size)) {
         return 0;
     }
 
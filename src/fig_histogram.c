@@ -0,0 +1,222 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fig.h>
+
+struct fig_histogram {
+    fig_state *state;
+    size_t pixel_count;
+    size_t transparent_count;
+    fig_color_count *colors;
+    size_t color_count;
+    size_t color_capacity;
+    /* An open addressing table of positions in colors plus one, or 0 for empty slots. */
+    size_t *slots;
+    size_t slot_count;
+    /* Whether colors are in the order returned by fig_histogram_get_colors. */
+    fig_bool_t sorted;
+};
+
+fig_histogram *fig_create_histogram(fig_state *state) {
+    if(state != NULL) {
+        fig_histogram *self = (fig_histogram *) fig_state_get_allocator(state)(fig_state_get_userdata(state), NULL, 0, sizeof(fig_histogram));
+        if(self != NULL) {
+            self->state = state;
+            self->pixel_count = 0;
+            self->transparent_count = 0;
+            self->colors = NULL;
+            self->color_count = 0;
+            self->color_capacity = 0;
+            self->slots = NULL;
+            self->slot_count = 0;
+            self->sorted = 1;
+        } else {
+            fig_state_set_error_allocation_failed(state);
+        }
+        return self;
+    }
+    return NULL;
+}
+
+static size_t fig_histogram_hash_(fig_uint32_t color) {
+    color ^= color >> 16;
+    color = (color * 0x45D9F3B) & 0xFFFFFFFF;
+    color ^= color >> 16;
+    return (size_t) color;
+}
+
+/* Fill the slots with the positions of every color. */
+static void fig_histogram_rehash_(fig_histogram *self) {
+    size_t mask = self->slot_count - 1;
+    size_t i;
+
+    memset(self->slots, 0, self->slot_count * sizeof(size_t));
+    for(i = 0; i < self->color_count; ++i) {
+        size_t slot = fig_histogram_hash_(self->colors[i].color) & mask;
+        while(self->slots[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        self->slots[slot] = i + 1;
+    }
+}
+
+/* Make room for count more colors, so that adding them can't fail. */
+static fig_bool_t fig_histogram_reserve_(fig_histogram *self, size_t count) {
+    fig_allocator_t alloc = fig_state_get_allocator(self->state);
+    void *ud = fig_state_get_userdata(self->state);
+    fig_color_count *colors;
+    size_t *slots;
+    size_t capacity;
+    size_t slot_count;
+
+    if(self->color_count + count <= self->color_capacity) {
+        return 1;
+    }
+    capacity = self->color_capacity != 0 ? self->color_capacity : 256;
+    while(capacity < self->color_count + count) {
+        capacity *= 2;
+    }
+    /* Keep the table at most half full. */
+    slot_count = capacity * 2;
+    if(slot_count > ~(size_t) 0 / sizeof(size_t) || capacity > ~(size_t) 0 / sizeof(fig_color_count)) {
+        fig_state_set_error(self->state, "histogram has too many colors");
+        return 0;
+    }
+
+    /* The slots are rebuilt from scratch, so a new table is allocated first,
+       and nothing changes unless both allocations succeed. */
+    slots = (size_t *) alloc(ud, NULL, 0, slot_count * sizeof(size_t));
+    if(slots == NULL) {
+        fig_state_set_error_allocation_failed(self->state);
+        return 0;
+    }
+    colors = (fig_color_count *) alloc(ud, self->colors, self->color_capacity * sizeof(fig_color_count), capacity * sizeof(fig_color_count));
+    if(colors == NULL) {
+        alloc(ud, slots, slot_count * sizeof(size_t), 0);
+        fig_state_set_error_allocation_failed(self->state);
+        return 0;
+    }
+    alloc(ud, self->slots, self->slot_count * sizeof(size_t), 0);
+    self->colors = colors;
+    self->color_capacity = capacity;
+    self->slots = slots;
+    self->slot_count = slot_count;
+    fig_histogram_rehash_(self);
+    return 1;
+}
+
+static void fig_histogram_add_color_(fig_histogram *self, fig_uint32_t color, size_t count) {
+    size_t mask = self->slot_count - 1;
+    size_t slot = fig_histogram_hash_(color) & mask;
+
+    while(self->slots[slot] != 0) {
+        fig_color_count *entry = &self->colors[self->slots[slot] - 1];
+        if(entry->color == color) {
+            entry->count += count;
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+    self->colors[self->color_count].color = color;
+    self->colors[self->color_count].count = count;
+    self->slots[slot] = ++self->color_count;
+}
+
+void fig_histogram_clear(fig_histogram *self) {
+    self->pixel_count = 0;
+    self->transparent_count = 0;
+    self->color_count = 0;
+    self->sorted = 1;
+    if(self->slots != NULL) {
+        memset(self->slots, 0, self->slot_count * sizeof(size_t));
+    }
+}
+
+fig_bool_t fig_histogram_add_image(fig_histogram *self, fig_animation *animation, fig_image *image) {
+    size_t counts[256];
+    fig_palette *palette;
+    fig_uint32_t *palette_colors;
+    size_t palette_size;
+    size_t transparency_index;
+    size_t i;
+
+    if(!fig_histogram_reserve_(self, 256)) {
+        return 0;
+    }
+
+    fig_image_count_indices(image, counts);
+    palette = fig_animation_get_render_palette(animation, image);
+    palette_colors = fig_palette_get_colors(palette);
+    palette_size = fig_palette_count_colors(palette);
+    transparency_index = fig_image_get_transparent(image) ? fig_image_get_transparency_index(image) : 256;
+
+    /* Indices past the end of the palette are drawn as transparent, like the transparency index. */
+    for(i = 0; i < 256; ++i) {
+        if(counts[i] == 0) {
+            continue;
+        }
+        self->pixel_count += counts[i];
+        if(i == transparency_index || i >= palette_size) {
+            self->transparent_count += counts[i];
+        } else {
+            fig_histogram_add_color_(self, palette_colors[i], counts[i]);
+            self->sorted = 0;
+        }
+    }
+    return 1;
+}
+
+fig_bool_t fig_histogram_add_animation(fig_histogram *self, fig_animation *animation) {
+    fig_image **images = fig_animation_get_images(animation);
+    size_t image_count = fig_animation_count_images(animation);
+    size_t i;
+
+    for(i = 0; i < image_count; ++i) {
+        if(!fig_histogram_add_image(self, animation, images[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+size_t fig_histogram_count_pixels(fig_histogram *self) {
+    return self->pixel_count;
+}
+
+size_t fig_histogram_count_transparent(fig_histogram *self) {
+    return self->transparent_count;
+}
+
+size_t fig_histogram_count_colors(fig_histogram *self) {
+    return self->color_count;
+}
+
+/* Order colors most common first, then by color value, so that the order doesn't depend on the order they were added. */
+static int fig_histogram_compare_colors_(const void *a, const void *b) {
+    const fig_color_count *color_a = (const fig_color_count *) a;
+    const fig_color_count *color_b = (const fig_color_count *) b;
+
+    if(color_a->count != color_b->count) {
+        return color_a->count > color_b->count ? -1 : 1;
+    }
+    return color_a->color < color_b->color ? -1 : color_a->color > color_b->color;
+}
+
+fig_color_count *fig_histogram_get_colors(fig_histogram *self) {
+    if(!self->sorted) {
+        qsort(self->colors, self->color_count, sizeof(fig_color_count), fig_histogram_compare_colors_);
+        fig_histogram_rehash_(self);
+        self->sorted = 1;
+    }
+    return self->colors;
+}
+
+void fig_histogram_free(fig_histogram *self) {
+    if(self != NULL) {
+        fig_allocator_t alloc = fig_state_get_allocator(self->state);
+        void *ud = fig_state_get_userdata(self->state);
+
+        alloc(ud, self->colors, self->color_capacity * sizeof(fig_color_count), 0);
+        alloc(ud, self->slots, self->slot_count * sizeof(size_t), 0);
+        alloc(ud, self, sizeof(fig_histogram), 0);
+    }
+}
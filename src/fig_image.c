@@ -1,3 +1,4 @@
+#include <string.h>
 #include <fig.h>
 
 struct fig_image {
@@ -6,6 +7,8 @@ struct fig_image {
     size_t indexed_y;
     size_t indexed_width;
     size_t indexed_height;
+    size_t render_x;
+    size_t render_y;
     size_t render_width;
     size_t render_height;
     size_t delay;
@@ -14,7 +17,22 @@ struct fig_image {
     fig_bool_t transparent;
     size_t transparency_index;
     fig_uint8_t *indexed_data;
-    fig_uint32_t *render_data;
+    /* The number of bytes between the start of each row of the indexed data. */
+    size_t indexed_stride;
+    /* Whether the indexed data is freed by the image, rather than attached by the user. */
+    fig_bool_t indexed_owned;
+    /* Either BGRA colors or palette indices, depending on the pixel size. */
+    void *render_data;
+    size_t render_pixel_size;
+    /* The number of bytes between the start of each row of the render data. */
+    size_t render_stride;
+    /* Whether the render data is freed by the image, rather than attached by the user. */
+    fig_bool_t render_owned;
+    fig_uint8_t perceptual_hash[8];
+    fig_bool_t has_perceptual_hash;
+    fig_uint8_t content_hash[8];
+    fig_uint8_t frame_hash[8];
+    fig_bool_t has_hashes;
 };
 
 static void fig_image_set_error_size_overflow_(fig_state *state) {
@@ -30,6 +48,8 @@ fig_image *fig_create_image(fig_state *state) {
             self->indexed_y = 0;
             self->indexed_width = 0;
             self->indexed_height = 0;
+            self->render_x = 0;
+            self->render_y = 0;
             self->render_width = 0;
             self->render_height = 0;
             self->delay = 0;
@@ -41,7 +61,14 @@ fig_image *fig_create_image(fig_state *state) {
             self->transparent = 0;
             self->transparency_index = 0;
             self->indexed_data = NULL;
+            self->indexed_stride = 0;
+            self->indexed_owned = 1;
             self->render_data = NULL;
+            self->render_pixel_size = 0;
+            self->render_stride = 0;
+            self->render_owned = 1;
+            self->has_perceptual_hash = 0;
+            self->has_hashes = 0;
         } else {
             fig_state_set_error_allocation_failed(state);
         }
@@ -74,6 +101,35 @@ fig_uint8_t *fig_image_get_indexed_data(fig_image *self) {
     return self->indexed_data;
 }
 
+size_t fig_image_get_indexed_stride(fig_image *self) {
+    return self->indexed_stride;
+}
+
+void fig_image_count_indices(fig_image *self, size_t *counts) {
+    size_t partial[4][256];
+    size_t i, x, y;
+
+    /* Counting into four tables in turn lets neighboring pixels with the same index
+     * increment different counters, instead of waiting on each other. */
+    memset(partial, 0, sizeof(partial));
+    for(y = 0; y < self->indexed_height; ++y) {
+        const fig_uint8_t *row = self->indexed_data + y * self->indexed_stride;
+
+        for(x = 0; x + 4 <= self->indexed_width; x += 4) {
+            ++partial[0][row[x]];
+            ++partial[1][row[x + 1]];
+            ++partial[2][row[x + 2]];
+            ++partial[3][row[x + 3]];
+        }
+        for(; x < self->indexed_width; ++x) {
+            ++partial[0][row[x]];
+        }
+    }
+    for(i = 0; i < 256; ++i) {
+        counts[i] = partial[0][i] + partial[1][i] + partial[2][i] + partial[3][i];
+    }
+}
+
 void fig_image_set_origin_x(fig_image *self, size_t value) {
     self->indexed_x = value;
 }
@@ -86,11 +142,28 @@ fig_bool_t fig_image_resize_indexed(fig_image *self, size_t width, size_t height
     if(height == 0 || width <= ~(size_t) 0 / height) {
         size_t old_size = self->indexed_width * self->indexed_height;
         size_t new_size = width * height;    
+
+        /* Storage attached by the user isn't ours to resize or free. */
+        if(!self->indexed_owned) {
+            if(self->indexed_data != NULL
+            && self->indexed_width == width
+            && self->indexed_height == height) {
+                return 1;
+            }
+            self->indexed_data = NULL;
+            self->indexed_width = 0;
+            self->indexed_height = 0;
+            self->indexed_stride = 0;
+            self->indexed_owned = 1;
+            old_size = 0;
+        }
+
         if(new_size == 0) {
             fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state), self->indexed_data, old_size, 0);
             self->indexed_data = NULL;
             self->indexed_width = 0;
             self->indexed_height = 0;
+            self->indexed_stride = 0;
             return 1;
         } else {
             fig_uint8_t *index_data;
@@ -102,6 +175,7 @@ fig_bool_t fig_image_resize_indexed(fig_image *self, size_t width, size_t height
             } else {
                 self->indexed_width = width;
                 self->indexed_height = height;
+                self->indexed_stride = width;
                 self->indexed_data = index_data;
                 return 1;
             }
@@ -112,6 +186,48 @@ fig_bool_t fig_image_resize_indexed(fig_image *self, size_t width, size_t height
     }
 }
 
+fig_bool_t fig_image_attach_indexed(fig_image *self, fig_uint8_t *data, size_t width, size_t height, fig_bool_t owned) {
+    if(height != 0 && width > ~(size_t) 0 / height) {
+        fig_image_set_error_size_overflow_(self->state);
+        return 0;
+    }
+    if(width == 0 || height == 0 || data == NULL) {
+        return fig_image_resize_indexed(self, 0, 0);
+    }
+
+    if(self->indexed_owned) {
+        fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
+            self->indexed_data, self->indexed_width * self->indexed_height, 0);
+    }
+    self->indexed_data = data;
+    self->indexed_width = width;
+    self->indexed_height = height;
+    self->indexed_stride = width;
+    self->indexed_owned = owned;
+    return 1;
+}
+
+fig_bool_t fig_image_attach_indexed_view(fig_image *self, fig_uint8_t *parent, size_t parent_stride, const fig_rect *rect) {
+    if(rect->x > parent_stride || rect->width > parent_stride - rect->x) {
+        fig_state_set_error(self->state, "indexed view is wider than the stride of its parent");
+        return 0;
+    }
+    if(rect->width == 0 || rect->height == 0 || parent == NULL) {
+        return fig_image_resize_indexed(self, 0, 0);
+    }
+
+    if(self->indexed_owned) {
+        fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
+            self->indexed_data, self->indexed_width * self->indexed_height, 0);
+    }
+    self->indexed_data = parent + rect->y * parent_stride + rect->x;
+    self->indexed_width = rect->width;
+    self->indexed_height = rect->height;
+    self->indexed_stride = parent_stride;
+    self->indexed_owned = 0;
+    return 1;
+}
+
 size_t fig_image_get_render_width(fig_image *self) {
     return self->render_width;
 }
@@ -120,24 +236,83 @@ size_t fig_image_get_render_height(fig_image *self) {
     return self->render_height;
 }
 
+size_t fig_image_get_render_origin_x(fig_image *self) {
+    return self->render_x;
+}
+
+size_t fig_image_get_render_origin_y(fig_image *self) {
+    return self->render_y;
+}
+
 fig_uint32_t *fig_image_get_render_data(fig_image *self) {
-    return self->render_data;
+    return self->render_pixel_size == sizeof(fig_uint32_t) ? (fig_uint32_t *) self->render_data : NULL;
 }
 
-fig_bool_t fig_image_resize_render(fig_image *self, size_t width, size_t height) {
-    if(height == 0 || width <= ~(size_t) 0 / height) {
-        size_t old_size = self->render_width * self->render_height;
-        size_t new_size = width * height;
+fig_uint8_t *fig_image_get_render_index_data(fig_image *self) {
+    return self->render_pixel_size == sizeof(fig_uint8_t) ? (fig_uint8_t *) self->render_data : NULL;
+}
+
+size_t fig_image_get_render_stride(fig_image *self) {
+    return self->render_stride;
+}
+
+void fig_image_set_render_origin_x(fig_image *self, size_t value) {
+    self->render_x = value;
+}
+
+void fig_image_set_render_origin_y(fig_image *self, size_t value) {
+    self->render_y = value;
+}
+
+static fig_bool_t fig_image_resize_render_surface_(fig_image *self, size_t width, size_t height, size_t pixel_size) {
+    if(height == 0 || width <= ~(size_t) 0 / pixel_size / height) {
+        fig_allocator_t alloc = fig_state_get_allocator(self->state);
+        void *ud = fig_state_get_userdata(self->state);
+        size_t old_size = self->render_stride * self->render_height;
+        size_t new_size = pixel_size * width * height;
+
+        /* Keep the current surface if it already has the requested layout,
+         * so that storage attached by the user keeps being rendered into. */
+        if(self->render_data != NULL
+        && self->render_pixel_size == pixel_size
+        && self->render_width == width
+        && self->render_height == height) {
+            return 1;
+        }
+        /* Storage attached by the user isn't ours to resize or free. */
+        if(!self->render_owned) {
+            self->render_data = NULL;
+            self->render_pixel_size = 0;
+            self->render_stride = 0;
+            self->render_width = 0;
+            self->render_height = 0;
+            self->render_owned = 1;
+            old_size = 0;
+        }
+        /* A surface of a different pixel format can't be reused. */
+        if(self->render_pixel_size != pixel_size && self->render_data != NULL) {
+            alloc(ud, self->render_data, old_size, 0);
+            self->render_data = NULL;
+            self->render_pixel_size = 0;
+            self->render_stride = 0;
+            self->render_width = 0;
+            self->render_height = 0;
+            old_size = 0;
+        }
+
         if(new_size == 0) {
-            fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state), self->render_data, sizeof(fig_uint32_t) * old_size, 0);
+            alloc(ud, self->render_data, old_size, 0);
             self->render_data = NULL;
+            self->render_pixel_size = 0;
+            self->render_stride = 0;
+            self->render_x = 0;
+            self->render_y = 0;
             self->render_width = 0;
             self->render_height = 0;
             return 1;
         } else {
-            fig_uint32_t *render_data;
-            render_data = (fig_uint32_t *) fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
-                self->render_data, sizeof(fig_uint32_t) * old_size, sizeof(fig_uint32_t) * new_size);
+            void *render_data;
+            render_data = alloc(ud, self->render_data, old_size, new_size);
             if(render_data == NULL) {
                 fig_state_set_error_allocation_failed(self->state);
                 return 0;
@@ -145,6 +320,8 @@ fig_bool_t fig_image_resize_render(fig_image *self, size_t width, size_t height)
                 self->render_width = width;
                 self->render_height = height;
                 self->render_data = render_data;
+                self->render_pixel_size = pixel_size;
+                self->render_stride = pixel_size * width;
                 return 1;
             }
         }
@@ -154,6 +331,48 @@ fig_bool_t fig_image_resize_render(fig_image *self, size_t width, size_t height)
     }
 }
 
+fig_bool_t fig_image_resize_render(fig_image *self, size_t width, size_t height) {
+    return fig_image_resize_render_surface_(self, width, height, sizeof(fig_uint32_t));
+}
+
+fig_bool_t fig_image_resize_render_index(fig_image *self, size_t width, size_t height) {
+    return fig_image_resize_render_surface_(self, width, height, sizeof(fig_uint8_t));
+}
+
+static fig_bool_t fig_image_attach_render_surface_(fig_image *self, void *data, size_t width, size_t height, size_t stride, fig_bool_t owned, size_t pixel_size) {
+    if(stride % pixel_size != 0 || stride / pixel_size < width) {
+        fig_state_set_error(self->state, "render stride is too small for the width");
+        return 0;
+    }
+    if(height != 0 && stride > ~(size_t) 0 / height) {
+        fig_image_set_error_size_overflow_(self->state);
+        return 0;
+    }
+    if(width == 0 || height == 0 || data == NULL) {
+        return fig_image_resize_render_surface_(self, 0, 0, pixel_size);
+    }
+
+    if(self->render_owned) {
+        fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state),
+            self->render_data, self->render_stride * self->render_height, 0);
+    }
+    self->render_data = data;
+    self->render_pixel_size = pixel_size;
+    self->render_stride = stride;
+    self->render_width = width;
+    self->render_height = height;
+    self->render_owned = owned;
+    return 1;
+}
+
+fig_bool_t fig_image_attach_render(fig_image *self, fig_uint32_t *data, size_t width, size_t height, size_t stride, fig_bool_t owned) {
+    return fig_image_attach_render_surface_(self, data, width, height, stride, owned, sizeof(fig_uint32_t));
+}
+
+fig_bool_t fig_image_attach_render_index(fig_image *self, fig_uint8_t *data, size_t width, size_t height, size_t stride, fig_bool_t owned) {
+    return fig_image_attach_render_surface_(self, data, width, height, stride, owned, sizeof(fig_uint8_t));
+}
+
 size_t fig_image_get_delay(fig_image *self) {
     return self->delay;
 }
@@ -186,6 +405,41 @@ void fig_image_set_transparency_index(fig_image *self, size_t value) {
     self->transparency_index = value;
 }
 
+const fig_uint8_t *fig_image_get_perceptual_hash(fig_image *self) {
+    return self->has_perceptual_hash ? self->perceptual_hash : NULL;
+}
+
+const fig_uint8_t *fig_image_get_content_hash(fig_image *self) {
+    return self->has_hashes ? self->content_hash : NULL;
+}
+
+const fig_uint8_t *fig_image_get_frame_hash(fig_image *self) {
+    return self->has_hashes ? self->frame_hash : NULL;
+}
+
+void fig_image_set_hashes(fig_image *self, const fig_uint8_t *content_hash, const fig_uint8_t *frame_hash) {
+    size_t i;
+
+    self->has_hashes = content_hash != NULL && frame_hash != NULL;
+    if(self->has_hashes) {
+        for(i = 0; i < sizeof(self->content_hash); ++i) {
+            self->content_hash[i] = content_hash[i];
+            self->frame_hash[i] = frame_hash[i];
+        }
+    }
+}
+
+void fig_image_set_perceptual_hash(fig_image *self, const fig_uint8_t *hash) {
+    size_t i;
+
+    self->has_perceptual_hash = hash != NULL;
+    if(hash != NULL) {
+        for(i = 0; i < sizeof(self->perceptual_hash); ++i) {
+            self->perceptual_hash[i] = hash[i];
+        }
+    }
+}
+
 void fig_image_free(fig_image *self) {
     if(self != NULL) {
         fig_allocator_t alloc = fig_state_get_allocator(self->state);
@@ -195,8 +449,12 @@ void fig_image_free(fig_image *self) {
             fig_palette_free(self->palette);
         }
    
-        alloc(ud, self->indexed_data, self->indexed_width * self->indexed_height, 0);
-        alloc(ud, self->render_data, sizeof(fig_uint32_t) * self->render_width * self->render_height, 0);
+        if(self->indexed_owned) {
+            alloc(ud, self->indexed_data, self->indexed_width * self->indexed_height, 0);
+        }
+        if(self->render_owned) {
+            alloc(ud, self->render_data, self->render_stride * self->render_height, 0);
+        }
         alloc(ud, self, sizeof(fig_image), 0);
     }
 }
@@ -0,0 +1,377 @@
+#include <math.h>
+#include <fig.h>
+
+enum {
+    /* Filter weights are fixed point numbers with this many bits after the point. */
+    FIG_RESAMPLE_WEIGHT_BITS = 14,
+    /* The rows between the two passes keep this many bits after the point. */
+    FIG_RESAMPLE_ROW_BITS = 7
+};
+
+/* The source pixels and weights that make up each destination pixel along one axis. */
+typedef struct {
+    size_t dest_size;
+    /* The largest number of source pixels used by a destination pixel. */
+    size_t taps;
+    /* The first source pixel used by each destination pixel. */
+    size_t *starts;
+    /* The number of source pixels used by each destination pixel. */
+    size_t *counts;
+    /* taps weights per destination pixel, which add up to 1 << FIG_RESAMPLE_WEIGHT_BITS. */
+    int *weights;
+} fig_resample_axis_;
+
+struct fig_resampler {
+    fig_state *state;
+    size_t src_width;
+    size_t src_height;
+    fig_resample_axis_ horizontal;
+    fig_resample_axis_ vertical;
+};
+
+static double fig_filter_sinc_(double x) {
+    if(x == 0.0) {
+        return 1.0;
+    }
+    x *= 3.14159265358979323846;
+    return sin(x) / x;
+}
+
+static double fig_filter_support_(fig_filter_t filter) {
+    switch(filter) {
+        case FIG_FILTER_BOX: return 0.5;
+        case FIG_FILTER_BILINEAR: return 1.0;
+        default: return 3.0;
+    }
+}
+
+static double fig_filter_evaluate_(fig_filter_t filter, double x) {
+    if(x < 0.0) {
+        x = -x;
+    }
+    switch(filter) {
+        case FIG_FILTER_BOX: return x <= 0.5 ? 1.0 : 0.0;
+        case FIG_FILTER_BILINEAR: return x < 1.0 ? 1.0 - x : 0.0;
+        default: return x < 3.0 ? fig_filter_sinc_(x) * fig_filter_sinc_(x / 3.0) : 0.0;
+    }
+}
+
+static void fig_resample_axis_free_(fig_state *state, fig_resample_axis_ *axis) {
+    fig_allocator_t alloc = fig_state_get_allocator(state);
+    void *ud = fig_state_get_userdata(state);
+
+    alloc(ud, axis->starts, axis->dest_size * sizeof(size_t), 0);
+    alloc(ud, axis->counts, axis->dest_size * sizeof(size_t), 0);
+    alloc(ud, axis->weights, axis->dest_size * axis->taps * sizeof(int), 0);
+    axis->starts = NULL;
+    axis->counts = NULL;
+    axis->weights = NULL;
+}
+
+/* Precompute the weights for resampling src_size pixels into dest_size pixels.
+ * Shrinking widens the filter by the scale, so every source pixel contributes. */
+static fig_bool_t fig_resample_axis_init_(fig_state *state, fig_resample_axis_ *axis, size_t src_size, size_t dest_size, fig_filter_t filter) {
+    fig_allocator_t alloc = fig_state_get_allocator(state);
+    void *ud = fig_state_get_userdata(state);
+    double scale = (double) src_size / (double) dest_size;
+    double filter_scale = scale > 1.0 ? scale : 1.0;
+    double support = fig_filter_support_(filter) * filter_scale;
+    size_t i, j;
+
+    axis->dest_size = dest_size;
+    axis->taps = (size_t) ceil(support) * 2 + 1;
+    if(axis->taps > src_size) {
+        axis->taps = src_size;
+    }
+    axis->starts = NULL;
+    axis->counts = NULL;
+    axis->weights = NULL;
+    if(dest_size > ~(size_t) 0 / sizeof(size_t) / axis->taps) {
+        fig_state_set_error(state, "image dimensions requested are too large");
+        return 0;
+    }
+    axis->starts = (size_t *) alloc(ud, NULL, 0, dest_size * sizeof(size_t));
+    axis->counts = (size_t *) alloc(ud, NULL, 0, dest_size * sizeof(size_t));
+    axis->weights = (int *) alloc(ud, NULL, 0, dest_size * axis->taps * sizeof(int));
+    if(axis->starts == NULL || axis->counts == NULL || axis->weights == NULL) {
+        fig_resample_axis_free_(state, axis);
+        fig_state_set_error_allocation_failed(state);
+        return 0;
+    }
+
+    for(i = 0; i < dest_size; ++i) {
+        double center = ((double) i + 0.5) * scale;
+        double low = floor(center - support + 0.5);
+        double high = floor(center + support + 0.5);
+        double factors[64];
+        double total;
+        int *weights = axis->weights + i * axis->taps;
+        size_t start = low > 0.0 ? (size_t) low : 0;
+        size_t end = high < (double) src_size ? (size_t) high : src_size;
+        size_t largest;
+        long sum;
+
+        if(end > start + axis->taps) {
+            end = start + axis->taps;
+        }
+        if(end <= start) {
+            /* Upscaling can leave the filter between two pixels at the edges. */
+            start = center < (double) src_size ? (size_t) center : src_size - 1;
+            end = start + 1;
+        }
+
+        /* Most filters fit on the stack, and the values are only needed until they're quantized. */
+        total = 0.0;
+        for(j = start; j < end; ++j) {
+            double value = fig_filter_evaluate_(filter, ((double) j + 0.5 - center) / filter_scale);
+            if(j - start < sizeof(factors) / sizeof(factors[0])) {
+                factors[j - start] = value;
+            }
+            total += value;
+        }
+        if(total == 0.0) {
+            total = 1.0;
+        }
+
+        sum = 0;
+        largest = 0;
+        for(j = start; j < end; ++j) {
+            double value = j - start < sizeof(factors) / sizeof(factors[0])
+                ? factors[j - start]
+                : fig_filter_evaluate_(filter, ((double) j + 0.5 - center) / filter_scale);
+            weights[j - start] = (int) floor(value / total * (1 << FIG_RESAMPLE_WEIGHT_BITS) + 0.5);
+            sum += weights[j - start];
+            if(weights[j - start] > weights[largest]) {
+                largest = j - start;
+            }
+        }
+        for(j = end - start; j < axis->taps; ++j) {
+            weights[j] = 0;
+        }
+        /* Rounding can leave the weights slightly off, so the largest weight takes up the difference. */
+        weights[largest] += (int) ((1L << FIG_RESAMPLE_WEIGHT_BITS) - sum);
+
+        axis->starts[i] = start;
+        axis->counts[i] = end - start;
+    }
+    return 1;
+}
+
+fig_resampler *fig_create_resampler(fig_state *state, size_t src_width, size_t src_height, size_t dest_width, size_t dest_height, fig_filter_t filter) {
+    if(state != NULL) {
+        fig_resampler *self;
+
+        FIG_ASSERT(filter < FIG_FILTER_COUNT);
+        if(src_width == 0 || src_height == 0 || dest_width == 0 || dest_height == 0) {
+            fig_state_set_error(state, "image is empty");
+            return NULL;
+        }
+
+        self = (fig_resampler *) fig_state_get_allocator(state)(fig_state_get_userdata(state), NULL, 0, sizeof(fig_resampler));
+        if(self == NULL) {
+            fig_state_set_error_allocation_failed(state);
+            return NULL;
+        }
+        self->state = state;
+        self->src_width = src_width;
+        self->src_height = src_height;
+        if(!fig_resample_axis_init_(state, &self->horizontal, src_width, dest_width, filter)) {
+            fig_state_get_allocator(state)(fig_state_get_userdata(state), self, sizeof(fig_resampler), 0);
+            return NULL;
+        }
+        if(!fig_resample_axis_init_(state, &self->vertical, src_height, dest_height, filter)) {
+            fig_resample_axis_free_(state, &self->horizontal);
+            fig_state_get_allocator(state)(fig_state_get_userdata(state), self, sizeof(fig_resampler), 0);
+            return NULL;
+        }
+        return self;
+    }
+    return NULL;
+}
+
+size_t fig_resampler_get_src_width(fig_resampler *self) {
+    return self->src_width;
+}
+
+size_t fig_resampler_get_src_height(fig_resampler *self) {
+    return self->src_height;
+}
+
+size_t fig_resampler_get_dest_width(fig_resampler *self) {
+    return self->horizontal.dest_size;
+}
+
+size_t fig_resampler_get_dest_height(fig_resampler *self) {
+    return self->vertical.dest_size;
+}
+
+/* Filter the source rows used by a destination row into a row of premultiplied channels,
+ * with FIG_RESAMPLE_ROW_BITS bits after the point. */
+static void fig_resample_column_(fig_resampler *self, const fig_uint8_t *src, size_t src_stride, size_t y, long *row) {
+    const int *weights = self->vertical.weights + y * self->vertical.taps;
+    size_t start = self->vertical.starts[y];
+    size_t count = self->vertical.counts[y];
+    size_t width = self->src_width;
+    size_t i, k;
+
+    for(i = 0; i < width * 4; ++i) {
+        row[i] = 0;
+    }
+    for(k = 0; k < count; ++k) {
+        const fig_uint32_t *pixels = (const fig_uint32_t *) (src + (start + k) * src_stride);
+        long weight = weights[k];
+
+        if(weight == 0) {
+            continue;
+        }
+        for(i = 0; i < width; ++i) {
+            fig_uint32_t color = pixels[i];
+            long a = (long) (color >> 24);
+            long r = (long) ((color >> 16) & 0xFF);
+            long g = (long) ((color >> 8) & 0xFF);
+            long b = (long) (color & 0xFF);
+
+            /* Filtering premultiplied colors keeps transparent pixels from darkening their neighbors. */
+            if(a != 255) {
+                r = (r * a + 127) / 255;
+                g = (g * a + 127) / 255;
+                b = (b * a + 127) / 255;
+            }
+            row[i * 4] += b * weight;
+            row[i * 4 + 1] += g * weight;
+            row[i * 4 + 2] += r * weight;
+            row[i * 4 + 3] += a * weight;
+        }
+    }
+    /* Overshoot from negative lobes is clamped here, so the second pass never sees negative values. */
+    for(i = 0; i < width * 4; ++i) {
+        long value = row[i];
+        if(value <= 0) {
+            row[i] = 0;
+        } else {
+            value = (value + (1L << (FIG_RESAMPLE_WEIGHT_BITS - FIG_RESAMPLE_ROW_BITS - 1))) >> (FIG_RESAMPLE_WEIGHT_BITS - FIG_RESAMPLE_ROW_BITS);
+            row[i] = value < (255L << FIG_RESAMPLE_ROW_BITS) ? value : (255L << FIG_RESAMPLE_ROW_BITS);
+        }
+    }
+}
+
+static long fig_resample_channel_(long value) {
+    if(value <= 0) {
+        return 0;
+    }
+    value = (value + (1L << (FIG_RESAMPLE_WEIGHT_BITS + FIG_RESAMPLE_ROW_BITS - 1))) >> (FIG_RESAMPLE_WEIGHT_BITS + FIG_RESAMPLE_ROW_BITS);
+    return value < 255 ? value : 255;
+}
+
+/* Filter a row of premultiplied channels into a destination row of BGRA colors. */
+static void fig_resample_row_(fig_resampler *self, const long *row, fig_uint32_t *dest) {
+    const fig_resample_axis_ *axis = &self->horizontal;
+    size_t x, k;
+
+    for(x = 0; x < axis->dest_size; ++x) {
+        const int *weights = axis->weights + x * axis->taps;
+        const long *channels = row + axis->starts[x] * 4;
+        size_t count = axis->counts[x];
+        long b = 0, g = 0, r = 0, a = 0;
+
+        for(k = 0; k < count; ++k) {
+            long weight = weights[k];
+            b += channels[k * 4] * weight;
+            g += channels[k * 4 + 1] * weight;
+            r += channels[k * 4 + 2] * weight;
+            a += channels[k * 4 + 3] * weight;
+        }
+        a = fig_resample_channel_(a);
+        b = fig_resample_channel_(b);
+        g = fig_resample_channel_(g);
+        r = fig_resample_channel_(r);
+        if(a == 0) {
+            dest[x] = 0;
+            continue;
+        }
+        if(a != 255) {
+            b = b < a ? (b * 255 + a / 2) / a : 255;
+            g = g < a ? (g * 255 + a / 2) / a : 255;
+            r = r < a ? (r * 255 + a / 2) / a : 255;
+        }
+        dest[x] = ((fig_uint32_t) a << 24) | ((fig_uint32_t) r << 16) | ((fig_uint32_t) g << 8) | (fig_uint32_t) b;
+    }
+}
+
+fig_bool_t fig_resampler_resample_rows(fig_resampler *self, const fig_uint32_t *src, size_t src_stride, fig_uint32_t *dest, size_t dest_stride, size_t start, size_t end) {
+    fig_allocator_t alloc = fig_state_get_allocator(self->state);
+    void *ud = fig_state_get_userdata(self->state);
+    size_t row_size;
+    long *row;
+    size_t y;
+
+    FIG_ASSERT(start <= end && end <= self->vertical.dest_size);
+    if(self->src_width > ~(size_t) 0 / (4 * sizeof(long))) {
+        fig_state_set_error(self->state, "image dimensions requested are too large");
+        return 0;
+    }
+    row_size = self->src_width * 4 * sizeof(long);
+    row = (long *) alloc(ud, NULL, 0, row_size);
+    if(row == NULL) {
+        fig_state_set_error_allocation_failed(self->state);
+        return 0;
+    }
+    for(y = start; y < end; ++y) {
+        fig_resample_column_(self, (const fig_uint8_t *) src, src_stride, y, row);
+        fig_resample_row_(self, row, (fig_uint32_t *) ((fig_uint8_t *) dest + y * dest_stride));
+    }
+    alloc(ud, row, row_size, 0);
+    return 1;
+}
+
+fig_bool_t fig_resampler_resample(fig_resampler *self, const fig_uint32_t *src, size_t src_stride, fig_uint32_t *dest, size_t dest_stride) {
+    return fig_resampler_resample_rows(self, src, src_stride, dest, dest_stride, 0, self->vertical.dest_size);
+}
+
+fig_bool_t fig_animation_resample_frame(fig_animation *self, size_t index, fig_resampler *resampler, fig_uint32_t *out, size_t out_stride) {
+    fig_state *state = resampler->state;
+    fig_image *image;
+    size_t width = fig_animation_get_width(self);
+    size_t height = fig_animation_get_height(self);
+    fig_uint32_t *canvas;
+    fig_bool_t result;
+
+    if(index >= fig_animation_count_images(self)) {
+        fig_state_set_error(state, "image index is out of range");
+        return 0;
+    }
+    if(resampler->src_width != width || resampler->src_height != height) {
+        fig_state_set_error(state, "resampler source size doesn't match the canvas");
+        return 0;
+    }
+
+    /* A render surface covering the canvas is the frame itself, so it's read in place. */
+    image = fig_animation_get_images(self)[index];
+    if(fig_image_get_render_data(image) != NULL
+    && fig_image_get_render_width(image) == width
+    && fig_image_get_render_height(image) == height) {
+        return fig_resampler_resample(resampler, fig_image_get_render_data(image), fig_image_get_render_stride(image), out, out_stride);
+    }
+
+    if(height > ~(size_t) 0 / sizeof(fig_uint32_t) / width) {
+        fig_state_set_error(state, "image dimensions requested are too large");
+        return 0;
+    }
+    canvas = (fig_uint32_t *) fig_state_get_allocator(state)(fig_state_get_userdata(state), NULL, 0, width * height * sizeof(fig_uint32_t));
+    if(canvas == NULL) {
+        fig_state_set_error_allocation_failed(state);
+        return 0;
+    }
+    result = fig_animation_get_frame_rgba(self, index, canvas)
+        && fig_resampler_resample(resampler, canvas, width * sizeof(fig_uint32_t), out, out_stride);
+    fig_state_get_allocator(state)(fig_state_get_userdata(state), canvas, width * height * sizeof(fig_uint32_t), 0);
+    return result;
+}
+
+void fig_resampler_free(fig_resampler *self) {
+    if(self != NULL) {
+        fig_resample_axis_free_(self->state, &self->horizontal);
+        fig_resample_axis_free_(self->state, &self->vertical);
+        fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state), self, sizeof(fig_resampler), 0);
+    }
+}
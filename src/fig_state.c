@@ -5,6 +5,8 @@ struct fig_state {
     const char *error;
     fig_allocator_t alloc;
     void *ud;
+    fig_allocator_t storage_alloc;
+    void *storage_ud;
 };
 
 static void *fig_default_alloc_(void *ud, void *ptr, size_t old_size, size_t new_size) {
@@ -33,6 +35,8 @@ fig_state *fig_create_custom_state(fig_allocator_t alloc, void *ud) {
         self->error = NULL;
         self->alloc = alloc;
         self->ud = ud;
+        self->storage_alloc = alloc;
+        self->storage_ud = ud;
     }
     return self;
 }
@@ -57,6 +61,19 @@ void *fig_state_get_userdata(fig_state *self) {
     return self->ud;
 }
 
+void fig_state_set_storage_allocator(fig_state *self, fig_allocator_t alloc, void *ud) {
+    self->storage_alloc = alloc;
+    self->storage_ud = ud;
+}
+
+fig_allocator_t fig_state_get_storage_allocator(fig_state *self) {
+    return self->storage_alloc;
+}
+
+void *fig_state_get_storage_userdata(fig_state *self) {
+    return self->storage_ud;
+}
+
 void fig_state_free(fig_state *self) {
     if(self != NULL) {
         self->alloc(self->ud, self, sizeof(fig_state), 0);
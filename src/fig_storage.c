@@ -0,0 +1,101 @@
+#if defined(FIG_MAPPED_STORAGE) && !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+/* ftruncate and fileno are POSIX, so they aren't declared in strict ANSI C without this. */
+#define _POSIX_C_SOURCE 200112L
+#endif
+#ifdef FIG_MAPPED_STORAGE
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#endif
+#include <string.h>
+#include <fig.h>
+
+#ifdef FIG_MAPPED_STORAGE
+
+#ifdef _WIN32
+static void *fig_map_temporary_file_(size_t size) {
+    char directory[MAX_PATH];
+    char filename[MAX_PATH];
+    HANDLE file;
+    HANDLE mapping;
+    void *data;
+
+    if(GetTempPathA(MAX_PATH, directory) == 0
+    || GetTempFileNameA(directory, "fig", 0, filename) == 0) {
+        return NULL;
+    }
+    file = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if(file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE,
+        (DWORD) ((unsigned __int64) size >> 32), (DWORD) size, NULL);
+    /* The view keeps the file alive until it's unmapped, and then it's deleted. */
+    CloseHandle(file);
+    if(mapping == NULL) {
+        return NULL;
+    }
+    data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    CloseHandle(mapping);
+    return data;
+}
+
+static void fig_unmap_temporary_file_(void *data, size_t size) {
+    (void) size;
+    UnmapViewOfFile(data);
+}
+#else
+static void *fig_map_temporary_file_(size_t size) {
+    FILE *file;
+    void *data;
+
+    file = tmpfile();
+    if(file == NULL) {
+        return NULL;
+    }
+    if(ftruncate(fileno(file), (off_t) size) != 0) {
+        fclose(file);
+        return NULL;
+    }
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(file), 0);
+    /* The mapping keeps the file alive until it's unmapped, and then it's deleted. */
+    fclose(file);
+    return data != MAP_FAILED ? data : NULL;
+}
+
+static void fig_unmap_temporary_file_(void *data, size_t size) {
+    munmap(data, size);
+}
+#endif
+
+void *fig_mapped_storage_alloc(void *ud, void *ptr, size_t old_size, size_t new_size) {
+    void *data;
+    (void) ud;
+
+    if((ptr != NULL && old_size == 0)
+    || (ptr == NULL && old_size != 0)) {
+        return NULL;
+    }
+
+    data = NULL;
+    if(new_size != 0) {
+        data = fig_map_temporary_file_(new_size);
+        if(data == NULL) {
+            return NULL;
+        }
+        if(ptr != NULL) {
+            memcpy(data, ptr, old_size < new_size ? old_size : new_size);
+        }
+    }
+    if(ptr != NULL) {
+        fig_unmap_temporary_file_(ptr, old_size);
+    }
+    return data;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,287 @@
+#include <string.h>
+#include <fig.h>
+
+/* The tensor value of each channel for every possible byte of that channel. */
+typedef struct {
+    size_t channels;
+    fig_bool_t is_float;
+    float floats[4][256];
+    fig_uint8_t bytes[4][256];
+} fig_tensor_lut_;
+
+/* Where the channels are in a BGRA color, in tensor channel order. */
+static const unsigned fig_tensor_channel_shifts_[4] = { 16, 8, 0, 24 };
+
+static void fig_tensor_lut_init_(fig_tensor_lut_ *lut, const fig_tensor_options *options) {
+    size_t c, i;
+
+    lut->channels = options->channels;
+    lut->is_float = options->type == FIG_TENSOR_TYPE_FLOAT32;
+    for(c = 0; c < lut->channels; ++c) {
+        for(i = 0; i < 256; ++i) {
+            lut->floats[c][i] = ((float) i / 255.0f - options->mean[c]) / options->std[c];
+            lut->bytes[c][i] = (fig_uint8_t) i;
+        }
+    }
+}
+
+/* Fold a palette into a lookup table, so that each channel of a palette index is a single lookup.
+ * The background index is transparent. */
+static void fig_tensor_lut_fold_palette_(const fig_tensor_lut_ *lut, fig_palette *palette, size_t background_index, fig_tensor_lut_ *dest) {
+    fig_uint32_t *colors = fig_palette_get_colors(palette);
+    size_t color_count = fig_palette_count_colors(palette);
+    size_t c, i;
+
+    dest->channels = lut->channels;
+    dest->is_float = lut->is_float;
+    for(i = 0; i < 256; ++i) {
+        fig_uint32_t color = i < color_count && i != background_index ? colors[i] : 0;
+
+        for(c = 0; c < lut->channels; ++c) {
+            size_t value = (color >> fig_tensor_channel_shifts_[c]) & 0xFF;
+            dest->floats[c][i] = lut->floats[c][value];
+            dest->bytes[c][i] = lut->bytes[c][value];
+        }
+    }
+}
+
+/* Write a row of palette indices into the tensor. Each channel is written as its own pass,
+ * so that the planes of a NCHW tensor are written sequentially. The steps are in elements. */
+static void fig_tensor_write_index_row_(const fig_tensor_lut_ *lut, const fig_uint8_t *src, size_t width, void *dest, size_t pixel_step, size_t channel_step) {
+    size_t c, x;
+
+    for(c = 0; c < lut->channels; ++c) {
+        if(lut->is_float) {
+            const float *values = lut->floats[c];
+            float *out = (float *) dest + c * channel_step;
+
+            for(x = 0; x < width; ++x) {
+                out[x * pixel_step] = values[src[x]];
+            }
+        } else {
+            const fig_uint8_t *values = lut->bytes[c];
+            fig_uint8_t *out = (fig_uint8_t *) dest + c * channel_step;
+
+            for(x = 0; x < width; ++x) {
+                out[x * pixel_step] = values[src[x]];
+            }
+        }
+    }
+}
+
+/* Write a row of BGRA colors into the tensor, like fig_tensor_write_index_row_. */
+static void fig_tensor_write_color_row_(const fig_tensor_lut_ *lut, const fig_uint32_t *src, size_t width, void *dest, size_t pixel_step, size_t channel_step) {
+    size_t c, x;
+
+    for(c = 0; c < lut->channels; ++c) {
+        unsigned shift = fig_tensor_channel_shifts_[c];
+
+        if(lut->is_float) {
+            const float *values = lut->floats[c];
+            float *out = (float *) dest + c * channel_step;
+
+            for(x = 0; x < width; ++x) {
+                out[x * pixel_step] = values[(src[x] >> shift) & 0xFF];
+            }
+        } else {
+            fig_uint8_t *out = (fig_uint8_t *) dest + c * channel_step;
+
+            for(x = 0; x < width; ++x) {
+                out[x * pixel_step] = (fig_uint8_t) ((src[x] >> shift) & 0xFF);
+            }
+        }
+    }
+}
+
+/* Get the tensor dimensions for an animation. */
+static void fig_tensor_get_dimensions_(fig_animation *animation, const fig_tensor_options *options, size_t *width, size_t *height) {
+    *width = options->width != 0 ? options->width : fig_animation_get_width(animation);
+    *height = options->height != 0 ? options->height : fig_animation_get_height(animation);
+}
+
+size_t fig_get_tensor_size(fig_animation *animation, size_t count, const fig_tensor_options *options) {
+    size_t element_size = options->type == FIG_TENSOR_TYPE_FLOAT32 ? sizeof(float) : sizeof(fig_uint8_t);
+    size_t width, height;
+
+    if(options->channels != 3 && options->channels != 4) {
+        return 0;
+    }
+    fig_tensor_get_dimensions_(animation, options, &width, &height);
+    if((height != 0 && width > ~(size_t) 0 / height)
+    || (width * height != 0 && count > ~(size_t) 0 / (width * height) / options->channels / element_size)) {
+        return 0;
+    }
+    return count * width * height * options->channels * element_size;
+}
+
+/* The state used for writing every frame of a tensor. */
+typedef struct {
+    fig_state *state;
+    fig_animation *animation;
+    const fig_tensor_options *options;
+    size_t width;
+    size_t height;
+    size_t element_size;
+    fig_tensor_lut_ lut;
+    /* The lookup table folded with the animation palette, or NULL if not made yet. */
+    fig_tensor_lut_ *index_lut;
+    /* Reused for frames without a render surface to read, or NULL if not allocated yet. */
+    fig_uint32_t *canvas;
+    size_t canvas_size;
+    /* Used when the tensor size differs from the canvas, or NULL. */
+    fig_resampler *resampler;
+} fig_tensor_writer_;
+
+static void fig_tensor_writer_free_(fig_tensor_writer_ *self) {
+    fig_allocator_t alloc = fig_state_get_allocator(self->state);
+    void *ud = fig_state_get_userdata(self->state);
+
+    alloc(ud, self->index_lut, self->index_lut != NULL ? sizeof(fig_tensor_lut_) : 0, 0);
+    alloc(ud, self->canvas, self->canvas != NULL ? self->canvas_size : 0, 0);
+    fig_resampler_free(self->resampler);
+}
+
+/* Write the frame of the image at the given index into a tensor frame starting at dest. */
+static fig_bool_t fig_tensor_write_frame_(fig_tensor_writer_ *self, size_t index, fig_uint8_t *dest) {
+    fig_animation *animation = self->animation;
+    fig_image *image = fig_animation_get_images(animation)[index];
+    size_t canvas_width = fig_animation_get_width(animation);
+    size_t canvas_height = fig_animation_get_height(animation);
+    size_t pixel_step, channel_step, row_step;
+    size_t y;
+
+    if(self->options->layout == FIG_TENSOR_LAYOUT_NHWC) {
+        pixel_step = self->options->channels;
+        channel_step = 1;
+        row_step = self->width * self->options->channels;
+    } else {
+        pixel_step = 1;
+        channel_step = self->width * self->height;
+        row_step = self->width;
+    }
+    row_step *= self->element_size;
+
+    if(self->resampler == NULL
+    && fig_image_get_render_index_data(image) != NULL
+    && fig_image_get_render_width(image) == canvas_width
+    && fig_image_get_render_height(image) == canvas_height) {
+        const fig_uint8_t *src = fig_image_get_render_index_data(image);
+        size_t stride = fig_image_get_render_stride(image);
+
+        /* Palette index surfaces are read straight through the palette, without expanding them into colors. */
+        if(self->index_lut == NULL) {
+            self->index_lut = (fig_tensor_lut_ *) fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state), NULL, 0, sizeof(fig_tensor_lut_));
+            if(self->index_lut == NULL) {
+                fig_state_set_error_allocation_failed(self->state);
+                return 0;
+            }
+            fig_tensor_lut_fold_palette_(&self->lut, fig_animation_get_palette(animation),
+                fig_animation_get_render_background_index(animation), self->index_lut);
+        }
+        for(y = 0; y < self->height; ++y) {
+            fig_tensor_write_index_row_(self->index_lut, src + y * stride, self->width, dest + y * row_step, pixel_step, channel_step);
+        }
+    } else {
+        const fig_uint32_t *src;
+        size_t stride;
+
+        if(self->resampler == NULL
+        && fig_image_get_render_data(image) != NULL
+        && fig_image_get_render_width(image) == canvas_width
+        && fig_image_get_render_height(image) == canvas_height) {
+            src = fig_image_get_render_data(image);
+            stride = fig_image_get_render_stride(image);
+        } else {
+            if(self->canvas == NULL) {
+                self->canvas = (fig_uint32_t *) fig_state_get_allocator(self->state)(fig_state_get_userdata(self->state), NULL, 0, self->canvas_size);
+                if(self->canvas == NULL) {
+                    fig_state_set_error_allocation_failed(self->state);
+                    return 0;
+                }
+            }
+            if(self->resampler != NULL) {
+                if(!fig_animation_resample_frame(animation, index, self->resampler, self->canvas, self->width * sizeof(fig_uint32_t))) {
+                    return 0;
+                }
+            } else if(!fig_animation_get_frame_rgba(animation, index, self->canvas)) {
+                return 0;
+            }
+            src = self->canvas;
+            stride = self->width * sizeof(fig_uint32_t);
+        }
+        for(y = 0; y < self->height; ++y) {
+            fig_tensor_write_color_row_(&self->lut, (const fig_uint32_t *) ((const fig_uint8_t *) src + y * stride),
+                self->width, dest + y * row_step, pixel_step, channel_step);
+        }
+    }
+    return 1;
+}
+
+fig_bool_t fig_export_tensor(fig_state *state, void *out, fig_animation *animation, const size_t *indices, size_t count, const fig_tensor_options *options) {
+    fig_tensor_writer_ writer;
+    size_t image_count = fig_animation_count_images(animation);
+    size_t frame_size;
+    size_t i;
+
+    FIG_ASSERT(options->type < FIG_TENSOR_TYPE_COUNT);
+    FIG_ASSERT(options->layout < FIG_TENSOR_LAYOUT_COUNT);
+    if(options->channels != 3 && options->channels != 4) {
+        fig_state_set_error(state, "tensors must have 3 or 4 channels");
+        return 0;
+    }
+    if(options->type == FIG_TENSOR_TYPE_FLOAT32) {
+        for(i = 0; i < options->channels; ++i) {
+            if(options->std[i] == 0.0f) {
+                fig_state_set_error(state, "tensor normalization requires a nonzero standard deviation");
+                return 0;
+            }
+        }
+    }
+    for(i = 0; i < count; ++i) {
+        if((indices != NULL ? indices[i] : i) >= image_count) {
+            fig_state_set_error(state, "image index is out of range");
+            return 0;
+        }
+    }
+    if(fig_animation_get_width(animation) == 0 || fig_animation_get_height(animation) == 0) {
+        fig_state_set_error(state, "image is empty");
+        return 0;
+    }
+    frame_size = fig_get_tensor_size(animation, 1, options);
+    if(frame_size == 0 || (count != 0 && fig_get_tensor_size(animation, count, options) == 0)) {
+        fig_state_set_error(state, "image dimensions requested are too large");
+        return 0;
+    }
+
+    memset(&writer, 0, sizeof(writer));
+    writer.state = state;
+    writer.animation = animation;
+    writer.options = options;
+    fig_tensor_get_dimensions_(animation, options, &writer.width, &writer.height);
+    writer.element_size = options->type == FIG_TENSOR_TYPE_FLOAT32 ? sizeof(float) : sizeof(fig_uint8_t);
+    fig_tensor_lut_init_(&writer.lut, options);
+
+    if(writer.width != fig_animation_get_width(animation) || writer.height != fig_animation_get_height(animation)) {
+        writer.resampler = fig_create_resampler(state, fig_animation_get_width(animation), fig_animation_get_height(animation),
+            writer.width, writer.height, options->filter);
+        if(writer.resampler == NULL) {
+            return 0;
+        }
+    }
+    /* The canvas holds a reconstructed or resampled frame, which is the size of the tensor frame either way. */
+    if(writer.width * writer.height > ~(size_t) 0 / sizeof(fig_uint32_t)) {
+        fig_state_set_error(state, "image dimensions requested are too large");
+        fig_tensor_writer_free_(&writer);
+        return 0;
+    }
+    writer.canvas_size = writer.width * writer.height * sizeof(fig_uint32_t);
+
+    for(i = 0; i < count; ++i) {
+        if(!fig_tensor_write_frame_(&writer, indices != NULL ? indices[i] : i, (fig_uint8_t *) out + i * frame_size)) {
+            fig_tensor_writer_free_(&writer);
+            return 0;
+        }
+    }
+    fig_tensor_writer_free_(&writer);
+    return 1;
+}
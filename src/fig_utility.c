@@ -12,4 +12,183 @@ void fig_unpack_color(fig_uint32_t color, fig_uint8_t *r, fig_uint8_t *g, fig_ui
     *g = (fig_uint8_t)((color >> 8) & 0xFF);
     *b = (fig_uint8_t)(color & 0xFF);
     *a = (fig_uint8_t)((color >> 24) & 0xFF);
-}
\ No newline at end of file
+}
+
+void fig_init_load_options(fig_load_options *options) {
+    options->render_images = 1;
+    options->render_mode = FIG_RENDER_MODE_FULL;
+    options->contiguous_render = 0;
+    options->contiguous_indexed = 0;
+    options->perceptual_hashes = 0;
+}
+
+size_t fig_perceptual_hash_distance(const fig_uint8_t *a, const fig_uint8_t *b) {
+    size_t distance = 0;
+    size_t i;
+
+    for(i = 0; i < 8; ++i) {
+        unsigned bits = (unsigned) (a[i] ^ b[i]);
+        while(bits != 0) {
+            bits &= bits - 1;
+            ++distance;
+        }
+    }
+    return distance;
+}
+
+void fig_init_atlas_options(fig_atlas_options *options) {
+    options->indexed = 0;
+    options->max_width = 0;
+    options->padding = 0;
+}
+
+void fig_init_tensor_options(fig_tensor_options *options) {
+    size_t i;
+
+    options->type = FIG_TENSOR_TYPE_UINT8;
+    options->layout = FIG_TENSOR_LAYOUT_NCHW;
+    options->channels = 3;
+    options->width = 0;
+    options->height = 0;
+    options->filter = FIG_FILTER_BILINEAR;
+    for(i = 0; i < 4; ++i) {
+        options->mean[i] = 0.0f;
+        options->std[i] = 1.0f;
+    }
+}
+
+size_t fig_pixel_format_get_size(fig_pixel_format_t format) {
+    switch(format) {
+        case FIG_PIXEL_FORMAT_RGB8: return 3;
+        case FIG_PIXEL_FORMAT_RGB565: return 2;
+        default: return 4;
+    }
+}
+
+/* Convert a row of BGRA colors into the given format.
+ * The format is dispatched once per row, so every inner loop is a
+ * straight pass that the compiler is free to unroll or vectorize. */
+static void fig_convert_color_row_(const fig_uint32_t *src, fig_uint8_t *dest, size_t width, fig_pixel_format_t format) {
+    size_t i;
+
+    switch(format) {
+        case FIG_PIXEL_FORMAT_RGBA8:
+            for(i = 0; i < width; ++i) {
+                fig_uint32_t color = src[i];
+                dest[0] = (fig_uint8_t)((color >> 16) & 0xFF);
+                dest[1] = (fig_uint8_t)((color >> 8) & 0xFF);
+                dest[2] = (fig_uint8_t)(color & 0xFF);
+                dest[3] = (fig_uint8_t)((color >> 24) & 0xFF);
+                dest += 4;
+            }
+            break;
+        case FIG_PIXEL_FORMAT_BGRA8:
+            for(i = 0; i < width; ++i) {
+                fig_uint32_t color = src[i];
+                dest[0] = (fig_uint8_t)(color & 0xFF);
+                dest[1] = (fig_uint8_t)((color >> 8) & 0xFF);
+                dest[2] = (fig_uint8_t)((color >> 16) & 0xFF);
+                dest[3] = (fig_uint8_t)((color >> 24) & 0xFF);
+                dest += 4;
+            }
+            break;
+        case FIG_PIXEL_FORMAT_RGB8:
+            for(i = 0; i < width; ++i) {
+                fig_uint32_t color = src[i];
+                dest[0] = (fig_uint8_t)((color >> 16) & 0xFF);
+                dest[1] = (fig_uint8_t)((color >> 8) & 0xFF);
+                dest[2] = (fig_uint8_t)(color & 0xFF);
+                dest += 3;
+            }
+            break;
+        case FIG_PIXEL_FORMAT_RGB565: {
+            fig_uint16_t *dest16 = (fig_uint16_t *) dest;
+            for(i = 0; i < width; ++i) {
+                fig_uint32_t color = src[i];
+                dest16[i] = (fig_uint16_t)(((color >> 8) & 0xF800)
+                    | ((color >> 5) & 0x07E0)
+                    | ((color >> 3) & 0x001F));
+            }
+            break;
+        }
+        case FIG_PIXEL_FORMAT_PREMULTIPLIED_RGBA8:
+            for(i = 0; i < width; ++i) {
+                fig_uint32_t color = src[i];
+                fig_uint32_t a = (color >> 24) & 0xFF;
+                dest[0] = (fig_uint8_t)((((color >> 16) & 0xFF) * a + 127) / 255);
+                dest[1] = (fig_uint8_t)((((color >> 8) & 0xFF) * a + 127) / 255);
+                dest[2] = (fig_uint8_t)(((color & 0xFF) * a + 127) / 255);
+                dest[3] = (fig_uint8_t) a;
+                dest += 4;
+            }
+            break;
+        default:
+            FIG_ASSERT(0);
+            break;
+    }
+}
+
+void fig_convert_colors(const fig_uint32_t *src, size_t src_stride, void *dest, size_t dest_stride, size_t width, size_t height, fig_pixel_format_t format) {
+    const fig_uint8_t *src_row = (const fig_uint8_t *) src;
+    fig_uint8_t *dest_row = (fig_uint8_t *) dest;
+    size_t i;
+
+    for(i = 0; i < height; ++i) {
+        fig_convert_color_row_((const fig_uint32_t *) src_row, dest_row, width, format);
+        src_row += src_stride;
+        dest_row += dest_stride;
+    }
+}
+
+void fig_convert_indices(const fig_uint8_t *src, size_t src_stride, const fig_uint32_t *colors, size_t color_count, void *dest, size_t dest_stride, size_t width, size_t height, fig_pixel_format_t format) {
+    fig_uint32_t lut_colors[256];
+    fig_uint8_t lut[256 * 4];
+    fig_uint16_t lut16[256];
+    fig_uint8_t *dest_row = (fig_uint8_t *) dest;
+    size_t pixel_size = fig_pixel_format_get_size(format);
+    size_t i, j;
+
+    /* Convert the palette once, so each pixel is a single table lookup. */
+    for(i = 0; i < 256; ++i) {
+        lut_colors[i] = i < color_count ? colors[i] : 0;
+    }
+    for(i = 0; i < 256; ++i) {
+        if(pixel_size == 2) {
+            fig_convert_color_row_(&lut_colors[i], (fig_uint8_t *) &lut16[i], 1, format);
+        } else {
+            fig_convert_color_row_(&lut_colors[i], lut + i * 4, 1, format);
+        }
+    }
+
+    for(i = 0; i < height; ++i) {
+        const fig_uint8_t *src_row = src + i * src_stride;
+
+        switch(pixel_size) {
+            case 4:
+                for(j = 0; j < width; ++j) {
+                    const fig_uint8_t *pixel = lut + src_row[j] * 4;
+                    dest_row[j * 4] = pixel[0];
+                    dest_row[j * 4 + 1] = pixel[1];
+                    dest_row[j * 4 + 2] = pixel[2];
+                    dest_row[j * 4 + 3] = pixel[3];
+                }
+                break;
+            case 3:
+                for(j = 0; j < width; ++j) {
+                    const fig_uint8_t *pixel = lut + src_row[j] * 4;
+                    dest_row[j * 3] = pixel[0];
+                    dest_row[j * 3 + 1] = pixel[1];
+                    dest_row[j * 3 + 2] = pixel[2];
+                }
+                break;
+            case 2: {
+                fig_uint16_t *dest16 = (fig_uint16_t *) dest_row;
+                for(j = 0; j < width; ++j) {
+                    dest16[j] = lut16[src_row[j]];
+                }
+                break;
+            }
+        }
+        dest_row += dest_stride;
+    }
+}
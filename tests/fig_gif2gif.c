@@ -10,6 +10,7 @@ int main(int argc, char **argv) {
     fig_input *input;
     fig_output *output;
     fig_animation *animation;
+    fig_load_options load_options;
 
     if(argc < 3) {
         fputs("Usage: fig_gif2gif input_filename output_filename\n", stderr);
@@ -26,7 +27,9 @@ int main(int argc, char **argv) {
 
     state = fig_create_state();
     input = fig_create_file_input(state, src_file);
-    animation = fig_load_gif(state, input);
+    fig_init_load_options(&load_options);
+    load_options.render_images = 0;
+    animation = fig_load_gif_with_options(state, input, &load_options);
     fig_input_free(input);
     fclose(src_file);
 
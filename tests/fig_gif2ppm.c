@@ -43,13 +43,13 @@ int main(int argc, char **argv) {
 
         for(i = 0; i < image_count; ++i) {
             fig_image *image;
-            size_t width, height, image_size;
+            size_t width, height, stride;
             fig_uint32_t *data;
 
             image = images[i];
             width = fig_image_get_render_width(image);
             height = fig_image_get_render_height(image);
-            image_size = width * height;
+            stride = fig_image_get_render_stride(image);
             data = fig_image_get_render_data(image);
 
             sprintf(buffer, "out.%03d.ppm", (int) i);
@@ -58,19 +58,24 @@ int main(int argc, char **argv) {
 
             if(f != NULL) {
                 fprintf(f, "P6 %d %d 255 ", (int) width, (int) height);
-                for(j = 0; j < image_size; ++j) {
-                    fig_uint8_t out[3];
+                for(j = 0; j < height; ++j) {
+                    const fig_uint32_t *row = (const fig_uint32_t *) ((const char *) data + j * stride);
+                    size_t k;
 
-                    if(((data[j] >> 24) & 0xFF) == 0) {
-                        out[0] = 0xFF;
-                        out[1] = 0x00;
-                        out[2] = 0xFF;
-                    } else {
-                        out[0] = (data[j] >> 16) & 0xFF;
-                        out[1] = (data[j] >> 8) & 0xFF;
-                        out[2] = data[j] & 0xFF;
+                    for(k = 0; k < width; ++k) {
+                        fig_uint8_t out[3];
+
+                        if(((row[k] >> 24) & 0xFF) == 0) {
+                            out[0] = 0xFF;
+                            out[1] = 0x00;
+                            out[2] = 0xFF;
+                        } else {
+                            out[0] = (row[k] >> 16) & 0xFF;
+                            out[1] = (row[k] >> 8) & 0xFF;
+                            out[2] = row[k] & 0xFF;
+                        }
+                        fwrite(out, 3, 1, f);
                     }
-                    fwrite(out, 3, 1, f);
                 }
                 fclose(f);
             }
@@ -0,0 +1,1518 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fig.h>
+
+/* Plays animations with a fig_player after rendering them in each render mode,
+ * and checks every frame shown against the frames of a full render. */
+
+static const char *mode_names[] = { "full", "delta", "checkpoint", "index", "sampled" };
+
+static unsigned long random_state = 1;
+
+static size_t next_random(size_t limit) {
+    random_state = (random_state * 1103515245UL + 12345UL) & 0xFFFFFFFFUL;
+    return (size_t) (random_state >> 16) % limit;
+}
+
+/* Make an animation with random image sizes, transparency, disposals and delays. */
+static fig_animation *generate_animation(fig_state *state) {
+    fig_animation *animation = fig_create_animation(state);
+    fig_palette *palette;
+    size_t width, height, image_count;
+    size_t i, j;
+
+    if(animation == NULL) {
+        return NULL;
+    }
+    width = 1 + next_random(24);
+    height = 1 + next_random(24);
+    fig_animation_set_dimensions(animation, width, height);
+
+    palette = fig_animation_get_palette(animation);
+    fig_palette_resize(palette, 16);
+    for(i = 0; i < 16; ++i) {
+        fig_palette_set(palette, i, 0xFF000000 | (fig_uint32_t) (next_random(0x1000) * 0x1001));
+    }
+
+    image_count = 1 + next_random(12);
+    for(i = 0; i < image_count; ++i) {
+        fig_image *image = fig_animation_add_image(animation);
+        /* Some images repeat the one before, so that animations have duplicate images and frames. */
+        fig_image *previous = i != 0 && next_random(4) == 0 ? fig_animation_get_images(animation)[i - 1] : NULL;
+        size_t image_width = previous != NULL ? fig_image_get_indexed_width(previous) : 1 + next_random(width);
+        size_t image_height = previous != NULL ? fig_image_get_indexed_height(previous) : 1 + next_random(height);
+        fig_uint8_t *data;
+
+        if(image == NULL || !fig_image_resize_indexed(image, image_width, image_height)) {
+            fig_animation_free(animation);
+            return NULL;
+        }
+        data = fig_image_get_indexed_data(image);
+        if(previous != NULL) {
+            fig_image_set_origin_x(image, fig_image_get_origin_x(previous));
+            fig_image_set_origin_y(image, fig_image_get_origin_y(previous));
+            memcpy(data, fig_image_get_indexed_data(previous), image_width * image_height);
+            fig_image_set_transparent(image, fig_image_get_transparent(previous));
+            /* The transparency index doesn't matter to images that aren't transparent. */
+            fig_image_set_transparency_index(image, fig_image_get_transparent(previous) ? fig_image_get_transparency_index(previous) : next_random(16));
+        } else {
+            fig_image_set_origin_x(image, next_random(width - image_width + 1));
+            fig_image_set_origin_y(image, next_random(height - image_height + 1));
+            for(j = 0; j < image_width * image_height; ++j) {
+                data[j] = (fig_uint8_t) next_random(16);
+            }
+            fig_image_set_transparent(image, next_random(2));
+            fig_image_set_transparency_index(image, next_random(16));
+        }
+        fig_image_set_disposal(image, (fig_disposal_t) next_random(4));
+        fig_image_set_delay(image, next_random(4));
+    }
+    fig_animation_set_loop_count(animation, next_random(3));
+    return animation;
+}
+
+/* Save an animation and load it back with the given load options.
+ * Returns NULL if it couldn't be saved or loaded. */
+static fig_animation *reload(fig_state *state, fig_animation *animation, const fig_load_options *options) {
+    fig_animation *loaded = NULL;
+    FILE *file = tmpfile();
+
+    if(file != NULL) {
+        fig_output *output = fig_create_file_output(state, file);
+        fig_bool_t saved = fig_save_gif(state, output, animation);
+
+        fig_output_free(output);
+        if(saved) {
+            fig_input *input;
+
+            rewind(file);
+            input = fig_create_file_input(state, file);
+            loaded = fig_load_gif_with_options(state, input, options);
+            fig_input_free(input);
+        }
+        fclose(file);
+    }
+    return loaded;
+}
+
+/* Save an animation as a GIF, and return the bytes of the file, with their
+ * number written into size. Returns NULL if it couldn't be saved. */
+static fig_uint8_t *save_bytes(fig_state *state, fig_animation *animation, size_t *size) {
+    fig_uint8_t *data = NULL;
+    FILE *file = tmpfile();
+
+    if(file != NULL) {
+        fig_output *output = fig_create_file_output(state, file);
+        fig_bool_t saved = fig_save_gif(state, output, animation);
+
+        fig_output_free(output);
+        if(saved) {
+            *size = (size_t) ftell(file);
+            data = (fig_uint8_t *) malloc(*size + 1);
+            rewind(file);
+            if(data != NULL && fread(data, 1, *size, file) != *size) {
+                free(data);
+                data = NULL;
+            }
+        }
+        fclose(file);
+    }
+    return data;
+}
+
+/* Render every image of an animation in FIG_RENDER_MODE_FULL, and return
+ * a copy of all the frames, one after another. Returns NULL on failure. */
+static fig_uint32_t *render_frames(fig_animation *animation) {
+    size_t width = fig_animation_get_width(animation);
+    size_t height = fig_animation_get_height(animation);
+    size_t image_count = fig_animation_count_images(animation);
+    fig_image **images = fig_animation_get_images(animation);
+    size_t frame_size = width * height;
+    fig_uint32_t *frames;
+    size_t i, y;
+
+    frames = (fig_uint32_t *) malloc(image_count * frame_size * sizeof(fig_uint32_t));
+    if(frames == NULL) {
+        return NULL;
+    }
+    fig_animation_set_render_mode(animation, FIG_RENDER_MODE_FULL);
+    if(!fig_animation_render_images(animation)) {
+        free(frames);
+        return NULL;
+    }
+    for(i = 0; i < image_count; ++i) {
+        const fig_uint8_t *data = (const fig_uint8_t *) fig_image_get_render_data(images[i]);
+        size_t stride = fig_image_get_render_stride(images[i]);
+
+        for(y = 0; y < height; ++y) {
+            memcpy(frames + i * frame_size + y * width, data + y * stride, width * sizeof(fig_uint32_t));
+        }
+    }
+    return frames;
+}
+
+/* Compute the perceptual hash of a frame as described by fig_animation_set_perceptual_hashes,
+ * straight from the colors of the frame. */
+static void compute_perceptual_hash(const fig_uint32_t *frame, size_t width, size_t height, fig_uint8_t *hash) {
+    size_t row, column, x, y;
+
+    for(row = 0; row < 8; ++row) {
+        double sums[9];
+        size_t widths[9];
+
+        for(column = 0; column < 9; ++column) {
+            sums[column] = 0.0;
+            widths[column] = (column + 1) * width / 9 - column * width / 9;
+            for(y = row * height / 8; y < (row + 1) * height / 8; ++y) {
+                for(x = column * width / 9; x < (column + 1) * width / 9; ++x) {
+                    fig_uint32_t color = frame[y * width + x];
+                    sums[column] += (double) (((color >> 16) & 0xFF) * 77 + ((color >> 8) & 0xFF) * 150 + (color & 0xFF) * 29);
+                }
+            }
+        }
+        /* Cells in a row are equally tall, so comparing average luminance only needs their widths. */
+        hash[row] = 0;
+        for(column = 0; column < 8; ++column) {
+            if(sums[column] * (double) widths[column + 1] > sums[column + 1] * (double) widths[column]) {
+                hash[row] |= (fig_uint8_t) (0x80 >> column);
+            }
+        }
+    }
+}
+
+/* Count the images of a rendered animation whose perceptual hash isn't the hash of the expected frame. */
+static size_t check_perceptual_hashes(fig_animation *animation, const fig_uint32_t *frames) {
+    size_t width = fig_animation_get_width(animation);
+    size_t height = fig_animation_get_height(animation);
+    size_t image_count = fig_animation_count_images(animation);
+    fig_image **images = fig_animation_get_images(animation);
+    size_t mismatches = 0;
+    size_t i;
+
+    for(i = 0; i < image_count; ++i) {
+        const fig_uint8_t *hash = fig_image_get_perceptual_hash(images[i]);
+        fig_uint8_t expected[8];
+
+        compute_perceptual_hash(frames + i * width * height, width, height, expected);
+        if(hash == NULL || memcmp(hash, expected, 8) != 0 || fig_perceptual_hash_distance(hash, expected) != 0) {
+            ++mismatches;
+        }
+    }
+    return mismatches;
+}
+
+static int compare_color_values(const void *a, const void *b) {
+    const fig_color_count *color_a = (const fig_color_count *) a;
+    const fig_color_count *color_b = (const fig_color_count *) b;
+    return color_a->color < color_b->color ? -1 : color_a->color > color_b->color;
+}
+
+static int compare_color_counts(const void *a, const void *b) {
+    const fig_color_count *color_a = (const fig_color_count *) a;
+    const fig_color_count *color_b = (const fig_color_count *) b;
+    if(color_a->count != color_b->count) {
+        return color_a->count > color_b->count ? -1 : 1;
+    }
+    return compare_color_values(a, b);
+}
+
+/* Count every pixel of the indexed data of each image by hand, then check the histogram
+ * of the animation against it, both when added at once and one image at a time. */
+static size_t check_histogram(fig_state *state, fig_animation *animation) {
+    size_t image_count = fig_animation_count_images(animation);
+    fig_image **images = fig_animation_get_images(animation);
+    fig_color_count *expected = (fig_color_count *) malloc(image_count * 256 * sizeof(fig_color_count));
+    fig_histogram *histogram = fig_create_histogram(state);
+    size_t pixel_count = 0;
+    size_t transparent_count = 0;
+    size_t color_count = 0;
+    size_t mismatches = 0;
+    size_t pass;
+    size_t i, j, x, y;
+
+    if(expected == NULL || histogram == NULL) {
+        free(expected);
+        fig_histogram_free(histogram);
+        return 1;
+    }
+    for(i = 0; i < image_count; ++i) {
+        fig_image *image = images[i];
+        fig_palette *palette = fig_animation_get_render_palette(animation, image);
+        fig_uint8_t *data = fig_image_get_indexed_data(image);
+        size_t stride = fig_image_get_indexed_stride(image);
+        size_t counts[256];
+
+        memset(counts, 0, sizeof(counts));
+        for(y = 0; y < fig_image_get_indexed_height(image); ++y) {
+            for(x = 0; x < fig_image_get_indexed_width(image); ++x) {
+                ++counts[data[y * stride + x]];
+            }
+        }
+        for(j = 0; j < 256; ++j) {
+            pixel_count += counts[j];
+            if((fig_image_get_transparent(image) && j == fig_image_get_transparency_index(image)) || j >= fig_palette_count_colors(palette)) {
+                transparent_count += counts[j];
+            } else if(counts[j] != 0) {
+                expected[color_count].color = fig_palette_get_colors(palette)[j];
+                expected[color_count].count = counts[j];
+                ++color_count;
+            }
+        }
+    }
+    /* Merge the counts of equal colors, then order them like fig_histogram_get_colors. */
+    qsort(expected, color_count, sizeof(fig_color_count), compare_color_values);
+    for(i = 0, j = 0; i < color_count; ++i) {
+        if(j != 0 && expected[j - 1].color == expected[i].color) {
+            expected[j - 1].count += expected[i].count;
+        } else {
+            expected[j++] = expected[i];
+        }
+    }
+    color_count = j;
+    qsort(expected, color_count, sizeof(fig_color_count), compare_color_counts);
+
+    for(pass = 0; pass < 2; ++pass) {
+        fig_bool_t added = 1;
+        fig_color_count *colors;
+
+        fig_histogram_clear(histogram);
+        if(pass == 0) {
+            added = fig_histogram_add_animation(histogram, animation);
+        } else {
+            for(i = 0; i < image_count && added; ++i) {
+                added = fig_histogram_add_image(histogram, animation, images[i]);
+            }
+        }
+        if(!added
+        || fig_histogram_count_pixels(histogram) != pixel_count
+        || fig_histogram_count_transparent(histogram) != transparent_count
+        || fig_histogram_count_colors(histogram) != color_count) {
+            ++mismatches;
+            continue;
+        }
+        colors = fig_histogram_get_colors(histogram);
+        for(i = 0; i < color_count; ++i) {
+            if(colors[i].color != expected[i].color || colors[i].count != expected[i].count) {
+                ++mismatches;
+                break;
+            }
+        }
+    }
+    fig_histogram_free(histogram);
+    free(expected);
+    return mismatches;
+}
+
+/* Check whether two images are encoded the same way, as covered by their content hashes. */
+static fig_bool_t same_content(fig_animation *animation, fig_image *a, fig_image *b) {
+    fig_palette *palette_a = fig_animation_get_render_palette(animation, a);
+    fig_palette *palette_b = fig_animation_get_render_palette(animation, b);
+    size_t width = fig_image_get_indexed_width(a);
+    size_t height = fig_image_get_indexed_height(a);
+    size_t y;
+
+    if(fig_image_get_origin_x(a) != fig_image_get_origin_x(b)
+    || fig_image_get_origin_y(a) != fig_image_get_origin_y(b)
+    || width != fig_image_get_indexed_width(b)
+    || height != fig_image_get_indexed_height(b)
+    || fig_image_get_transparent(a) != fig_image_get_transparent(b)
+    || (fig_image_get_transparent(a) && fig_image_get_transparency_index(a) != fig_image_get_transparency_index(b))
+    || fig_palette_count_colors(palette_a) != fig_palette_count_colors(palette_b)
+    || memcmp(fig_palette_get_colors(palette_a), fig_palette_get_colors(palette_b), fig_palette_count_colors(palette_a) * sizeof(fig_uint32_t)) != 0) {
+        return 0;
+    }
+    for(y = 0; y < height; ++y) {
+        if(memcmp(fig_image_get_indexed_data(a) + y * fig_image_get_indexed_stride(a), fig_image_get_indexed_data(b) + y * fig_image_get_indexed_stride(b), width) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Hash the images, then count the images whose duplicate frames, frame hash or content hash
+ * disagree with comparing the expected frames and the images themselves. */
+static size_t check_duplicate_frames(fig_animation *animation, const fig_uint32_t *frames) {
+    size_t frame_size = fig_animation_get_width(animation) * fig_animation_get_height(animation);
+    size_t image_count = fig_animation_count_images(animation);
+    fig_image **images = fig_animation_get_images(animation);
+    size_t *firsts = (size_t *) malloc(image_count * sizeof(size_t));
+    size_t distinct_count = 0;
+    size_t expected_distinct = 0;
+    size_t mismatches = 0;
+    size_t i, j;
+
+    if(firsts == NULL) {
+        return 1;
+    }
+    /* Earlier checks change and restore the images, so the hashes are computed again. */
+    if(!fig_animation_hash_images(animation) || !fig_animation_find_duplicate_frames(animation, firsts, &distinct_count)) {
+        free(firsts);
+        return image_count;
+    }
+    for(i = 0; i < image_count; ++i) {
+        const fig_uint8_t *frame_hash = fig_image_get_frame_hash(images[i]);
+        const fig_uint8_t *content_hash = fig_image_get_content_hash(images[i]);
+        size_t first = i;
+
+        for(j = 0; j < i; ++j) {
+            if(memcmp(frames + j * frame_size, frames + i * frame_size, frame_size * sizeof(fig_uint32_t)) == 0) {
+                first = j;
+                break;
+            }
+        }
+        if(first == i) {
+            ++expected_distinct;
+        }
+        if(frame_hash == NULL || content_hash == NULL || firsts[i] != first) {
+            ++mismatches;
+            continue;
+        }
+        for(j = 0; j < i; ++j) {
+            fig_bool_t same_frame = memcmp(frames + j * frame_size, frames + i * frame_size, frame_size * sizeof(fig_uint32_t)) == 0;
+            if(same_frame != (memcmp(fig_image_get_frame_hash(images[j]), frame_hash, 8) == 0)
+            || same_content(animation, images[j], images[i]) != (memcmp(fig_image_get_content_hash(images[j]), content_hash, 8) == 0)) {
+                ++mismatches;
+                break;
+            }
+        }
+    }
+    if(distinct_count != expected_distinct) {
+        ++mismatches;
+    }
+    free(firsts);
+    return mismatches;
+}
+
+/* Count the frames shown by a player that differ from the expected frames,
+ * or that are shown at the wrong time or loop. */
+static size_t check_player(fig_state *state, fig_animation *animation, const fig_uint32_t *frames) {
+    size_t width = fig_animation_get_width(animation);
+    size_t height = fig_animation_get_height(animation);
+    size_t image_count = fig_animation_count_images(animation);
+    fig_image **images = fig_animation_get_images(animation);
+    size_t loop_count = fig_animation_get_loop_count(animation);
+    /* A loop count of 0 plays forever, so only check the first two plays. */
+    size_t plays = loop_count != 0 ? loop_count + 1 : 2;
+    size_t frame_size = width * height;
+    size_t mismatches = 0;
+    size_t duration = 0;
+    size_t time = 0;
+    fig_player *player;
+    size_t i;
+
+    for(i = 0; i < image_count; ++i) {
+        duration += fig_image_get_delay(images[i]);
+    }
+    player = fig_create_player(state, animation);
+    if(player == NULL) {
+        return 1;
+    }
+    for(i = 0; i < image_count * plays; ++i) {
+        const fig_uint32_t *expected = frames + fig_player_get_image_index(player) * frame_size;
+        fig_bool_t advanced;
+
+        if(memcmp(fig_player_get_canvas(player), expected, frame_size * sizeof(fig_uint32_t)) != 0
+        || fig_player_get_image_index(player) != i % image_count
+        || fig_player_get_loop_index(player) != i / image_count
+        || fig_player_get_time(player) != time) {
+            ++mismatches;
+        }
+        time += fig_image_get_delay(images[i % image_count]);
+        advanced = fig_player_advance(player);
+        if(advanced != (loop_count == 0 || i + 1 < image_count * plays)) {
+            ++mismatches;
+        }
+        if(!advanced) {
+            break;
+        }
+    }
+    for(i = 0; i < image_count * 2; ++i) {
+        const fig_uint32_t *expected;
+        size_t seek = next_random(image_count * 8 + 1);
+        fig_bool_t finished = loop_count != 0 && (duration == 0 || seek >= duration * (loop_count + 1));
+        fig_bool_t playing = fig_player_seek_time(player, seek);
+        size_t index = fig_player_get_image_index(player);
+
+        expected = frames + index * frame_size;
+        if(memcmp(fig_player_get_canvas(player), expected, frame_size * sizeof(fig_uint32_t)) != 0
+        || playing == finished) {
+            ++mismatches;
+        } else if(finished || duration == 0) {
+            if(index != image_count - 1) {
+                ++mismatches;
+            }
+        } else if(fig_player_get_time(player) > seek
+        || fig_player_get_time(player) + fig_image_get_delay(images[index]) <= seek) {
+            ++mismatches;
+        }
+    }
+    fig_player_free(player);
+    return mismatches;
+}
+
+/* Count the images whose dirty rects miss a pixel that differs from the frame
+ * before, or don't fit the canvas. The first image must dirty the full canvas. */
+static size_t check_dirty_rects(fig_animation *animation, const fig_uint32_t *frames) {
+    size_t width = fig_animation_get_width(animation);
+    size_t height = fig_animation_get_height(animation);
+    size_t image_count = fig_animation_count_images(animation);
+    size_t frame_size = width * height;
+    size_t mismatches = 0;
+    size_t i, j, x, y;
+
+    for(i = 0; i < image_count; ++i) {
+        fig_rect rects[2];
+        size_t count = fig_animation_get_dirty_rects(animation, i, rects);
+        fig_bool_t correct = count <= 2;
+
+        for(j = 0; j < count && correct; ++j) {
+            correct = rects[j].x + rects[j].width <= width && rects[j].y + rects[j].height <= height;
+        }
+        if(correct && i == 0) {
+            correct = count == 1 && rects[0].x == 0 && rects[0].y == 0
+                && rects[0].width == width && rects[0].height == height;
+        }
+        for(y = 0; y < height && correct && i > 0; ++y) {
+            for(x = 0; x < width && correct; ++x) {
+                if(frames[i * frame_size + y * width + x] != frames[(i - 1) * frame_size + y * width + x]) {
+                    correct = 0;
+                    for(j = 0; j < count; ++j) {
+                        if(x >= rects[j].x && x < rects[j].x + rects[j].width
+                        && y >= rects[j].y && y < rects[j].y + rects[j].height) {
+                            correct = 1;
+                        }
+                    }
+                }
+            }
+        }
+        if(!correct) {
+            ++mismatches;
+        }
+    }
+    return mismatches;
+}
+
+/* Count the frames that differ from the expected frames when they're
+ * rendered as tiles of a random size into a frame with a wider stride. */
+static size_t check_tiles(fig_animation *animation, const fig_uint32_t *frames) {
+    size_t width = fig_animation_get_width(animation);
+    size_t height = fig_animation_get_height(animation);
+    size_t image_count = fig_animation_count_images(animation);
+    size_t frame_size = width * height;
+    size_t stride = width + 3;
+    size_t tile_width = 1 + next_random(width);
+    size_t tile_height = 1 + next_random(height);
+    size_t mismatches = 0;
+    fig_uint32_t *frame;
+    size_t i, x, y;
+
+    frame = (fig_uint32_t *) malloc(stride * height * sizeof(fig_uint32_t));
+    if(frame == NULL) {
+        return 1;
+    }
+    for(i = 0; i < image_count; ++i) {
+        fig_bool_t correct = 1;
+
+        for(y = 0; y < height; y += tile_height) {
+            for(x = 0; x < width; x += tile_width) {
+                fig_rect area;
+
+                area.x = x;
+                area.y = y;
+                area.width = tile_width < width - x ? tile_width : width - x;
+                area.height = tile_height < height - y ? tile_height : height - y;
+                if(!fig_animation_get_frame_area_rgba(animation, i, &area, frame + y * stride + x, stride * sizeof(fig_uint32_t))) {
+                    correct = 0;
+                }
+            }
+        }
+        for(y = 0; y < height; ++y) {
+            if(memcmp(frame + y * stride, frames + i * frame_size + y * width, width * sizeof(fig_uint32_t)) != 0) {
+                correct = 0;
+            }
+        }
+        if(!correct) {
+            ++mismatches;
+        }
+    }
+    free(frame);
+    return mismatches;
+}
+
+/* Count the frames of an animation rendered as palette indices that are wrong when
+ * converted with a palette of inverted colors, into a random area of the canvas.
+ * Pixels outside of the area must be left alone. */
+static size_t check_palette_swap(fig_state *state, fig_animation *animation, const fig_uint32_t *frames) {
+    size_t width = fig_animation_get_width(animation);
+    size_t height = fig_animation_get_height(animation);
+    size_t image_count = fig_animation_count_images(animation);
+    fig_image **images = fig_animation_get_images(animation);
+    fig_palette *palette = fig_animation_get_palette(animation);
+    size_t frame_size = width * height;
+    size_t mismatches = 0;
+    fig_palette *inverted;
+    fig_uint32_t *expected;
+    fig_uint8_t *want;
+    fig_uint8_t *got;
+    size_t i, j, x, y;
+
+    inverted = fig_create_palette(state);
+    expected = (fig_uint32_t *) malloc(frame_size * sizeof(fig_uint32_t));
+    want = (fig_uint8_t *) malloc(frame_size * 4);
+    got = (fig_uint8_t *) malloc(frame_size * 4);
+    if(inverted == NULL || expected == NULL || want == NULL || got == NULL
+    || !fig_palette_resize(inverted, fig_palette_count_colors(palette))) {
+        fig_palette_free(inverted);
+        free(expected);
+        free(want);
+        free(got);
+        return 1;
+    }
+    for(i = 0; i < fig_palette_count_colors(palette); ++i) {
+        fig_palette_set(inverted, i, fig_palette_get(palette, i) ^ 0x00FFFFFF);
+    }
+
+    for(i = 0; i < image_count; ++i) {
+        fig_rect area;
+        fig_bool_t correct;
+
+        /* The background is transparent in any palette, and every palette color is opaque. */
+        for(j = 0; j < frame_size; ++j) {
+            expected[j] = frames[i * frame_size + j] != 0 ? frames[i * frame_size + j] ^ 0x00FFFFFF : 0;
+        }
+        fig_convert_colors(expected, width * sizeof(fig_uint32_t), want, width * 4, width, height, FIG_PIXEL_FORMAT_RGBA8);
+
+        area.x = next_random(width);
+        area.y = next_random(height);
+        area.width = 1 + next_random(width - area.x);
+        area.height = 1 + next_random(height - area.y);
+        memset(got, 0xAB, frame_size * 4);
+        correct = fig_animation_convert_render_palette(animation, images[i], inverted, &area, got, width * 4, FIG_PIXEL_FORMAT_RGBA8);
+        for(y = 0; y < height && correct; ++y) {
+            for(x = 0; x < width && correct; ++x) {
+                const fig_uint8_t *pixel = got + (y * width + x) * 4;
+
+                if(x >= area.x && x < area.x + area.width && y >= area.y && y < area.y + area.height) {
+                    correct = memcmp(pixel, want + (y * width + x) * 4, 4) == 0;
+                } else {
+                    correct = pixel[0] == 0xAB && pixel[1] == 0xAB && pixel[2] == 0xAB && pixel[3] == 0xAB;
+                }
+            }
+        }
+        if(!correct) {
+            ++mismatches;
+        }
+    }
+    fig_palette_free(inverted);
+    free(expected);
+    free(want);
+    free(got);
+    return mismatches;
+}
+
+/* Apply every transform to an animation, and count the frames that differ
+ * from the expected frames moved the same way. Each transform is undone
+ * by its inverse before the next one, so the animation ends up unchanged. */
+static size_t check_transforms(fig_animation *animation, const fig_uint32_t *frames) {
+    static const fig_transform_t inverses[] = {
+        FIG_TRANSFORM_ROTATE_270, FIG_TRANSFORM_ROTATE_180, FIG_TRANSFORM_ROTATE_90,
+        FIG_TRANSFORM_FLIP_HORIZONTAL, FIG_TRANSFORM_FLIP_VERTICAL, FIG_TRANSFORM_TRANSPOSE
+    };
+    size_t width = fig_animation_get_width(animation);
+    size_t height = fig_animation_get_height(animation);
+    size_t image_count = fig_animation_count_images(animation);
+    size_t frame_size = width * height;
+    size_t mismatches = 0;
+    size_t transform, i, x, y;
+
+    for(transform = 0; transform < FIG_TRANSFORM_COUNT; ++transform) {
+        fig_bool_t swap_axes = transform == FIG_TRANSFORM_ROTATE_90
+            || transform == FIG_TRANSFORM_ROTATE_270
+            || transform == FIG_TRANSFORM_TRANSPOSE;
+        size_t new_width = swap_axes ? height : width;
+        size_t new_height = swap_axes ? width : height;
+        fig_uint32_t *moved;
+
+        if(!fig_animation_transform(animation, (fig_transform_t) transform)
+        || fig_animation_get_width(animation) != new_width
+        || fig_animation_get_height(animation) != new_height
+        || (moved = render_frames(animation)) == NULL) {
+            return mismatches + image_count;
+        }
+        for(i = 0; i < image_count; ++i) {
+            fig_bool_t correct = 1;
+
+            for(y = 0; y < new_height && correct; ++y) {
+                for(x = 0; x < new_width && correct; ++x) {
+                    size_t source_x, source_y;
+
+                    /* Find the pixel of the frame before the transform that lands here. */
+                    switch(transform) {
+                        case FIG_TRANSFORM_ROTATE_90:
+                            source_x = y;
+                            source_y = height - 1 - x;
+                            break;
+                        case FIG_TRANSFORM_ROTATE_180:
+                            source_x = width - 1 - x;
+                            source_y = height - 1 - y;
+                            break;
+                        case FIG_TRANSFORM_ROTATE_270:
+                            source_x = width - 1 - y;
+                            source_y = x;
+                            break;
+                        case FIG_TRANSFORM_FLIP_HORIZONTAL:
+                            source_x = width - 1 - x;
+                            source_y = y;
+                            break;
+                        case FIG_TRANSFORM_FLIP_VERTICAL:
+                            source_x = x;
+                            source_y = height - 1 - y;
+                            break;
+                        case FIG_TRANSFORM_TRANSPOSE:
+                        default:
+                            source_x = y;
+                            source_y = x;
+                            break;
+                    }
+                    correct = moved[i * frame_size + y * new_width + x] == frames[i * frame_size + source_y * width + source_x];
+                }
+            }
+            if(!correct) {
+                ++mismatches;
+            }
+        }
+        free(moved);
+        if(!fig_animation_transform(animation, inverses[transform])) {
+            return mismatches + image_count;
+        }
+    }
+    return mismatches;
+}
+
+/* Pack an animation into an atlas, and count the frames that differ from
+ * the expected frames when their areas of the atlas are drawn onto a clear canvas. */
+static size_t check_atlas(fig_state *state, fig_animation *animation, const fig_uint32_t *frames) {
+    size_t width = fig_animation_get_width(animation);
+    size_t height = fig_animation_get_height(animation);
+    size_t image_count = fig_animation_count_images(animation);
+    fig_image **images = fig_animation_get_images(animation);
+    size_t frame_size = width * height;
+    size_t mismatches = 0;
+    fig_atlas_options options;
+    fig_atlas *atlas;
+    fig_uint32_t *frame;
+    size_t i, y;
+
+    atlas = fig_create_atlas(state);
+    frame = (fig_uint32_t *) malloc(frame_size * sizeof(fig_uint32_t));
+    fig_init_atlas_options(&options);
+    options.padding = next_random(3);
+    options.max_width = next_random(2) ? width + next_random(width * 2) : 0;
+    if(atlas == NULL || frame == NULL
+    || !fig_atlas_pack(atlas, animation, &options)
+    || fig_atlas_count_frames(atlas) != image_count) {
+        fig_atlas_free(atlas);
+        free(frame);
+        return image_count;
+    }
+    for(i = 0; i < image_count; ++i) {
+        const fig_atlas_frame *placed = fig_atlas_get_frames(atlas) + i;
+        const fig_rect *source = &placed->source;
+
+        if(source->x + source->width > fig_atlas_get_width(atlas)
+        || source->y + source->height > fig_atlas_get_height(atlas)
+        || placed->x + source->width > width
+        || placed->y + source->height > height
+        || placed->delay != fig_image_get_delay(images[i])) {
+            ++mismatches;
+            continue;
+        }
+        memset(frame, 0, frame_size * sizeof(fig_uint32_t));
+        for(y = 0; y < source->height; ++y) {
+            memcpy(frame + (placed->y + y) * width + placed->x,
+                fig_atlas_get_data(atlas) + (source->y + y) * fig_atlas_get_width(atlas) + source->x,
+                source->width * sizeof(fig_uint32_t));
+        }
+        if(memcmp(frame, frames + i * frame_size, frame_size * sizeof(fig_uint32_t)) != 0) {
+            ++mismatches;
+        }
+    }
+    fig_atlas_free(atlas);
+    free(frame);
+    return mismatches;
+}
+
+/* Copy the indexed data of every image of an animation into one sheet, with a
+ * row stride wider than any image, and make each image a view of its cell.
+ * Count the frames that differ from the expected frames after that, plus one
+ * if the animation doesn't save to the same GIF as before. The sheet is returned
+ * through sheet, and must outlive the views. */
+static size_t check_views(fig_state *state, fig_animation *animation, const fig_uint32_t *frames, fig_uint8_t **sheet) {
+    size_t width = fig_animation_get_width(animation);
+    size_t height = fig_animation_get_height(animation);
+    size_t image_count = fig_animation_count_images(animation);
+    fig_image **images = fig_animation_get_images(animation);
+    size_t frame_size = width * height;
+    size_t mismatches = 0;
+    size_t stride = 3;
+    size_t rows = 0;
+    size_t row = 0;
+    fig_uint8_t *before;
+    fig_uint8_t *after;
+    size_t before_size = 0;
+    size_t after_size = 0;
+    fig_uint32_t *viewed;
+    size_t i, y;
+
+    for(i = 0; i < image_count; ++i) {
+        if(fig_image_get_indexed_width(images[i]) + 7 > stride) {
+            stride = fig_image_get_indexed_width(images[i]) + 7;
+        }
+        rows += fig_image_get_indexed_height(images[i]);
+    }
+    *sheet = (fig_uint8_t *) malloc(stride * rows + 1);
+    if(*sheet == NULL) {
+        return image_count;
+    }
+    before = save_bytes(state, animation, &before_size);
+
+    for(i = 0; i < image_count; ++i) {
+        fig_image *image = images[i];
+        const fig_uint8_t *data = fig_image_get_indexed_data(image);
+        fig_rect rect;
+
+        /* Each cell starts partway into its rows, so that views don't line up with them. */
+        rect.x = 3;
+        rect.y = row;
+        rect.width = fig_image_get_indexed_width(image);
+        rect.height = fig_image_get_indexed_height(image);
+        for(y = 0; y < rect.height; ++y) {
+            memcpy(*sheet + (row + y) * stride + rect.x, data + y * fig_image_get_indexed_stride(image), rect.width);
+        }
+        if(!fig_image_attach_indexed_view(image, *sheet, stride, &rect)
+        || fig_image_get_indexed_stride(image) != stride
+        || fig_image_get_indexed_data(image) != *sheet + row * stride + rect.x) {
+            ++mismatches;
+        }
+        row += rect.height;
+    }
+
+    viewed = render_frames(animation);
+    if(viewed == NULL) {
+        mismatches += image_count;
+    } else {
+        for(i = 0; i < image_count; ++i) {
+            if(memcmp(viewed + i * frame_size, frames + i * frame_size, frame_size * sizeof(fig_uint32_t)) != 0) {
+                ++mismatches;
+            }
+        }
+        free(viewed);
+    }
+
+    /* Animations that can't be saved, such as with a transparency index outside of the palette, can't be compared. */
+    after = save_bytes(state, animation, &after_size);
+    if(before != NULL && (after == NULL || after_size != before_size || memcmp(after, before, before_size) != 0)) {
+        ++mismatches;
+    }
+    free(before);
+    free(after);
+    return mismatches;
+}
+
+/* Render an animation one segment between keyframes at a time, from the last
+ * segment to the first, since segments don't depend on each other.
+ * Returns whether every segment was rendered. */
+static fig_bool_t render_ranges(fig_animation *animation) {
+    size_t end = fig_animation_count_images(animation);
+    size_t start;
+
+    if(!fig_animation_prepare_render(animation)) {
+        return 0;
+    }
+    for(start = end; start > 0; --start) {
+        if(fig_animation_is_keyframe(animation, start - 1)) {
+            if(!fig_animation_render_image_range(animation, start - 1, end)) {
+                return 0;
+            }
+            end = start - 1;
+        }
+    }
+    return 1;
+}
+
+/* Render an animation in FIG_RENDER_MODE_SAMPLED, sampling every 3 images and then
+ * 3 times every 4 units of time, and count the images that are sampled the wrong
+ * number of times, or whose render surface isn't the expected frame when sampled
+ * and empty otherwise. Sampling by interval is left set afterwards. */
+static size_t check_samples(fig_animation *animation, const fig_uint32_t *frames) {
+    size_t width = fig_animation_get_width(animation);
+    size_t height = fig_animation_get_height(animation);
+    size_t image_count = fig_animation_count_images(animation);
+    fig_image **images = fig_animation_get_images(animation);
+    size_t frame_size = width * height;
+    size_t mismatches = 0;
+    size_t pass, i, k, y;
+
+    fig_animation_set_render_mode(animation, FIG_RENDER_MODE_SAMPLED);
+    fig_animation_set_sample_interval(animation, 3);
+    for(pass = 0; pass < 2; ++pass) {
+        size_t time = 0;
+
+        fig_animation_set_sample_rate(animation, pass == 0 ? 0 : 3, 4);
+        if(!render_ranges(animation)) {
+            return image_count;
+        }
+        for(i = 0; i < image_count; ++i) {
+            size_t delay = fig_image_get_delay(images[i]);
+            size_t expected = 0;
+            fig_bool_t correct;
+
+            if(pass == 0) {
+                expected = i % 3 == 0;
+            } else {
+                /* The sample times are k * 4 / 3, so count them while the image shows. */
+                for(k = 0; k * 4 < (time + delay) * 3; ++k) {
+                    if(k * 4 >= time * 3) {
+                        ++expected;
+                    }
+                }
+            }
+            time += delay;
+
+            correct = fig_animation_count_samples(animation, i) == expected;
+            if(correct && expected == 0) {
+                correct = fig_image_get_render_width(images[i]) * fig_image_get_render_height(images[i]) == 0;
+            } else if(correct) {
+                const fig_uint8_t *data = (const fig_uint8_t *) fig_image_get_render_data(images[i]);
+
+                correct = data != NULL
+                    && fig_image_get_render_width(images[i]) == width
+                    && fig_image_get_render_height(images[i]) == height;
+                for(y = 0; y < height && correct; ++y) {
+                    correct = memcmp(data + y * fig_image_get_render_stride(images[i]),
+                        frames + i * frame_size + y * width, width * sizeof(fig_uint32_t)) == 0;
+                }
+            }
+            if(!correct) {
+                ++mismatches;
+            }
+        }
+    }
+    fig_animation_set_sample_rate(animation, 0, 100);
+    return mismatches;
+}
+
+/* Scale an animation up by 2, and count the frames that differ from the expected
+ * frames with every pixel repeated into a 2 x 2 block. The animation stays scaled. */
+static size_t check_scale(fig_animation *animation, const fig_uint32_t *frames) {
+    size_t width = fig_animation_get_width(animation);
+    size_t height = fig_animation_get_height(animation);
+    size_t image_count = fig_animation_count_images(animation);
+    size_t frame_size = width * height;
+    size_t mismatches = 0;
+    fig_uint32_t *scaled_frames;
+    size_t i, x, y;
+
+    if(!fig_animation_scale(animation, 2)
+    || fig_animation_get_width(animation) != width * 2
+    || fig_animation_get_height(animation) != height * 2
+    || (scaled_frames = render_frames(animation)) == NULL) {
+        return image_count;
+    }
+    for(i = 0; i < image_count; ++i) {
+        for(y = 0; y < height * 2; ++y) {
+            for(x = 0; x < width * 2; ++x) {
+                if(scaled_frames[i * frame_size * 4 + y * width * 2 + x] != frames[i * frame_size + y / 2 * width + x / 2]) {
+                    break;
+                }
+            }
+            if(x < width * 2) {
+                break;
+            }
+        }
+        if(y < height * 2) {
+            ++mismatches;
+        }
+    }
+    free(scaled_frames);
+    return mismatches;
+}
+
+/* Check an animation in every render mode, and then scale it up, which leaves it
+ * scaled up by 2. Returns the number of mismatched frames. */
+static size_t check_animation(fig_state *state, fig_animation *animation, const char *name) {
+    size_t width = fig_animation_get_width(animation);
+    size_t height = fig_animation_get_height(animation);
+    size_t image_count = fig_animation_count_images(animation);
+    size_t frame_size = width * height;
+    fig_uint32_t *frames;
+    fig_uint8_t *sheet = NULL;
+    size_t total = 0;
+    size_t mismatches;
+    size_t mode;
+
+    if(image_count == 0 || frame_size == 0) {
+        return 0;
+    }
+    frames = render_frames(animation);
+    if(frames == NULL) {
+        return 1;
+    }
+
+    mismatches = check_dirty_rects(animation, frames);
+    if(mismatches != 0) {
+        printf("%s: %lu images with wrong dirty rects\n", name, (unsigned long) mismatches);
+        total += mismatches;
+    }
+    mismatches = check_tiles(animation, frames);
+    if(mismatches != 0) {
+        printf("%s: %lu wrong frames rendered as tiles\n", name, (unsigned long) mismatches);
+        total += mismatches;
+    }
+    mismatches = check_transforms(animation, frames);
+    if(mismatches != 0) {
+        printf("%s: %lu wrong frames after transforms\n", name, (unsigned long) mismatches);
+        total += mismatches;
+    }
+    mismatches = check_atlas(state, animation, frames);
+    if(mismatches != 0) {
+        printf("%s: %lu wrong frames in the atlas\n", name, (unsigned long) mismatches);
+        total += mismatches;
+    }
+    /* The images stay views of the sheet until scaling replaces their indexed data. */
+    mismatches = check_views(state, animation, frames, &sheet);
+    if(mismatches != 0) {
+        printf("%s: %lu wrong frames with views of a sheet\n", name, (unsigned long) mismatches);
+        total += mismatches;
+    }
+
+    mismatches = check_samples(animation, frames);
+    if(mismatches != 0) {
+        printf("%s: %lu wrongly sampled images\n", name, (unsigned long) mismatches);
+        total += mismatches;
+    }
+    mismatches = check_histogram(state, animation);
+    if(mismatches != 0) {
+        printf("%s: %lu wrong histograms\n", name, (unsigned long) mismatches);
+        total += mismatches;
+    }
+    mismatches = check_duplicate_frames(animation, frames);
+    if(mismatches != 0) {
+        printf("%s: %lu images with wrong hashes or duplicate frames\n", name, (unsigned long) mismatches);
+        total += mismatches;
+    }
+
+    fig_animation_set_perceptual_hashes(animation, 1);
+    for(mode = 0; mode < FIG_RENDER_MODE_COUNT; ++mode) {
+        fig_animation_set_render_mode(animation, (fig_render_mode_t) mode);
+        if(!render_ranges(animation)) {
+            /* Animations with more than one palette can't be rendered as palette indices. */
+            if(mode != FIG_RENDER_MODE_INDEX) {
+                printf("%s: %s render failed\n", name, mode_names[mode]);
+                ++total;
+            }
+            continue;
+        }
+        mismatches = check_player(state, animation, frames);
+        if(mismatches != 0) {
+            printf("%s: %lu wrong frames after %s render\n", name, (unsigned long) mismatches, mode_names[mode]);
+            total += mismatches;
+        }
+        mismatches = check_perceptual_hashes(animation, frames);
+        if(mismatches != 0) {
+            printf("%s: %lu wrong perceptual hashes after %s render\n", name, (unsigned long) mismatches, mode_names[mode]);
+            total += mismatches;
+        }
+        if(mode == FIG_RENDER_MODE_INDEX) {
+            mismatches = check_palette_swap(state, animation, frames);
+            if(mismatches != 0) {
+                printf("%s: %lu wrong frames after palette swap\n", name, (unsigned long) mismatches);
+                total += mismatches;
+            }
+        }
+    }
+
+    mismatches = check_scale(animation, frames);
+    if(mismatches != 0) {
+        printf("%s: %lu wrong frames after scaling\n", name, (unsigned long) mismatches);
+        total += mismatches;
+    }
+    free(sheet);
+    free(frames);
+    return total;
+}
+
+/* Read the codes of the LZW data of the first image of a saved GIF, growing the code size
+ * like a decoder, and check that the end code is complete and nothing follows it. */
+static fig_bool_t check_lzw_end_code(const fig_uint8_t *file, size_t size) {
+    fig_uint8_t data[65536];
+    size_t data_size = 0;
+    size_t position = 13;
+    size_t bit, min_code_size, code_size, code_count;
+    fig_bool_t has_old_code = 0;
+
+    if(size < 13) {
+        return 0;
+    }
+    if(file[10] & 0x80) {
+        position += (size_t) 3 << ((file[10] & 0x07) + 1);
+    }
+    /* Skip the extensions before the image. */
+    while(position + 1 < size && file[position] == 0x21) {
+        position += 2;
+        while(position < size && file[position] != 0) {
+            position += file[position] + 1;
+        }
+        ++position;
+    }
+    if(position + 11 > size || file[position] != 0x2C) {
+        return 0;
+    }
+    if(file[position + 9] & 0x80) {
+        position += (size_t) 3 << ((file[position + 9] & 0x07) + 1);
+    }
+    position += 10;
+    min_code_size = file[position++];
+    while(position < size && file[position] != 0) {
+        size_t length = file[position++];
+        if(position + length > size || data_size + length > sizeof(data)) {
+            return 0;
+        }
+        memcpy(data + data_size, file + position, length);
+        data_size += length;
+        position += length;
+    }
+
+    code_size = min_code_size + 1;
+    code_count = ((size_t) 1 << min_code_size) + 2;
+    bit = 0;
+    while(bit + code_size <= data_size * 8) {
+        size_t code = 0;
+        size_t i;
+
+        for(i = 0; i < code_size; ++i) {
+            code |= (size_t) ((data[(bit + i) / 8] >> ((bit + i) % 8)) & 1) << i;
+        }
+        bit += code_size;
+        if(code == (size_t) 1 << min_code_size) {
+            code_size = min_code_size + 1;
+            code_count = ((size_t) 1 << min_code_size) + 2;
+            has_old_code = 0;
+        } else if(code == ((size_t) 1 << min_code_size) + 1) {
+            /* Only the padding of the last byte can follow the end code. */
+            return (bit + 7) / 8 == data_size;
+        } else {
+            if(has_old_code && code_count < 4096) {
+                ++code_count;
+                if((code_count & (((size_t) 1 << code_size) - 1)) == 0 && code_count < 4096) {
+                    ++code_size;
+                }
+            }
+            has_old_code = 1;
+        }
+    }
+    return 0;
+}
+
+/* Save and load single-row images in which no pair of neighboring indices repeats,
+ * so that every pixel after the first adds an LZW code. The lengths end the data right
+ * where a decoder widens its codes, with the end code landing on a byte boundary,
+ * and right where the code table is full, which doesn't widen them.
+ * Returns the number of images that didn't save or load back correctly. */
+static size_t check_lzw_boundaries(fig_state *state) {
+    static const size_t lengths[] = { 255, 767, 1791, 3839, 8444, 8445, 8446, 19194, 19195, 19196 };
+    size_t failures = 0;
+    size_t i, j;
+
+    for(i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+        size_t length = lengths[i];
+        fig_animation *animation = fig_create_animation(state);
+        fig_animation *loaded = NULL;
+        fig_image *image;
+        fig_uint8_t *data;
+        fig_uint8_t *file_data = NULL;
+        size_t file_size = 0;
+        size_t index = 0;
+        FILE *file = tmpfile();
+
+        fig_animation_set_dimensions(animation, length, 1);
+        fig_palette_resize(fig_animation_get_palette(animation), 256);
+        image = fig_animation_add_image(animation);
+        fig_image_resize_indexed(image, length, 1);
+        data = fig_image_get_indexed_data(image);
+        for(j = 0; j < length; ++j) {
+            data[j] = (fig_uint8_t) index;
+            /* Each run of 256 steps by a different odd amount, so every pair is new. */
+            index = (index + 1 + j / 256 * 2) & 0xFF;
+        }
+
+        if(file != NULL) {
+            fig_output *output = fig_create_file_output(state, file);
+            fig_bool_t saved = fig_save_gif(state, output, animation);
+
+            fig_output_free(output);
+            if(saved) {
+                fig_input *input;
+
+                file_size = (size_t) ftell(file);
+                file_data = (fig_uint8_t *) malloc(file_size);
+                rewind(file);
+                if(file_data != NULL && fread(file_data, 1, file_size, file) == file_size) {
+                    rewind(file);
+                    input = fig_create_file_input(state, file);
+                    loaded = fig_load_gif(state, input);
+                    fig_input_free(input);
+                }
+            }
+            fclose(file);
+        }
+
+        if(loaded == NULL
+        || fig_animation_count_images(loaded) != 1
+        || fig_image_get_indexed_width(fig_animation_get_images(loaded)[0]) != length
+        || memcmp(fig_image_get_indexed_data(fig_animation_get_images(loaded)[0]), data, length) != 0) {
+            printf("lzw: %lu pixels didn't load back the same\n", (unsigned long) length);
+            ++failures;
+        } else if(!check_lzw_end_code(file_data, file_size)) {
+            printf("lzw: %lu pixels were saved with a bad end code\n", (unsigned long) length);
+            ++failures;
+        }
+        free(file_data);
+        fig_animation_free(loaded);
+        fig_animation_free(animation);
+    }
+    return failures;
+}
+
+/* Resample small images with known results: a 2x box downscale averages each
+ * 2 x 2 block, without transparent pixels darkening the colors of the others,
+ * and every filter keeps an image of the same size as it is, except that
+ * premultiplying clears the colors of fully transparent pixels.
+ * Returns the number of images that weren't resampled to the known result. */
+static size_t check_resampler(fig_state *state) {
+    static const fig_uint32_t src[] = {
+        0xFF102030, 0xFF304050, 0x80FF0000, 0x00FFFFFF, 0xFF202020, 0xFF404040,
+        0xFF506070, 0xFF70C0F0, 0x0000FF00, 0x000000FF, 0xFF606060, 0xFF808080,
+        0xFF808080, 0xFF808080, 0xFF0000F0, 0xFF00F000, 0xFFF00000, 0xFF000000,
+        0xFF808080, 0xFF808080, 0xFF0000F0, 0xFF00F000, 0xFFF00000, 0xFF000000
+    };
+    static const fig_uint32_t box[] = {
+        0xFF406078, 0x20FF0000, 0xFF505050,
+        0xFF808080, 0xFF007878, 0xFF780000
+    };
+    fig_uint32_t same[24];
+    fig_uint32_t dest[24];
+    size_t failures = 0;
+    size_t filter, i;
+    fig_resampler *resampler;
+
+    for(i = 0; i < 24; ++i) {
+        same[i] = (src[i] >> 24) != 0 ? src[i] : 0;
+    }
+
+    resampler = fig_create_resampler(state, 6, 4, 3, 2, FIG_FILTER_BOX);
+    if(resampler == NULL
+    || !fig_resampler_resample(resampler, src, 6 * sizeof(fig_uint32_t), dest, 3 * sizeof(fig_uint32_t))
+    || memcmp(dest, box, sizeof(box)) != 0) {
+        puts("resample: box downscale by 2 didn't average each block");
+        ++failures;
+    }
+    fig_resampler_free(resampler);
+
+    for(filter = 0; filter < FIG_FILTER_COUNT; ++filter) {
+        resampler = fig_create_resampler(state, 6, 4, 6, 4, (fig_filter_t) filter);
+        if(resampler == NULL
+        || !fig_resampler_resample(resampler, src, 6 * sizeof(fig_uint32_t), dest, 6 * sizeof(fig_uint32_t))
+        || memcmp(dest, same, sizeof(same)) != 0) {
+            printf("resample: filter %lu didn't keep an image of the same size\n", (unsigned long) filter);
+            ++failures;
+        }
+        fig_resampler_free(resampler);
+    }
+    return failures;
+}
+
+/* Export an animation into a tensor with the given options, and compare it with the
+ * expected elements, which are floats or bytes depending on the options.
+ * Returns whether the tensor has the expected size and elements. */
+static fig_bool_t export_matches(fig_state *state, fig_animation *animation, const fig_tensor_options *options, const void *expected, size_t count) {
+    size_t element_size = options->type == FIG_TENSOR_TYPE_FLOAT32 ? sizeof(float) : sizeof(fig_uint8_t);
+    size_t size = fig_get_tensor_size(animation, fig_animation_count_images(animation), options);
+    fig_bool_t matches;
+    void *tensor;
+    size_t i;
+
+    if(size != count * element_size) {
+        return 0;
+    }
+    tensor = malloc(size);
+    matches = tensor != NULL && fig_export_tensor(state, tensor, animation, NULL, fig_animation_count_images(animation), options);
+    for(i = 0; i < count && matches; ++i) {
+        if(options->type == FIG_TENSOR_TYPE_FLOAT32) {
+            float difference = ((const float *) tensor)[i] - ((const float *) expected)[i];
+            matches = difference > -0.0001f && difference < 0.0001f;
+        } else {
+            matches = ((const fig_uint8_t *) tensor)[i] == ((const fig_uint8_t *) expected)[i];
+        }
+    }
+    free(tensor);
+    return matches;
+}
+
+/* Export a 2 x 1 animation with known tensors, whose first frame shows an opaque
+ * and a transparent pixel, and whose second frame shows two opaque pixels.
+ * It's exported without a render, from full renders, and from palette index renders,
+ * which are read through a table made from the palette.
+ * Returns the number of tensors that didn't match. */
+static size_t check_tensors(fig_state *state) {
+    static const fig_uint8_t nchw[] = {
+        51, 0, 102, 0, 153, 0,
+        204, 51, 0, 102, 0, 153
+    };
+    static const fig_uint8_t nhwc[] = {
+        51, 102, 153, 255, 0, 0, 0, 0,
+        204, 0, 0, 255, 51, 102, 153, 255
+    };
+    static const float normalized_nchw[] = {
+        0.0f, -0.4f, 0.0f, -0.8f, 0.0f, -1.2f,
+        1.2f, 0.0f, -0.8f, 0.0f, -1.2f, 0.0f
+    };
+    static const float normalized_nhwc[] = {
+        0.0f, 0.0f, 0.0f, 1.0f, -0.4f, -0.8f, -1.2f, 0.0f,
+        1.2f, -0.8f, -1.2f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f
+    };
+    static const fig_uint8_t first[] = { 0, 1 };
+    static const fig_uint8_t second[] = { 1, 0 };
+    size_t failures = 0;
+    fig_animation *animation;
+    fig_tensor_options options;
+    fig_image *image;
+    size_t source;
+
+    animation = fig_create_animation(state);
+    if(animation == NULL) {
+        return 1;
+    }
+    fig_animation_set_dimensions(animation, 2, 1);
+    fig_palette_resize(fig_animation_get_palette(animation), 2);
+    fig_palette_set(fig_animation_get_palette(animation), 0, 0xFF336699);
+    fig_palette_set(fig_animation_get_palette(animation), 1, 0xFFCC0000);
+    image = fig_animation_add_image(animation);
+    fig_image_resize_indexed(image, 2, 1);
+    memcpy(fig_image_get_indexed_data(image), first, 2);
+    fig_image_set_transparent(image, 1);
+    fig_image_set_transparency_index(image, 1);
+    image = fig_animation_add_image(animation);
+    fig_image_resize_indexed(image, 2, 1);
+    memcpy(fig_image_get_indexed_data(image), second, 2);
+
+    fig_init_tensor_options(&options);
+    options.channels = 5;
+    if(fig_get_tensor_size(animation, 2, &options) != 0) {
+        puts("tensor: 5 channels didn't give a size of 0");
+        ++failures;
+    }
+
+    for(source = 0; source < 3; ++source) {
+        if(source == 1) {
+            fig_animation_set_render_mode(animation, FIG_RENDER_MODE_FULL);
+            fig_animation_render_images(animation);
+        } else if(source == 2) {
+            fig_animation_set_render_mode(animation, FIG_RENDER_MODE_INDEX);
+            fig_animation_render_images(animation);
+        }
+
+        fig_init_tensor_options(&options);
+        if(!export_matches(state, animation, &options, nchw, sizeof(nchw))) {
+            printf("tensor: wrong uint8 NCHW tensor from source %lu\n", (unsigned long) source);
+            ++failures;
+        }
+        options.layout = FIG_TENSOR_LAYOUT_NHWC;
+        options.channels = 4;
+        if(!export_matches(state, animation, &options, nhwc, sizeof(nhwc))) {
+            printf("tensor: wrong uint8 NHWC tensor from source %lu\n", (unsigned long) source);
+            ++failures;
+        }
+
+        options.type = FIG_TENSOR_TYPE_FLOAT32;
+        options.mean[0] = 0.2f;
+        options.mean[1] = 0.4f;
+        options.mean[2] = 0.6f;
+        options.std[0] = options.std[1] = options.std[2] = 0.5f;
+        if(!export_matches(state, animation, &options, normalized_nhwc, sizeof(normalized_nhwc) / sizeof(float))) {
+            printf("tensor: wrong normalized NHWC tensor from source %lu\n", (unsigned long) source);
+            ++failures;
+        }
+        options.layout = FIG_TENSOR_LAYOUT_NCHW;
+        options.channels = 3;
+        if(!export_matches(state, animation, &options, normalized_nchw, sizeof(normalized_nchw) / sizeof(float))) {
+            printf("tensor: wrong normalized NCHW tensor from source %lu\n", (unsigned long) source);
+            ++failures;
+        }
+    }
+    fig_animation_free(animation);
+    return failures;
+}
+
+/* Load a GIF from the given bytes, with the given load options, or with fig_load_gif
+ * when they're NULL. Returns NULL if the file couldn't be written or loaded. */
+static fig_animation *load_bytes(fig_state *state, const fig_uint8_t *data, size_t size, const fig_load_options *options) {
+    fig_animation *animation = NULL;
+    FILE *file = tmpfile();
+
+    if(file != NULL) {
+        if(fwrite(data, 1, size, file) == size) {
+            fig_input *input;
+
+            rewind(file);
+            input = fig_create_file_input(state, file);
+            animation = options != NULL
+                ? fig_load_gif_with_options(state, input, options)
+                : fig_load_gif(state, input);
+            fig_input_free(input);
+        }
+        fclose(file);
+    }
+    return animation;
+}
+
+/* Load an animation with contiguous render surfaces in every render mode.
+ * Only modes that keep a full canvas per image use a block, and every render
+ * surface must then be the canvas at its place in the block.
+ * Returns the number of modes that didn't behave that way. */
+static size_t check_render_slab(fig_state *state, fig_animation *animation, const char *name) {
+    size_t failures = 0;
+    size_t mode, i;
+
+    for(mode = 0; mode < FIG_RENDER_MODE_COUNT; ++mode) {
+        fig_load_options options;
+        fig_animation *loaded;
+        const fig_uint8_t *slab;
+        size_t pitch;
+        fig_bool_t correct = 1;
+
+        fig_init_load_options(&options);
+        options.render_mode = (fig_render_mode_t) mode;
+        options.contiguous_render = 1;
+        loaded = reload(state, animation, &options);
+        if(loaded == NULL) {
+            /* Animations with more than one palette can't be rendered as palette indices. */
+            if(mode != FIG_RENDER_MODE_INDEX) {
+                printf("%s: %s load failed\n", name, mode_names[mode]);
+                ++failures;
+            }
+            continue;
+        }
+        slab = (const fig_uint8_t *) fig_animation_get_render_slab(loaded);
+        pitch = fig_animation_get_render_slab_pitch(loaded);
+        if(mode == FIG_RENDER_MODE_FULL || mode == FIG_RENDER_MODE_INDEX) {
+            fig_image **images = fig_animation_get_images(loaded);
+
+            for(i = 0; i < fig_animation_count_images(loaded); ++i) {
+                const void *data = mode == FIG_RENDER_MODE_INDEX
+                    ? (const void *) fig_image_get_render_index_data(images[i])
+                    : (const void *) fig_image_get_render_data(images[i]);
+                if(slab == NULL || data != (const void *) (slab + i * pitch)) {
+                    correct = 0;
+                }
+            }
+        } else if(slab != NULL) {
+            correct = 0;
+        }
+        if(!correct) {
+            printf("%s: %s render surfaces aren't in the right block\n", name, mode_names[mode]);
+            ++failures;
+        }
+        fig_animation_free(loaded);
+    }
+    return failures;
+}
+
+/* Load a GIF whose logical screen is empty, which can't be rendered.
+ * fig_load_gif still returns the decoded image, but rendering with the load options fails.
+ * Returns the number of loads that didn't behave that way. */
+static size_t check_empty_screen(fig_state *state) {
+    static const fig_uint8_t file[] = {
+        'G', 'I', 'F', '8', '9', 'a', 0, 0, 0, 0, 0x80, 0, 0, 0, 0, 0, 0, 0, 0,
+        ',', 0, 0, 0, 0, 1, 0, 1, 0, 0, 2, 2, 0x44, 0x01, 0, ';'
+    };
+    size_t failures = 0;
+    fig_load_options options;
+    fig_animation *animation;
+
+    animation = load_bytes(state, file, sizeof(file), NULL);
+    if(animation == NULL || fig_animation_count_images(animation) != 1) {
+        puts("empty screen: fig_load_gif didn't return the image");
+        ++failures;
+    }
+    fig_animation_free(animation);
+
+    fig_init_load_options(&options);
+    animation = load_bytes(state, file, sizeof(file), &options);
+    if(animation != NULL) {
+        puts("empty screen: fig_load_gif_with_options didn't fail to render");
+        ++failures;
+    }
+    fig_animation_free(animation);
+    return failures;
+}
+
+int main(int argc, char **argv) {
+    fig_state *state;
+    size_t total = 0;
+    int i;
+
+    state = fig_create_state();
+    if(argc < 2) {
+        /* Without any files, check randomly generated animations. */
+        for(i = 0; i < 1000; ++i) {
+            char name[32];
+            fig_animation *animation;
+
+            random_state = (unsigned long) i;
+            animation = generate_animation(state);
+            if(animation == NULL) {
+                fputs("error while generating animation\n", stderr);
+                return 1;
+            }
+            sprintf(name, "seed %d", i);
+            total += check_render_slab(state, animation, name);
+            total += check_animation(state, animation, name);
+            fig_animation_free(animation);
+        }
+        total += check_lzw_boundaries(state);
+        total += check_empty_screen(state);
+        total += check_resampler(state);
+        total += check_tensors(state);
+    }
+    for(i = 1; i < argc; ++i) {
+        FILE *f;
+        fig_input *input;
+        fig_animation *animation;
+
+        f = fopen(argv[i], "rb");
+        if(f == NULL) {
+            fprintf(stderr, "%s: could not open\n", argv[i]);
+            return 1;
+        }
+        input = fig_create_file_input(state, f);
+        animation = fig_load_gif(state, input);
+        fig_input_free(input);
+        fclose(f);
+        if(animation == NULL) {
+            fprintf(stderr, "%s: error while reading: %s\n", argv[i], fig_state_get_error(state) != NULL ? fig_state_get_error(state) : "");
+            return 1;
+        }
+        total += check_animation(state, animation, argv[i]);
+        fig_animation_free(animation);
+    }
+    fig_state_free(state);
+
+    if(total != 0) {
+        printf("%lu checks failed\n", (unsigned long) total);
+        return 1;
+    }
+    puts("all checks passed");
+    return 0;
+}